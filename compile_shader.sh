@@ -1,3 +1,69 @@
 #!/bin/bash
-VulkanSDK/macOS/bin/glslc -o src/spvShaders/vert.spv src/glslShaders/shader.vert
-VulkanSDK/macOS/bin/glslc -o src/spvShaders/frag.spv src/glslShaders/shader.frag
+# Precompiles every shader in src/glslShaders and every define variant the program asks for.
+# These are only used when the program is built without shaderc, otherwise shaders are compiled
+# at runtime. CMake runs this at build time with GLSLC set and the build's spvShaders directory
+# as the argument; run by hand it writes src/spvShaders/<name>.spv.
+cd "$(dirname "$0")" || exit 1
+OUTPUT_DIR=${1:-src/spvShaders}
+mkdir -p "$OUTPUT_DIR" || exit 1
+
+# Prefer GLSLC, then the SDK glslc, then whatever is on PATH
+if [ -n "$GLSLC" ]; then
+    :
+elif [ -n "$VULKAN_SDK" ] && [ -x "$VULKAN_SDK/bin/glslc" ]; then
+    GLSLC="$VULKAN_SDK/bin/glslc"
+elif [ "$(uname)" = "Darwin" ] && [ -x VulkanSDK/macOS/bin/glslc ]; then
+    GLSLC=VulkanSDK/macOS/bin/glslc
+elif [ -x VulkanSDK/x86_64/bin/glslc ]; then
+    GLSLC=VulkanSDK/x86_64/bin/glslc
+else
+    GLSLC=glslc
+fi
+
+for shader in src/glslShaders/*.vert src/glslShaders/*.frag src/glslShaders/*.comp; do
+    [ -e "$shader" ] || continue
+    "$GLSLC" -O -o "$OUTPUT_DIR/$(basename "$shader").spv" "$shader" || exit 1
+done
+
+# Variants that need defines, see ShaderPermutation::defines(), describeScenePipeline(),
+# describeDepthPrepassPipeline(), describeShadowPipeline() and describeDeferredLightingPipeline().
+# The file name lists the defines in the order the program adds them.
+variant() {
+    local shader=$1
+    shift
+    local output="$OUTPUT_DIR/$shader"
+    local defines=()
+    for define in "$@"; do
+        output="$output.$define"
+        defines+=("-D$define=1")
+    done
+    "$GLSLC" -O "${defines[@]}" -o "$output.spv" "src/glslShaders/$shader" || exit 1
+}
+
+for quantized in "" QUANTIZED_VERTICES; do
+    for bindless in "" BINDLESS; do
+        for drawData in "" DRAW_DATA_UBO; do
+            variant shader.vert $quantized $bindless $drawData DEPTH_ONLY
+            for worldPosition in "" WORLD_POSITION; do
+                [ -z "$quantized$bindless$drawData$worldPosition" ] && continue
+                variant shader.vert $quantized $bindless $drawData $worldPosition
+            done
+            [ -n "$quantized" ] && continue
+            for shadows in "" SHADOWS; do
+                for lights in "" CLUSTERED_LIGHTS; do
+                    [ -z "$bindless$drawData$shadows$lights" ] && continue
+                    variant shader.frag $bindless $drawData $shadows $lights
+                done
+            done
+            variant shader.frag $bindless $drawData GBUFFER
+        done
+    done
+done
+
+variant shadow.vert BINDLESS
+for shadows in "" SHADOWS; do
+    for lights in "" CLUSTERED_LIGHTS; do
+        [ -z "$shadows$lights" ] && continue
+        variant deferred_lighting.frag $shadows $lights
+    done
+done
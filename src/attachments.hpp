@@ -0,0 +1,112 @@
+#ifndef VULKANPROGRAM_ATTACHMENTS_HPP
+#define VULKANPROGRAM_ATTACHMENTS_HPP
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+struct DepthFormatInfo
+{
+    VkFormat format;
+    // Bits of depth precision and bytes per pixel the format takes in memory
+    uint32_t bits;
+    uint32_t bytesPerPixel;
+    const char *name;
+};
+
+// Cheapest first. Nothing draws with stencil, so the 24 bit format is the one without it;
+// D24_UNORM_S8_UINT costs the same 4 bytes and would need both aspects in every barrier.
+inline const std::vector<DepthFormatInfo> &depthFormatCandidates()
+{
+    static const std::vector<DepthFormatInfo> candidates =
+            {
+                    {VK_FORMAT_D16_UNORM,           16, 2, "D16_UNORM"},
+                    {VK_FORMAT_X8_D24_UNORM_PACK32, 24, 4, "X8_D24_UNORM"},
+                    {VK_FORMAT_D32_SFLOAT,          32, 4, "D32_SFLOAT"}
+            };
+    return candidates;
+}
+
+// The cheapest depth format with at least minimumBits of precision and the given optimal tiling
+// features. Falls back to more precision than asked for when the device lacks a format.
+inline DepthFormatInfo selectDepthFormat(VkPhysicalDevice physicalDevice, uint32_t minimumBits,
+                                         VkFormatFeatureFlags requiredFeatures)
+{
+    for (const auto &candidate: depthFormatCandidates())
+    {
+        if (candidate.bits < minimumBits)
+        {
+            continue;
+        }
+
+        VkFormatProperties formatProperties{};
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, candidate.format, &formatProperties);
+        if ((formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures)
+        {
+            return candidate;
+        }
+    }
+    throw std::runtime_error("failed to find a supported depth format!");
+}
+
+// Memory type for an attachment. Transient attachments (TRANSIENT_ATTACHMENT usage, never
+// stored) go to lazily allocated memory when the device has it: tile based GPUs then keep them
+// in tile memory and never back them with real memory. lazy tells which one it became.
+inline uint32_t findAttachmentMemoryType(VkPhysicalDevice physicalDevice, uint32_t memoryTypeBits,
+                                         bool transient, bool &lazy)
+{
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    auto find = [&](VkMemoryPropertyFlags flags) -> uint32_t
+    {
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+        {
+            if ((memoryTypeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+            {
+                return i;
+            }
+        }
+        return UINT32_MAX;
+    };
+
+    lazy = false;
+    if (transient)
+    {
+        uint32_t lazyType = find(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+        if (lazyType != UINT32_MAX)
+        {
+            lazy = true;
+            return lazyType;
+        }
+    }
+
+    uint32_t deviceLocalType = find(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (deviceLocalType == UINT32_MAX)
+    {
+        throw std::runtime_error("failed to find a memory type for an attachment!");
+    }
+    return deviceLocalType;
+}
+
+// The highest sample count up to requested that the device can render color and depth with
+inline VkSampleCountFlagBits clampSampleCount(VkPhysicalDevice physicalDevice, uint32_t requested)
+{
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    VkSampleCountFlags supported = properties.limits.framebufferColorSampleCounts &
+                                   properties.limits.framebufferDepthSampleCounts;
+
+    for (VkSampleCountFlagBits samples: {VK_SAMPLE_COUNT_8_BIT, VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_2_BIT})
+    {
+        if (static_cast<uint32_t>(samples) <= requested && (supported & samples))
+        {
+            return samples;
+        }
+    }
+    return VK_SAMPLE_COUNT_1_BIT;
+}
+
+#endif //VULKANPROGRAM_ATTACHMENTS_HPP
@@ -0,0 +1,166 @@
+#ifndef VULKANPROGRAM_BENCHMARKS_HPP
+#define VULKANPROGRAM_BENCHMARKS_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "transform_store.hpp"
+
+// CPU side micro benchmarks. They are run from the command line instead of
+// opening a window, e.g. "VulkanProgram --bench-transforms 100000".
+
+// Same math as the renderer used to do per object: a chain of glm calls
+// followed by proj * view * model.
+inline void composeInstanceMatricesScalarGlm(const TransformStore &store, const glm::mat4 &viewProj,
+                                             InstanceData *out)
+{
+    for (std::size_t i = 0; i < store.size(); i++)
+    {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), store.position(i));
+        model = model * glm::mat4_cast(store.rotation(i));
+        model = glm::scale(model, store.scale(i));
+
+        out[i].model = model;
+        out[i].mvp = viewProj * model;
+    }
+}
+
+inline void runTransformBenchmark(std::size_t objectCount)
+{
+    const int iterations = 200;
+
+    TransformStore store;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 6.28f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+
+    for (std::size_t i = 0; i < objectCount; i++)
+    {
+        glm::vec3 axis = glm::normalize(glm::vec3(position(rng), position(rng), position(rng)) + glm::vec3(0.01f));
+        store.add({position(rng), position(rng), position(rng)},
+                  glm::angleAxis(angle(rng), axis),
+                  {scale(rng), scale(rng), scale(rng)});
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 1.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 10.0f);
+    glm::mat4 viewProj = proj * view;
+
+    std::vector<InstanceData> scalarResult(objectCount);
+    std::vector<InstanceData> batchResult(objectCount);
+
+    auto timePerObject = [&](auto &&kernel, std::vector<InstanceData> &out)
+    {
+        kernel(store, viewProj, out.data()); // warm up
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            kernel(store, viewProj, out.data());
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / (double(iterations) * objectCount);
+    };
+
+    double scalarTime = timePerObject(composeInstanceMatricesScalarGlm, scalarResult);
+    double batchTime = timePerObject(composeInstanceMatrices, batchResult);
+
+    float maxError = 0.0f;
+    for (std::size_t i = 0; i < objectCount; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            for (int r = 0; r < 4; r++)
+            {
+                maxError = std::max(maxError, std::abs(scalarResult[i].model[c][r] - batchResult[i].model[c][r]));
+                maxError = std::max(maxError, std::abs(scalarResult[i].mvp[c][r] - batchResult[i].mvp[c][r]));
+            }
+        }
+    }
+
+    std::cout << "Transform benchmark: " << objectCount << " objects, " << iterations << " iterations\n";
+    std::cout << "  scalar glm:      " << scalarTime << " ns/object\n";
+    std::cout << "  batched (" << transform_kernels::nativeLanesName() << "): " << batchTime << " ns/object\n";
+    std::cout << "  speedup:         " << scalarTime / batchTime << "x\n";
+    std::cout << "  max abs error:   " << maxError << std::endl;
+}
+
+// CPU time spent per frame between acquiring the swapchain image and presenting it, measured by
+// the renderer with --bench-frames. The first frames build pipelines and are left out. The GPU time
+// of a frame comes from the profiler, 0 when it could not be measured.
+inline void printFrameTimeBenchmark(std::vector<double> frameMilliseconds, const std::string &profile,
+                                    double gpuFrameMilliseconds)
+{
+    std::size_t warmUp = std::min<std::size_t>(10, frameMilliseconds.size() / 10);
+    frameMilliseconds.erase(frameMilliseconds.begin(), frameMilliseconds.begin() + warmUp);
+    if (frameMilliseconds.empty())
+    {
+        return;
+    }
+
+    double total = 0.0;
+    for (double milliseconds: frameMilliseconds)
+    {
+        total += milliseconds;
+    }
+    std::sort(frameMilliseconds.begin(), frameMilliseconds.end());
+
+    std::cout << "Frame benchmark (" << profile << "): " << frameMilliseconds.size() << " frames\n";
+    std::cout << "  CPU per frame mean: " << total / static_cast<double>(frameMilliseconds.size()) << " ms\n";
+    std::cout << "  median:             " << frameMilliseconds[frameMilliseconds.size() / 2] << " ms\n";
+    std::cout << "  99th percentile:    " << frameMilliseconds[frameMilliseconds.size() * 99 / 100] << " ms\n";
+    if (gpuFrameMilliseconds > 0.0)
+    {
+        std::cout << "  GPU per frame mean: " << gpuFrameMilliseconds << " ms\n";
+    }
+    std::cout << std::flush;
+}
+
+// With --bench-frames and shadows, the last of every SHADOW_BASELINE_PERIOD blocks of
+// SHADOW_BASELINE_BLOCK frames is drawn without shadows, the baseline for their cost
+constexpr uint64_t SHADOW_BASELINE_BLOCK = 32;
+constexpr uint64_t SHADOW_BASELINE_PERIOD = 4;
+
+// Light counts --bench-lights steps through, each for the same number of frames
+constexpr uint32_t LIGHT_BENCHMARK_COUNTS[] = {10, 100, 1000, 10000};
+
+// GPU time of the frames rendered with one light count, added up by the renderer
+struct LightBenchmarkStep
+{
+    uint32_t lights = 0;
+    uint64_t frames = 0;
+    double binningMilliseconds = 0.0;
+    double frameMilliseconds = 0.0;
+    uint64_t lightReferences = 0;
+};
+
+inline void printLightScalingBenchmark(const std::vector<LightBenchmarkStep> &steps, uint64_t clusterCount)
+{
+    std::cout << "Light scaling benchmark: " << clusterCount << " clusters\n";
+    std::cout << "  lights  frames  binning ms  GPU frame ms  lights per cluster\n";
+    for (const auto &step: steps)
+    {
+        if (step.frames == 0)
+        {
+            continue;
+        }
+        double frames = static_cast<double>(step.frames);
+        std::cout << "  " << std::setw(6) << step.lights << "  " << std::setw(6) << step.frames << "  "
+                  << std::setw(10) << step.binningMilliseconds / frames << "  "
+                  << std::setw(12) << step.frameMilliseconds / frames << "  "
+                  << std::setw(18) << static_cast<double>(step.lightReferences) / frames /
+                                      static_cast<double>(clusterCount) << "\n";
+    }
+    std::cout << std::flush;
+}
+
+#endif //VULKANPROGRAM_BENCHMARKS_HPP
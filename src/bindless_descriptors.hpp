@@ -0,0 +1,243 @@
+#ifndef VULKANPROGRAM_BINDLESS_DESCRIPTORS_HPP
+#define VULKANPROGRAM_BINDLESS_DESCRIPTORS_HPP
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// One descriptor set holding every texture and storage buffer of the program, built on
+// VK_EXT_descriptor_indexing. Shaders pick what they read with indices from push constants,
+// so the set is bound once per command buffer and draws never bind descriptors.
+//
+//   binding 0: texture2D textures[]    partially bound, update after bind
+//   binding 1: sampler                 immutable
+//   binding 2: buffer buffers[]        partially bound, update after bind
+//
+// Slots are written when a resource is added. A removed slot may be handed out again right
+// away, so only remove resources that no frame in flight reads any more, or release the slot
+// through DeletionQueue::defer.
+class BindlessDescriptors
+{
+public:
+    static constexpr uint32_t TEXTURE_BINDING = 0;
+    static constexpr uint32_t SAMPLER_BINDING = 1;
+    static constexpr uint32_t BUFFER_BINDING = 2;
+
+    void create(VkDevice renderDevice, VkSampler sampler, uint32_t maxTextures, uint32_t maxBuffers)
+    {
+        device = renderDevice;
+        textureSlots = SlotAllocator(maxTextures);
+        bufferSlots = SlotAllocator(maxBuffers);
+
+        VkDescriptorSetLayoutBinding textureBinding{};
+        textureBinding.binding = TEXTURE_BINDING;
+        textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        textureBinding.descriptorCount = maxTextures;
+        textureBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorSetLayoutBinding samplerBinding{};
+        samplerBinding.binding = SAMPLER_BINDING;
+        samplerBinding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+        samplerBinding.descriptorCount = 1;
+        samplerBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        samplerBinding.pImmutableSamplers = &sampler;
+
+        VkDescriptorSetLayoutBinding bufferBinding{};
+        bufferBinding.binding = BUFFER_BINDING;
+        bufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bufferBinding.descriptorCount = maxBuffers;
+        bufferBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
+                                   VK_SHADER_STAGE_COMPUTE_BIT;
+
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings = {textureBinding, samplerBinding, bufferBinding};
+
+        // Unused slots may hold anything, and slots can be written while the set is bound
+        VkDescriptorBindingFlagsEXT arrayFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+                                                 VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT;
+        std::array<VkDescriptorBindingFlagsEXT, 3> bindingFlags = {arrayFlags, 0, arrayFlags};
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo{};
+        bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+        bindingFlagsCreateInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+        bindingFlagsCreateInfo.pBindingFlags = bindingFlags.data();
+
+        VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+        descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        descriptorSetLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+        descriptorSetLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+        descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        descriptorSetLayoutCreateInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &setLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create bindless descriptor set layout!");
+        }
+
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+        poolSizes[0] = {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, maxTextures};
+        poolSizes[1] = {VK_DESCRIPTOR_TYPE_SAMPLER, 1};
+        poolSizes[2] = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxBuffers};
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = 1;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create bindless descriptor pool!");
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = pool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &setLayout;
+
+        if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate bindless descriptor set!");
+        }
+    }
+
+    void destroy() const
+    {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+        vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    }
+
+    bool valid() const
+    {
+        return descriptorSet != VK_NULL_HANDLE;
+    }
+
+    VkDescriptorSetLayout layout() const
+    {
+        return setLayout;
+    }
+
+    VkDescriptorSet set() const
+    {
+        return descriptorSet;
+    }
+
+    // Returns the index shaders use for textures[]
+    uint32_t addTexture(VkImageView imageView, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    {
+        uint32_t index = textureSlots.allocate("texture");
+
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageView = imageView;
+        imageInfo.imageLayout = imageLayout;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = descriptorSet;
+        descriptorWrite.dstBinding = TEXTURE_BINDING;
+        descriptorWrite.dstArrayElement = index;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &imageInfo;
+
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        return index;
+    }
+
+    // Returns the index shaders use for buffers[]
+    uint32_t addBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE)
+    {
+        uint32_t index = bufferSlots.allocate("buffer");
+
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = buffer;
+        bufferInfo.offset = offset;
+        bufferInfo.range = range;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = descriptorSet;
+        descriptorWrite.dstBinding = BUFFER_BINDING;
+        descriptorWrite.dstArrayElement = index;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        return index;
+    }
+
+    void removeTexture(uint32_t index)
+    {
+        textureSlots.release(index);
+    }
+
+    void removeBuffer(uint32_t index)
+    {
+        bufferSlots.release(index);
+    }
+
+    uint32_t textureCount() const
+    {
+        return textureSlots.used();
+    }
+
+    uint32_t bufferCount() const
+    {
+        return bufferSlots.used();
+    }
+
+private:
+    // Hands out the lowest never used index, or a released one
+    struct SlotAllocator
+    {
+        uint32_t capacity = 0;
+        uint32_t next = 0;
+        std::vector<uint32_t> released;
+
+        SlotAllocator() = default;
+
+        explicit SlotAllocator(uint32_t capacity) : capacity(capacity)
+        {
+        }
+
+        uint32_t allocate(const char *what)
+        {
+            if (!released.empty())
+            {
+                uint32_t index = released.back();
+                released.pop_back();
+                return index;
+            }
+            if (next == capacity)
+            {
+                throw std::runtime_error(std::string("bindless ") + what + " array is full!");
+            }
+            return next++;
+        }
+
+        void release(uint32_t index)
+        {
+            released.push_back(index);
+        }
+
+        uint32_t used() const
+        {
+            return next - static_cast<uint32_t>(released.size());
+        }
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    SlotAllocator textureSlots;
+    SlotAllocator bufferSlots;
+};
+
+#endif //VULKANPROGRAM_BINDLESS_DESCRIPTORS_HPP
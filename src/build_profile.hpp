@@ -0,0 +1,73 @@
+#ifndef VULKANPROGRAM_BUILD_PROFILE_HPP
+#define VULKANPROGRAM_BUILD_PROFILE_HPP
+
+#include <cstring>
+#include <initializer_list>
+
+// Debug builds run with the validation layer and check the result of every Vulkan call.
+// Release builds (NDEBUG) start without layers or debug messenger and do not look at the
+// results of the calls made every frame. Both can be set by the build instead.
+#ifndef VULKANPROGRAM_VALIDATION
+#ifdef NDEBUG
+#define VULKANPROGRAM_VALIDATION 0
+#else
+#define VULKANPROGRAM_VALIDATION 1
+#endif
+#endif
+
+#ifndef VULKANPROGRAM_FRAME_RESULT_CHECKS
+#ifdef NDEBUG
+#define VULKANPROGRAM_FRAME_RESULT_CHECKS 0
+#else
+#define VULKANPROGRAM_FRAME_RESULT_CHECKS 1
+#endif
+#endif
+
+// GpuAssisted adds the layer's shader instrumentation (out of bounds descriptor indexing and
+// buffer accesses), which is much slower again than the layer alone
+enum class ValidationMode
+{
+    Off,
+    Layer,
+    GpuAssisted
+};
+
+constexpr ValidationMode defaultValidationMode()
+{
+    return VULKANPROGRAM_VALIDATION ? ValidationMode::Layer : ValidationMode::Off;
+}
+
+constexpr const char *buildProfileName()
+{
+    return VULKANPROGRAM_FRAME_RESULT_CHECKS ? "debug" : "release";
+}
+
+inline const char *validationModeName(ValidationMode mode)
+{
+    switch (mode)
+    {
+        case ValidationMode::Off:
+            return "off";
+        case ValidationMode::Layer:
+            return "on";
+        case ValidationMode::GpuAssisted:
+            return "gpu";
+    }
+    return "unknown";
+}
+
+// "off", "on" or "gpu", false for anything else
+inline bool parseValidationMode(const char *text, ValidationMode &mode)
+{
+    for (ValidationMode candidate: {ValidationMode::Off, ValidationMode::Layer, ValidationMode::GpuAssisted})
+    {
+        if (strcmp(text, validationModeName(candidate)) == 0)
+        {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif //VULKANPROGRAM_BUILD_PROFILE_HPP
@@ -0,0 +1,171 @@
+#ifndef VULKANPROGRAM_DELETION_QUEUE_HPP
+#define VULKANPROGRAM_DELETION_QUEUE_HPP
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+// Vulkan handles retired while the program runs, each tagged with the timeline value of the
+// last submission that may use it (GpuTimeline::submitted() at the time it is retired). They
+// are destroyed by collect() once the GPU has reached that value, so replacing a resource never
+// needs vkDeviceWaitIdle.
+class DeletionQueue
+{
+public:
+    void init(VkDevice renderDevice)
+    {
+        device = renderDevice;
+    }
+
+    void retire(VkPipeline pipeline, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_PIPELINE, (uint64_t) pipeline, lastUse);
+    }
+
+    void retire(VkPipelineLayout pipelineLayout, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_PIPELINE_LAYOUT, (uint64_t) pipelineLayout, lastUse);
+    }
+
+    void retire(VkBuffer buffer, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_BUFFER, (uint64_t) buffer, lastUse);
+    }
+
+    void retire(VkImage image, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_IMAGE, (uint64_t) image, lastUse);
+    }
+
+    void retire(VkImageView imageView, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t) imageView, lastUse);
+    }
+
+    void retire(VkSampler sampler, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_SAMPLER, (uint64_t) sampler, lastUse);
+    }
+
+    void retire(VkFramebuffer framebuffer, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_FRAMEBUFFER, (uint64_t) framebuffer, lastUse);
+    }
+
+    void retire(VkDescriptorPool descriptorPool, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_DESCRIPTOR_POOL, (uint64_t) descriptorPool, lastUse);
+    }
+
+    // Memory is freed after the buffers and images retired with the same value, whatever the order
+    void retire(VkDeviceMemory memory, uint64_t lastUse)
+    {
+        push(VK_OBJECT_TYPE_DEVICE_MEMORY, (uint64_t) memory, lastUse);
+    }
+
+    // For what is not a handle, like a bindless descriptor slot that may be handed out again
+    void defer(std::function<void()> release, uint64_t lastUse)
+    {
+        entries.push_back({VK_OBJECT_TYPE_UNKNOWN, 0, lastUse, std::move(release)});
+    }
+
+    // Destroys everything whose last use is at or before completedValue
+    void collect(uint64_t completedValue)
+    {
+        std::vector<Entry> pending;
+        std::vector<Entry> memories;
+        for (auto &entry: entries)
+        {
+            if (entry.lastUse > completedValue)
+            {
+                pending.push_back(std::move(entry));
+            } else if (entry.type == VK_OBJECT_TYPE_DEVICE_MEMORY)
+            {
+                memories.push_back(std::move(entry));
+            } else
+            {
+                destroy(entry);
+            }
+        }
+        for (const auto &memory: memories)
+        {
+            destroy(memory);
+        }
+        entries = std::move(pending);
+    }
+
+    std::size_t pendingCount() const
+    {
+        return entries.size();
+    }
+
+    uint64_t destroyedCount() const
+    {
+        return destroyed;
+    }
+
+private:
+    struct Entry
+    {
+        VkObjectType type;
+        uint64_t handle;
+        uint64_t lastUse;
+        std::function<void()> release;
+    };
+
+    void push(VkObjectType type, uint64_t handle, uint64_t lastUse)
+    {
+        if (handle != 0)
+        {
+            entries.push_back({type, handle, lastUse, nullptr});
+        }
+    }
+
+    void destroy(const Entry &entry)
+    {
+        switch (entry.type)
+        {
+            case VK_OBJECT_TYPE_PIPELINE:
+                vkDestroyPipeline(device, (VkPipeline) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+                vkDestroyPipelineLayout(device, (VkPipelineLayout) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_BUFFER:
+                vkDestroyBuffer(device, (VkBuffer) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_IMAGE:
+                vkDestroyImage(device, (VkImage) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_IMAGE_VIEW:
+                vkDestroyImageView(device, (VkImageView) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_SAMPLER:
+                vkDestroySampler(device, (VkSampler) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_FRAMEBUFFER:
+                vkDestroyFramebuffer(device, (VkFramebuffer) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+                vkDestroyDescriptorPool(device, (VkDescriptorPool) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_DEVICE_MEMORY:
+                vkFreeMemory(device, (VkDeviceMemory) entry.handle, nullptr);
+                break;
+            case VK_OBJECT_TYPE_UNKNOWN:
+                entry.release();
+                break;
+            default:
+                throw std::runtime_error("unsupported handle type in deletion queue!");
+        }
+        destroyed++;
+    }
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<Entry> entries;
+    uint64_t destroyed = 0;
+};
+
+#endif //VULKANPROGRAM_DELETION_QUEUE_HPP
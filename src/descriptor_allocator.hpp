@@ -0,0 +1,499 @@
+#ifndef VULKANPROGRAM_DESCRIPTOR_ALLOCATOR_HPP
+#define VULKANPROGRAM_DESCRIPTOR_ALLOCATOR_HPP
+
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "hash.hpp"
+
+// Ratio of descriptors of one type per set, a pool for n sets holds ratio * n of them
+struct DescriptorPoolSizeRatio
+{
+    VkDescriptorType type;
+    float ratio;
+};
+
+// Creates each distinct descriptor set layout once. Layouts are looked up by their binding
+// signature (binding, type, count, stages and immutable samplers, in binding order), so
+// code asking for the same layout in different places shares one VkDescriptorSetLayout.
+class DescriptorLayoutCache
+{
+public:
+    void init(VkDevice renderDevice)
+    {
+        device = renderDevice;
+    }
+
+    VkDescriptorSetLayout get(std::vector<VkDescriptorSetLayoutBinding> bindings)
+    {
+        std::sort(bindings.begin(), bindings.end(),
+                  [](const VkDescriptorSetLayoutBinding &a, const VkDescriptorSetLayoutBinding &b)
+                  {
+                      return a.binding < b.binding;
+                  });
+
+        Signature signature{};
+        for (const auto &binding: bindings)
+        {
+            signature.bindings.push_back({binding.binding, binding.descriptorType, binding.descriptorCount,
+                                          binding.stageFlags, {}});
+            if (binding.pImmutableSamplers)
+            {
+                signature.bindings.back().immutableSamplers.assign(binding.pImmutableSamplers,
+                                                                   binding.pImmutableSamplers + binding.descriptorCount);
+            }
+        }
+
+        auto found = layouts.find(signature);
+        if (found != layouts.end())
+        {
+            hitCount++;
+            return found->second;
+        }
+
+        VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+        descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        descriptorSetLayoutCreateInfo.pBindings = bindings.data();
+
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+        if (vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &layout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create descriptor set layout!");
+        }
+
+        std::vector<VkDescriptorPoolSize> counts;
+        for (const auto &binding: bindings)
+        {
+            auto sameType = [&binding](const VkDescriptorPoolSize &size)
+            {
+                return size.type == binding.descriptorType;
+            };
+            auto count = std::find_if(counts.begin(), counts.end(), sameType);
+            if (count == counts.end())
+            {
+                counts.push_back({binding.descriptorType, binding.descriptorCount});
+            } else
+            {
+                count->descriptorCount += binding.descriptorCount;
+            }
+        }
+        descriptorCounts.emplace(layout, std::move(counts));
+
+        layouts.emplace(std::move(signature), layout);
+        return layout;
+    }
+
+    // Descriptors of each type a set of the layout takes, null for layouts made elsewhere
+    const std::vector<VkDescriptorPoolSize> *descriptorsPerSet(VkDescriptorSetLayout layout) const
+    {
+        auto found = descriptorCounts.find(layout);
+        return found != descriptorCounts.end() ? &found->second : nullptr;
+    }
+
+    void destroy() const
+    {
+        for (const auto &layout: layouts)
+        {
+            vkDestroyDescriptorSetLayout(device, layout.second, nullptr);
+        }
+    }
+
+    uint32_t layoutCount() const
+    {
+        return static_cast<uint32_t>(layouts.size());
+    }
+
+    uint64_t hits() const
+    {
+        return hitCount;
+    }
+
+private:
+    struct BindingSignature
+    {
+        uint32_t binding;
+        VkDescriptorType type;
+        uint32_t count;
+        VkShaderStageFlags stages;
+        std::vector<VkSampler> immutableSamplers;
+
+        bool operator==(const BindingSignature &other) const
+        {
+            return binding == other.binding && type == other.type && count == other.count &&
+                   stages == other.stages && immutableSamplers == other.immutableSamplers;
+        }
+    };
+
+    struct Signature
+    {
+        std::vector<BindingSignature> bindings;
+
+        bool operator==(const Signature &other) const
+        {
+            return bindings == other.bindings;
+        }
+    };
+
+    struct SignatureHash
+    {
+        std::size_t operator()(const Signature &signature) const
+        {
+            uint64_t result = hashValue(signature.bindings.size());
+            for (const auto &binding: signature.bindings)
+            {
+                result = hashValue(binding.binding, result);
+                result = hashValue(binding.type, result);
+                result = hashValue(binding.count, result);
+                result = hashValue(binding.stages, result);
+                for (VkSampler sampler: binding.immutableSamplers)
+                {
+                    result = hashValue(sampler, result);
+                }
+            }
+            return static_cast<std::size_t>(result);
+        }
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::unordered_map<Signature, VkDescriptorSetLayout, SignatureHash> layouts;
+    std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorPoolSize>> descriptorCounts;
+    uint64_t hitCount = 0;
+};
+
+// One binding written by a DescriptorUpdateTemplate. The VkDescriptorBufferInfo or
+// VkDescriptorImageInfo of array element i is read from data + offset + i * stride.
+struct DescriptorTemplateEntry
+{
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+    std::size_t offset;
+    std::size_t stride;
+};
+
+// Writes a whole set from one struct with a single call. Uses VK_KHR_descriptor_update_template
+// when the device has it, otherwise the same struct is turned into vkUpdateDescriptorSets writes.
+class DescriptorUpdateTemplate
+{
+public:
+    void create(VkDevice renderDevice, VkDescriptorSetLayout layout, std::vector<DescriptorTemplateEntry> templateEntries,
+                bool useExtension)
+    {
+        device = renderDevice;
+        entries = std::move(templateEntries);
+
+        if (!useExtension)
+        {
+            return;
+        }
+
+        createTemplate = (PFN_vkCreateDescriptorUpdateTemplateKHR) vkGetDeviceProcAddr(
+                device, "vkCreateDescriptorUpdateTemplateKHR");
+        updateWithTemplate = (PFN_vkUpdateDescriptorSetWithTemplateKHR) vkGetDeviceProcAddr(
+                device, "vkUpdateDescriptorSetWithTemplateKHR");
+        destroyTemplate = (PFN_vkDestroyDescriptorUpdateTemplateKHR) vkGetDeviceProcAddr(
+                device, "vkDestroyDescriptorUpdateTemplateKHR");
+        if (createTemplate == nullptr || updateWithTemplate == nullptr || destroyTemplate == nullptr)
+        {
+            return;
+        }
+
+        std::vector<VkDescriptorUpdateTemplateEntryKHR> updateEntries;
+        for (const auto &entry: entries)
+        {
+            VkDescriptorUpdateTemplateEntryKHR updateEntry{};
+            updateEntry.dstBinding = entry.binding;
+            updateEntry.dstArrayElement = 0;
+            updateEntry.descriptorCount = entry.count;
+            updateEntry.descriptorType = entry.type;
+            updateEntry.offset = entry.offset;
+            updateEntry.stride = entry.stride;
+            updateEntries.push_back(updateEntry);
+        }
+
+        VkDescriptorUpdateTemplateCreateInfoKHR templateCreateInfo{};
+        templateCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR;
+        templateCreateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(updateEntries.size());
+        templateCreateInfo.pDescriptorUpdateEntries = updateEntries.data();
+        templateCreateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+        templateCreateInfo.descriptorSetLayout = layout;
+
+        if (createTemplate(device, &templateCreateInfo, nullptr, &updateTemplate) != VK_SUCCESS)
+        {
+            updateTemplate = VK_NULL_HANDLE;
+        }
+    }
+
+    void update(VkDescriptorSet descriptorSet, const void *data) const
+    {
+        if (updateTemplate != VK_NULL_HANDLE)
+        {
+            updateWithTemplate(device, descriptorSet, updateTemplate, data);
+            return;
+        }
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites;
+        for (const auto &entry: entries)
+        {
+            for (uint32_t i = 0; i < entry.count; i++)
+            {
+                const char *info = static_cast<const char *>(data) + entry.offset + i * entry.stride;
+
+                VkWriteDescriptorSet descriptorWrite{};
+                descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrite.dstSet = descriptorSet;
+                descriptorWrite.dstBinding = entry.binding;
+                descriptorWrite.dstArrayElement = i;
+                descriptorWrite.descriptorType = entry.type;
+                descriptorWrite.descriptorCount = 1;
+                if (isImageDescriptor(entry.type))
+                {
+                    descriptorWrite.pImageInfo = reinterpret_cast<const VkDescriptorImageInfo *>(info);
+                } else
+                {
+                    descriptorWrite.pBufferInfo = reinterpret_cast<const VkDescriptorBufferInfo *>(info);
+                }
+                descriptorWrites.push_back(descriptorWrite);
+            }
+        }
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(),
+                               0, nullptr);
+    }
+
+    bool usesTemplate() const
+    {
+        return updateTemplate != VK_NULL_HANDLE;
+    }
+
+    void destroy() const
+    {
+        if (updateTemplate != VK_NULL_HANDLE)
+        {
+            destroyTemplate(device, updateTemplate, nullptr);
+        }
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<DescriptorTemplateEntry> entries;
+    VkDescriptorUpdateTemplateKHR updateTemplate = VK_NULL_HANDLE;
+
+    PFN_vkCreateDescriptorUpdateTemplateKHR createTemplate = nullptr;
+    PFN_vkUpdateDescriptorSetWithTemplateKHR updateWithTemplate = nullptr;
+    PFN_vkDestroyDescriptorUpdateTemplateKHR destroyTemplate = nullptr;
+
+    static bool isImageDescriptor(VkDescriptorType type)
+    {
+        return type == VK_DESCRIPTOR_TYPE_SAMPLER || type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ||
+               type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE || type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE ||
+               type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    }
+};
+
+// Hands out descriptor sets from a growing list of pools.
+//
+// When the current pool runs out (VK_ERROR_OUT_OF_POOL_MEMORY or a fragmented pool) the
+// next one is taken, each newly created pool is twice the size of the previous one. A set
+// that does not fit into that either gets a pool sized for it, with the descriptor counts of
+// its layout from the layout cache. reset()
+// resets every pool at once and keeps them for reuse, which is how per frame allocators
+// throw away all sets of a frame once its fence has been waited on.
+class DescriptorAllocator
+{
+public:
+    void init(VkDevice renderDevice, uint32_t initialSetsPerPool, std::vector<DescriptorPoolSizeRatio> ratios,
+              const DescriptorLayoutCache *layouts = nullptr)
+    {
+        device = renderDevice;
+        setsPerPool = initialSetsPerPool;
+        poolSizeRatios = std::move(ratios);
+        layoutCache = layouts;
+    }
+
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout)
+    {
+        if (currentPool == VK_NULL_HANDLE)
+        {
+            currentPool = takePool();
+        }
+
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        VkResult result = allocateFrom(currentPool, layout, descriptorSet);
+        if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+        {
+            usedPools.push_back(currentPool);
+            currentPool = takePool();
+            result = allocateFrom(currentPool, layout, descriptorSet);
+        }
+
+        // More of a type than the ratios give a pool
+        const std::vector<VkDescriptorPoolSize> *required =
+                layoutCache != nullptr ? layoutCache->descriptorsPerSet(layout) : nullptr;
+        if ((result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) && required != nullptr)
+        {
+            usedPools.push_back(currentPool);
+            currentPool = createPool(required);
+            result = allocateFrom(currentPool, layout, descriptorSet);
+        }
+
+        if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+        {
+            throw std::runtime_error(required != nullptr
+                                     ? "descriptor set does not fit into a pool sized for its layout!"
+                                     : "descriptor set does not fit into a new pool, create its layout "
+                                       "with the layout cache!");
+        }
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate descriptor set!");
+        }
+
+        allocatedCount++;
+        allocatedSinceReset++;
+        return descriptorSet;
+    }
+
+    // Every set handed out so far becomes invalid
+    void reset()
+    {
+        if (currentPool != VK_NULL_HANDLE)
+        {
+            usedPools.push_back(currentPool);
+            currentPool = VK_NULL_HANDLE;
+        }
+
+        for (VkDescriptorPool pool: usedPools)
+        {
+            vkResetDescriptorPool(device, pool, 0);
+            freePools.push_back(pool);
+        }
+        usedPools.clear();
+
+        allocatedSinceReset = 0;
+        resetCount++;
+    }
+
+    void destroy() const
+    {
+        for (VkDescriptorPool pool: usedPools)
+        {
+            vkDestroyDescriptorPool(device, pool, nullptr);
+        }
+        for (VkDescriptorPool pool: freePools)
+        {
+            vkDestroyDescriptorPool(device, pool, nullptr);
+        }
+        vkDestroyDescriptorPool(device, currentPool, nullptr);
+    }
+
+    uint64_t setsAllocated() const
+    {
+        return allocatedCount;
+    }
+
+    uint32_t setsSinceReset() const
+    {
+        return allocatedSinceReset;
+    }
+
+    uint64_t resets() const
+    {
+        return resetCount;
+    }
+
+    uint32_t poolCount() const
+    {
+        return static_cast<uint32_t>(usedPools.size() + freePools.size()) + (currentPool != VK_NULL_HANDLE ? 1 : 0);
+    }
+
+private:
+    static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t setsPerPool = 0;
+    std::vector<DescriptorPoolSizeRatio> poolSizeRatios;
+    const DescriptorLayoutCache *layoutCache = nullptr;
+
+    VkDescriptorPool currentPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorPool> usedPools;
+    std::vector<VkDescriptorPool> freePools;
+
+    uint64_t allocatedCount = 0;
+    uint32_t allocatedSinceReset = 0;
+    uint64_t resetCount = 0;
+
+    VkResult allocateFrom(VkDescriptorPool pool, VkDescriptorSetLayout layout, VkDescriptorSet &descriptorSet) const
+    {
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = pool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &layout;
+
+        return vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
+    }
+
+    // A pool that was reset earlier, or a new one twice the size of the last
+    VkDescriptorPool takePool()
+    {
+        if (!freePools.empty())
+        {
+            VkDescriptorPool pool = freePools.back();
+            freePools.pop_back();
+            return pool;
+        }
+        return createPool(nullptr);
+    }
+
+    // Sized by the ratios, and with at least the descriptors of one required set
+    VkDescriptorPool createPool(const std::vector<VkDescriptorPoolSize> *required)
+    {
+        std::vector<VkDescriptorPoolSize> poolSizes;
+        for (const auto &sizeRatio: poolSizeRatios)
+        {
+            uint32_t count = std::max(1u, static_cast<uint32_t>(sizeRatio.ratio * static_cast<float>(setsPerPool)));
+            poolSizes.push_back({sizeRatio.type, count});
+        }
+        if (required != nullptr)
+        {
+            for (const auto &requiredSize: *required)
+            {
+                auto sameType = [&requiredSize](const VkDescriptorPoolSize &size)
+                {
+                    return size.type == requiredSize.type;
+                };
+                auto poolSize = std::find_if(poolSizes.begin(), poolSizes.end(), sameType);
+                if (poolSize == poolSizes.end())
+                {
+                    poolSizes.push_back(requiredSize);
+                } else
+                {
+                    poolSize->descriptorCount = std::max(poolSize->descriptorCount, requiredSize.descriptorCount);
+                }
+            }
+        }
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setsPerPool;
+
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
+
+        setsPerPool = std::min(setsPerPool * 2, MAX_SETS_PER_POOL);
+        return pool;
+    }
+};
+
+#endif //VULKANPROGRAM_DESCRIPTOR_ALLOCATOR_HPP
@@ -0,0 +1,275 @@
+#ifndef VULKANPROGRAM_DEVICE_SELECTION_HPP
+#define VULKANPROGRAM_DEVICE_SELECTION_HPP
+
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// What a physical device looks like to pickPhysicalDevice(). Unsuitable devices keep the
+// reason so the log says why a GPU was passed over.
+struct PhysicalDeviceCandidate
+{
+    VkPhysicalDevice device = VK_NULL_HANDLE;
+    uint32_t index = 0;
+    std::string name;
+    std::string uuid;
+    VkPhysicalDeviceType type = VK_PHYSICAL_DEVICE_TYPE_OTHER;
+    VkDeviceSize deviceLocalBytes = 0;
+    uint32_t apiVersion = 0;
+
+    bool suitable = true;
+    std::string unsuitableReason;
+    int64_t score = 0;
+};
+
+inline std::string deviceUuidToString(const uint8_t (&uuid)[VK_UUID_SIZE])
+{
+    std::string text;
+    char byte[3];
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+    {
+        if (i == 4 || i == 6 || i == 8 || i == 10)
+        {
+            text += '-';
+        }
+        snprintf(byte, sizeof(byte), "%02x", uuid[i]);
+        text += byte;
+    }
+    return text;
+}
+
+inline const char *physicalDeviceTypeName(VkPhysicalDeviceType type)
+{
+    switch (type)
+    {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+            return "discrete";
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+            return "integrated";
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+            return "virtual";
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:
+            return "cpu";
+        default:
+            return "other";
+    }
+}
+
+// Device type decides first, a discrete GPU always wins over an integrated one and a software
+// rasterizer like llvmpipe comes last. Within a type more device local memory, dedicated
+// compute and transfer queue families and optional extensions break the tie.
+//
+// A device is unsuitable without the required extensions, a queue family that can do graphics
+// and present to the surface, anisotropic filtering or timeline semaphores.
+inline PhysicalDeviceCandidate scorePhysicalDevice(VkPhysicalDevice physicalDevice,
+                                                   uint32_t index,
+                                                   VkSurfaceKHR surface,
+                                                   const std::vector<const char *> &requiredExtensions,
+                                                   const std::vector<const char *> &optionalExtensions,
+                                                   PFN_vkGetPhysicalDeviceProperties2KHR getProperties2)
+{
+    PhysicalDeviceCandidate candidate{};
+    candidate.device = physicalDevice;
+    candidate.index = index;
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    candidate.name = properties.deviceName;
+    candidate.type = properties.deviceType;
+    candidate.apiVersion = properties.apiVersion;
+
+    // The device UUID needs properties2, without it the pipeline cache UUID has to do
+    candidate.uuid = deviceUuidToString(properties.pipelineCacheUUID);
+    if (getProperties2 != nullptr)
+    {
+        VkPhysicalDeviceIDPropertiesKHR idProperties{};
+        idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR;
+        VkPhysicalDeviceProperties2KHR properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+        properties2.pNext = &idProperties;
+        getProperties2(physicalDevice, &properties2);
+        candidate.uuid = deviceUuidToString(idProperties.deviceUUID);
+    }
+
+    auto unsuitable = [&](const std::string &reason)
+    {
+        if (candidate.suitable)
+        {
+            candidate.suitable = false;
+            candidate.unsuitableReason = reason;
+        }
+    };
+
+    switch (properties.deviceType)
+    {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+            candidate.score += 100000;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+            candidate.score += 50000;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+            candidate.score += 20000;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:
+            candidate.score += 1000;
+            break;
+        default:
+            break;
+    }
+
+    // One point per 64 MiB of device local memory, at most 1024 so memory never outweighs type
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            candidate.deviceLocalBytes += memoryProperties.memoryHeaps[i].size;
+        }
+    }
+    candidate.score += static_cast<int64_t>(std::min<VkDeviceSize>(candidate.deviceLocalBytes >> 26, 1024));
+
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+    auto hasExtension = [&](const char *name)
+    {
+        return std::any_of(extensions.begin(), extensions.end(), [&](const VkExtensionProperties &extension)
+        {
+            return strcmp(extension.extensionName, name) == 0;
+        });
+    };
+
+    for (const char *extension: requiredExtensions)
+    {
+        if (!hasExtension(extension))
+        {
+            unsuitable(std::string("missing ") + extension);
+        }
+    }
+    for (const char *extension: optionalExtensions)
+    {
+        if (hasExtension(extension))
+        {
+            candidate.score += 50;
+        }
+    }
+
+    if (properties.apiVersion < VK_API_VERSION_1_2 && !hasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+    {
+        unsuitable("no timeline semaphores");
+    }
+
+    VkPhysicalDeviceFeatures features{};
+    vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+    if (!features.samplerAnisotropy)
+    {
+        unsuitable("no samplerAnisotropy");
+    }
+    if (features.multiDrawIndirect && features.drawIndirectFirstInstance)
+    {
+        candidate.score += 50;
+    }
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    bool graphicsAndPresent = false;
+    bool dedicatedCompute = false;
+    bool dedicatedTransfer = false;
+    for (uint32_t i = 0; i < queueFamilyCount; i++)
+    {
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        VkBool32 presentSupport = VK_FALSE;
+        vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &presentSupport);
+
+        graphicsAndPresent = graphicsAndPresent || ((flags & VK_QUEUE_GRAPHICS_BIT) && presentSupport);
+        dedicatedCompute = dedicatedCompute || ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT));
+        dedicatedTransfer = dedicatedTransfer || ((flags & VK_QUEUE_TRANSFER_BIT) &&
+                                                  !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)));
+    }
+
+    if (!graphicsAndPresent)
+    {
+        unsuitable("no queue family with graphics and present");
+    }
+    candidate.score += dedicatedCompute ? 100 : 0;
+    candidate.score += dedicatedTransfer ? 100 : 0;
+
+    return candidate;
+}
+
+// An override picks the device by index, by a case insensitive part of its name or by the
+// start of its UUID (as printed in the device list). A number is tried as an index first, then
+// like any other text, as a UUID may well start with digits only. Null when nothing matches.
+inline const PhysicalDeviceCandidate *findDeviceOverride(const std::vector<PhysicalDeviceCandidate> &candidates,
+                                                         const std::string &deviceOverride)
+{
+    auto lower = [](std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c)
+        {
+            return static_cast<char>(std::tolower(c));
+        });
+        return text;
+    };
+
+    if (!deviceOverride.empty() &&
+        std::all_of(deviceOverride.begin(), deviceOverride.end(), [](unsigned char c) { return std::isdigit(c); }))
+    {
+        // Out of range numbers are no index
+        errno = 0;
+        unsigned long index = strtoul(deviceOverride.c_str(), nullptr, 10);
+        for (const auto &candidate: candidates)
+        {
+            if (errno != ERANGE && index == candidate.index)
+            {
+                return &candidate;
+            }
+        }
+    }
+
+    std::string wanted = lower(deviceOverride);
+    for (const auto &candidate: candidates)
+    {
+        if (lower(candidate.name).find(wanted) != std::string::npos || lower(candidate.uuid).rfind(wanted, 0) == 0)
+        {
+            return &candidate;
+        }
+    }
+    return nullptr;
+}
+
+inline void printPhysicalDeviceCandidates(const std::vector<PhysicalDeviceCandidate> &candidates)
+{
+    for (const auto &candidate: candidates)
+    {
+        std::cout << "GPU " << candidate.index << ": " << candidate.name
+                  << " (" << physicalDeviceTypeName(candidate.type) << ", "
+                  << (candidate.deviceLocalBytes >> 20) << " MiB, Vulkan "
+                  << VK_VERSION_MAJOR(candidate.apiVersion) << "." << VK_VERSION_MINOR(candidate.apiVersion)
+                  << ", " << candidate.uuid << ") ";
+        if (candidate.suitable)
+        {
+            std::cout << "score " << candidate.score << std::endl;
+        } else
+        {
+            std::cout << "unsuitable: " << candidate.unsuitableReason << std::endl;
+        }
+    }
+}
+
+#endif //VULKANPROGRAM_DEVICE_SELECTION_HPP
@@ -0,0 +1,98 @@
+#ifndef VULKANPROGRAM_DYNAMIC_RENDERING_HPP
+#define VULKANPROGRAM_DYNAMIC_RENDERING_HPP
+
+#include <vulkan/vulkan.h>
+
+// VK_KHR_dynamic_rendering for Vulkan headers older than 1.2.197, which do not have it yet.
+// Layouts and values are the ones of the extension, newer headers skip all of this.
+#ifndef VK_KHR_dynamic_rendering
+#define VK_KHR_dynamic_rendering 1
+#define VK_KHR_DYNAMIC_RENDERING_SPEC_VERSION 1
+#define VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME "VK_KHR_dynamic_rendering"
+
+#define VK_STRUCTURE_TYPE_RENDERING_INFO_KHR ((VkStructureType) 1000044000)
+#define VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR ((VkStructureType) 1000044001)
+#define VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR ((VkStructureType) 1000044002)
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR ((VkStructureType) 1000044003)
+
+typedef VkFlags VkRenderingFlagsKHR;
+
+typedef struct VkRenderingAttachmentInfoKHR
+{
+    VkStructureType sType;
+    const void *pNext;
+    VkImageView imageView;
+    VkImageLayout imageLayout;
+    VkResolveModeFlagBits resolveMode;
+    VkImageView resolveImageView;
+    VkImageLayout resolveImageLayout;
+    VkAttachmentLoadOp loadOp;
+    VkAttachmentStoreOp storeOp;
+    VkClearValue clearValue;
+} VkRenderingAttachmentInfoKHR;
+
+typedef struct VkRenderingInfoKHR
+{
+    VkStructureType sType;
+    const void *pNext;
+    VkRenderingFlagsKHR flags;
+    VkRect2D renderArea;
+    uint32_t layerCount;
+    uint32_t viewMask;
+    uint32_t colorAttachmentCount;
+    const VkRenderingAttachmentInfoKHR *pColorAttachments;
+    const VkRenderingAttachmentInfoKHR *pDepthAttachment;
+    const VkRenderingAttachmentInfoKHR *pStencilAttachment;
+} VkRenderingInfoKHR;
+
+typedef struct VkPipelineRenderingCreateInfoKHR
+{
+    VkStructureType sType;
+    const void *pNext;
+    uint32_t viewMask;
+    uint32_t colorAttachmentCount;
+    const VkFormat *pColorAttachmentFormats;
+    VkFormat depthAttachmentFormat;
+    VkFormat stencilAttachmentFormat;
+} VkPipelineRenderingCreateInfoKHR;
+
+typedef struct VkPhysicalDeviceDynamicRenderingFeaturesKHR
+{
+    VkStructureType sType;
+    void *pNext;
+    VkBool32 dynamicRendering;
+} VkPhysicalDeviceDynamicRenderingFeaturesKHR;
+
+typedef void (VKAPI_PTR *PFN_vkCmdBeginRenderingKHR)(VkCommandBuffer commandBuffer,
+                                                     const VkRenderingInfoKHR *pRenderingInfo);
+typedef void (VKAPI_PTR *PFN_vkCmdEndRenderingKHR)(VkCommandBuffer commandBuffer);
+#endif
+
+// Device level entry points of dynamic rendering and synchronization2, loaded once the
+// device is created. All of them are set or none.
+struct DynamicRenderingFunctions
+{
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+    PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2 = nullptr;
+
+    bool load(VkDevice device)
+    {
+        cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+        cmdEndRendering = (PFN_vkCmdEndRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+        cmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2KHR) vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR");
+        if (cmdBeginRendering == nullptr || cmdEndRendering == nullptr || cmdPipelineBarrier2 == nullptr)
+        {
+            *this = {};
+            return false;
+        }
+        return true;
+    }
+
+    bool loaded() const
+    {
+        return cmdBeginRendering != nullptr;
+    }
+};
+
+#endif //VULKANPROGRAM_DYNAMIC_RENDERING_HPP
@@ -0,0 +1,87 @@
+#ifndef VULKANPROGRAM_DYNAMIC_RESOLUTION_HPP
+#define VULKANPROGRAM_DYNAMIC_RESOLUTION_HPP
+
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Picks the render scale (of width and height) for the next frame from measured GPU frame
+// times. GPU time is taken to grow with the pixel count, so the scale heads for
+// sqrt(target / measured) of the current one. It only moves part of the way each frame since
+// a measurement is a few frames old by the time it is read back, and in steps of 1/64 so
+// small jitter does not change the resolution every frame.
+class DynamicResolutionController
+{
+public:
+    DynamicResolutionController() = default;
+
+    DynamicResolutionController(double targetMilliseconds, float minimumScale)
+            : targetMilliseconds(targetMilliseconds),
+              minimumScale(std::min(std::max(minimumScale, 1.0f / STEPS), 1.0f))
+    {
+    }
+
+    // True when the scale changed
+    bool update(double gpuMilliseconds)
+    {
+        if (targetMilliseconds <= 0.0 || gpuMilliseconds <= 0.0)
+        {
+            return false;
+        }
+
+        double desired = currentScale * std::sqrt(targetMilliseconds / gpuMilliseconds);
+        double next = currentScale + DAMPING * (desired - currentScale);
+        float quantized = std::round(static_cast<float>(next) * STEPS) / STEPS;
+        quantized = std::min(std::max(quantized, minimumScale), 1.0f);
+
+        scaleSum += currentScale;
+        updates++;
+        if (quantized == currentScale)
+        {
+            return false;
+        }
+        currentScale = quantized;
+        changes++;
+        return true;
+    }
+
+    float scale() const
+    {
+        return currentScale;
+    }
+
+    // Part of maximum drawn at the current scale, at least one pixel
+    VkExtent2D renderExtent(VkExtent2D maximum) const
+    {
+        auto scaled = [this](uint32_t size)
+        {
+            return std::max(1u, static_cast<uint32_t>(std::lround(static_cast<float>(size) * currentScale)));
+        };
+        return {std::min(scaled(maximum.width), maximum.width), std::min(scaled(maximum.height), maximum.height)};
+    }
+
+    double averageScale() const
+    {
+        return updates > 0 ? scaleSum / static_cast<double>(updates) : currentScale;
+    }
+
+    uint64_t scaleChanges() const
+    {
+        return changes;
+    }
+
+private:
+    static constexpr float STEPS = 64.0f;
+    static constexpr double DAMPING = 0.25;
+
+    double targetMilliseconds = 0.0;
+    float minimumScale = 1.0f;
+    float currentScale = 1.0f;
+
+    double scaleSum = 0.0;
+    uint64_t updates = 0;
+    uint64_t changes = 0;
+};
+
+#endif //VULKANPROGRAM_DYNAMIC_RESOLUTION_HPP
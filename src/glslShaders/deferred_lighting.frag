@@ -0,0 +1,30 @@
+#version 450
+// Lighting subpass of deferred shading. The G-buffer of the geometry subpass is read
+// through input attachments at this fragment's own pixel, so on tile based GPUs it is
+// never written to memory. The world position comes from depth and the inverse view
+// projection, everything else is the lighting of the forward scene shader.
+
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput gbufferAlbedo;
+layout(input_attachment_index = 1, set = 0, binding = 1) uniform subpassInput gbufferNormal;
+layout(input_attachment_index = 2, set = 0, binding = 2) uniform subpassInput gbufferDepth;
+
+// See DeferredUniforms in vertex.hpp
+layout(set = 0, binding = 3) uniform DeferredUniforms {
+    mat4 inverseViewProjection;
+    vec2 inverseRenderSize;
+} deferred;
+
+layout(location = 0) out vec4 outColor;
+
+#include "lighting.h"
+
+void main() {
+    vec4 albedo = subpassLoad(gbufferAlbedo);
+    vec3 normal = normalize(subpassLoad(gbufferNormal).xyz * 2.0 - 1.0);
+    float depth = subpassLoad(gbufferDepth).r;
+
+    vec2 ndc = gl_FragCoord.xy * deferred.inverseRenderSize * 2.0 - 1.0;
+    vec4 worldPosition = deferred.inverseViewProjection * vec4(ndc, depth, 1.0);
+
+    outColor = vec4(albedo.rgb * surfaceLight(worldPosition.xyz / worldPosition.w, normal), albedo.a);
+}
@@ -0,0 +1,39 @@
+// Per draw data of the scene shaders. Included by vertex.hpp and by the GLSL sources, so the
+// C++ struct and the shader block are generated from the same member list. Members are 32 bit
+// scalars only, they have the same offsets in C++, push constant blocks and std140.
+//
+//   instanceBufferIndex  slot of the current frame's instance buffer (bindless only)
+//   objectIndex          added to gl_InstanceIndex to find the model matrix of the object
+//   materialId           texture slot of the material (bindless only)
+//   lodBias              added to the mip level the texture is sampled at
+
+#ifndef VULKANPROGRAM_DRAW_CONSTANTS_H
+#define VULKANPROGRAM_DRAW_CONSTANTS_H
+
+#ifdef __cplusplus
+#include <cstdint>
+#define DRAW_CONSTANTS_UINT uint32_t
+#else
+#define DRAW_CONSTANTS_UINT uint
+#endif
+
+#define DRAW_CONSTANTS_MEMBERS                  \
+    DRAW_CONSTANTS_UINT instanceBufferIndex;    \
+    DRAW_CONSTANTS_UINT objectIndex;            \
+    DRAW_CONSTANTS_UINT materialId;             \
+    float lodBias;
+
+#ifndef __cplusplus
+// Push constants by default, a dynamic uniform buffer per draw to compare against
+#ifdef DRAW_DATA_UBO
+layout(set = 1, binding = 0) uniform DrawData {
+    DRAW_CONSTANTS_MEMBERS
+} draw;
+#else
+layout(push_constant) uniform DrawPushConstants {
+    DRAW_CONSTANTS_MEMBERS
+} draw;
+#endif
+#endif
+
+#endif //VULKANPROGRAM_DRAW_CONSTANTS_H
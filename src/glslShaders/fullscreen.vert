@@ -0,0 +1,8 @@
+#version 450
+// One triangle over the whole viewport, from gl_VertexIndex alone. It lies on the far
+// plane, so a GREATER depth test passes only where something was drawn.
+
+void main() {
+    vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(position * 2.0 - 1.0, 1.0, 1.0);
+}
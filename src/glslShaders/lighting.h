@@ -0,0 +1,137 @@
+// Lighting of a surface point, shared by the forward scene shader and the lighting subpass of
+// deferred shading. SHADOWS adds the shadowed directional light of the shadow set (set 2),
+// CLUSTERED_LIGHTS the point and spot lights of the cluster set (set 3).
+
+#ifndef VULKANPROGRAM_LIGHTING_H
+#define VULKANPROGRAM_LIGHTING_H
+
+const float AMBIENT = 0.3;
+
+#ifdef SHADOWS
+// One layer per cascade, compared against with hardware PCF
+layout(set = 2, binding = 0) uniform sampler2DArrayShadow shadowMap;
+
+// See ShadowUniforms in vertex.hpp
+layout(set = 2, binding = 1) uniform ShadowUniforms {
+    mat4 cascadeViewProjection[4];
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSizes;
+    vec4 lightDirection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+    uint cascadeCount;
+} shadow;
+
+// 1 when lit, 0 when in shadow. Past the last cascade everything is lit.
+float shadowFactor(vec3 worldPosition, vec3 normal) {
+    float viewDepth = dot(worldPosition - shadow.cameraPosition.xyz, shadow.cameraForward.xyz);
+    uint cascade = 0;
+    while (cascade < shadow.cascadeCount && viewDepth > shadow.cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade == shadow.cascadeCount) {
+        return 1.0;
+    }
+
+    // Pushed out along the normal by a texel and a half, so surfaces do not shadow themselves
+    vec3 offsetPosition = worldPosition + normal * 1.5 * shadow.cascadeTexelSizes[cascade];
+    vec4 shadowPosition = shadow.cascadeViewProjection[cascade] * vec4(offsetPosition, 1.0);
+    vec2 uv = shadowPosition.xy * 0.5 + 0.5;
+
+    // 4 bilinear compares half a texel apart, 16 texels in all. Explicit gradients since the
+    // cascade, and with it the control flow, differs between neighbouring fragments.
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int i = 0; i < 4; i++) {
+        vec2 offset = (vec2(i & 1, i >> 1) - 0.5) * texel;
+        lit += textureGrad(shadowMap, vec4(uv + offset, float(cascade), shadowPosition.z), vec2(0.0), vec2(0.0));
+    }
+    return lit * 0.25;
+}
+
+// Ambient plus the shadowed directional light
+float sunLight(vec3 worldPosition, vec3 normal) {
+    float diffuse = max(dot(normal, -shadow.lightDirection.xyz), 0.0);
+    float lit = diffuse > 0.0 ? shadowFactor(worldPosition, normal) : 0.0;
+    return AMBIENT + (1.0 - AMBIENT) * diffuse * lit;
+}
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+struct Light {
+    vec4 positionRange;
+    vec4 color;
+    vec4 directionCone;
+};
+
+// See ClusterUniforms in vertex.hpp and cluster_lights.comp, which fills the buffers below
+layout(set = 3, binding = 0) uniform ClusterUniforms {
+    mat4 view;
+    mat4 inverseProjection;
+    vec2 screenSize;
+    float nearPlane;
+    float farPlane;
+    uvec4 gridSize;
+    uint lightCount;
+    float sliceScale;
+    float sliceBias;
+    uint maxLightReferences;
+} cluster;
+
+layout(std430, set = 3, binding = 1) readonly buffer LightBuffer {
+    Light lights[];
+};
+
+layout(std430, set = 3, binding = 2) readonly buffer ClusterBuffer {
+    uvec2 clusterLights[];
+};
+
+layout(std430, set = 3, binding = 3) readonly buffer LightIndexBuffer {
+    uint lightIndices[];
+};
+
+// Sum of the point and spot lights binned into the fragment's cluster
+vec3 clusteredLight(vec3 worldPosition, vec3 normal) {
+    float viewDepth = -(cluster.view * vec4(worldPosition, 1.0)).z;
+    uint slice = uint(clamp(log(viewDepth) * cluster.sliceScale + cluster.sliceBias,
+                            0.0, float(cluster.gridSize.z - 1)));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy) / cluster.gridSize.w, cluster.gridSize.xy - 1);
+    uvec2 list = clusterLights[tile.x + cluster.gridSize.x * (tile.y + cluster.gridSize.y * slice)];
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0; i < list.y; i++) {
+        Light light = lights[lightIndices[list.x + i]];
+        vec3 toLight = light.positionRange.xyz - worldPosition;
+        float distanceSquared = dot(toLight, toLight);
+        float rangeSquared = light.positionRange.w * light.positionRange.w;
+        if (distanceSquared >= rangeSquared) {
+            continue;
+        }
+        vec3 direction = toLight * inversesqrt(distanceSquared);
+
+        // Inverse square falloff, windowed to reach 0 at the range
+        float window = 1.0 - distanceSquared / rangeSquared;
+        float attenuation = window * window / (1.0 + distanceSquared);
+        if (light.directionCone.w > -1.0) {
+            float cosine = dot(-direction, light.directionCone.xyz);
+            attenuation *= smoothstep(light.directionCone.w, mix(light.directionCone.w, 1.0, 0.25), cosine);
+        }
+        result += light.color.rgb * max(dot(normal, direction), 0.0) * attenuation;
+    }
+    return result;
+}
+#endif
+
+// What the albedo of the surface is multiplied with
+vec3 surfaceLight(vec3 worldPosition, vec3 normal) {
+    vec3 light = vec3(AMBIENT);
+#ifdef SHADOWS
+    light = vec3(sunLight(worldPosition, normal));
+#endif
+#ifdef CLUSTERED_LIGHTS
+    light += clusteredLight(worldPosition, normal);
+#endif
+    return light;
+}
+
+#endif //VULKANPROGRAM_LIGHTING_H
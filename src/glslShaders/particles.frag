@@ -0,0 +1,16 @@
+#version 450
+// Round soft particle, written with premultiplied alpha
+
+layout(location = 0) in vec2 quadPosition;
+layout(location = 1) in vec4 color;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    float falloff = 1.0 - smoothstep(0.5, 1.0, length(quadPosition));
+    float alpha = color.a * falloff;
+    if (alpha <= 0.0) {
+        discard;
+    }
+    outColor = vec4(color.rgb * alpha, alpha);
+}
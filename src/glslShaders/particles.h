@@ -0,0 +1,188 @@
+// Particles of the GPU particle system and how they move. Included by particle_simulation.hpp
+// and by the particle shaders, so the CPU reference steps particles with the same code the
+// compute shaders run. Everything is written in what C++ with glm and GLSL have in common,
+// the few differences are behind the PARTICLE_ macros.
+//
+// A particle is identified by the number it was emitted as. Its lifetime and initial velocity
+// are hashed from that id, so the particle a slot holds can be recreated from the id alone,
+// whichever slot the GPU put it in.
+
+#ifndef VULKANPROGRAM_PARTICLES_H
+#define VULKANPROGRAM_PARTICLES_H
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <glm/glm.hpp>
+#define PARTICLE_UINT uint32_t
+#define PARTICLE_VEC3 glm::vec3
+#define PARTICLE_FUNCTION inline
+#define PARTICLE_INOUT(type) type &
+#else
+#define PARTICLE_UINT uint
+#define PARTICLE_VEC3 vec3
+#define PARTICLE_FUNCTION
+#define PARTICLE_INOUT(type) inout type
+#endif
+
+// Lifetime in seconds and initial speed up and sideways
+#define PARTICLE_MIN_LIFETIME 1.5f
+#define PARTICLE_MAX_LIFETIME 3.0f
+#define PARTICLE_MIN_SPEED 1.5f
+#define PARTICLE_MAX_SPEED 2.5f
+#define PARTICLE_SPREAD 0.6f
+
+// Invocations per group of particle_simulate.comp and particle_emit.comp
+#define PARTICLE_GROUP_SIZE 256
+// Elements sorted in shared memory by one group of particle_sort.comp, two per invocation
+#define PARTICLE_SORT_BLOCK 1024
+
+// 32 bytes, the same in C++ and std430
+#define PARTICLE_MEMBERS                        \
+    PARTICLE_VEC3 position;                     \
+    float age;                                  \
+    PARTICLE_VEC3 velocity;                     \
+    PARTICLE_UINT id;
+
+// What one step does, the same for every particle. Scalars and vec3 followed by a scalar only,
+// so the offsets match std140 as well.
+//
+//   firstEmitted  id of the first particle emitted in the step, the others follow
+//   emitCount     particles emitted in the step, at the emitter with age 0
+//   capacity      slots of the particle buffer, emission stops when all are taken
+//   bounce        part of the vertical speed kept when a particle hits the floor
+#define PARTICLE_STEP_MEMBERS                   \
+    PARTICLE_VEC3 emitterPosition;              \
+    float deltaTime;                            \
+    PARTICLE_VEC3 gravity;                      \
+    float floorHeight;                          \
+    PARTICLE_UINT firstEmitted;                 \
+    PARTICLE_UINT emitCount;                    \
+    PARTICLE_UINT capacity;                     \
+    float bounce;
+
+// Counters of the particle system, in one buffer that is also the indirect draw and dispatch
+// arguments. The first four are a VkDrawIndirectCommand drawing aliveCount quads, the next
+// three a VkDispatchIndirectCommand covering aliveCount with simulation groups.
+//
+//   deadCount       slots on the dead list, signed as emission takes slots off speculatively
+//   compactedCount  particles appended to the compacted list in this step
+//   allocatedCount  slots handed out so far that never were on the dead list
+//   droppedCount    particles that found no free slot, over all steps
+#define PARTICLE_COUNTER_MEMBERS                \
+    PARTICLE_UINT drawVertexCount;              \
+    PARTICLE_UINT aliveCount;                   \
+    PARTICLE_UINT drawFirstVertex;              \
+    PARTICLE_UINT drawFirstInstance;            \
+    PARTICLE_UINT simulateGroupsX;              \
+    PARTICLE_UINT simulateGroupsY;              \
+    PARTICLE_UINT simulateGroupsZ;              \
+    int deadCount;                              \
+    PARTICLE_UINT compactedCount;               \
+    PARTICLE_UINT allocatedCount;               \
+    PARTICLE_UINT droppedCount;
+
+struct Particle {
+    PARTICLE_MEMBERS
+};
+
+// PCG hash, good enough to derive independent random numbers from consecutive ids
+PARTICLE_FUNCTION PARTICLE_UINT particleHash(PARTICLE_UINT value) {
+    PARTICLE_UINT state = value * 747796405u + 2891336453u;
+    PARTICLE_UINT word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Random number in [0, 1) of a particle, a different one for every stream
+PARTICLE_FUNCTION float particleRandom(PARTICLE_UINT id, PARTICLE_UINT stream) {
+    return float(particleHash(id * 4u + stream) >> 8u) * (1.0f / 16777216.0f);
+}
+
+PARTICLE_FUNCTION float particleLifetime(PARTICLE_UINT id) {
+    return PARTICLE_MIN_LIFETIME + (PARTICLE_MAX_LIFETIME - PARTICLE_MIN_LIFETIME) * particleRandom(id, 0u);
+}
+
+PARTICLE_FUNCTION Particle emitParticle(PARTICLE_UINT id, PARTICLE_VEC3 emitterPosition) {
+    Particle particle;
+    particle.position = emitterPosition;
+    particle.age = 0.0f;
+    particle.velocity = PARTICLE_VEC3(PARTICLE_SPREAD * (2.0f * particleRandom(id, 1u) - 1.0f),
+                                      PARTICLE_SPREAD * (2.0f * particleRandom(id, 2u) - 1.0f),
+                                      PARTICLE_MIN_SPEED + (PARTICLE_MAX_SPEED - PARTICLE_MIN_SPEED) *
+                                                           particleRandom(id, 3u));
+    particle.id = id;
+    return particle;
+}
+
+// Semi-implicit Euler step with a bouncing floor. False once the particle outlived its lifetime.
+PARTICLE_FUNCTION bool stepParticle(PARTICLE_INOUT(Particle) particle, PARTICLE_VEC3 gravity, float floorHeight,
+                                    float bounce, float deltaTime) {
+    particle.velocity += gravity * deltaTime;
+    particle.position += particle.velocity * deltaTime;
+    if (particle.position.z < floorHeight && particle.velocity.z < 0.0f) {
+        particle.position.z = floorHeight;
+        particle.velocity.z = -particle.velocity.z * bounce;
+    }
+    particle.age += deltaTime;
+    return particle.age < particleLifetime(particle.id);
+}
+
+#ifdef __cplusplus
+struct ParticleStep
+{
+    PARTICLE_STEP_MEMBERS
+};
+
+struct ParticleCounters
+{
+    PARTICLE_COUNTER_MEMBERS
+};
+#else
+// The particle set of every particle shader, see createParticleSystem() in main.cpp. The step
+// and camera of the frame are in the uniforms, see ParticleUniforms in vertex.hpp. Vertex
+// shaders define PARTICLE_READ_ONLY, they may not write storage buffers.
+#ifdef PARTICLE_READ_ONLY
+#define PARTICLE_BUFFER readonly buffer
+#else
+#define PARTICLE_BUFFER buffer
+#endif
+
+layout(binding = 0) uniform ParticleUniforms {
+    PARTICLE_STEP_MEMBERS
+    mat4 viewProjection;
+    // xyz camera right and up, w particle size
+    vec4 cameraRight;
+    vec4 cameraUp;
+    vec4 cameraPosition;
+} uniforms;
+
+// Indexed by slot
+layout(std430, binding = 1) PARTICLE_BUFFER ParticleBuffer {
+    Particle particles[];
+};
+
+// Slots of the live particles, sorted back to front. Drawn in that order and simulated next step.
+layout(std430, binding = 2) PARTICLE_BUFFER ParticleAliveList {
+    uint aliveList[];
+};
+
+// Slots of the particles that survived or were emitted in this step, in no particular order
+layout(std430, binding = 3) PARTICLE_BUFFER ParticleCompactedList {
+    uint compactedList[];
+};
+
+// Free slots
+layout(std430, binding = 4) PARTICLE_BUFFER ParticleDeadList {
+    uint deadList[];
+};
+
+// Sort key and slot, padded to a power of two
+layout(std430, binding = 5) PARTICLE_BUFFER ParticleSortBuffer {
+    uvec2 sortPairs[];
+};
+
+layout(std430, binding = 6) PARTICLE_BUFFER ParticleCounterBuffer {
+    PARTICLE_COUNTER_MEMBERS
+} counters;
+#endif
+
+#endif //VULKANPROGRAM_PARTICLES_H
@@ -0,0 +1,27 @@
+#version 450
+// Camera facing quad of a particle, six vertices per instance. Instances are
+// the entries of the alive list, which is sorted back to front, so the quads
+// blend in the right order without writing depth.
+#define PARTICLE_READ_ONLY
+#include "particles.h"
+
+layout(location = 0) out vec2 quadPosition;
+layout(location = 1) out vec4 color;
+
+const vec2 CORNERS[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0),
+                               vec2(-1.0, 1.0), vec2(1.0, -1.0), vec2(1.0, 1.0));
+
+void main() {
+    Particle particle = particles[aliveList[gl_InstanceIndex]];
+    float life = clamp(particle.age / particleLifetime(particle.id), 0.0, 1.0);
+
+    vec2 corner = CORNERS[gl_VertexIndex];
+    float size = uniforms.cameraRight.w * (1.0 - 0.5 * life);
+    vec3 position = particle.position +
+                    (corner.x * uniforms.cameraRight.xyz + corner.y * uniforms.cameraUp.xyz) * size;
+    gl_Position = uniforms.viewProjection * vec4(position, 1.0);
+
+    // Hot when emitted, cooling down and fading out over the lifetime
+    quadPosition = corner;
+    color = vec4(mix(vec3(1.0, 0.8, 0.4), vec3(0.8, 0.2, 0.05), life), 1.0 - life);
+}
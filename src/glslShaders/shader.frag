@@ -1,11 +1,65 @@
 #version 450
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+// Declares draw, the per draw data
+#include "draw_constants.h"
+
+// Permutation switches, see ShaderFeature in shader_permutations.hpp and
+// FragmentSpecializationConstants in vertex.hpp
+layout(constant_id = 0) const bool TEXTURED = true;
+layout(constant_id = 1) const bool VERTEX_COLOR = false;
+
+#ifdef BINDLESS
+// Every texture of the program, see BindlessDescriptors
+layout(set = 0, binding = 0) uniform texture2D textures[];
+layout(set = 0, binding = 1) uniform sampler textureSampler;
+
+vec4 sampleTexture(vec2 texCoord) {
+    // The same for the whole draw, so the index is dynamically uniform
+    return texture(sampler2D(textures[draw.materialId], textureSampler), texCoord, draw.lodBias);
+}
+#else
 layout(binding = 1) uniform sampler2D texSampler;
 
+vec4 sampleTexture(vec2 texCoord) {
+    return texture(texSampler, texCoord, draw.lodBias);
+}
+#endif
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
 
+#if defined(SHADOWS) || defined(CLUSTERED_LIGHTS) || defined(GBUFFER)
+layout(location = 2) in vec3 fragWorldPosition;
+
+// The mesh has no normals, the face normal comes from the screen space derivatives. Screen y
+// points down, so this order faces the camera.
+vec3 faceNormal() {
+    return normalize(cross(dFdy(fragWorldPosition), dFdx(fragWorldPosition)));
+}
+#endif
+
+#ifdef GBUFFER
+// Geometry subpass of deferred shading: the G-buffer is lit by deferred_lighting.frag
+layout(location = 1) out vec4 outNormal;
+#else
+#include "lighting.h"
+#endif
+
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    vec4 color = TEXTURED ? sampleTexture(fragTexCoord) : vec4(0.8, 0.8, 0.8, 1.0);
+    if (VERTEX_COLOR) {
+        color.rgb *= fragColor;
+    }
+#ifdef GBUFFER
+    // Albedo in an sRGB attachment, the normal mapped to 0 to 1 in a 10 bit one
+    outNormal = vec4(faceNormal() * 0.5 + 0.5, 0.0);
+#elif defined(SHADOWS) || defined(CLUSTERED_LIGHTS)
+    color.rgb *= surfaceLight(fragWorldPosition, faceNormal());
+#endif
+    outColor = color;
 }
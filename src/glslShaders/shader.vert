@@ -1,20 +1,88 @@
 #version 450
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+// Declares draw, the per draw data
+#include "draw_constants.h"
+
+struct InstanceData {
+    mat4 model;
+    mat4 mvp;
+};
+
+#ifdef BINDLESS
+// Every storage buffer of the program, see BindlessDescriptors. Instance data of the
+// current frame is the one at draw.instanceBufferIndex.
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+} buffers[];
+
+#define INSTANCES buffers[draw.instanceBufferIndex].instances
+#else
 layout(binding = 0) uniform UniformBufferObject{
     mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
+// Filled by the CPU transform kernels every frame, one entry per object
+layout(std430, binding = 2) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+#define INSTANCES instances
+#endif
+
+#ifdef QUANTIZED_VERTICES
+// Positions are snorm16 relative to the mesh bounds, see QuantizedVertex and
+// VertexSpecializationConstants in vertex.hpp
+layout(constant_id = 0) const float BOUNDS_CENTER_X = 0.0;
+layout(constant_id = 1) const float BOUNDS_CENTER_Y = 0.0;
+layout(constant_id = 2) const float BOUNDS_CENTER_Z = 0.0;
+layout(constant_id = 3) const float BOUNDS_HALF_EXTENT_X = 1.0;
+layout(constant_id = 4) const float BOUNDS_HALF_EXTENT_Y = 1.0;
+layout(constant_id = 5) const float BOUNDS_HALF_EXTENT_Z = 1.0;
+
+layout(location = 0) in vec4 inPosition;
+#else
 layout(location = 0) in vec3 inPosition;
+#endif
+
+#ifndef DEPTH_ONLY
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+#ifdef WORLD_POSITION
+// For shading with shadows and clustered lights
+layout(location = 2) out vec3 fragWorldPosition;
+#endif
+#endif
+
+// The depth pre-pass (DEPTH_ONLY, positions only and no fragment shader) and the scene pass
+// after it have to compute the exact same depth for its EQUAL test
+invariant gl_Position;
+
+vec3 objectPosition() {
+#ifdef QUANTIZED_VERTICES
+    return vec3(BOUNDS_CENTER_X, BOUNDS_CENTER_Y, BOUNDS_CENTER_Z) +
+           inPosition.xyz * vec3(BOUNDS_HALF_EXTENT_X, BOUNDS_HALF_EXTENT_Y, BOUNDS_HALF_EXTENT_Z);
+#else
+    return inPosition;
+#endif
+}
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    uint object = draw.objectIndex + gl_InstanceIndex;
+    gl_Position = INSTANCES[object].mvp * vec4(objectPosition(), 1.0);
+#ifndef DEPTH_ONLY
     fragColor = inColor;
     fragTexCoord = inTexCoord;
+#ifdef WORLD_POSITION
+    fragWorldPosition = (INSTANCES[object].model * vec4(objectPosition(), 1.0)).xyz;
+#endif
+#endif
 }
@@ -0,0 +1,49 @@
+#version 450
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+// Depth of every object as seen from the light, into one cascade of the shadow map. The float
+// position stream only, all objects in one instanced draw.
+
+struct InstanceData {
+    mat4 model;
+    mat4 mvp;
+};
+
+layout(push_constant) uniform ShadowPushConstants {
+    uint instanceBufferIndex;
+    uint cascade;
+} push;
+
+#ifdef BINDLESS
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+} buffers[];
+
+#define INSTANCES buffers[push.instanceBufferIndex].instances
+#else
+layout(std430, set = 0, binding = 2) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+#define INSTANCES instances
+#endif
+
+// See ShadowUniforms in vertex.hpp
+layout(set = 1, binding = 1) uniform ShadowUniforms {
+    mat4 cascadeViewProjection[4];
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSizes;
+    vec4 lightDirection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+    uint cascadeCount;
+} shadow;
+
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+    vec4 worldPosition = INSTANCES[gl_InstanceIndex].model * vec4(inPosition, 1.0);
+    gl_Position = shadow.cascadeViewProjection[push.cascade] * worldPosition;
+}
@@ -0,0 +1,349 @@
+#ifndef VULKANPROGRAM_GPU_PROFILER_HPP
+#define VULKANPROGRAM_GPU_PROFILER_HPP
+
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "render_graph.hpp"
+
+// GPU time of named scopes from timestamp queries. Every frame in flight has its own query
+// pool, read back by collect() once that frame is known to be done, so reading never stalls.
+//
+// Scopes are tagged with the queue they run on. Per frame the time the compute queue was busy
+// while the graphics queue was busy too, with this or the previous frame, is added up as
+// overlap. That compares timestamps of different queues, which desktop drivers write from the
+// same clock.
+class GpuProfiler
+{
+public:
+    void create(VkDevice renderDevice, VkPhysicalDevice physicalDevice, uint32_t frameCount,
+                uint32_t maxScopesPerFrame = 64)
+    {
+        device = renderDevice;
+        maxScopes = maxScopesPerFrame;
+
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        if (!properties.limits.timestampComputeAndGraphics || properties.limits.timestampPeriod <= 0.0f)
+        {
+            return;
+        }
+        nanosecondsPerTick = properties.limits.timestampPeriod;
+
+        frames.resize(frameCount);
+        for (auto &frame: frames)
+        {
+            VkQueryPoolCreateInfo queryPoolCreateInfo{};
+            queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolCreateInfo.queryCount = 2 * maxScopes;
+
+            if (vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &frame.queryPool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create timestamp query pool!");
+            }
+        }
+    }
+
+    void destroy() const
+    {
+        for (const auto &frame: frames)
+        {
+            vkDestroyQueryPool(device, frame.queryPool, nullptr);
+        }
+    }
+
+    bool enabled() const
+    {
+        return !frames.empty();
+    }
+
+    // Recorded into the command buffer of the frame that is submitted first
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frame)
+    {
+        if (!enabled())
+        {
+            return;
+        }
+        frames[frame].scopes.clear();
+        frames[frame].submitted = true;
+        vkCmdResetQueryPool(commandBuffer, frames[frame].queryPool, 0, 2 * maxScopes);
+    }
+
+    // A command buffer recorded earlier for this frame slot is submitted again. It has to have
+    // the same scopes as the one recorded last.
+    void resubmitFrame(uint32_t frame)
+    {
+        if (enabled())
+        {
+            frames[frame].submitted = true;
+        }
+    }
+
+    // Scopes do not nest. Scopes beyond maxScopesPerFrame are not measured.
+    void beginScope(VkCommandBuffer commandBuffer, uint32_t frame, const std::string &name, RenderGraphQueue queue)
+    {
+        if (!enabled() || frames[frame].scopes.size() == maxScopes)
+        {
+            return;
+        }
+        FrameData &frameData = frames[frame];
+        frameData.scopes.push_back({name, queue, true});
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frameData.queryPool,
+                            2 * static_cast<uint32_t>(frameData.scopes.size() - 1));
+    }
+
+    void endScope(VkCommandBuffer commandBuffer, uint32_t frame)
+    {
+        if (!enabled() || frames[frame].scopes.empty() || !frames[frame].scopes.back().open)
+        {
+            return;
+        }
+        FrameData &frameData = frames[frame];
+        frameData.scopes.back().open = false;
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frameData.queryPool,
+                            2 * static_cast<uint32_t>(frameData.scopes.size() - 1) + 1);
+    }
+
+    // Reads the timestamps of frame. Only call once its submissions are complete.
+    void collect(uint32_t frame)
+    {
+        if (!enabled() || !frames[frame].submitted || frames[frame].scopes.empty())
+        {
+            return;
+        }
+        FrameData &frameData = frames[frame];
+        frameData.submitted = false;
+
+        std::vector<uint64_t> timestamps(2 * frameData.scopes.size());
+        VkResult result = vkGetQueryPoolResults(device, frameData.queryPool, 0,
+                                                static_cast<uint32_t>(timestamps.size()),
+                                                timestamps.size() * sizeof(uint64_t), timestamps.data(),
+                                                sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result != VK_SUCCESS)
+        {
+            return;
+        }
+
+        std::vector<std::pair<double, double>> graphicsIntervals;
+        std::vector<std::pair<double, double>> computeIntervals;
+        double frameBegin = 0.0;
+        double frameEnd = 0.0;
+        for (std::size_t i = 0; i < frameData.scopes.size(); i++)
+        {
+            double begin = static_cast<double>(timestamps[2 * i]) * nanosecondsPerTick;
+            double end = static_cast<double>(timestamps[2 * i + 1]) * nanosecondsPerTick;
+            if (end < begin)
+            {
+                continue;
+            }
+
+            ScopeStats &stats = statsFor(frameData.scopes[i].name);
+            stats.lastNanoseconds = end - begin;
+            stats.totalNanoseconds += end - begin;
+            stats.samples++;
+
+            frameBegin = graphicsIntervals.empty() && computeIntervals.empty() ? begin : std::min(frameBegin, begin);
+            frameEnd = std::max(frameEnd, end);
+
+            (frameData.scopes[i].queue == RenderGraphQueue::Compute ? computeIntervals : graphicsIntervals)
+                    .emplace_back(begin, end);
+        }
+
+        if (frameEnd > frameBegin)
+        {
+            lastFrameNanoseconds = frameEnd - frameBegin;
+            frameNanoseconds += lastFrameNanoseconds;
+            framesCollected++;
+        }
+
+        // Compute work of this frame may run alongside graphics work of the previous one
+        std::vector<std::pair<double, double>> thisFrameGraphics = graphicsIntervals;
+        graphicsIntervals.insert(graphicsIntervals.end(), previousGraphicsIntervals.begin(),
+                                 previousGraphicsIntervals.end());
+        previousGraphicsIntervals = std::move(thisFrameGraphics);
+
+        if (!computeIntervals.empty())
+        {
+            mergeIntervals(graphicsIntervals);
+            mergeIntervals(computeIntervals);
+            computeBusyNanoseconds += totalLength(computeIntervals);
+            overlapNanoseconds += intersectionLength(graphicsIntervals, computeIntervals);
+            framesWithCompute++;
+        }
+    }
+
+    // Of the most recent frame collected, 0 when the scope was not measured yet
+    double lastMilliseconds(const std::string &name) const
+    {
+        for (const auto &stats: scopeStats)
+        {
+            if (stats.first == name)
+            {
+                return stats.second.lastNanoseconds / 1e6;
+            }
+        }
+        return 0.0;
+    }
+
+    double averageMilliseconds(const std::string &name) const
+    {
+        for (const auto &stats: scopeStats)
+        {
+            if (stats.first == name)
+            {
+                return stats.second.totalNanoseconds / 1e6 / static_cast<double>(stats.second.samples);
+            }
+        }
+        return 0.0;
+    }
+
+    // From the first scope of a frame starting to the last one ending, on any queue
+    double averageFrameMilliseconds() const
+    {
+        return framesCollected > 0 ? frameNanoseconds / 1e6 / static_cast<double>(framesCollected) : 0.0;
+    }
+
+    // Of the most recent frame collected. collectedFrames() tells when there is a new one.
+    double lastFrameMilliseconds() const
+    {
+        return lastFrameNanoseconds / 1e6;
+    }
+
+    uint64_t collectedFrames() const
+    {
+        return framesCollected;
+    }
+
+    void print(std::ostream &out) const
+    {
+        if (scopeStats.empty())
+        {
+            return;
+        }
+
+        out << "GPU time per frame:\n";
+        for (const auto &stats: scopeStats)
+        {
+            out << "  " << std::left << std::setw(20) << stats.first << std::right << std::fixed
+                << std::setprecision(3) << stats.second.totalNanoseconds / 1e6 / static_cast<double>(stats.second.samples)
+                << " ms\n";
+        }
+        if (framesWithCompute > 0)
+        {
+            double busy = computeBusyNanoseconds / 1e6 / static_cast<double>(framesWithCompute);
+            double overlap = overlapNanoseconds / 1e6 / static_cast<double>(framesWithCompute);
+            out << "  compute queue busy " << busy << " ms per frame, " << overlap
+                << " ms of it overlapping graphics (" << (busy > 0.0 ? 100.0 * overlap / busy : 0.0) << "%)\n";
+        }
+        out << std::defaultfloat << std::flush;
+    }
+
+private:
+    struct Scope
+    {
+        std::string name;
+        RenderGraphQueue queue;
+        bool open;
+    };
+
+    struct FrameData
+    {
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        // Kept after collect(), a resubmitted command buffer writes the same scopes again
+        std::vector<Scope> scopes;
+        bool submitted = false;
+    };
+
+    struct ScopeStats
+    {
+        double totalNanoseconds = 0.0;
+        double lastNanoseconds = 0.0;
+        uint64_t samples = 0;
+    };
+
+    ScopeStats &statsFor(const std::string &name)
+    {
+        for (auto &stats: scopeStats)
+        {
+            if (stats.first == name)
+            {
+                return stats.second;
+            }
+        }
+        scopeStats.emplace_back(name, ScopeStats{});
+        return scopeStats.back().second;
+    }
+
+    static void mergeIntervals(std::vector<std::pair<double, double>> &intervals)
+    {
+        std::sort(intervals.begin(), intervals.end());
+        std::vector<std::pair<double, double>> merged;
+        for (const auto &interval: intervals)
+        {
+            if (!merged.empty() && interval.first <= merged.back().second)
+            {
+                merged.back().second = std::max(merged.back().second, interval.second);
+            } else
+            {
+                merged.push_back(interval);
+            }
+        }
+        intervals = std::move(merged);
+    }
+
+    static double totalLength(const std::vector<std::pair<double, double>> &intervals)
+    {
+        double total = 0.0;
+        for (const auto &interval: intervals)
+        {
+            total += interval.second - interval.first;
+        }
+        return total;
+    }
+
+    // Both lists sorted and merged
+    static double intersectionLength(const std::vector<std::pair<double, double>> &a,
+                                     const std::vector<std::pair<double, double>> &b)
+    {
+        double total = 0.0;
+        std::size_t i = 0;
+        std::size_t j = 0;
+        while (i < a.size() && j < b.size())
+        {
+            double begin = std::max(a[i].first, b[j].first);
+            double end = std::min(a[i].second, b[j].second);
+            total += std::max(0.0, end - begin);
+            if (a[i].second < b[j].second)
+            {
+                i++;
+            } else
+            {
+                j++;
+            }
+        }
+        return total;
+    }
+
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t maxScopes = 0;
+    float nanosecondsPerTick = 1.0f;
+    std::vector<FrameData> frames;
+
+    std::vector<std::pair<std::string, ScopeStats>> scopeStats;
+    std::vector<std::pair<double, double>> previousGraphicsIntervals;
+    double lastFrameNanoseconds = 0.0;
+    double frameNanoseconds = 0.0;
+    uint64_t framesCollected = 0;
+    double computeBusyNanoseconds = 0.0;
+    double overlapNanoseconds = 0.0;
+    uint64_t framesWithCompute = 0;
+};
+
+#endif //VULKANPROGRAM_GPU_PROFILER_HPP
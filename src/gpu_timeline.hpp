@@ -0,0 +1,122 @@
+#ifndef VULKANPROGRAM_GPU_TIMELINE_HPP
+#define VULKANPROGRAM_GPU_TIMELINE_HPP
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <stdexcept>
+
+// One timeline semaphore counting every submission of the program. Each submit signals the
+// next value, so "is the work of submission N done" is a single comparison against the
+// counter, for the CPU as well as for other queues waiting on the semaphore.
+//
+// Core in Vulkan 1.2, otherwise VK_KHR_timeline_semaphore. Pass useExtension when the device
+// only has the extension so the KHR entry points are used.
+class GpuTimeline
+{
+public:
+    void create(VkDevice renderDevice, bool useExtension)
+    {
+        device = renderDevice;
+
+        getCounterValue = (PFN_vkGetSemaphoreCounterValue) vkGetDeviceProcAddr(
+                device, useExtension ? "vkGetSemaphoreCounterValueKHR" : "vkGetSemaphoreCounterValue");
+        waitSemaphores = (PFN_vkWaitSemaphores) vkGetDeviceProcAddr(
+                device, useExtension ? "vkWaitSemaphoresKHR" : "vkWaitSemaphores");
+        if (getCounterValue == nullptr || waitSemaphores == nullptr)
+        {
+            throw std::runtime_error("failed to load timeline semaphore functions!");
+        }
+
+        VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo{};
+        semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        semaphoreTypeCreateInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreCreateInfo{};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+
+        if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &timeline) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create timeline semaphore!");
+        }
+    }
+
+    void destroy() const
+    {
+        vkDestroySemaphore(device, timeline, nullptr);
+    }
+
+    VkSemaphore semaphore() const
+    {
+        return timeline;
+    }
+
+    // Value the next submission signals. Values are handed out in submission order, call this
+    // right before the submit that signals it.
+    uint64_t next()
+    {
+        return ++submittedValue;
+    }
+
+    // Highest value handed out so far
+    uint64_t submitted() const
+    {
+        return submittedValue;
+    }
+
+    // Highest value the GPU has signalled. Cached, so repeated checks against old values do not
+    // go to the driver.
+    uint64_t completed() const
+    {
+        if (completedValue < submittedValue)
+        {
+            getCounterValue(device, timeline, &completedValue);
+        }
+        return completedValue;
+    }
+
+    bool isComplete(uint64_t value) const
+    {
+        return value <= completed();
+    }
+
+    // Blocks until the GPU signals value. Value 0 is signalled from the start.
+    void wait(uint64_t value) const
+    {
+        if (isComplete(value))
+        {
+            return;
+        }
+
+        VkSemaphoreWaitInfo semaphoreWaitInfo{};
+        semaphoreWaitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        semaphoreWaitInfo.semaphoreCount = 1;
+        semaphoreWaitInfo.pSemaphores = &timeline;
+        semaphoreWaitInfo.pValues = &value;
+
+        if (waitSemaphores(device, &semaphoreWaitInfo, UINT64_MAX) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to wait on timeline semaphore!");
+        }
+        completedValue = value;
+    }
+
+    // Everything submitted so far is done
+    void waitIdle() const
+    {
+        wait(submittedValue);
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkSemaphore timeline = VK_NULL_HANDLE;
+
+    uint64_t submittedValue = 0;
+    mutable uint64_t completedValue = 0;
+
+    PFN_vkGetSemaphoreCounterValue getCounterValue = nullptr;
+    PFN_vkWaitSemaphores waitSemaphores = nullptr;
+};
+
+#endif //VULKANPROGRAM_GPU_TIMELINE_HPP
@@ -0,0 +1,42 @@
+#ifndef VULKANPROGRAM_HASH_HPP
+#define VULKANPROGRAM_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// 64 bit FNV-1a. Stable between runs and platforms, so it can name files on disk.
+inline uint64_t hashBytes(const void *data, std::size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t hashString(const std::string &text, uint64_t hash = 14695981039346656037ull)
+{
+    // The length goes in as well so that ("ab", "c") and ("a", "bc") differ
+    uint64_t length = text.size();
+    hash = hashBytes(&length, sizeof(length), hash);
+    return hashBytes(text.data(), text.size(), hash);
+}
+
+template<typename T>
+inline uint64_t hashValue(const T &value, uint64_t hash = 14695981039346656037ull)
+{
+    return hashBytes(&value, sizeof(T), hash);
+}
+
+inline std::string hashToHex(uint64_t hash)
+{
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+    return text;
+}
+
+#endif //VULKANPROGRAM_HASH_HPP
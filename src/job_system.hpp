@@ -0,0 +1,120 @@
+#ifndef VULKANPROGRAM_JOB_SYSTEM_HPP
+#define VULKANPROGRAM_JOB_SYSTEM_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads running fire and forget jobs in submission order.
+// Used for work that must stay off the render thread, like building pipelines.
+class JobSystem
+{
+public:
+    explicit JobSystem(uint32_t threadCount = defaultThreadCount())
+    {
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            workers.emplace_back([this]()
+                                 {
+                                     workerLoop();
+                                 });
+        }
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        jobAvailable.notify_all();
+
+        for (auto &worker: workers)
+        {
+            worker.join();
+        }
+    }
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    // Leave one core to the render thread
+    static uint32_t defaultThreadCount()
+    {
+        // hardware_concurrency() is 0 when it cannot be determined
+        uint32_t cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 1;
+    }
+
+    uint32_t threadCount() const
+    {
+        return static_cast<uint32_t>(workers.size());
+    }
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    // Blocks until every submitted job has finished
+    void waitIdle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [this]()
+        {
+            return jobs.empty() && activeJobs == 0;
+        });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable allDone;
+    uint32_t activeJobs = 0;
+    bool running = true;
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobAvailable.wait(lock, [this]()
+                {
+                    return !jobs.empty() || !running;
+                });
+
+                // Jobs still queued on shutdown are dropped
+                if (!running)
+                {
+                    return;
+                }
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                activeJobs++;
+            }
+
+            job();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                activeJobs--;
+            }
+            allDone.notify_all();
+        }
+    }
+};
+
+#endif //VULKANPROGRAM_JOB_SYSTEM_HPP
@@ -1,6 +1,4 @@
 #include "glm/trigonometric.hpp"
-#define  GLM_FORCE_RADIANS
-#define  GLM_FORCE_DEPTH_ZERO_TO_ONE
 #define  TINYOBJLOADER_IMPLEMENTATION
 #define  STB_IMAGE_IMPLEMENTATION
 
@@ -23,6 +21,27 @@
 #include <chrono>
 #include "vulkan/vulkan_core.h"
 #include "vulkan_helpers.h"
+#include "transform_store.hpp"
+#include "program_options.hpp"
+#include "benchmarks.hpp"
+#include "render_graph.hpp"
+#include "shader_compiler.hpp"
+#include "shader_hot_reload.hpp"
+#include "shader_permutations.hpp"
+#include "pipeline_cache.hpp"
+#include "bindless_descriptors.hpp"
+#include "descriptor_allocator.hpp"
+#include "gpu_timeline.hpp"
+#include "deletion_queue.hpp"
+#include "device_selection.hpp"
+#include "queue_families.hpp"
+#include "gpu_profiler.hpp"
+#include "dynamic_rendering.hpp"
+#include "attachments.hpp"
+#include "dynamic_resolution.hpp"
+#include "shadow_cascades.hpp"
+#include "particle_simulation.hpp"
+#include "build_profile.hpp"
 #include <stb_image.h>
 #include <tiny_obj_loader.h>
 
@@ -51,11 +70,19 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
 class VulkanProgram
 {
 public:
-    void run()
+    explicit VulkanProgram(const ProgramOptions &options) : options(options)
+    {
+    }
+
+    // Returns the exit status of the program, 1 when the particles failed verification
+    int run()
     {
         // Create a window for presentation
         glfwInit();
 
+        // Validation layer and debug messenger, only when asked for
+        enableValidation();
+
         // Allow window system to add its own required
         // instance extensions
         addAdditionalInstanceExtensions();
@@ -81,11 +108,17 @@ public:
         // create swapchain
         createSwapchain();
         createSwapchainImageView();
+        createSceneColorTarget();
+        if (vulkanProgramInfo.postProcessingEnabled)
+        {
+            createHdrSceneColorTarget();
+        }
 
         // Drawing Commands
         createCommandBuffers();
 
-        // Depth buffer
+        // Multisampled color target and depth buffer
+        createMsaaColorTarget();
         createDepthBuffer();
 
         // Texture Images and its Image View
@@ -96,38 +129,177 @@ public:
         // Create Descriptor set which contains uniform buffers
         createDescriptorSetLayout();
         createUniformBuffer();
-        createDescriptorPool();
+
+        // Per object transforms and the instance buffers they are written to
+        createSceneObjects();
+        createInstanceBuffer();
+        createDescriptorAllocators();
+        if (vulkanProgramInfo.bindlessEnabled)
+        {
+            createBindlessDescriptors();
+        }
+        if (options.drawSubmission == "ubo")
+        {
+            createDrawDataBuffers();
+        }
 
         // Preparing for graphics pipeline
         // Create vertex buffer
         loadModel();
         createVertexBufferAndAllocateMemory();
+        createQuantizedVertexBuffer();
+        createPositionVertexBuffers();
 
         // Create vertex index buffer
         createIndexBuffer();
 
         // Graphics pipeline
+        if (options.hotReload)
+        {
+            shaderHotReloader = std::make_unique<ShaderHotReloader>(shaderCompiler);
+        }
+        if (!ShaderCompiler::runtimeCompilationAvailable())
+        {
+            std::cout << "Built without shaderc, loading precompiled shaders from spvShaders" << std::endl;
+        }
+
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            createShadowMap();
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            createClusteredLights();
+        }
+        if (vulkanProgramInfo.deferredShadingEnabled)
+        {
+            createGBuffer();
+        }
+
         createRenderPass();
         createGraphicsPipeline();
 
         createSwapchainFramebuffer();
 
+        // Before the resources whose descriptor sets use the transient images
+        createFrameTransients();
+
+        if (vulkanProgramInfo.upscaleByCompute)
+        {
+            createUpscaleResources();
+        }
+        if (vulkanProgramInfo.postProcessingEnabled)
+        {
+            createPostProcessingResources();
+        }
+        if (vulkanProgramInfo.particlesEnabled)
+        {
+            createParticleSystem();
+        }
+
+        // Hierarchical-Z occlusion culling
+        if (vulkanProgramInfo.occlusionCullingEnabled)
+        {
+            createDepthPyramid();
+            createOcclusionCullingResources();
+        }
+
 
         // Synchronization Objects
         createSynchronizationObjects();
 
 
+        if (!options.dumpRenderGraph.empty())
+        {
+            dumpFrameGraph(options.dumpRenderGraph == "dot");
+        }
+
+        if (shaderHotReloader)
+        {
+            shaderHotReloader->start();
+        }
+
         // Program Loop
         programLoop();
 
+        bool verified = !vulkanProgramInfo.particleReference || verifyParticles();
+
         cleanup();
+        return verified ? 0 : 1;
     }
 
 private:
+    ProgramOptions options;
+
+    ShaderCompiler shaderCompiler;
+
+    // Only created with --hot-reload
+    std::unique_ptr<ShaderHotReloader> shaderHotReloader;
+
+    // Graphics pipelines are described by value and looked up here. Everything but the
+    // default scene pipeline is created on the worker threads of pipelineJobs.
+    std::unique_ptr<JobSystem> pipelineJobs;
+    std::unique_ptr<PipelineManager> pipelineManager;
+
+    // Objects [firstObject, firstObject + objectCount) drawn with the same shader permutation
+    struct SceneDrawGroup
+    {
+        ShaderPermutation permutation;
+        uint32_t firstObject;
+        uint32_t objectCount;
+
+        // Set up with the pipeline layout, unused by groups of the default permutation
+        GraphicsPipelineDesc pipelineDesc{};
+        uint64_t pipelineKey = 0;
+
+        // Material of the group, its texture slot in the bindless texture array
+        uint32_t materialId = 0;
+
+        // What the group is drawn with in the frame being recorded, see resolveGroupPipelines()
+        VkPipeline framePipeline = VK_NULL_HANDLE;
+        bool frameQuantized = false;
+    };
+
     VkResult vkResult{};
 
     VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
 
+    // Command buffer of one render graph batch and the queue it is submitted to
+    struct FrameSubmission
+    {
+        RenderGraphQueue queue;
+        VkCommandBuffer commandBuffer;
+    };
+
+    // What the shading scene passes read besides their attachments, written earlier in the frame
+    struct SceneInputs
+    {
+        RenderGraphHandle shadowMap = 0;
+        RenderGraphHandle lightClusters = 0;
+        RenderGraphHandle lightIndices = 0;
+        RenderGraphHandle particles = 0;
+        RenderGraphHandle particleAliveList = 0;
+        RenderGraphHandle particleCounters = 0;
+    };
+
+    // The recorded frame of one (swapchain image, frame slot) pair, see staticCommandBuffers
+    struct StaticFrameCommands
+    {
+        // commandGeneration it was recorded at, 0 when never recorded
+        uint64_t generation = 0;
+        std::vector<VkCommandBuffer> graphicsCommandBuffers;
+        std::vector<VkCommandBuffer> computeCommandBuffers;
+        std::vector<FrameSubmission> submissions;
+    };
+
+    // The compiled frame graph of one swapchain image, see frameGraphs
+    struct CachedFrameGraph
+    {
+        // commandGeneration it was built at, 0 when never built
+        uint64_t generation = 0;
+        RenderGraph graph;
+    };
+
     // All the Vulkan program related data
     struct VulkanProgramInfo
     {
@@ -143,6 +315,10 @@ private:
 
         VkQueue presentQueue = VK_NULL_HANDLE;
 
+        // The same queue as graphicsQueue unless the device has a dedicated family for it
+        VkQueue computeQueue = VK_NULL_HANDLE;
+        VkQueue transferQueue = VK_NULL_HANDLE;
+
         VkSurfaceKHR windowSurface = VK_NULL_HANDLE;
 
         VkSwapchainKHR swapchain;
@@ -154,19 +330,40 @@ private:
         std::vector<VkImage> swapchainImages;
         std::vector<VkImageView> swapchainImageViews;
 
-        uint32_t graphicsQueueFamilyIndex = 0;
-        bool graphicsQueueFound = false;
+        QueueFamilySelection queueFamilies;
 
-        uint32_t presentQueueFamilyIndex = 0;
-        bool presentQueueFound = false;
+        // Culling runs on the compute queue, which resources it shares with graphics are
+        // created concurrent for
+        bool asyncComputeEnabled = false;
+        uint32_t graphicsAndComputeFamilies[2] = {};
 
         // Graphics Pipelines
         VkPipelineLayout pipelineLayout;
 
-        VkRenderPass renderPass;
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+
+        // The scene passes begin with vkCmdBeginRenderingKHR and the frame graph records sync2
+        // barriers when the device has dynamic rendering. No render pass or framebuffer objects then.
+        bool dynamicRenderingExtensionsAdded = false;
+        bool dynamicRenderingEnabled = false;
+        DynamicRenderingFunctions dynamicRendering;
 
         VkPipeline graphicsPipeline;
 
+        // Drawn with while the pipeline of a group is still being created. Either a pipeline
+        // of its own or the default scene pipeline when that has the fallback state already.
+        VkPipeline fallbackPipeline = VK_NULL_HANDLE;
+        bool ownsFallbackPipeline = false;
+        uint64_t fallbackDraws = 0;
+
+        // CPU time of every frame from acquire to present, kept with --bench-frames
+        std::vector<double> frameCpuMilliseconds;
+
+        // Handles replaced at runtime (pipelines of a shader reload, ...), destroyed once the
+        // timeline passes the last submission that used them
+        DeletionQueue deletionQueue;
+        uint64_t frameNumber = 0;
+
         uint32_t activeSwapchainImage = 0;
 
         std::vector<VkFramebuffer> swapchainFramebuffers;
@@ -175,23 +372,62 @@ private:
         VkCommandPool commandPool;
         VkCommandBuffer commandBuffers[MAX_FRAMES_IN_FLIGHT];
 
+        // A frame is split into batches whenever it switches queues. Graphics batches after the
+        // first record into the extra buffers, compute batches into the compute ones.
+        static constexpr uint32_t MAX_BATCHES_PER_QUEUE = 4;
+        VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+        VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+        VkCommandBuffer extraGraphicsCommandBuffers[MAX_FRAMES_IN_FLIGHT][MAX_BATCHES_PER_QUEUE - 1] = {};
+        VkCommandBuffer computeCommandBuffers[MAX_FRAMES_IN_FLIGHT][MAX_BATCHES_PER_QUEUE] = {};
+
+        // GPU time of every render graph pass, with how much compute overlaps graphics
+        GpuProfiler gpuProfiler;
+
+        // --static-command-buffers: every (swapchain image, frame slot) pair keeps the command
+        // buffers it was recorded into and submits them again until commandGeneration moves on.
+        // That happens when a pipeline is swapped by the hot reloader or becomes ready in the
+        // pipeline manager. Per frame data (uniforms, instance matrices) lives in buffers the
+        // recorded commands read, so it does not need a new recording.
+        bool staticCommandBuffers = false;
+        std::vector<StaticFrameCommands> staticFrameCommands;
+        std::vector<VkDescriptorSet> staticSceneDescriptorSets;
+        uint64_t commandGeneration = 1;
+        uint32_t observedPipelineGeneration = 0;
+        uint64_t staticRecordings = 0;
+
+        // The frame graph only changes with the swapchain image it draws into, the render extent
+        // and the shadow cascades to render. The last two bump commandGeneration, so every
+        // swapchain image keeps its compiled graph until commandGeneration moves on.
+        std::vector<CachedFrameGraph> frameGraphs;
+        // Images that only live within a frame (depth pyramid, bloom), in memory they share
+        // when their passes do not overlap. Every frame graph is bound to them.
+        RenderGraphTransients frameTransients;
+
         // Synchronization Objects
-        VkFence frameReadyFences[MAX_FRAMES_IN_FLIGHT];
+        // Every submission signals the next value of the timeline. frameTimelineValues holds the
+        // value of the last submission of each frame slot, waited on before the slot is reused.
+        GpuTimeline timeline;
+        uint64_t frameTimelineValues[MAX_FRAMES_IN_FLIGHT] = {};
+        // Signalled by the compute queue only. A shared counter would have to be signalled in
+        // submission order across both queues, which async compute does not guarantee.
+        GpuTimeline computeTimeline;
+        uint64_t frameComputeTimelineValues[MAX_FRAMES_IN_FLIGHT] = {};
+        bool timelineSemaphoreExtensionAdded = false;
         VkSemaphore nextImageReadySemaphores[MAX_FRAMES_IN_FLIGHT];
         VkSemaphore renderFinishedSemaphores[MAX_FRAMES_IN_FLIGHT];
 
         // Keep track of current frame. Its value should never exceed MAX_IN_FLIGHT_FRAMES
         int curr_frame = 0;
 
-        std::vector<const char *> layerEnabled =
-                {
-                        "VK_LAYER_KHRONOS_validation",
-                };
+        // Highest version both the loader and this program know, at most Vulkan 1.2
+        uint32_t instanceApiVersion = VK_API_VERSION_1_0;
 
-        std::vector<const char *> instanceExtensionsEnabled =
-                {
-                        VK_EXT_DEBUG_UTILS_EXTENSION_NAME
-                };
+        // The validation layer and the debug utils extension are added by enableValidation()
+        ValidationMode validation = ValidationMode::Off;
+
+        std::vector<const char *> layerEnabled;
+
+        std::vector<const char *> instanceExtensionsEnabled;
 
         std::vector<const char *> deviceExtensionsEnabled =
                 {
@@ -200,14 +436,40 @@ private:
 
         VkBuffer vertexBuffer = VK_NULL_HANDLE;
         VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
+        // Only created when a QUANTIZED_VERTICES permutation is drawn
+        VkBuffer quantizedVertexBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory quantizedVertexBufferMemory = VK_NULL_HANDLE;
+        // Position only streams of the depth pre-pass and shadow maps, the quantized one when a
+        // depth pre-pass group needs it
+        VkBuffer positionBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory positionBufferMemory = VK_NULL_HANDLE;
+        VkBuffer quantizedPositionBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory quantizedPositionBufferMemory = VK_NULL_HANDLE;
         VkBuffer indexBuffer = VK_NULL_HANDLE;
         VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
 
         std::vector<VkBuffer> uniformBuffers;
         std::vector<VkDeviceMemory> uniformBufferMemories;
         VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
-        VkDescriptorPool descriptorPool;
-        std::vector<VkDescriptorSet> descriptorSets;
+
+        // Layouts are shared through the cache. Sets that live as long as the program come from
+        // persistentDescriptors, sets of one frame from its frame allocator, which is reset once
+        // the frame slot's last submission has completed on the timeline.
+        DescriptorLayoutCache descriptorLayoutCache;
+        DescriptorAllocator persistentDescriptors;
+        std::vector<DescriptorAllocator> frameDescriptors;
+        bool descriptorUpdateTemplateAvailable = false;
+
+        // Scene set of the frame being recorded, written through sceneDescriptorTemplate
+        VkDescriptorSet sceneDescriptorSet = VK_NULL_HANDLE;
+        DescriptorUpdateTemplate sceneDescriptorTemplate;
+
+        // Scene objects. Transforms are kept as structure of arrays and turned into
+        // matrices straight into the persistently mapped instance buffer every frame.
+        TransformStore sceneTransforms;
+        std::vector<VkBuffer> instanceBuffers;
+        std::vector<VkDeviceMemory> instanceBufferMemories;
+        std::vector<InstanceData *> instanceBufferMappings;
 
         // Texture Images
         VkImage textureImage;
@@ -222,13 +484,306 @@ private:
         VkImage depthImage = VK_NULL_HANDLE;
         VkDeviceMemory depthImageMemory = VK_NULL_HANDLE;
         VkImageView depthImageView = VK_NULL_HANDLE;
+        // Cheapest format with --depth-bits of precision. Depth is transient (never stored, maybe
+        // lazily allocated) unless a second scene pass reads it, see twoScenePasses().
+        VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+        bool depthTransient = false;
+
+        // --msaa clamped to the device. With more than one sample the scene is drawn into a
+        // transient multisampled color image (and depth) resolved to the swapchain image at the
+        // end of the subpass, so the samples never reach memory.
+        VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+        VkImage msaaColorImage = VK_NULL_HANDLE;
+        VkDeviceMemory msaaColorImageMemory = VK_NULL_HANDLE;
+        VkImageView msaaColorImageView = VK_NULL_HANDLE;
+
+        // Dynamic resolution (--target-frame-ms). The scene is drawn into the top left renderExtent
+        // of sceneColorImage, which has the swapchain size so scale changes never reallocate.
+        // upscale.comp then fills the swapchain image from it, or a blit does when the swapchain
+        // cannot be a storage image. sceneColorFormat is the format the scene passes draw in.
+        bool dynamicResolutionEnabled = false;
+        bool upscaleByCompute = false;
+        bool storageWriteWithoutFormat = false;
+        VkFormat sceneColorFormat = VK_FORMAT_UNDEFINED;
+        VkExtent2D renderExtent{};
+        VkImage sceneColorImage = VK_NULL_HANDLE;
+        VkDeviceMemory sceneColorImageMemory = VK_NULL_HANDLE;
+        VkImageView sceneColorImageView = VK_NULL_HANDLE;
+        VkSampler upscaleSampler = VK_NULL_HANDLE;
+        VkDescriptorSetLayout upscaleSetLayout = VK_NULL_HANDLE;
+        VkDescriptorPool upscaleDescriptorPool = VK_NULL_HANDLE;
+        // One per swapchain image, the image is what they write
+        std::vector<VkDescriptorSet> upscaleSets;
+        VkPipelineLayout upscalePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline upscalePipeline = VK_NULL_HANDLE;
+        DynamicResolutionController resolutionController;
+        // Frames the GPU profiler had collected when the controller last looked
+        uint64_t resolutionMeasurements = 0;
+
+        // Post-processing (--post). The scene is drawn into sceneColorImage as 16 bit float HDR,
+        // the bloom passes build a pyramid of half size and smaller levels from it, and
+        // post_composite.comp writes the swapchain image as a storage image like the compute
+        // upscale. Each of them is a frame graph pass, so the GPU profiler times them.
+        bool postProcessingEnabled = false;
+        VkSampler postSampler = VK_NULL_HANDLE;
+        uint32_t bloomLevels = 0;
+        VkExtent2D bloomExtent{};
+        // Transient image of the frame graph. One view over all levels and one per level
+        VkImage bloomImage = VK_NULL_HANDLE;
+        VkImageView bloomImageView = VK_NULL_HANDLE;
+        std::vector<VkImageView> bloomLevelViews;
+        VkDescriptorSetLayout bloomSetLayout = VK_NULL_HANDLE;
+        // One per level the passes write, the level above or below is what they read
+        std::vector<VkDescriptorSet> bloomDownsampleSets;
+        std::vector<VkDescriptorSet> bloomUpsampleSets;
+        VkPipelineLayout bloomDownsamplePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline bloomDownsamplePipeline = VK_NULL_HANDLE;
+        VkPipelineLayout bloomUpsamplePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline bloomUpsamplePipeline = VK_NULL_HANDLE;
+        VkDescriptorSetLayout postCompositeSetLayout = VK_NULL_HANDLE;
+        // One per swapchain image, the image is what they write
+        std::vector<VkDescriptorSet> postCompositeSets;
+        VkPipelineLayout postCompositePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline postCompositePipeline = VK_NULL_HANDLE;
+
+        // --depth-prepass. The "depth prepass" pass draws depth in renderPass with these vertex
+        // shader only pipelines, the scene pass follows in lateRenderPass and tests for EQUAL.
+        bool depthPrepassEnabled = false;
+        VkPipeline depthPrepassPipeline = VK_NULL_HANDLE;
+        VkPipeline quantizedDepthPrepassPipeline = VK_NULL_HANDLE;
+
+        // --shadow-cascades. Every cascade is a layer of the shadow map, rendered by the "shadow
+        // cascades" pass when shadowRenderMask has its bit, otherwise it still holds what it was
+        // last rendered with. The SHADOWS scene shaders sample it through the shadow set (set 2),
+        // together with this frame's ShadowUniforms. sceneVersion moves on whenever objects move.
+        bool shadowsEnabled = false;
+        ShadowCascades shadowCascades;
+        VkFormat shadowMapFormat = VK_FORMAT_UNDEFINED;
+        VkImage shadowMapImage = VK_NULL_HANDLE;
+        VkDeviceMemory shadowMapMemory = VK_NULL_HANDLE;
+        VkImageView shadowMapView = VK_NULL_HANDLE;
+        std::vector<VkImageView> shadowLayerViews;
+        VkSampler shadowSampler = VK_NULL_HANDLE;
+        VkRenderPass shadowRenderPass = VK_NULL_HANDLE;
+        std::vector<VkFramebuffer> shadowFramebuffers;
+        VkDescriptorSetLayout shadowSetLayout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> shadowSets;
+        std::vector<VkBuffer> shadowUniformBuffers;
+        std::vector<VkDeviceMemory> shadowUniformBufferMemories;
+        std::vector<ShadowUniforms *> shadowUniformMappings;
+        VkPipelineLayout shadowPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline shadowPipeline = VK_NULL_HANDLE;
+        float shadowCasterExtent = 0.0f;
+        uint32_t shadowRenderMask = 0;
+        uint64_t sceneVersion = 0;
+        // GPU frame time of frames that rendered cascades, of frames that had all of them cached
+        // and of the benchmark's frames without shadows, told apart by what each frame slot
+        // submitted last
+        bool shadowFrameRendered[MAX_FRAMES_IN_FLIGHT] = {};
+        bool shadowFrameSkipped[MAX_FRAMES_IN_FLIGHT] = {};
+        uint64_t shadowMeasurements = 0;
+        double renderedShadowFrameMilliseconds = 0.0;
+        uint64_t renderedShadowFrames = 0;
+        double cachedShadowFrameMilliseconds = 0.0;
+        uint64_t cachedShadowFrames = 0;
+        double unshadowedFrameMilliseconds = 0.0;
+        uint64_t unshadowedFrames = 0;
+
+        // --lights. The "light binning" pass bins the lights of this frame's light buffer into the
+        // froxel grid, writing an offset and count per cluster and the light index list those
+        // point into. The CLUSTERED_LIGHTS fragment shader reads them through the cluster set
+        // (set 3). Cluster and index buffers are rewritten every frame, so one of each is enough.
+        bool clusteredLightsEnabled = false;
+        uint32_t maxLights = 0;
+        uint32_t activeLights = 0;
+        std::vector<ClusterLight> lights;
+        glm::uvec4 clusterGridSize{};
+        uint32_t maxLightReferences = 0;
+        VkBuffer clusterBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory clusterBufferMemory = VK_NULL_HANDLE;
+        VkBuffer lightIndexBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory lightIndexBufferMemory = VK_NULL_HANDLE;
+        std::vector<VkBuffer> lightBuffers;
+        std::vector<VkDeviceMemory> lightBufferMemories;
+        std::vector<ClusterLight *> lightBufferMappings;
+        std::vector<VkBuffer> clusterUniformBuffers;
+        std::vector<VkDeviceMemory> clusterUniformBufferMemories;
+        std::vector<ClusterUniforms *> clusterUniformMappings;
+        // Light references the binning wrote in the frame, read back once the frame is done
+        std::vector<VkBuffer> lightCounterBuffers;
+        std::vector<VkDeviceMemory> lightCounterBufferMemories;
+        std::vector<uint32_t *> lightCounterMappings;
+        VkDescriptorSetLayout clusterSetLayout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> clusterSets;
+        VkPipelineLayout clusterPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline clusterPipeline = VK_NULL_HANDLE;
+        // --bench-lights: light count each frame slot submitted last and the measurements per step
+        uint32_t frameLightCounts[MAX_FRAMES_IN_FLIGHT] = {};
+        uint64_t lightMeasurements = 0;
+        std::vector<LightBenchmarkStep> lightBenchmark;
+        uint64_t lightReferenceSum = 0;
+        uint64_t lightReferenceFrames = 0;
+        uint64_t lightIndexListOverflows = 0;
+
+        // --shading deferred. The scene render pass has a geometry subpass writing albedo, normal
+        // and depth and a lighting subpass reading them as input attachments at its own pixel.
+        // The G-buffer is transient and never stored, tile based GPUs keep it in tile memory.
+        // The lighting subpass binds the G-buffer set at set 0, the shadow and cluster sets where
+        // the forward scene shader has them.
+        bool deferredShadingEnabled = false;
+        VkImage gbufferAlbedoImage = VK_NULL_HANDLE;
+        VkDeviceMemory gbufferAlbedoMemory = VK_NULL_HANDLE;
+        VkImageView gbufferAlbedoView = VK_NULL_HANDLE;
+        VkImage gbufferNormalImage = VK_NULL_HANDLE;
+        VkDeviceMemory gbufferNormalMemory = VK_NULL_HANDLE;
+        VkImageView gbufferNormalView = VK_NULL_HANDLE;
+        std::vector<VkBuffer> deferredUniformBuffers;
+        std::vector<VkDeviceMemory> deferredUniformBufferMemories;
+        std::vector<DeferredUniforms *> deferredUniformMappings;
+        VkDescriptorSetLayout deferredSetLayout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> deferredSets;
+        VkPipelineLayout deferredPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline deferredLightingPipeline = VK_NULL_HANDLE;
+
+        // --particles. Particles live in device local buffers only. Every frame the "particle
+        // simulate" pass steps the live ones with an indirect dispatch and compacts them,
+        // "particle emit" adds new ones in slots off the dead list, and "particle sort" orders
+        // them back to front into the alive list, which the last scene pass draws with one
+        // vkCmdDrawIndirect. The counts travel in particleCounterBuffer (ParticleCounters),
+        // never through the CPU. The step of the frame is in its ParticleUniforms.
+        bool particlesEnabled = false;
+        uint32_t particleCapacity = 0;
+        // Power of two the sort works on, at least one sort block
+        uint32_t particleSortSize = 0;
+        // Emission per second, and the most particles one step emits, which sizes its dispatch
+        float particleEmitRate = 0.0f;
+        uint32_t maxParticleEmitCount = 0;
+        VkBuffer particleBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory particleBufferMemory = VK_NULL_HANDLE;
+        VkBuffer particleAliveBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory particleAliveBufferMemory = VK_NULL_HANDLE;
+        VkBuffer particleCompactedBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory particleCompactedBufferMemory = VK_NULL_HANDLE;
+        VkBuffer particleDeadBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory particleDeadBufferMemory = VK_NULL_HANDLE;
+        VkBuffer particleSortBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory particleSortBufferMemory = VK_NULL_HANDLE;
+        VkBuffer particleCounterBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory particleCounterBufferMemory = VK_NULL_HANDLE;
+        std::vector<VkBuffer> particleUniformBuffers;
+        std::vector<VkDeviceMemory> particleUniformBufferMemories;
+        std::vector<ParticleUniforms *> particleUniformMappings;
+        VkDescriptorSetLayout particleSetLayout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> particleSets;
+        VkPipelineLayout particleSimulatePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline particleSimulatePipeline = VK_NULL_HANDLE;
+        VkPipelineLayout particleEmitPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline particleEmitPipeline = VK_NULL_HANDLE;
+        VkPipelineLayout particleFinalizePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline particleFinalizePipeline = VK_NULL_HANDLE;
+        VkPipelineLayout particleSortPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline particleSortPipeline = VK_NULL_HANDLE;
+        VkPipelineLayout particleDrawPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline particleDrawPipeline = VK_NULL_HANDLE;
+        // Where the next step starts, carried over fractions of a particle included
+        std::chrono::steady_clock::time_point particleClock;
+        float particleTime = 0.0f;
+        float particleEmitCarry = 0.0f;
+        uint32_t particlesEmitted = 0;
+        ParticleStep lastParticleStep{};
+        glm::vec3 particleCameraPosition{};
+        // --verify-particles: the CPU reference, stepped with every step the GPU was given
+        std::unique_ptr<ParticleReference> particleReference;
+
+        // Objects split by shader permutation, in draw order
+        std::vector<SceneDrawGroup> drawGroups;
+
+        // Object space bounding box of the loaded mesh
+        glm::vec3 meshBoundsMin{};
+        glm::vec3 meshBoundsMax{};
+
+        // Hierarchical-Z occlusion culling. Only created when the option is on
+        // and the device can draw indirect with a first instance.
+        bool occlusionCullingEnabled = false;
+
+        VkRenderPass lateRenderPass = VK_NULL_HANDLE;
+
+        // Transient image of the frame graph
+        VkImage depthPyramidImage = VK_NULL_HANDLE;
+        VkImageView depthPyramidView = VK_NULL_HANDLE;
+        std::vector<VkImageView> depthPyramidMipViews;
+        VkSampler depthPyramidSampler = VK_NULL_HANDLE;
+        uint32_t depthPyramidWidth = 0;
+        uint32_t depthPyramidHeight = 0;
+        uint32_t depthPyramidLevels = 0;
+
+        VkBuffer visibilityBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory visibilityBufferMemory = VK_NULL_HANDLE;
+        VkBuffer earlyDrawBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory earlyDrawBufferMemory = VK_NULL_HANDLE;
+        VkBuffer lateDrawBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory lateDrawBufferMemory = VK_NULL_HANDLE;
+
+        // Bindless descriptors (--bindless), when the device supports descriptor indexing
+        bool descriptorIndexingExtensionsAdded = false;
+        bool bindlessEnabled = false;
+        uint32_t maxBindlessTextures = 0;
+        uint32_t maxBindlessBuffers = 0;
+        BindlessDescriptors bindless;
+        std::vector<uint32_t> instanceBufferIndices;
+
+        // Per draw uniform buffers of --draw-submission ubo, one persistently mapped ring per frame
+        VkDescriptorSetLayout drawDataSetLayout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> drawDataSets;
+        std::vector<VkBuffer> drawDataBuffers;
+        std::vector<VkDeviceMemory> drawDataBufferMemories;
+        std::vector<char *> drawDataMappings;
+        VkDeviceSize drawDataStride = 0;
+        uint32_t drawDataCapacity = 0;
+        uint32_t drawDataCursor = 0;
+
+        // CPU cost of recording the scene draws, reported on exit
+        double drawRecordingNanoseconds = 0.0;
+        uint64_t drawsRecorded = 0;
+
+        VkDescriptorPool occlusionDescriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSetLayout depthReduceSetLayout = VK_NULL_HANDLE;
+        VkDescriptorSetLayout cullSetLayout = VK_NULL_HANDLE;
+        std::vector<VkDescriptorSet> depthReduceSets;
+        std::vector<VkDescriptorSet> cullSets;
+
+        VkPipelineLayout depthReducePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline depthReducePipeline = VK_NULL_HANDLE;
+        VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline cullPipeline = VK_NULL_HANDLE;
 
     } vulkanProgramInfo;
 
     void initVulkan()
     {
+        // A Vulkan 1.0 loader has no vkEnumerateInstanceVersion and fails instance creation for any
+        // newer apiVersion
+        auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(
+                nullptr,
+                "vkEnumerateInstanceVersion");
+        uint32_t loaderApiVersion = VK_API_VERSION_1_0;
+        if (enumerateInstanceVersion != nullptr)
+        {
+            enumerateInstanceVersion(&loaderApiVersion);
+        }
+        vulkanProgramInfo.instanceApiVersion = std::min<uint32_t>(loaderApiVersion, VK_API_VERSION_1_2);
+
+        VkApplicationInfo applicationInfo{};
+        applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        applicationInfo.pApplicationName = "VulkanProgram";
+        applicationInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        applicationInfo.pEngineName = "VulkanProgram";
+        applicationInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+        applicationInfo.apiVersion = vulkanProgramInfo.instanceApiVersion;
+
         VkInstanceCreateInfo instanceCreateInfo{};
         instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        instanceCreateInfo.pApplicationInfo = &applicationInfo;
         instanceCreateInfo.enabledExtensionCount = vulkanProgramInfo.instanceExtensionsEnabled.size();
         instanceCreateInfo.ppEnabledExtensionNames = vulkanProgramInfo.instanceExtensionsEnabled.data();
         instanceCreateInfo.enabledLayerCount = vulkanProgramInfo.layerEnabled.size();
@@ -239,8 +794,27 @@ private:
         VkDebugUtilsMessengerCreateInfoEXT debugMessengerCreateInfo{};
         fillInDebugMessengerCreateInfo(debugMessengerCreateInfo);
 
+        // Shader instrumentation needs a descriptor set slot of its own, which the layer takes
+        // from the top of maxBoundDescriptorSets
+        const VkValidationFeatureEnableEXT gpuAssistedFeatures[] =
+                {
+                        VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_EXT,
+                        VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_RESERVE_BINDING_SLOT_EXT
+                };
+        VkValidationFeaturesEXT validationFeatures{};
+        validationFeatures.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+        validationFeatures.enabledValidationFeatureCount = 2;
+        validationFeatures.pEnabledValidationFeatures = gpuAssistedFeatures;
+
         // After it is filled, put it in pNext of instance create info.
-        instanceCreateInfo.pNext = &debugMessengerCreateInfo;
+        if (vulkanProgramInfo.validation != ValidationMode::Off)
+        {
+            instanceCreateInfo.pNext = &debugMessengerCreateInfo;
+        }
+        if (vulkanProgramInfo.validation == ValidationMode::GpuAssisted)
+        {
+            debugMessengerCreateInfo.pNext = &validationFeatures;
+        }
 
         vkResult = vkCreateInstance(&instanceCreateInfo,
                                     nullptr,
@@ -255,6 +829,11 @@ private:
 
     void createDebugMessenger()
     {
+        if (vulkanProgramInfo.validation == ValidationMode::Off)
+        {
+            return;
+        }
+
         // Find the function for creating debug messenger
         auto createDebugUtilsMessenger = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(
                 vulkanProgramInfo.vulkanInstance,
@@ -281,7 +860,70 @@ private:
                                    &physicalDeviceCount,
                                    physicalDevices.data());
 
-        vulkanProgramInfo.GPU = physicalDevices[0];
+        if (physicalDeviceCount == 0)
+        {
+            std::cout << "No Vulkan capable GPU found!" << std::endl;
+            exit(-1);
+        }
+
+        auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(
+                vulkanProgramInfo.vulkanInstance,
+                vulkanProgramInfo.instanceApiVersion >= VK_API_VERSION_1_1 ? "vkGetPhysicalDeviceProperties2"
+                                                                          : "vkGetPhysicalDeviceProperties2KHR");
+
+        // Extensions used when present: bindless and descriptor templates
+        const std::vector<const char *> optionalExtensions =
+                {
+                        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+                        VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME
+                };
+
+        std::vector<PhysicalDeviceCandidate> candidates;
+        for (uint32_t i = 0; i < physicalDeviceCount; i++)
+        {
+            candidates.push_back(scorePhysicalDevice(physicalDevices[i],
+                                                     i,
+                                                     vulkanProgramInfo.windowSurface,
+                                                     vulkanProgramInfo.deviceExtensionsEnabled,
+                                                     optionalExtensions,
+                                                     getProperties2));
+        }
+        printPhysicalDeviceCandidates(candidates);
+
+        const PhysicalDeviceCandidate *chosen = nullptr;
+        if (!options.gpu.empty())
+        {
+            chosen = findDeviceOverride(candidates, options.gpu);
+            if (chosen == nullptr)
+            {
+                std::cout << "No GPU matches " << options.gpu << "!" << std::endl;
+                exit(-1);
+            }
+            if (!chosen->suitable)
+            {
+                std::cout << "GPU " << chosen->name << " was asked for but is unsuitable: "
+                          << chosen->unsuitableReason << std::endl;
+                exit(-1);
+            }
+        } else
+        {
+            for (const auto &candidate: candidates)
+            {
+                if (candidate.suitable && (chosen == nullptr || candidate.score > chosen->score))
+                {
+                    chosen = &candidate;
+                }
+            }
+            if (chosen == nullptr)
+            {
+                std::cout << "No suitable GPU found!" << std::endl;
+                exit(-1);
+            }
+        }
+
+        std::cout << "Using GPU " << chosen->index << ": " << chosen->name
+                  << (options.gpu.empty() ? "" : " (selected with --gpu / VULKANPROGRAM_GPU)") << std::endl;
+        vulkanProgramInfo.GPU = chosen->device;
     }
 
     void createTextureImage()
@@ -477,14 +1119,7 @@ private:
 
         vkEndCommandBuffer(transferImageLayoutForCopyingBuffer);
 
-        VkSubmitInfo transferImageLayoutForCopyingBufferSubmitInfo{};
-        transferImageLayoutForCopyingBufferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        transferImageLayoutForCopyingBufferSubmitInfo.pCommandBuffers = &transferImageLayoutForCopyingBuffer;
-        transferImageLayoutForCopyingBufferSubmitInfo.commandBufferCount = 1;
-
-        vkQueueSubmit(vulkanProgramInfo.graphicsQueue, 1, &transferImageLayoutForCopyingBufferSubmitInfo,
-                      VK_NULL_HANDLE);
-        vkQueueWaitIdle(vulkanProgramInfo.graphicsQueue);
+        submitAndWait(transferImageLayoutForCopyingBuffer);
 
         vkFreeCommandBuffers(vulkanProgramInfo.renderDevice, vulkanProgramInfo.commandPool, 1,
                              &transferImageLayoutForCopyingBuffer);
@@ -534,14 +1169,7 @@ private:
 
         vkEndCommandBuffer(copyImageCommandBuffer);
 
-        VkSubmitInfo copyImageBufferSubmitInfo{};
-        copyImageBufferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        copyImageBufferSubmitInfo.commandBufferCount = 1;
-        copyImageBufferSubmitInfo.pCommandBuffers = &copyImageCommandBuffer;
-
-        vkQueueSubmit(vulkanProgramInfo.graphicsQueue, 1, &copyImageBufferSubmitInfo, VK_NULL_HANDLE);
-
-        vkQueueWaitIdle(vulkanProgramInfo.graphicsQueue);
+        submitAndWait(copyImageCommandBuffer);
 
         // Clean copy image command buffer
         vkFreeCommandBuffers(vulkanProgramInfo.renderDevice, vulkanProgramInfo.commandPool, 1, &copyImageCommandBuffer);
@@ -603,112 +1231,341 @@ private:
 
         vkEndCommandBuffer(transitionToShaderRead);
 
-        VkSubmitInfo transitionToShaderReadSubmitInfo
-                {
-                        VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                        nullptr,
-                        0,
-                        nullptr,
-                        nullptr,
-                        1,
-                        &transitionToShaderRead,
-                        0,
-                        nullptr
-                };
-
-        vkResult = vkQueueSubmit(vulkanProgramInfo.graphicsQueue, 1, &transitionToShaderReadSubmitInfo, VK_NULL_HANDLE);
-        checkVkResult(vkResult, "Failed to submit");
-
-        vkQueueWaitIdle(vulkanProgramInfo.graphicsQueue);
+        submitAndWait(transitionToShaderRead);
 
         // Free and destroy
         vkFreeCommandBuffers(vulkanProgramInfo.renderDevice, vulkanProgramInfo.commandPool, 1, &transitionToShaderRead);
     }
 
-    void createDeviceAndQueues()
+    // The instance may still be Vulkan 1.0, so features and limits of extensions come through
+    // VK_KHR_get_physical_device_properties2 when the instance has it
+    bool queryDescriptorIndexing(VkPhysicalDeviceDescriptorIndexingFeaturesEXT &features,
+                                 VkPhysicalDeviceDescriptorIndexingPropertiesEXT &properties) const
     {
-        uint32_t queueFamilyPptCount;
-        vkGetPhysicalDeviceQueueFamilyProperties(vulkanProgramInfo.GPU,
-                                                 &queueFamilyPptCount,
-                                                 nullptr);
+        if (!vulkanProgramInfo.descriptorIndexingExtensionsAdded)
+        {
+            return false;
+        }
+
+        auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(
+                vulkanProgramInfo.vulkanInstance,
+                "vkGetPhysicalDeviceFeatures2KHR");
+        auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(
+                vulkanProgramInfo.vulkanInstance,
+                "vkGetPhysicalDeviceProperties2KHR");
+        if (getFeatures2 == nullptr || getProperties2 == nullptr)
+        {
+            return false;
+        }
 
-        std::vector<VkQueueFamilyProperties> queueFamilyPptList(queueFamilyPptCount);
+        features = {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        VkPhysicalDeviceFeatures2KHR features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features2.pNext = &features;
+        getFeatures2(vulkanProgramInfo.GPU, &features2);
+
+        properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2KHR properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+        properties2.pNext = &properties;
+        getProperties2(vulkanProgramInfo.GPU, &properties2);
+        return true;
+    }
 
-        vkGetPhysicalDeviceQueueFamilyProperties(vulkanProgramInfo.GPU,
-                                                 &queueFamilyPptCount,
-                                                 queueFamilyPptList.data());
+    // Whether timeline semaphores are core for this device, given the instance version
+    bool timelineSemaphoresInCore() const
+    {
+        VkPhysicalDeviceProperties physicalDeviceProperties{};
+        vkGetPhysicalDeviceProperties(vulkanProgramInfo.GPU, &physicalDeviceProperties);
+        return std::min(vulkanProgramInfo.instanceApiVersion, physicalDeviceProperties.apiVersion) >=
+               VK_API_VERSION_1_2;
+    }
 
-        for (std::size_t i = 0; i < queueFamilyPptCount; i++)
+    bool queryTimelineSemaphore() const
+    {
+        auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(
+                vulkanProgramInfo.vulkanInstance,
+                vulkanProgramInfo.instanceApiVersion >= VK_API_VERSION_1_1 ? "vkGetPhysicalDeviceFeatures2"
+                                                                          : "vkGetPhysicalDeviceFeatures2KHR");
+        if (getFeatures2 == nullptr)
         {
-            if (VK_QUEUE_GRAPHICS_BIT & queueFamilyPptList[i].queueFlags)
-            {
-                vulkanProgramInfo.graphicsQueueFamilyIndex = i;
-                vulkanProgramInfo.graphicsQueueFound = true;
-                break;
-            }
+            return false;
         }
 
-        if (!vulkanProgramInfo.graphicsQueueFound)
+        VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures{};
+        timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        VkPhysicalDeviceFeatures2KHR features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features2.pNext = &timelineSemaphoreFeatures;
+        getFeatures2(vulkanProgramInfo.GPU, &features2);
+        return timelineSemaphoreFeatures.timelineSemaphore == VK_TRUE;
+    }
+
+    bool queryDynamicRendering() const
+    {
+        if (!vulkanProgramInfo.dynamicRenderingExtensionsAdded)
         {
-            std::cout << "Graphics queue not found!\n";
-            exit(-1);
+            return false;
         }
 
-        // Next find a present queue
-        VkBool32 presentSupport;
-        for (std::size_t i = 0; i < queueFamilyPptCount; i++)
+        auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2) vkGetInstanceProcAddr(
+                vulkanProgramInfo.vulkanInstance,
+                "vkGetPhysicalDeviceFeatures2");
+        if (getFeatures2 == nullptr)
         {
-            vkGetPhysicalDeviceSurfaceSupportKHR(vulkanProgramInfo.GPU,
-                                                 i,
-                                                 vulkanProgramInfo.windowSurface,
-                                                 &presentSupport);
-            if (presentSupport)
-            {
-                vulkanProgramInfo.presentQueueFamilyIndex = i;
-                vulkanProgramInfo.presentQueueFound = true;
-                break;
-            }
+            return false;
         }
 
-        if (presentSupport != VK_TRUE)
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+        dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{};
+        synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+        synchronization2Features.pNext = &dynamicRenderingFeatures;
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &synchronization2Features;
+        getFeatures2(vulkanProgramInfo.GPU, &features2);
+        return dynamicRenderingFeatures.dynamicRendering == VK_TRUE &&
+               synchronization2Features.synchronization2 == VK_TRUE;
+    }
+
+    void createDeviceAndQueues()
+    {
+        vulkanProgramInfo.queueFamilies = selectQueueFamilies(vulkanProgramInfo.GPU,
+                                                              vulkanProgramInfo.windowSurface,
+                                                              !options.singleQueue);
+        const QueueFamilySelection &queueFamilies = vulkanProgramInfo.queueFamilies;
+
+        if (queueFamilies.graphics == QueueFamilySelection::NONE)
         {
-            std::cout << "Cannot find a queue that supports presentation!" << std::endl;
+            std::cout << "Graphics queue not found!\n";
             exit(-1);
         }
 
-        if (vulkanProgramInfo.graphicsQueueFamilyIndex != vulkanProgramInfo.presentQueueFamilyIndex)
+        if (queueFamilies.present == QueueFamilySelection::NONE)
         {
-            std::cout << "Graphics queue index and present queue index are not the same!";
+            std::cout << "Cannot find a queue that supports presentation!" << std::endl;
             exit(-1);
         }
 
+        std::cout << "Queue families: graphics " << queueFamilies.graphics
+                  << ", present " << queueFamilies.present
+                  << ", compute " << queueFamilies.compute << (queueFamilies.asyncCompute() ? " (async)" : "")
+                  << ", transfer " << queueFamilies.transfer << (queueFamilies.separateTransfer() ? " (dedicated)" : "")
+                  << std::endl;
 
         // Logical Device Creation
-        // Fill queue creation info first
-        float graphicsQueuePriority = 1.0f;
-        VkDeviceQueueCreateInfo graphicsQueueCreateInfo{};
-        graphicsQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        graphicsQueueCreateInfo.queueCount = 1;
-        graphicsQueueCreateInfo.pNext = nullptr;
-        graphicsQueueCreateInfo.flags = 0;
-        graphicsQueueCreateInfo.pQueuePriorities = &graphicsQueuePriority;
-        graphicsQueueCreateInfo.queueFamilyIndex = vulkanProgramInfo.graphicsQueueFamilyIndex;
+        // One queue of every family that is used
+        float queuePriority = 1.0f;
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+        for (uint32_t family: queueFamilies.uniqueFamilies())
+        {
+            VkDeviceQueueCreateInfo queueCreateInfo{};
+            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfo.queueCount = 1;
+            queueCreateInfo.pNext = nullptr;
+            queueCreateInfo.flags = 0;
+            queueCreateInfo.pQueuePriorities = &queuePriority;
+            queueCreateInfo.queueFamilyIndex = family;
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
 
         // Enable device features
         VkPhysicalDeviceFeatures enabledPhysicalDeviceFeatures{};
         enabledPhysicalDeviceFeatures.samplerAnisotropy = VK_TRUE;
 
+        VkPhysicalDeviceFeatures supportedPhysicalDeviceFeatures{};
+        vkGetPhysicalDeviceFeatures(vulkanProgramInfo.GPU, &supportedPhysicalDeviceFeatures);
+
+        // GPU-assisted validation writes its findings from the instrumented shaders
+        if (vulkanProgramInfo.validation == ValidationMode::GpuAssisted)
+        {
+            enabledPhysicalDeviceFeatures.vertexPipelineStoresAndAtomics =
+                    supportedPhysicalDeviceFeatures.vertexPipelineStoresAndAtomics;
+            enabledPhysicalDeviceFeatures.fragmentStoresAndAtomics =
+                    supportedPhysicalDeviceFeatures.fragmentStoresAndAtomics;
+        }
+
+        // Occlusion culling issues one indirect draw per object with firstInstance as the object index
+        if (options.occlusionCulling)
+        {
+            if (supportedPhysicalDeviceFeatures.multiDrawIndirect &&
+                supportedPhysicalDeviceFeatures.drawIndirectFirstInstance)
+            {
+                enabledPhysicalDeviceFeatures.multiDrawIndirect = VK_TRUE;
+                enabledPhysicalDeviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+                vulkanProgramInfo.occlusionCullingEnabled = true;
+            } else
+            {
+                std::cout << "Occlusion culling needs multiDrawIndirect and drawIndirectFirstInstance, "
+                             "it is disabled" << std::endl;
+            }
+        }
+
+        // The depth pyramid would be built from the whole depth buffer, not the part drawn. The
+        // upscale shader writes the swapchain image without naming its format.
+        if (options.targetFrameMilliseconds > 0.0f)
+        {
+            if (vulkanProgramInfo.occlusionCullingEnabled)
+            {
+                std::cout << "Dynamic resolution does not work with occlusion culling, it is disabled" << std::endl;
+            } else
+            {
+                vulkanProgramInfo.dynamicResolutionEnabled = true;
+                vulkanProgramInfo.storageWriteWithoutFormat =
+                        supportedPhysicalDeviceFeatures.shaderStorageImageWriteWithoutFormat == VK_TRUE;
+                enabledPhysicalDeviceFeatures.shaderStorageImageWriteWithoutFormat =
+                        supportedPhysicalDeviceFeatures.shaderStorageImageWriteWithoutFormat;
+            }
+        }
+
+        // The post chain writes the swapchain image without naming its format as well. It works on
+        // the whole scene color image, not the part dynamic resolution draws.
+        if (options.postEffects != 0)
+        {
+            if (vulkanProgramInfo.dynamicResolutionEnabled)
+            {
+                std::cout << "Post-processing does not work with dynamic resolution, it is disabled" << std::endl;
+            } else
+            {
+                vulkanProgramInfo.postProcessingEnabled = true;
+                vulkanProgramInfo.storageWriteWithoutFormat =
+                        supportedPhysicalDeviceFeatures.shaderStorageImageWriteWithoutFormat == VK_TRUE;
+                enabledPhysicalDeviceFeatures.shaderStorageImageWriteWithoutFormat =
+                        supportedPhysicalDeviceFeatures.shaderStorageImageWriteWithoutFormat;
+            }
+        }
+
+        // Occlusion culling already draws the scene in two passes of its own
+        if (options.depthPrepass)
+        {
+            if (vulkanProgramInfo.occlusionCullingEnabled)
+            {
+                std::cout << "The depth pre-pass does not work with occlusion culling, it is disabled" << std::endl;
+            } else
+            {
+                vulkanProgramInfo.depthPrepassEnabled = true;
+            }
+        }
+
+        // The G-buffer is a single scene pass of its own, a second scene pass would have to store it
+        if (options.shading == "deferred")
+        {
+            if (vulkanProgramInfo.occlusionCullingEnabled || vulkanProgramInfo.depthPrepassEnabled)
+            {
+                std::cout << "Deferred shading does not work with occlusion culling or the depth pre-pass, "
+                             "shading forward" << std::endl;
+            } else
+            {
+                vulkanProgramInfo.deferredShadingEnabled = true;
+            }
+        }
+
+        // Shadow maps only need what every device has, the float position stream is created for them
+        vulkanProgramInfo.shadowsEnabled = options.shadowCascades > 0;
+
+        // Clustered lights only read storage buffers in the fragment shader, nothing to enable
+        vulkanProgramInfo.clusteredLightsEnabled = options.lights > 0 || options.benchLightFrames > 0;
+
+        // Particles need storage buffers in compute and vertex shaders and non-indexed indirect
+        // draws, which every device has
+        vulkanProgramInfo.particlesEnabled = options.particles > 0;
+
+        // Bindless descriptors index arrays with push constants, which is dynamically uniform
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabledDescriptorIndexingFeatures{};
+        enabledDescriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+        if (options.bindless)
+        {
+            VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedDescriptorIndexingFeatures{};
+            VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties{};
+
+            if (queryDescriptorIndexing(supportedDescriptorIndexingFeatures, descriptorIndexingProperties) &&
+                supportedDescriptorIndexingFeatures.runtimeDescriptorArray &&
+                supportedDescriptorIndexingFeatures.descriptorBindingPartiallyBound &&
+                supportedDescriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+                supportedDescriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind &&
+                supportedPhysicalDeviceFeatures.shaderSampledImageArrayDynamicIndexing &&
+                supportedPhysicalDeviceFeatures.shaderStorageBufferArrayDynamicIndexing)
+            {
+                // Large enough for any scene here, clamped to what the device takes in one set and stage
+                const VkPhysicalDeviceDescriptorIndexingPropertiesEXT &limits = descriptorIndexingProperties;
+                vulkanProgramInfo.maxBindlessBuffers = std::min({1024u,
+                                                                 limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                                                                 limits.maxDescriptorSetUpdateAfterBindStorageBuffers});
+                // The sampler and at least one texture have to fit into a stage next to the buffers
+                uint32_t stageResources = limits.maxPerStageUpdateAfterBindResources;
+                if (stageResources >= vulkanProgramInfo.maxBindlessBuffers + 2)
+                {
+                    vulkanProgramInfo.maxBindlessTextures = std::min({16384u,
+                                                                      limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                                                      limits.maxDescriptorSetUpdateAfterBindSampledImages,
+                                                                      stageResources -
+                                                                      vulkanProgramInfo.maxBindlessBuffers - 1});
+                }
+
+                if (vulkanProgramInfo.maxBindlessBuffers > 0 && vulkanProgramInfo.maxBindlessTextures > 0)
+                {
+                    enabledDescriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+                    enabledDescriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+                    enabledDescriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+                    enabledDescriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+                    enabledPhysicalDeviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+                    enabledPhysicalDeviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+                    vulkanProgramInfo.bindlessEnabled = true;
+                } else
+                {
+                    std::cout << "The update after bind descriptor limits are too small for the bindless set, "
+                                 "bindless descriptors are disabled" << std::endl;
+                }
+            } else
+            {
+                std::cout << "Bindless descriptors need VK_EXT_descriptor_indexing with update after bind "
+                             "and partially bound arrays, they are disabled" << std::endl;
+            }
+        }
+
+        // Frame pacing and uploads are synchronized on a timeline semaphore
+        if (!queryTimelineSemaphore())
+        {
+            throw std::runtime_error("timeline semaphores are not supported!");
+        }
+        void *enabledFeatureChain = vulkanProgramInfo.bindlessEnabled ? &enabledDescriptorIndexingFeatures : nullptr;
+
+        // Scene passes without render pass objects, with the barriers of the frame graph in sync2
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR enabledDynamicRenderingFeatures{};
+        enabledDynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+        VkPhysicalDeviceSynchronization2FeaturesKHR enabledSynchronization2Features{};
+        enabledSynchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+
+        if (queryDynamicRendering())
+        {
+            enabledDynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+            enabledDynamicRenderingFeatures.pNext = enabledFeatureChain;
+            enabledSynchronization2Features.synchronization2 = VK_TRUE;
+            enabledSynchronization2Features.pNext = &enabledDynamicRenderingFeatures;
+            enabledFeatureChain = &enabledSynchronization2Features;
+            vulkanProgramInfo.dynamicRenderingEnabled = true;
+        }
+
+        VkPhysicalDeviceTimelineSemaphoreFeatures enabledTimelineSemaphoreFeatures{};
+        enabledTimelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        enabledTimelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+        enabledTimelineSemaphoreFeatures.pNext = enabledFeatureChain;
+
         // Logical device creat info
         VkDeviceCreateInfo renderDeviceCreateInfo{};
         renderDeviceCreateInfo.flags = 0;
-        renderDeviceCreateInfo.pNext = nullptr;
+        renderDeviceCreateInfo.pNext = &enabledTimelineSemaphoreFeatures;
         renderDeviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
         renderDeviceCreateInfo.enabledExtensionCount = vulkanProgramInfo.deviceExtensionsEnabled.size();
         renderDeviceCreateInfo.ppEnabledExtensionNames = vulkanProgramInfo.deviceExtensionsEnabled.data();
         renderDeviceCreateInfo.enabledLayerCount = 0;
         renderDeviceCreateInfo.pEnabledFeatures = &enabledPhysicalDeviceFeatures;
-        renderDeviceCreateInfo.pQueueCreateInfos = &graphicsQueueCreateInfo;
-        renderDeviceCreateInfo.queueCreateInfoCount = 1;
+        renderDeviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+        renderDeviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 
         vkResult = vkCreateDevice(vulkanProgramInfo.GPU,
                                   &renderDeviceCreateInfo,
@@ -718,14 +1575,63 @@ private:
         checkVkResult(vkResult, "");
 
         vkGetDeviceQueue(vulkanProgramInfo.renderDevice,
-                         vulkanProgramInfo.graphicsQueueFamilyIndex,
+                         queueFamilies.graphics,
                          0,
                          &vulkanProgramInfo.graphicsQueue);
 
         vkGetDeviceQueue(vulkanProgramInfo.renderDevice,
-                         vulkanProgramInfo.presentQueueFamilyIndex,
+                         queueFamilies.present,
                          0,
                          &vulkanProgramInfo.presentQueue);
+
+        vkGetDeviceQueue(vulkanProgramInfo.renderDevice,
+                         queueFamilies.compute,
+                         0,
+                         &vulkanProgramInfo.computeQueue);
+
+        vkGetDeviceQueue(vulkanProgramInfo.renderDevice,
+                         queueFamilies.transfer,
+                         0,
+                         &vulkanProgramInfo.transferQueue);
+
+        if (vulkanProgramInfo.dynamicRenderingEnabled)
+        {
+            vulkanProgramInfo.dynamicRenderingEnabled = vulkanProgramInfo.dynamicRendering.load(
+                    vulkanProgramInfo.renderDevice);
+        }
+        std::cout << "Scene passes: " << (vulkanProgramInfo.dynamicRenderingEnabled ? "dynamic rendering"
+                                                                                   : "render pass objects")
+                  << std::endl;
+
+        vulkanProgramInfo.asyncComputeEnabled = queueFamilies.asyncCompute();
+        vulkanProgramInfo.graphicsAndComputeFamilies[0] = queueFamilies.graphics;
+        vulkanProgramInfo.graphicsAndComputeFamilies[1] = queueFamilies.compute;
+
+        // Created with the device, uploads before the first frame already wait on it
+        vulkanProgramInfo.timeline.create(vulkanProgramInfo.renderDevice,
+                                          vulkanProgramInfo.timelineSemaphoreExtensionAdded);
+        if (vulkanProgramInfo.asyncComputeEnabled)
+        {
+            vulkanProgramInfo.computeTimeline.create(vulkanProgramInfo.renderDevice,
+                                                     vulkanProgramInfo.timelineSemaphoreExtensionAdded);
+        }
+        vulkanProgramInfo.deletionQueue.init(vulkanProgramInfo.renderDevice);
+        vulkanProgramInfo.gpuProfiler.create(vulkanProgramInfo.renderDevice, vulkanProgramInfo.GPU,
+                                             MAX_FRAMES_IN_FLIGHT);
+    }
+
+    // Resources used by the graphics and the async compute queue are shared concurrently, which
+    // saves an ownership transfer pair on every use from the other queue
+    template<typename CreateInfo>
+    void shareWithComputeQueue(CreateInfo &createInfo) const
+    {
+        if (!vulkanProgramInfo.asyncComputeEnabled)
+        {
+            return;
+        }
+        createInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        createInfo.queueFamilyIndexCount = 2;
+        createInfo.pQueueFamilyIndices = vulkanProgramInfo.graphicsAndComputeFamilies;
     }
 
     void createWindowAndSurface()
@@ -755,6 +1661,14 @@ private:
         // Choose surface format
         VkSurfaceFormatKHR chosenSurfaceFormat;
         chosenSurfaceFormat = chooseSurfaceFormat();
+        VkImageUsageFlags swapchainImageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        if (vulkanProgramInfo.dynamicResolutionEnabled)
+        {
+            swapchainImageUsage = chooseUpscaleTarget(swapchainCapabilities, chosenSurfaceFormat);
+        } else if (vulkanProgramInfo.postProcessingEnabled)
+        {
+            swapchainImageUsage = choosePostProcessingTarget(swapchainCapabilities, chosenSurfaceFormat);
+        }
 
         // Choose presentation mode
         VkPresentModeKHR swapchainPresentMode;
@@ -785,12 +1699,15 @@ private:
         swapchainCreateInfo.presentMode = swapchainPresentMode;
         swapchainCreateInfo.preTransform = swapchainCapabilities.currentTransform;
         swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-        swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        swapchainCreateInfo.imageUsage = swapchainImageUsage;
         swapchainCreateInfo.imageArrayLayers = 1;
         swapchainCreateInfo.imageExtent = swapchainExtent;
         swapchainCreateInfo.surface = vulkanProgramInfo.windowSurface;
-        swapchainCreateInfo.pQueueFamilyIndices = &vulkanProgramInfo.presentQueueFamilyIndex;
-        swapchainCreateInfo.queueFamilyIndexCount = 1;
+        // Rendered to on the graphics queue and presented from the present queue
+        const uint32_t swapchainQueueFamilies[] = {vulkanProgramInfo.queueFamilies.graphics,
+                                                   vulkanProgramInfo.queueFamilies.present};
+        swapchainCreateInfo.pQueueFamilyIndices = swapchainQueueFamilies;
+        swapchainCreateInfo.queueFamilyIndexCount = swapchainImageSharingMode == VK_SHARING_MODE_CONCURRENT ? 2 : 1;
 
         vkResult = vkCreateSwapchainKHR(vulkanProgramInfo.renderDevice,
                                         &swapchainCreateInfo,
@@ -817,6 +1734,8 @@ private:
         vulkanProgramInfo.swapchainImageFormat = swapchainCreateInfo.imageFormat;
         vulkanProgramInfo.swapchainImageColorSpace = swapchainCreateInfo.imageColorSpace;
         vulkanProgramInfo.swapchainExtent = swapchainCreateInfo.imageExtent;
+        vulkanProgramInfo.sceneColorFormat = swapchainCreateInfo.imageFormat;
+        vulkanProgramInfo.renderExtent = swapchainCreateInfo.imageExtent;
     }
 
     void createSwapchainImageView()
@@ -851,406 +1770,626 @@ private:
 
     void createVertexBufferAndAllocateMemory()
     {
-        VkDeviceSize vertexBufferSize = sizeof(vertices[0]) * vertices.size();
-
-        VkBufferCreateInfo vertexBufferCreateInfo{};
-        vertexBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        vertexBufferCreateInfo.size = vertexBufferSize;
-        vertexBufferCreateInfo.pNext = nullptr;
-        vertexBufferCreateInfo.flags = 0;
-        vertexBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        vertexBufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        createDeviceLocalBuffer(vertices.data(),
+                                sizeof(vertices[0]) * vertices.size(),
+                                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                vulkanProgramInfo.vertexBuffer,
+                                vulkanProgramInfo.vertexBufferMemory);
+    }
 
-        VkBufferCreateInfo stagingBufferCreateInfo{};
-        stagingBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        stagingBufferCreateInfo.size = vertexBufferSize;
-        stagingBufferCreateInfo.pNext = nullptr;
-        stagingBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-        stagingBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    glm::vec3 quantizationCenter() const
+    {
+        return (vulkanProgramInfo.meshBoundsMin + vulkanProgramInfo.meshBoundsMax) * 0.5f;
+    }
 
-        createBuffer(vertexBufferCreateInfo,
-                     vulkanProgramInfo.renderDevice,
-                     vulkanProgramInfo.vertexBuffer,
-                     vulkanProgramInfo.GPU,
-                     vulkanProgramInfo.vertexBufferMemory,
-                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    glm::vec3 quantizationHalfExtent() const
+    {
+        return glm::max((vulkanProgramInfo.meshBoundsMax - vulkanProgramInfo.meshBoundsMin) * 0.5f, glm::vec3(1e-6f));
+    }
 
-        VkBuffer vertexStagingBuffer;
-        VkDeviceMemory vertexStagingBufferMemory;
+    bool drawsQuantizedVertices() const
+    {
+        for (const auto &group: vulkanProgramInfo.drawGroups)
+        {
+            if (group.permutation.has(SHADER_FEATURE_QUANTIZED_VERTICES))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // snorm16 position relative to the mesh bounds, w unused
+    void quantizePosition(const glm::vec3 &position, int16_t quantized[4]) const
+    {
+        glm::vec3 normalized = (position - quantizationCenter()) / quantizationHalfExtent();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float value = std::max(-1.0f, std::min(1.0f, normalized[axis]));
+            quantized[axis] = static_cast<int16_t>(std::lround(value * 32767.0f));
+        }
+        quantized[3] = 0;
+    }
+
+    void createQuantizedVertexBuffer()
+    {
+        if (!drawsQuantizedVertices())
+        {
+            return;
+        }
+
+        std::vector<QuantizedVertex> quantizedVertices(vertices.size());
+        for (std::size_t i = 0; i < vertices.size(); i++)
+        {
+            quantizePosition(vertices[i].pos, quantizedVertices[i].pos);
+            quantizedVertices[i].color = glm::packUnorm4x8(glm::vec4(vertices[i].color, 1.0f));
+            quantizedVertices[i].texCoord = glm::packHalf2x16(vertices[i].texCoord);
+        }
+
+        createDeviceLocalBuffer(quantizedVertices.data(),
+                                sizeof(QuantizedVertex) * quantizedVertices.size(),
+                                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                vulkanProgramInfo.quantizedVertexBuffer,
+                                vulkanProgramInfo.quantizedVertexBufferMemory);
+
+        std::cout << "Quantized vertices: " << sizeof(QuantizedVertex) * vertices.size() << " bytes instead of "
+                  << sizeof(Vertex) * vertices.size() << std::endl;
+    }
+
+    // The depth pre-pass fetches only positions, packed tightly so it reads a fraction of the
+    // bytes per vertex the scene pass does. Quantized exactly like the scene's vertices.
+    void createPositionVertexBuffers()
+    {
+        if (!vulkanProgramInfo.depthPrepassEnabled && !vulkanProgramInfo.shadowsEnabled)
+        {
+            return;
+        }
+
+        std::vector<glm::vec3> positions(vertices.size());
+        for (std::size_t i = 0; i < vertices.size(); i++)
+        {
+            positions[i] = vertices[i].pos;
+        }
+        createDeviceLocalBuffer(positions.data(),
+                                sizeof(glm::vec3) * positions.size(),
+                                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                vulkanProgramInfo.positionBuffer,
+                                vulkanProgramInfo.positionBufferMemory);
+
+        // Shadow maps are always drawn from float positions
+        if (!vulkanProgramInfo.depthPrepassEnabled || !drawsQuantizedVertices())
+        {
+            return;
+        }
+
+        std::vector<QuantizedPosition> quantizedPositions(vertices.size());
+        for (std::size_t i = 0; i < vertices.size(); i++)
+        {
+            quantizePosition(vertices[i].pos, quantizedPositions[i].pos);
+        }
+        createDeviceLocalBuffer(quantizedPositions.data(),
+                                sizeof(QuantizedPosition) * quantizedPositions.size(),
+                                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                vulkanProgramInfo.quantizedPositionBuffer,
+                                vulkanProgramInfo.quantizedPositionBufferMemory);
+    }
+
+    // Uploads data through a staging buffer into a new device local buffer. The copy runs on the
+    // transfer queue, with a dedicated family the buffer is then handed over to graphics.
+    void createDeviceLocalBuffer(const void *data, VkDeviceSize size, VkBufferUsageFlags usage,
+                                 VkBuffer &buffer, VkDeviceMemory &bufferMemory)
+    {
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = size;
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        bufferCreateInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+        createBuffer(bufferCreateInfo,
+                     vulkanProgramInfo.renderDevice,
+                     buffer,
+                     vulkanProgramInfo.GPU,
+                     bufferMemory,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
+        VkBufferCreateInfo stagingBufferCreateInfo{};
+        stagingBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        stagingBufferCreateInfo.size = size;
+        stagingBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        stagingBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
         createBuffer(stagingBufferCreateInfo,
                      vulkanProgramInfo.renderDevice,
-                     vertexStagingBuffer,
+                     stagingBuffer,
                      vulkanProgramInfo.GPU,
-                     vertexStagingBufferMemory,
+                     stagingBufferMemory,
                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 
-        void *stagingBufferMemoryMapping = nullptr;
+        void *mapping = nullptr;
+        vkMapMemory(vulkanProgramInfo.renderDevice, stagingBufferMemory, 0, size, 0, &mapping);
+        memcpy(mapping, data, size);
+        vkUnmapMemory(vulkanProgramInfo.renderDevice, stagingBufferMemory);
 
-        vkMapMemory(vulkanProgramInfo.renderDevice,
-                    vertexStagingBufferMemory,
-                    0,
-                    vertexBufferCreateInfo.size,
-                    0,
-                    &stagingBufferMemoryMapping);
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(vulkanProgramInfo.transferCommandPool);
 
-        memcpy(stagingBufferMemoryMapping,
-               vertices.data(),
-               vertexBufferCreateInfo.size);
+        VkBufferCopy bufferCopy{};
+        bufferCopy.size = size;
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, buffer, 1, &bufferCopy);
 
-        vkUnmapMemory(vulkanProgramInfo.renderDevice,
-                      vertexStagingBufferMemory);
+        if (!vulkanProgramInfo.queueFamilies.separateTransfer())
+        {
+            endSingleTimeCommands(commandBuffer);
+        } else
+        {
+            // Release on the transfer queue, acquire on the graphics queue. Both halves name the
+            // same families, the acquire waits for the release through the timeline.
+            VkBufferMemoryBarrier ownershipBarrier{};
+            ownershipBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            ownershipBarrier.buffer = buffer;
+            ownershipBarrier.offset = 0;
+            ownershipBarrier.size = VK_WHOLE_SIZE;
+            ownershipBarrier.srcQueueFamilyIndex = vulkanProgramInfo.queueFamilies.transfer;
+            ownershipBarrier.dstQueueFamilyIndex = vulkanProgramInfo.queueFamilies.graphics;
+            ownershipBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            ownershipBarrier.dstAccessMask = 0;
+
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                 0,
+                                 0, nullptr,
+                                 1, &ownershipBarrier,
+                                 0, nullptr);
+            vkEndCommandBuffer(commandBuffer);
+
+            uint64_t copied = submitOneOff(vulkanProgramInfo.transferQueue, commandBuffer, 0);
+
+            VkCommandBuffer acquireCommandBuffer = beginSingleTimeCommands();
+
+            ownershipBarrier.srcAccessMask = 0;
+            ownershipBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                             VK_ACCESS_SHADER_READ_BIT;
+
+            vkCmdPipelineBarrier(acquireCommandBuffer,
+                                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                 VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0,
+                                 0, nullptr,
+                                 1, &ownershipBarrier,
+                                 0, nullptr);
+            vkEndCommandBuffer(acquireCommandBuffer);
+
+            uint64_t acquired = submitOneOff(vulkanProgramInfo.graphicsQueue, acquireCommandBuffer, copied);
+            vulkanProgramInfo.timeline.wait(acquired);
+
+            vkFreeCommandBuffers(vulkanProgramInfo.renderDevice, vulkanProgramInfo.transferCommandPool,
+                                 1, &commandBuffer);
+            vkFreeCommandBuffers(vulkanProgramInfo.renderDevice, vulkanProgramInfo.commandPool,
+                                 1, &acquireCommandBuffer);
+        }
+
+        vkDestroyBuffer(vulkanProgramInfo.renderDevice, stagingBuffer, nullptr);
+        vkFreeMemory(vulkanProgramInfo.renderDevice, stagingBufferMemory, nullptr);
+    }
+
+    void createIndexBuffer()
+    {
+        createDeviceLocalBuffer(vertex_indices.data(),
+                                sizeof(vertex_indices[0]) * vertex_indices.size(),
+                                VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                vulkanProgramInfo.indexBuffer,
+                                vulkanProgramInfo.indexBufferMemory);
+    }
+
+    void createGraphicsPipeline()
+    {
+        // Pipeline Layout
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        // Set 0 holds the resources, either per frame or the global bindless set. Per draw data
+        // comes as push constants, or from set 1 with --draw-submission ubo. Set 2 is the shadow
+        // set and set 3 the cluster set. Sets skipped in between are empty.
+        std::vector<VkDescriptorSetLayout> setLayouts = {vulkanProgramInfo.bindlessEnabled
+                                                         ? vulkanProgramInfo.bindless.layout()
+                                                         : vulkanProgramInfo.descriptorSetLayout};
+        auto setLayoutAt = [&](uint32_t set, VkDescriptorSetLayout layout)
+        {
+            if (setLayouts.size() < set)
+            {
+                setLayouts.resize(set, vulkanProgramInfo.descriptorLayoutCache.get({}));
+            }
+            setLayouts.push_back(layout);
+        };
+        if (options.drawSubmission == "ubo")
+        {
+            setLayoutAt(1, vulkanProgramInfo.drawDataSetLayout);
+        }
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            setLayoutAt(2, vulkanProgramInfo.shadowSetLayout);
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            setLayoutAt(3, vulkanProgramInfo.clusterSetLayout);
+        }
 
-        // Copy buffer
-        VkCommandBufferAllocateInfo copyBufferCmdCreateInfo{};
-        copyBufferCmdCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        copyBufferCmdCreateInfo.commandBufferCount = 1;
-        copyBufferCmdCreateInfo.commandPool = vulkanProgramInfo.commandPool;
-        copyBufferCmdCreateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VkPushConstantRange drawPushConstantRange{};
+        drawPushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        drawPushConstantRange.offset = 0;
+        drawPushConstantRange.size = sizeof(DrawPushConstants);
 
-        VkCommandBuffer copyBufferCmd;
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &drawPushConstantRange;
+        pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
 
-        vkAllocateCommandBuffers(vulkanProgramInfo.renderDevice,
-                                 &copyBufferCmdCreateInfo,
-                                 &copyBufferCmd);
+        vkResult = vkCreatePipelineLayout(vulkanProgramInfo.renderDevice,
+                                          &pipelineLayoutCreateInfo,
+                                          nullptr,
+                                          &vulkanProgramInfo.pipelineLayout);
 
-        VkCommandBufferBeginInfo copyBufferCmdBeginInfo{};
-        copyBufferCmdBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        copyBufferCmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        checkVkResult(vkResult, "Failed to Pipeline Layout");
 
-        vkBeginCommandBuffer(copyBufferCmd, &copyBufferCmdBeginInfo);
+        pipelineJobs = std::make_unique<JobSystem>();
+        pipelineManager = std::make_unique<PipelineManager>(vulkanProgramInfo.renderDevice,
+                                                            vulkanProgramInfo.GPU,
+                                                            shaderCompiler,
+                                                            *pipelineJobs);
 
-        VkBufferCopy vertexBufferCopy{};
-        vertexBufferCopy.size = vertexBufferSize;
-        vertexBufferCopy.dstOffset = 0;
-        vertexBufferCopy.srcOffset = 0;
+        // The default permutation is built right away, everything else on worker threads
+        ShaderPermutation defaultPermutation{options.shaderFeatures};
+        GraphicsPipelineDesc defaultDesc = describeScenePipeline(defaultPermutation);
 
-        vkCmdCopyBuffer(copyBufferCmd,
-                        vertexStagingBuffer,
-                        vulkanProgramInfo.vertexBuffer,
-                        1,
-                        &vertexBufferCopy);
+        vulkanProgramInfo.graphicsPipeline = pipelineManager->create(defaultDesc);
+        if (vulkanProgramInfo.graphicsPipeline == VK_NULL_HANDLE)
+        {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+
+        if (shaderHotReloader)
+        {
+            shaderHotReloader->watch("scene", &vulkanProgramInfo.graphicsPipeline,
+                                     {{"shader.vert", defaultDesc.stages[0].defines},
+                                      {"shader.frag", defaultDesc.stages[1].defines}},
+                                     [this, defaultDesc](const std::vector<std::vector<char>> &spirv)
+                                     {
+                                         return pipelineManager->create(defaultDesc, &spirv);
+                                     });
+        }
+
+        if (vulkanProgramInfo.depthPrepassEnabled)
+        {
+            createDepthPrepassPipelines();
+        }
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            createShadowPipeline();
+        }
+        if (vulkanProgramInfo.deferredShadingEnabled)
+        {
+            createDeferredLightingPipeline();
+        }
 
-        vkEndCommandBuffer(copyBufferCmd);
+        std::vector<GraphicsPipelineDesc> prewarmDescs;
+        for (auto &group: vulkanProgramInfo.drawGroups)
+        {
+            if (group.permutation == defaultPermutation)
+            {
+                continue;
+            }
 
-        VkSubmitInfo copyBufferCommandSubmitInfo{};
-        copyBufferCommandSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        copyBufferCommandSubmitInfo.commandBufferCount = 1;
-        copyBufferCommandSubmitInfo.pCommandBuffers = &copyBufferCmd;
+            group.pipelineDesc = describeScenePipeline(group.permutation);
+            group.pipelineKey = group.pipelineDesc.hash();
+            prewarmDescs.push_back(group.pipelineDesc);
+        }
 
-        vkQueueSubmit(vulkanProgramInfo.graphicsQueue,
-                      1,
-                      &copyBufferCommandSubmitInfo,
-                      VK_NULL_HANDLE);
+        if (prewarmDescs.empty())
+        {
+            return;
+        }
 
-        vkQueueWaitIdle(vulkanProgramInfo.graphicsQueue);
+        // Queue every material of the scene now so most of them are done before the first frame
+        pipelineManager->prewarm(prewarmDescs);
 
-        vkFreeMemory(vulkanProgramInfo.renderDevice,
-                     vertexStagingBufferMemory,
-                     nullptr);
+        // Groups whose pipeline is not ready yet are drawn untextured from the float vertex
+        // buffer. A default pipeline with exactly that state doubles as the fallback.
+        ShaderPermutation fallbackPermutation{0};
+        if (defaultPermutation == fallbackPermutation)
+        {
+            vulkanProgramInfo.fallbackPipeline = vulkanProgramInfo.graphicsPipeline;
+            return;
+        }
 
-        vkDestroyBuffer(vulkanProgramInfo.renderDevice,
-                        vertexStagingBuffer,
-                        nullptr);
+        vulkanProgramInfo.fallbackPipeline = pipelineManager->create(describeScenePipeline(fallbackPermutation));
+        if (vulkanProgramInfo.fallbackPipeline == VK_NULL_HANDLE)
+        {
+            throw std::runtime_error("failed to create fallback pipeline!");
+        }
+        vulkanProgramInfo.ownsFallbackPipeline = true;
     }
 
-    void createIndexBuffer()
+    // Pipeline state of a scene permutation: shaders, vertex layout and specialization constants
+    // differ, the fixed function state is the same for all of them
+    GraphicsPipelineDesc describeScenePipeline(const ShaderPermutation &permutation) const
     {
-        VkDeviceSize indexBufferSize = sizeof(vertex_indices[0]) * vertex_indices.size();
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
+        GraphicsPipelineDesc desc{};
+        describeSceneTarget(desc);
 
-        VkBufferCreateInfo indexBufferCreateInfo{};
-        indexBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        indexBufferCreateInfo.size = indexBufferSize;
-        indexBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        indexBufferCreateInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        createBuffer(indexBufferCreateInfo,
-                     vulkanProgramInfo.renderDevice,
-                     vulkanProgramInfo.indexBuffer,
-                     vulkanProgramInfo.GPU,
-                     vulkanProgramInfo.indexBufferMemory,
-                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        desc.vertexLayout.binding = 1;
+        if (permutation.has(SHADER_FEATURE_QUANTIZED_VERTICES))
+        {
+            desc.vertexLayout.stride = sizeof(QuantizedVertex);
+            desc.vertexLayout.attributes = {
+                    {0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(QuantizedVertex, pos)},
+                    {1, VK_FORMAT_R8G8B8A8_UNORM,     offsetof(QuantizedVertex, color)},
+                    {2, VK_FORMAT_R16G16_SFLOAT,      offsetof(QuantizedVertex, texCoord)}
+            };
+        } else
+        {
+            desc.vertexLayout.stride = sizeof(Vertex);
+            desc.vertexLayout.attributes = {
+                    {0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos)},
+                    {1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color)},
+                    {2, VK_FORMAT_R32G32_SFLOAT,    offsetof(Vertex, texCoord)}
+            };
+        }
 
-        VkBufferCreateInfo stagingBufferCreateInfo{};
-        stagingBufferCreateInfo.size = indexBufferSize;
-        stagingBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        stagingBufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        stagingBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        createBuffer(stagingBufferCreateInfo,
-                     vulkanProgramInfo.renderDevice,
-                     stagingBuffer,
-                     vulkanProgramInfo.GPU,
-                     stagingBufferMemory,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        // Only the shading pipelines pass on the world position, the depth pre-pass has no use for it
+        ShaderStageDesc vertexStage = describeSceneVertexStage(permutation);
+        if (vulkanProgramInfo.shadowsEnabled || vulkanProgramInfo.clusteredLightsEnabled ||
+            vulkanProgramInfo.deferredShadingEnabled)
+        {
+            vertexStage.defines.emplace_back("WORLD_POSITION", "1");
+        }
 
-        void *mappedMemoryData;
-        vkMapMemory(vulkanProgramInfo.renderDevice,
-                    stagingBufferMemory,
-                    0,
-                    indexBufferSize,
-                    0,
-                    &mappedMemoryData);
-        memcpy(mappedMemoryData, vertex_indices.data(), indexBufferSize);
-        vkUnmapMemory(vulkanProgramInfo.renderDevice,
-                      stagingBufferMemory);
+        // Fragment constants are the 2 booleans of FragmentSpecializationConstants
+        ShaderStageDesc fragmentStage{};
+        fragmentStage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragmentStage.name = "shader.frag";
+        if (vulkanProgramInfo.bindlessEnabled)
+        {
+            fragmentStage.defines.emplace_back("BINDLESS", "1");
+        }
+        if (options.drawSubmission == "ubo")
+        {
+            fragmentStage.defines.emplace_back("DRAW_DATA_UBO", "1");
+        }
+        // Deferred shading lights in the lighting subpass, the scene only fills the G-buffer
+        if (vulkanProgramInfo.deferredShadingEnabled)
+        {
+            fragmentStage.defines.emplace_back("GBUFFER", "1");
+        } else
+        {
+            appendLightingDefines(fragmentStage);
+        }
 
-        VkCommandBuffer commandBuffer;
+        FragmentSpecializationConstants fragmentConstants{};
+        fragmentConstants.textured = permutation.has(SHADER_FEATURE_TEXTURED) ? VK_TRUE : VK_FALSE;
+        fragmentConstants.vertexColor = permutation.has(SHADER_FEATURE_VERTEX_COLOR) ? VK_TRUE : VK_FALSE;
 
-        VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
-        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        commandBufferAllocateInfo.commandBufferCount = 1;
-        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        commandBufferAllocateInfo.commandPool = vulkanProgramInfo.commandPool;
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            fragmentStage.specializationEntries.push_back({i, static_cast<uint32_t>(i * sizeof(uint32_t)), sizeof(uint32_t)});
+        }
+        const char *bytes = reinterpret_cast<const char *>(&fragmentConstants);
+        fragmentStage.specializationData.assign(bytes, bytes + sizeof(fragmentConstants));
 
-        vkAllocateCommandBuffers(vulkanProgramInfo.renderDevice,
-                                 &commandBufferAllocateInfo,
-                                 &commandBuffer);
+        desc.stages = {vertexStage, fragmentStage};
+        return desc;
+    }
 
-        VkCommandBufferBeginInfo commandBufferBeginInfo{};
-        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    // Render pass, attachment formats and depth state every scene pipeline shares. After a depth
+    // pre-pass only the fragments that made it into the depth buffer pass, and depth is left as is.
+    void describeSceneTarget(GraphicsPipelineDesc &desc) const
+    {
+        desc.layout = vulkanProgramInfo.pipelineLayout;
+        // Compatible with lateRenderPass as well, both have the same attachments. With dynamic
+        // rendering there is no render pass and the formats describe the attachments instead.
+        desc.renderPass = vulkanProgramInfo.renderPass;
+        desc.subpass = 0;
+        // Albedo and normal of the G-buffer
+        if (vulkanProgramInfo.deferredShadingEnabled)
+        {
+            desc.colorAttachmentCount = 2;
+        }
+        if (vulkanProgramInfo.dynamicRenderingEnabled)
+        {
+            desc.colorFormat = vulkanProgramInfo.sceneColorFormat;
+            desc.depthFormat = vulkanProgramInfo.depthFormat;
+        }
+        desc.samples = vulkanProgramInfo.msaaSamples;
 
-        VkBufferCopy bufferCopy{};
-        bufferCopy.size = indexBufferSize;
-        bufferCopy.srcOffset = 0;
-        bufferCopy.dstOffset = 0;
+        if (vulkanProgramInfo.depthPrepassEnabled)
+        {
+            desc.depth.compareOp = VK_COMPARE_OP_EQUAL;
+            desc.depth.writeEnable = VK_FALSE;
+        }
+    }
 
-        vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+    // Lights the forward scene shader and the deferred lighting subpass add
+    void appendLightingDefines(ShaderStageDesc &fragmentStage) const
+    {
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            fragmentStage.defines.emplace_back("SHADOWS", "1");
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            fragmentStage.defines.emplace_back("CLUSTERED_LIGHTS", "1");
+        }
+    }
 
-        vkCmdCopyBuffer(commandBuffer, stagingBuffer, vulkanProgramInfo.indexBuffer, 1, &bufferCopy);
+    ShaderStageDesc describeSceneVertexStage(const ShaderPermutation &permutation) const
+    {
+        ShaderStageDesc vertexStage{};
+        vertexStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertexStage.name = "shader.vert";
+        vertexStage.defines = permutation.defines();
+        if (vulkanProgramInfo.bindlessEnabled)
+        {
+            vertexStage.defines.emplace_back("BINDLESS", "1");
+        }
+        if (options.drawSubmission == "ubo")
+        {
+            vertexStage.defines.emplace_back("DRAW_DATA_UBO", "1");
+        }
 
-        vkEndCommandBuffer(commandBuffer);
+        // Vertex constants are the 6 floats of VertexSpecializationConstants
+        if (permutation.has(SHADER_FEATURE_QUANTIZED_VERTICES))
+        {
+            VertexSpecializationConstants vertexConstants{};
+            glm::vec3 center = quantizationCenter();
+            glm::vec3 halfExtent = quantizationHalfExtent();
+            for (int i = 0; i < 3; i++)
+            {
+                vertexConstants.boundsCenter[i] = center[i];
+                vertexConstants.boundsHalfExtent[i] = halfExtent[i];
+            }
 
-        VkSubmitInfo commandBufferSubmitInfo{};
-        commandBufferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        commandBufferSubmitInfo.commandBufferCount = 1;
-        commandBufferSubmitInfo.pCommandBuffers = &commandBuffer;
+            for (uint32_t i = 0; i < 6; i++)
+            {
+                vertexStage.specializationEntries.push_back({i, static_cast<uint32_t>(i * sizeof(float)), sizeof(float)});
+            }
+            const char *bytes = reinterpret_cast<const char *>(&vertexConstants);
+            vertexStage.specializationData.assign(bytes, bytes + sizeof(vertexConstants));
+        }
+        return vertexStage;
+    }
 
-        vkQueueSubmit(vulkanProgramInfo.graphicsQueue,
-                      1,
-                      &commandBufferSubmitInfo,
-                      VK_NULL_HANDLE);
+    // Vertex shader only: depth of the scene from the position stream. Float or quantized
+    // positions are transformed by the same code as in the scene pipelines, so depth matches.
+    GraphicsPipelineDesc describeDepthPrepassPipeline(bool quantized) const
+    {
+        GraphicsPipelineDesc desc{};
+        describeSceneTarget(desc);
+        desc.depth.compareOp = VK_COMPARE_OP_LESS;
+        desc.depth.writeEnable = VK_TRUE;
+        desc.blend.writeMask = 0;
+
+        desc.vertexLayout.binding = 1;
+        if (quantized)
+        {
+            desc.vertexLayout.stride = sizeof(QuantizedPosition);
+            desc.vertexLayout.attributes = {{0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(QuantizedPosition, pos)}};
+        } else
+        {
+            desc.vertexLayout.stride = sizeof(glm::vec3);
+            desc.vertexLayout.attributes = {{0, VK_FORMAT_R32G32B32_SFLOAT, 0}};
+        }
 
-        vkQueueWaitIdle(vulkanProgramInfo.graphicsQueue);
+        ShaderStageDesc vertexStage = describeSceneVertexStage(
+                ShaderPermutation{quantized ? SHADER_FEATURE_QUANTIZED_VERTICES : 0u});
+        vertexStage.defines.emplace_back("DEPTH_ONLY", "1");
 
-        vkFreeMemory(vulkanProgramInfo.renderDevice,
-                     stagingBufferMemory,
-                     nullptr);
-        vkDestroyBuffer(vulkanProgramInfo.renderDevice,
-                        stagingBuffer,
-                        nullptr);
+        desc.stages = {vertexStage};
+        return desc;
     }
 
-    void createGraphicsPipeline()
+    void createDepthPrepassPipelines()
     {
-        auto vertShaderCode = readFile("../src/spvShaders/vert.spv");
-        auto fragShaderCode = readFile("../src/spvShaders/frag.spv");
-
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertShaderStageInfo.module = vertShaderModule;
-        vertShaderStageInfo.pName = "main";
-
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        fragShaderStageInfo.module = fragShaderModule;
-        fragShaderStageInfo.pName = "main";
-
-        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
-                                                          fragShaderStageInfo};
-
-        // ===========================================================================
-        // Fixed functions
-        // ===========================================================================
-
-        // Vertex Input Bind Description
-        VkVertexInputBindingDescription vertexInputBindingDescription{};
-        vertexInputBindingDescription.binding = 1;
-        vertexInputBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        vertexInputBindingDescription.stride = sizeof(Vertex);
-
-        // Vertex Attribute Description
-        VkVertexInputAttributeDescription vertexInputPosition{};
-        vertexInputPosition.binding = 1;
-        vertexInputPosition.location = 0;
-        vertexInputPosition.format = VK_FORMAT_R32G32B32_SFLOAT;
-        vertexInputPosition.offset = offsetof(Vertex, pos);
-
-        VkVertexInputAttributeDescription vertexInputColor{};
-        vertexInputColor.binding = 1;
-        vertexInputColor.location = 1;
-        vertexInputColor.format = VK_FORMAT_R32G32B32_SFLOAT;
-        vertexInputColor.offset = offsetof(Vertex, color);
-
-        VkVertexInputAttributeDescription vertexInputTexCoord{};
-        vertexInputTexCoord.binding = 1;
-        vertexInputTexCoord.location = 2;
-        vertexInputTexCoord.format = VK_FORMAT_R32G32_SFLOAT;
-        vertexInputTexCoord.offset = offsetof(Vertex, texCoord);
-
-        VkVertexInputAttributeDescription vertexInputAttributeDescriptions[] =
-                {
-                        vertexInputPosition,
-                        vertexInputColor,
-                        vertexInputTexCoord
-                };
+        GraphicsPipelineDesc desc = describeDepthPrepassPipeline(false);
+        vulkanProgramInfo.depthPrepassPipeline = pipelineManager->create(desc);
+        if (vulkanProgramInfo.depthPrepassPipeline == VK_NULL_HANDLE)
+        {
+            throw std::runtime_error("failed to create depth pre-pass pipeline!");
+        }
 
-        // Vertex Input
-        VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo{};
-        vertexInputStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputStateCreateInfo.pNext = nullptr;
-        vertexInputStateCreateInfo.pVertexAttributeDescriptions = vertexInputAttributeDescriptions;
-        vertexInputStateCreateInfo.pVertexBindingDescriptions = &vertexInputBindingDescription;
-        vertexInputStateCreateInfo.vertexAttributeDescriptionCount =
-                sizeof(vertexInputAttributeDescriptions) / sizeof(VkVertexInputAttributeDescription);;
-        vertexInputStateCreateInfo.vertexBindingDescriptionCount = 1;
-
-        // Input Assembly
-        VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCreateInfo{};
-        inputAssemblyStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssemblyStateCreateInfo.primitiveRestartEnable = VK_FALSE;
-        inputAssemblyStateCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-        // Viewport
-        VkViewport viewport{};
-        viewport.width = (float) vulkanProgramInfo.swapchainExtent.width;
-        viewport.height = (float) vulkanProgramInfo.swapchainExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
+        if (shaderHotReloader)
+        {
+            shaderHotReloader->watch("depth prepass", &vulkanProgramInfo.depthPrepassPipeline,
+                                     {{"shader.vert", desc.stages[0].defines}},
+                                     [this, desc](const std::vector<std::vector<char>> &spirv)
+                                     {
+                                         return pipelineManager->create(desc, &spirv);
+                                     });
+        }
 
-        VkRect2D scissor{};
-        scissor.extent = vulkanProgramInfo.swapchainExtent;
-        scissor.offset.x = 0.0f;
-        scissor.offset.y = 0.0f;
-
-        VkPipelineViewportStateCreateInfo viewportStateCreateInfo{};
-        viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportStateCreateInfo.pScissors = &scissor;
-        viewportStateCreateInfo.scissorCount = 1;
-        viewportStateCreateInfo.pViewports = &viewport;
-        viewportStateCreateInfo.viewportCount = 1;
-
-        // Rasterizer
-        VkPipelineRasterizationStateCreateInfo rasterizationStateCreateInfo{};
-        rasterizationStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizationStateCreateInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
-        rasterizationStateCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizationStateCreateInfo.depthBiasEnable = VK_FALSE;
-        rasterizationStateCreateInfo.depthClampEnable = VK_FALSE;
-        rasterizationStateCreateInfo.lineWidth = 1.0f;
-        rasterizationStateCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizationStateCreateInfo.rasterizerDiscardEnable = VK_FALSE;
-        rasterizationStateCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizationStateCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-
-        // Depth and Stencil
-        VkPipelineDepthStencilStateCreateInfo depthStencilStateCreateInfo{};
-        depthStencilStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-        depthStencilStateCreateInfo.depthTestEnable = VK_TRUE;
-        depthStencilStateCreateInfo.depthWriteEnable = VK_TRUE;
-        depthStencilStateCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
-        depthStencilStateCreateInfo.depthBoundsTestEnable = VK_FALSE;
-        depthStencilStateCreateInfo.stencilTestEnable = VK_FALSE;
-
-        // Multisampling
-        VkPipelineMultisampleStateCreateInfo multisampleStateCreateInfo{};
-        multisampleStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampleStateCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-        multisampleStateCreateInfo.sampleShadingEnable = VK_FALSE;
-
-        // Depth and Stencil: Skip for now
-
-        // Color blending
-        VkPipelineColorBlendStateCreateInfo colorBlendStateCreateInfo{};
-        colorBlendStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlendStateCreateInfo.attachmentCount = 1;
-        colorBlendStateCreateInfo.logicOpEnable = VK_FALSE;
-
-        VkPipelineColorBlendAttachmentState colorBlendAttachmentState{};
-        colorBlendAttachmentState.blendEnable = VK_FALSE;
-        colorBlendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_A_BIT |
-                                                   VK_COLOR_COMPONENT_R_BIT |
-                                                   VK_COLOR_COMPONENT_G_BIT |
-                                                   VK_COLOR_COMPONENT_B_BIT;
-
-        colorBlendStateCreateInfo.pAttachments = &colorBlendAttachmentState;
-
-        // Dynamic State: nullptr
+        if (vulkanProgramInfo.quantizedPositionBuffer == VK_NULL_HANDLE)
+        {
+            return;
+        }
 
-        // Pipeline Layout
-        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
-        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-        pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
-        pipelineLayoutCreateInfo.setLayoutCount = 1;
-        pipelineLayoutCreateInfo.pSetLayouts = &vulkanProgramInfo.descriptorSetLayout;
+        GraphicsPipelineDesc quantizedDesc = describeDepthPrepassPipeline(true);
+        vulkanProgramInfo.quantizedDepthPrepassPipeline = pipelineManager->create(quantizedDesc);
+        if (vulkanProgramInfo.quantizedDepthPrepassPipeline == VK_NULL_HANDLE)
+        {
+            throw std::runtime_error("failed to create depth pre-pass pipeline!");
+        }
 
-        // END of setting fixed function state
-        vkResult = vkCreatePipelineLayout(vulkanProgramInfo.renderDevice,
-                                          &pipelineLayoutCreateInfo,
-                                          nullptr,
-                                          &vulkanProgramInfo.pipelineLayout);
+        if (shaderHotReloader)
+        {
+            shaderHotReloader->watch("quantized depth prepass", &vulkanProgramInfo.quantizedDepthPrepassPipeline,
+                                     {{"shader.vert", quantizedDesc.stages[0].defines}},
+                                     [this, quantizedDesc](const std::vector<std::vector<char>> &spirv)
+                                     {
+                                         return pipelineManager->create(quantizedDesc, &spirv);
+                                     });
+        }
+    }
 
-        checkVkResult(vkResult, "Failed to Pipeline Layout");
+    void createRenderPass()
+    {
+        // Dynamic rendering describes the attachments when the scene pass begins
+        if (vulkanProgramInfo.dynamicRenderingEnabled)
+        {
+            return;
+        }
 
-        // Start creating graphics pipeline
-        VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo{};
-        graphicsPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        graphicsPipelineCreateInfo.renderPass = vulkanProgramInfo.renderPass;
-        graphicsPipelineCreateInfo.layout = vulkanProgramInfo.pipelineLayout;
-        graphicsPipelineCreateInfo.pVertexInputState = &vertexInputStateCreateInfo;
-        graphicsPipelineCreateInfo.pInputAssemblyState = &inputAssemblyStateCreateInfo;
-        graphicsPipelineCreateInfo.pRasterizationState = &rasterizationStateCreateInfo;
-        graphicsPipelineCreateInfo.pMultisampleState = &multisampleStateCreateInfo;
-        graphicsPipelineCreateInfo.pColorBlendState = &colorBlendStateCreateInfo;
-        graphicsPipelineCreateInfo.pDynamicState = nullptr;
-        graphicsPipelineCreateInfo.pStages = shaderStages;
-        graphicsPipelineCreateInfo.stageCount = 2;
-        graphicsPipelineCreateInfo.pDepthStencilState = &depthStencilStateCreateInfo;
-        graphicsPipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
-        graphicsPipelineCreateInfo.subpass = 0;
-
-        vkCreateGraphicsPipelines(vulkanProgramInfo.renderDevice,
-                                  VK_NULL_HANDLE,
-                                  1,
-                                  &graphicsPipelineCreateInfo,
-                                  nullptr,
-                                  &vulkanProgramInfo.graphicsPipeline);
+        VkImageLayout colorFinalLayout = sceneColorOffscreen()
+                                         ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                                         : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        if (vulkanProgramInfo.deferredShadingEnabled)
+        {
+            createDeferredRenderPass(colorFinalLayout);
+            return;
+        }
+        if (!vulkanProgramInfo.occlusionCullingEnabled && !vulkanProgramInfo.depthPrepassEnabled)
+        {
+            createSceneRenderPass(true, colorFinalLayout, vulkanProgramInfo.renderPass);
+            return;
+        }
 
-        vkDestroyShaderModule(vulkanProgramInfo.renderDevice,
-                              fragShaderModule, nullptr);
-        vkDestroyShaderModule(vulkanProgramInfo.renderDevice,
-                              vertShaderModule, nullptr);
+        // With occlusion culling or the depth pre-pass the scene is drawn in two render passes. The
+        // first one clears and keeps color and depth around (for the depth pyramid), the second one
+        // continues where it left off.
+        createSceneRenderPass(true, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, vulkanProgramInfo.renderPass);
+        createSceneRenderPass(false, colorFinalLayout, vulkanProgramInfo.lateRenderPass);
     }
 
-    void createRenderPass()
+    void createSceneRenderPass(bool clear, VkImageLayout colorFinalLayout, VkRenderPass &renderPass)
     {
+        bool multisampled = vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
         // Attachment description for render pass
-        // Color attachment
+        // Color attachment, the multisampled one is resolved and then dropped
         VkAttachmentDescription colorAttachment{};
-        colorAttachment.format = vulkanProgramInfo.swapchainImageFormat;
-        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.format = vulkanProgramInfo.sceneColorFormat;
+        colorAttachment.samples = vulkanProgramInfo.msaaSamples;
+        colorAttachment.initialLayout = clear ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.finalLayout = multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : colorFinalLayout;
+        colorAttachment.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.loadOp = clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
 
         // Depth attachment
         VkAttachmentDescription depthAttachment{};
-        depthAttachment.format = VK_FORMAT_D32_SFLOAT;
-        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachment.format = vulkanProgramInfo.depthFormat;
+        depthAttachment.initialLayout = clear ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
         depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.loadOp = clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+        depthAttachment.storeOp = sceneDepthStoreOp(clear);
+        depthAttachment.samples = vulkanProgramInfo.msaaSamples;
+
+        // Swapchain (or scene color) image the samples are resolved into, every pixel of it is written
+        VkAttachmentDescription resolveAttachment{};
+        resolveAttachment.format = vulkanProgramInfo.sceneColorFormat;
+        resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        resolveAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        resolveAttachment.finalLayout = colorFinalLayout;
+        resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 
         // Attachment reference for subpass
         // Color attachment reference for our first and only subpass in the render pass
@@ -1263,23 +2402,29 @@ private:
         depthAttachmentReference.attachment = 1;
         depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
+        VkAttachmentReference resolveAttachmentReference{};
+        resolveAttachmentReference.attachment = 2;
+        resolveAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
         // Subpass description
         VkSubpassDescription subpassDescription{};
         subpassDescription.colorAttachmentCount = 1;
         subpassDescription.pColorAttachments = &colorAttachmentReference;
+        subpassDescription.pResolveAttachments = multisampled ? &resolveAttachmentReference : nullptr;
         subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
         subpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
 
-        std::array<VkAttachmentDescription, 2> attachmentsForRenderPass =
+        std::array<VkAttachmentDescription, 3> attachmentsForRenderPass =
                 {
                         colorAttachment,
-                        depthAttachment
+                        depthAttachment,
+                        resolveAttachment
                 };
 
         // Render Pass create info
         VkRenderPassCreateInfo renderPassCreateInfo{};
         renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachmentsForRenderPass.size());
+        renderPassCreateInfo.attachmentCount = multisampled ? 3 : 2;
         renderPassCreateInfo.pAttachments = attachmentsForRenderPass.data();
         renderPassCreateInfo.pSubpasses = &subpassDescription;
         renderPassCreateInfo.subpassCount = 1;
@@ -1289,24 +2434,54 @@ private:
         vkResult = vkCreateRenderPass(vulkanProgramInfo.renderDevice,
                                       &renderPassCreateInfo,
                                       nullptr,
-                                      &vulkanProgramInfo.renderPass);
+                                      &renderPass);
         checkVkResult(vkResult, "Failed to create Render Pass");
     }
 
-    void createSwapchainFramebuffer()
+    // Depth only has to reach memory when a second scene pass reads it after the first one: the
+    // late pass (and depth pyramid) of occlusion culling, or the scene pass after the depth
+    // pre-pass. Nothing reads it after the last one.
+    VkAttachmentStoreOp sceneDepthStoreOp(bool firstScenePass) const
     {
+        return firstScenePass && twoScenePasses() ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    }
 
-        vulkanProgramInfo.swapchainFramebuffers.resize(vulkanProgramInfo.swapchainImages.size());
+    bool twoScenePasses() const
+    {
+        return vulkanProgramInfo.occlusionCullingEnabled || vulkanProgramInfo.depthPrepassEnabled;
+    }
 
-        // Create a Framebuffer for each image in swapchain
-        for (std::size_t i = 0; i < vulkanProgramInfo.swapchainImages.size(); i++)
+    void createSwapchainFramebuffer()
+    {
+        if (vulkanProgramInfo.dynamicRenderingEnabled)
         {
+            return;
+        }
 
-            std::array<VkImageView, 2> framebufferAttachments =
-                    {
-                            vulkanProgramInfo.swapchainImageViews[i],
-                            vulkanProgramInfo.depthImageView
-                    };
+        vulkanProgramInfo.swapchainFramebuffers.resize(vulkanProgramInfo.swapchainImages.size());
+
+        // Create a Framebuffer for each image in swapchain
+        for (std::size_t i = 0; i < vulkanProgramInfo.swapchainImages.size(); i++)
+        {
+            // With MSAA the swapchain image is the resolve attachment after the multisampled ones,
+            // deferred shading has the G-buffer after color and depth
+            std::vector<VkImageView> framebufferAttachments;
+            if (vulkanProgramInfo.deferredShadingEnabled)
+            {
+                framebufferAttachments = {sceneColorTargetView(i),
+                                          vulkanProgramInfo.depthImageView,
+                                          vulkanProgramInfo.gbufferAlbedoView,
+                                          vulkanProgramInfo.gbufferNormalView};
+            } else if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+            {
+                framebufferAttachments = {vulkanProgramInfo.msaaColorImageView,
+                                          vulkanProgramInfo.depthImageView,
+                                          sceneColorTargetView(i)};
+            } else
+            {
+                framebufferAttachments = {sceneColorTargetView(i),
+                                          vulkanProgramInfo.depthImageView};
+            }
             VkFramebufferCreateInfo framebufferCreateInfo{};
             framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
             framebufferCreateInfo.renderPass = vulkanProgramInfo.renderPass;
@@ -1331,7 +2506,7 @@ private:
         VkCommandPoolCreateInfo commandPoolCreateInfo{};
         commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        commandPoolCreateInfo.queueFamilyIndex = vulkanProgramInfo.graphicsQueueFamilyIndex;
+        commandPoolCreateInfo.queueFamilyIndex = vulkanProgramInfo.queueFamilies.graphics;
 
         vkCreateCommandPool(vulkanProgramInfo.renderDevice,
                             &commandPoolCreateInfo,
@@ -1351,10 +2526,178 @@ private:
                                             &commandBufferAllocateInfo,
                                             vulkanProgramInfo.commandBuffers);
         checkVkResult(vkResult, "Failed to allocate Command Buffers");
+
+        commandBufferAllocateInfo.commandBufferCount = VulkanProgramInfo::MAX_BATCHES_PER_QUEUE - 1;
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkResult = vkAllocateCommandBuffers(vulkanProgramInfo.renderDevice,
+                                                &commandBufferAllocateInfo,
+                                                vulkanProgramInfo.extraGraphicsCommandBuffers[i]);
+            checkVkResult(vkResult, "Failed to allocate Command Buffers");
+        }
+
+        // Pools of the other queues share the graphics pool when they use the same family
+        vulkanProgramInfo.computeCommandPool = vulkanProgramInfo.commandPool;
+        vulkanProgramInfo.transferCommandPool = vulkanProgramInfo.commandPool;
+
+        if (vulkanProgramInfo.asyncComputeEnabled)
+        {
+            commandPoolCreateInfo.queueFamilyIndex = vulkanProgramInfo.queueFamilies.compute;
+            vkResult = vkCreateCommandPool(vulkanProgramInfo.renderDevice,
+                                           &commandPoolCreateInfo,
+                                           nullptr,
+                                           &vulkanProgramInfo.computeCommandPool);
+            checkVkResult(vkResult, "Failed to create compute command pool");
+
+            commandBufferAllocateInfo.commandPool = vulkanProgramInfo.computeCommandPool;
+            commandBufferAllocateInfo.commandBufferCount = VulkanProgramInfo::MAX_BATCHES_PER_QUEUE;
+            for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            {
+                vkResult = vkAllocateCommandBuffers(vulkanProgramInfo.renderDevice,
+                                                    &commandBufferAllocateInfo,
+                                                    vulkanProgramInfo.computeCommandBuffers[i]);
+                checkVkResult(vkResult, "Failed to allocate compute command buffers");
+            }
+        }
+
+        vulkanProgramInfo.frameGraphs.resize(vulkanProgramInfo.swapchainImages.size());
+        if (options.staticCommandBuffers)
+        {
+            createStaticCommandBuffers();
+        }
+
+        if (vulkanProgramInfo.queueFamilies.separateTransfer())
+        {
+            commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            commandPoolCreateInfo.queueFamilyIndex = vulkanProgramInfo.queueFamilies.transfer;
+            vkResult = vkCreateCommandPool(vulkanProgramInfo.renderDevice,
+                                           &commandPoolCreateInfo,
+                                           nullptr,
+                                           &vulkanProgramInfo.transferCommandPool);
+            checkVkResult(vkResult, "Failed to create transfer command pool");
+        }
+    }
+
+    // One set of batch command buffers per (swapchain image, frame slot) pair, recorded the
+    // first time the pair comes up
+    void createStaticCommandBuffers()
+    {
+        std::size_t pairs = vulkanProgramInfo.swapchainImages.size() * MAX_FRAMES_IN_FLIGHT;
+        vulkanProgramInfo.staticFrameCommands.resize(pairs);
+        vulkanProgramInfo.staticSceneDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
+        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        commandBufferAllocateInfo.commandBufferCount = VulkanProgramInfo::MAX_BATCHES_PER_QUEUE;
+
+        for (auto &commands: vulkanProgramInfo.staticFrameCommands)
+        {
+            commands.graphicsCommandBuffers.resize(VulkanProgramInfo::MAX_BATCHES_PER_QUEUE);
+            commandBufferAllocateInfo.commandPool = vulkanProgramInfo.commandPool;
+            vkResult = vkAllocateCommandBuffers(vulkanProgramInfo.renderDevice,
+                                                &commandBufferAllocateInfo,
+                                                commands.graphicsCommandBuffers.data());
+            checkVkResult(vkResult, "Failed to allocate static command buffers");
+
+            if (vulkanProgramInfo.asyncComputeEnabled)
+            {
+                commands.computeCommandBuffers.resize(VulkanProgramInfo::MAX_BATCHES_PER_QUEUE);
+                commandBufferAllocateInfo.commandPool = vulkanProgramInfo.computeCommandPool;
+                vkResult = vkAllocateCommandBuffers(vulkanProgramInfo.renderDevice,
+                                                    &commandBufferAllocateInfo,
+                                                    commands.computeCommandBuffers.data());
+                checkVkResult(vkResult, "Failed to allocate static compute command buffers");
+            }
+        }
+        vulkanProgramInfo.staticCommandBuffers = true;
+    }
+
+    // Command buffer for one off work like uploads and layout transitions
+    VkCommandBuffer beginSingleTimeCommands()
+    {
+        return beginSingleTimeCommands(vulkanProgramInfo.commandPool);
+    }
+
+    VkCommandBuffer beginSingleTimeCommands(VkCommandPool commandPool)
+    {
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
+        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferAllocateInfo.commandPool = commandPool;
+        commandBufferAllocateInfo.commandBufferCount = 1;
+        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+        VkCommandBuffer commandBuffer;
+        vkResult = vkAllocateCommandBuffers(vulkanProgramInfo.renderDevice,
+                                            &commandBufferAllocateInfo,
+                                            &commandBuffer);
+        checkVkResult(vkResult, "Failed to allocate command buffer");
+
+        VkCommandBufferBeginInfo commandBufferBeginInfo{};
+        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+
+        return commandBuffer;
+    }
+
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer)
+    {
+        vkEndCommandBuffer(commandBuffer);
+
+        submitAndWait(commandBuffer);
+
+        vkFreeCommandBuffers(vulkanProgramInfo.renderDevice, vulkanProgramInfo.commandPool, 1, &commandBuffer);
+    }
+
+    // Submits one off work and blocks until it is done. Waits on the timeline value of this
+    // submission rather than with vkQueueWaitIdle, so frames in flight are not waited for.
+    void submitAndWait(VkCommandBuffer commandBuffer)
+    {
+        vulkanProgramInfo.timeline.wait(submitOneOff(vulkanProgramInfo.graphicsQueue, commandBuffer, 0));
+    }
+
+    // Submits one off work to any queue and returns the timeline value it signals. It waits on
+    // the GPU for waitValue first, 0 waits for nothing. Later submissions to other queues have to
+    // wait for the returned value (on the GPU or the CPU), so values are signalled in order.
+    uint64_t submitOneOff(VkQueue queue, VkCommandBuffer commandBuffer, uint64_t waitValue)
+    {
+        uint64_t signalValue = vulkanProgramInfo.timeline.next();
+        VkSemaphore timelineSemaphore = vulkanProgramInfo.timeline.semaphore();
+        VkPipelineStageFlags waitStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+        VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+        timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineSubmitInfo.waitSemaphoreValueCount = waitValue != 0 ? 1 : 0;
+        timelineSubmitInfo.pWaitSemaphoreValues = &waitValue;
+        timelineSubmitInfo.signalSemaphoreValueCount = 1;
+        timelineSubmitInfo.pSignalSemaphoreValues = &signalValue;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineSubmitInfo;
+        submitInfo.waitSemaphoreCount = waitValue != 0 ? 1 : 0;
+        submitInfo.pWaitSemaphores = &timelineSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStages;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timelineSemaphore;
+
+        vkResult = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+        checkVkResult(vkResult, "Failed to submit");
+
+        return signalValue;
     }
 
-    void recordCommandBuffer()
+    // Records the frame graph, one command buffer per batch. Returned in submission order.
+    // Records into the frame slot's command buffers, or the ones of staticCommands when given.
+    std::vector<FrameSubmission> recordCommandBuffer(StaticFrameCommands *staticCommands = nullptr)
     {
+        vulkanProgramInfo.drawDataCursor = 0;
+        resolveGroupPipelines();
+
         VkCommandBufferBeginInfo commandBufferBeginInfo{};
         commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         commandBufferBeginInfo.pInheritanceInfo = nullptr;
@@ -1365,7 +2708,8 @@ private:
         VkClearValue depthClearValue{};
         depthClearValue.depthStencil = {1.0f, 0};
 
-        VkClearValue clearValues[2] =
+        // Static, the passes of the cached frame graphs keep pointing at them
+        static const VkClearValue clearValues[2] =
                 {
                         colorClearValue,
                         depthClearValue
@@ -1376,539 +2720,5023 @@ private:
         renderPassBeginInfo.renderPass = vulkanProgramInfo.renderPass;
         renderPassBeginInfo.pClearValues = clearValues;
         renderPassBeginInfo.clearValueCount = 2;
-        renderPassBeginInfo.framebuffer = vulkanProgramInfo.swapchainFramebuffers[vulkanProgramInfo.activeSwapchainImage];
         renderPassBeginInfo.renderArea.offset = {0, 0};
-        renderPassBeginInfo.renderArea.extent = vulkanProgramInfo.swapchainExtent;
+        renderPassBeginInfo.renderArea.extent = vulkanProgramInfo.renderExtent;
+        if (!vulkanProgramInfo.dynamicRenderingEnabled)
+        {
+            renderPassBeginInfo.framebuffer = vulkanProgramInfo.swapchainFramebuffers[vulkanProgramInfo.activeSwapchainImage];
+        }
 
-        vkBeginCommandBuffer(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                             &commandBufferBeginInfo);
+        CachedFrameGraph &cachedGraph = vulkanProgramInfo.frameGraphs[vulkanProgramInfo.activeSwapchainImage];
+        if (cachedGraph.generation != vulkanProgramInfo.commandGeneration)
+        {
+            cachedGraph.graph = RenderGraph();
+            buildFrameGraph(cachedGraph.graph, renderPassBeginInfo);
+            cachedGraph.graph.compile();
+            cachedGraph.graph.realize(vulkanProgramInfo.renderDevice,
+                                      vulkanProgramInfo.GPU,
+                                      vulkanProgramInfo.frameTransients,
+                                      transientQueueFamilies());
+            if (vulkanProgramInfo.dynamicRenderingEnabled)
+            {
+                cachedGraph.graph.setPipelineBarrier2(vulkanProgramInfo.dynamicRendering.cmdPipelineBarrier2);
+            }
+            cachedGraph.generation = vulkanProgramInfo.commandGeneration;
+        }
+        RenderGraph &frameGraph = cachedGraph.graph;
 
-        vkCmdBindPipeline(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                          VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          vulkanProgramInfo.graphicsPipeline);
+        // Every pass is a profiler scope
+        auto frame = static_cast<uint32_t>(vulkanProgramInfo.curr_frame);
+        GpuProfiler &profiler = vulkanProgramInfo.gpuProfiler;
+        frameGraph.setPassHooks(
+                [&profiler, frame](VkCommandBuffer commandBuffer, const std::string &name, RenderGraphQueue queue)
+                {
+                    profiler.beginScope(commandBuffer, frame, name, queue);
+                },
+                [&profiler, frame](VkCommandBuffer commandBuffer, const std::string &, RenderGraphQueue)
+                {
+                    profiler.endScope(commandBuffer, frame);
+                });
 
-        vkCmdBeginRenderPass(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                             &renderPassBeginInfo,
-                             VK_SUBPASS_CONTENTS_INLINE);
+        std::vector<RenderGraphBatch> batches = frameGraph.batches();
+        if (batches.empty())
+        {
+            batches.push_back({RenderGraphQueue::Graphics, 0, 0});
+        }
 
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                               1,
-                               1,
-                               &vulkanProgramInfo.vertexBuffer,
-                               offsets);
+        std::vector<FrameSubmission> submissions;
+        uint32_t graphicsBatches = 0;
+        uint32_t computeBatches = 0;
+        for (std::size_t i = 0; i < batches.size(); i++)
+        {
+            uint32_t &used = batches[i].queue == RenderGraphQueue::Compute ? computeBatches : graphicsBatches;
+            if (used == VulkanProgramInfo::MAX_BATCHES_PER_QUEUE)
+            {
+                throw std::runtime_error("frame graph switches queues too often!");
+            }
 
-        vkCmdBindIndexBuffer(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                             vulkanProgramInfo.indexBuffer,
-                             0,
-                             VK_INDEX_TYPE_UINT32);
-        /*
-        vkCmdDraw(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                  vertices.size(),
-                  1,
-                  0,
-                  0);
-        */
-        vkCmdBindDescriptorSets(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                                VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                vulkanProgramInfo.pipelineLayout,
-                                0,
-                                1,
-                                &vulkanProgramInfo.descriptorSets[vulkanProgramInfo.curr_frame],
-                                0,
-                                nullptr);
+            VkCommandBuffer commandBuffer;
+            if (staticCommands != nullptr)
+            {
+                commandBuffer = batches[i].queue == RenderGraphQueue::Compute
+                                ? staticCommands->computeCommandBuffers[used]
+                                : staticCommands->graphicsCommandBuffers[used];
+            } else if (batches[i].queue == RenderGraphQueue::Compute)
+            {
+                commandBuffer = vulkanProgramInfo.computeCommandBuffers[frame][used];
+            } else
+            {
+                commandBuffer = used == 0 ? vulkanProgramInfo.commandBuffers[frame]
+                                          : vulkanProgramInfo.extraGraphicsCommandBuffers[frame][used - 1];
+            }
+            used++;
 
-        vkCmdDrawIndexed(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                         static_cast<uint32_t>(vertex_indices.size()),
-                         1,
-                         0,
-                         0,
-                         0);
+            vkResetCommandBuffer(commandBuffer, 0);
+            vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+
+            if (i == 0)
+            {
+                profiler.beginFrame(commandBuffer, frame);
+            }
+            frameGraph.executeBatch(commandBuffer, batches[i], i + 1 == batches.size());
 
-        vkCmdEndRenderPass(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame]);
+            vkResult = vkEndCommandBuffer(commandBuffer);
+            checkFrameVkResult(vkResult, "Failed to end command buffer");
 
-        vkResult = vkEndCommandBuffer(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame]);
+            submissions.push_back({batches[i].queue, commandBuffer});
+        }
 
-        checkVkResult(vkResult, "Failed to end command buffer");
+        return submissions;
     }
 
-    void createSynchronizationObjects()
+    // Describes the frame for the active swapchain image. Per frame data is read when the passes
+    // record, so the graph is only built again when frameGraphs says so.
+    void buildFrameGraph(RenderGraph &graph, const VkRenderPassBeginInfo &renderPassBeginInfo)
     {
-        VkFenceCreateInfo frameReadyCreatInfo{};
-        frameReadyCreatInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        frameReadyCreatInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-        frameReadyCreatInfo.pNext = nullptr;
+        // The swapchain image is waited on at the color output stage and its old content is not needed
+        ResourceState acquiredState{};
+        acquiredState.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        acquiredState.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        RenderGraphHandle swapchainTarget = graph.importImage("swapchain image",
+                                                              vulkanProgramInfo.swapchainImages[vulkanProgramInfo.activeSwapchainImage],
+                                                              vulkanProgramInfo.swapchainImageViews[vulkanProgramInfo.activeSwapchainImage],
+                                                              VK_IMAGE_ASPECT_COLOR_BIT,
+                                                              1,
+                                                              acquiredState);
+
+        // Depth is cleared every frame, but last frame's depth tests still have to be done with it
+        ResourceState depthState = describeUsage(ResourceUsage::DepthAttachment);
+        depthState.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        RenderGraphHandle depthTarget = graph.importImage("depth",
+                                                          vulkanProgramInfo.depthImage,
+                                                          vulkanProgramInfo.depthImageView,
+                                                          VK_IMAGE_ASPECT_DEPTH_BIT,
+                                                          1,
+                                                          depthState);
 
-        VkSemaphoreCreateInfo nextImageReadySemaphoreCreateInfo{};
-        nextImageReadySemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        graph.markOutput(swapchainTarget, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 
-        VkSemaphoreCreateInfo renderFinishedSemaphoreCreateInfo{};
-        renderFinishedSemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        SceneInputs sceneInputs{};
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            sceneInputs.shadowMap = addShadowPass(graph);
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            addLightBinningPass(graph, sceneInputs);
+        }
+        if (vulkanProgramInfo.particlesEnabled)
+        {
+            addParticlePasses(graph, sceneInputs);
+        }
 
-        for (std::size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        // Dynamic resolution and post-processing draw into the scene color image, which last
+        // frame's upscale or post passes read
+        RenderGraphHandle colorTarget = swapchainTarget;
+        if (sceneColorOffscreen())
         {
-            vkResult = vkCreateFence(vulkanProgramInfo.renderDevice,
-                                     &frameReadyCreatInfo,
-                                     nullptr,
-                                     &vulkanProgramInfo.frameReadyFences[i]);
+            ResourceState sceneColorState = describeUsage(vulkanProgramInfo.upscaleByCompute ||
+                                                          vulkanProgramInfo.postProcessingEnabled
+                                                          ? ResourceUsage::SampledCompute
+                                                          : ResourceUsage::TransferSrc);
+            sceneColorState.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            colorTarget = graph.importImage("scene color",
+                                            vulkanProgramInfo.sceneColorImage,
+                                            vulkanProgramInfo.sceneColorImageView,
+                                            VK_IMAGE_ASPECT_COLOR_BIT,
+                                            1,
+                                            sceneColorState);
+        }
 
-            checkVkResult(vkResult, "Failed to create frame ready fence");
+        if (vulkanProgramInfo.occlusionCullingEnabled)
+        {
+            addOcclusionCulledScenePasses(graph, renderPassBeginInfo, colorTarget, depthTarget, sceneInputs);
+            if (vulkanProgramInfo.postProcessingEnabled)
+            {
+                addPostProcessingPasses(graph, colorTarget, swapchainTarget);
+            }
+            return;
+        }
 
-            vkResult = vkCreateSemaphore(vulkanProgramInfo.renderDevice,
-                                         &nextImageReadySemaphoreCreateInfo,
-                                         nullptr,
-                                         &vulkanProgramInfo.nextImageReadySemaphores[i]);
-            checkVkResult(vkResult, "Failed to create next image ready semaphore");
+        // The pre-pass clears both attachments and fills depth, the scene pass continues with them
+        VkRenderPassBeginInfo sceneRenderPassBeginInfo = renderPassBeginInfo;
+        if (vulkanProgramInfo.depthPrepassEnabled)
+        {
+            graph.addPass("depth prepass", [this, renderPassBeginInfo](VkCommandBuffer commandBuffer)
+                    {
+                        beginScenePass(commandBuffer, renderPassBeginInfo, true);
+                        recordSceneDrawCommands(commandBuffer, VK_NULL_HANDLE, true);
+                        endScenePass(commandBuffer);
+                    })
+                    .write(colorTarget, ResourceUsage::ColorAttachment)
+                    .write(depthTarget, ResourceUsage::DepthAttachment);
+            sceneRenderPassBeginInfo.renderPass = vulkanProgramInfo.lateRenderPass;
+        }
 
-            vkResult = vkCreateSemaphore(vulkanProgramInfo.renderDevice,
-                                         &renderFinishedSemaphoreCreateInfo,
-                                         nullptr,
-                                         &vulkanProgramInfo.renderFinishedSemaphores[i]);
+        bool clear = !vulkanProgramInfo.depthPrepassEnabled;
+        auto scenePass = graph.addPass("scene", [this, sceneRenderPassBeginInfo, clear](VkCommandBuffer commandBuffer)
+                {
+                    beginScenePass(commandBuffer, sceneRenderPassBeginInfo, clear);
+                    recordSceneDrawCommands(commandBuffer, VK_NULL_HANDLE);
+                    if (vulkanProgramInfo.deferredShadingEnabled)
+                    {
+                        recordDeferredLighting(commandBuffer);
+                    }
+                    if (vulkanProgramInfo.particlesEnabled)
+                    {
+                        recordParticleDraw(commandBuffer);
+                    }
+                    endScenePass(commandBuffer);
+                });
+        scenePass.write(colorTarget, ResourceUsage::ColorAttachment, scenePassPresentLayout())
+                .write(depthTarget, ResourceUsage::DepthAttachment);
+        readSceneInputs(scenePass, sceneInputs);
+        if (vulkanProgramInfo.particlesEnabled)
+        {
+            readParticleInputs(scenePass, sceneInputs);
+        }
 
-            checkVkResult(vkResult, "Failed to create render finished semaphore");
+        // The swapchain image is written by the resolve at the end of the pass, at the color output stage too
+        if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+        {
+            ResourceState msaaColorState = describeUsage(ResourceUsage::ColorAttachment);
+            msaaColorState.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            RenderGraphHandle msaaColorTarget = graph.importImage("msaa color",
+                                                                  vulkanProgramInfo.msaaColorImage,
+                                                                  vulkanProgramInfo.msaaColorImageView,
+                                                                  VK_IMAGE_ASPECT_COLOR_BIT,
+                                                                  1,
+                                                                  msaaColorState);
+            scenePass.write(msaaColorTarget, ResourceUsage::ColorAttachment);
+        }
+
+        if (vulkanProgramInfo.dynamicResolutionEnabled)
+        {
+            addUpscalePass(graph, colorTarget, swapchainTarget);
+        }
+        if (vulkanProgramInfo.postProcessingEnabled)
+        {
+            addPostProcessingPasses(graph, colorTarget, swapchainTarget);
         }
     }
 
-    void createDescriptorSetLayout()
+    void readSceneInputs(RenderGraph::PassBuilder &pass, const SceneInputs &sceneInputs) const
     {
-        VkDescriptorSetLayoutBinding descriptorSetLayoutBinding{};
-        descriptorSetLayoutBinding.binding = 0;
-        descriptorSetLayoutBinding.descriptorCount = 1;
-        descriptorSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorSetLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-        VkDescriptorSetLayoutBinding textureImageSamplerDescriptorBinding{};
-        textureImageSamplerDescriptorBinding.binding = 1;
-        textureImageSamplerDescriptorBinding.descriptorCount = 1;
-        textureImageSamplerDescriptorBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        textureImageSamplerDescriptorBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            pass.read(sceneInputs.shadowMap, ResourceUsage::SampledFragment);
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            pass.read(sceneInputs.lightClusters, ResourceUsage::StorageReadFragment)
+                    .read(sceneInputs.lightIndices, ResourceUsage::StorageReadFragment);
+        }
+    }
 
-        std::array<VkDescriptorSetLayoutBinding, 2> descriptorSetLayoutBindings =
-                {
-                        descriptorSetLayoutBinding, textureImageSamplerDescriptorBinding
-                };
+    // Layout the last scene pass leaves the swapchain image in. The render pass transitions it
+    // for presenting, with dynamic rendering the frame graph does in its epilogue. With dynamic
+    // resolution or post-processing the pass draws the scene color image, which stays in
+    // attachment layout.
+    VkImageLayout scenePassPresentLayout() const
+    {
+        return vulkanProgramInfo.dynamicRenderingEnabled || sceneColorOffscreen()
+               ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    }
 
-        VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
-        descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(descriptorSetLayoutBindings.size());
-        descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings.data();
+    // The scene is drawn into sceneColorImage, and a compute pass or blit fills the swapchain image
+    bool sceneColorOffscreen() const
+    {
+        return vulkanProgramInfo.dynamicResolutionEnabled || vulkanProgramInfo.postProcessingEnabled;
+    }
 
-        vkCreateDescriptorSetLayout(vulkanProgramInfo.renderDevice,
-                                    &descriptorSetLayoutCreateInfo,
-                                    nullptr,
-                                    &vulkanProgramInfo.descriptorSetLayout);
+    // What the scene passes draw into (or resolve into with MSAA) for a swapchain image
+    VkImageView sceneColorTargetView(uint32_t swapchainImage) const
+    {
+        return sceneColorOffscreen() ? vulkanProgramInfo.sceneColorImageView
+                                     : vulkanProgramInfo.swapchainImageViews[swapchainImage];
     }
 
-    void createUniformBuffer()
+    // Starts drawing into the active swapchain image and the depth buffer. clear is false for a
+    // pass that continues the one before (renderPassBeginInfo then names lateRenderPass). The
+    // frame graph has both images in attachment layout by then.
+    void beginScenePass(VkCommandBuffer commandBuffer, const VkRenderPassBeginInfo &renderPassBeginInfo, bool clear)
     {
-        vulkanProgramInfo.uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-        vulkanProgramInfo.uniformBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        if (!vulkanProgramInfo.dynamicRenderingEnabled)
+        {
+            vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            return;
+        }
 
-        VkBufferCreateInfo uniformBufferCreateInfo{};
-        uniformBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        uniformBufferCreateInfo.size = sizeof(UniformBufferObject);
-        uniformBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        uniformBufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        VkImageView colorTargetView = sceneColorTargetView(vulkanProgramInfo.activeSwapchainImage);
 
-        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        VkRenderingAttachmentInfoKHR colorAttachment{};
+        colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        colorAttachment.imageView = colorTargetView;
+        colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.loadOp = clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.clearValue = renderPassBeginInfo.pClearValues[0];
+        if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
         {
-            createBuffer(uniformBufferCreateInfo,
-                         vulkanProgramInfo.renderDevice,
-                         vulkanProgramInfo.uniformBuffers[i],
-                         vulkanProgramInfo.GPU,
-                         vulkanProgramInfo.uniformBufferMemories[i],
-                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
+            // Samples are averaged into the swapchain image and dropped
+            colorAttachment.imageView = vulkanProgramInfo.msaaColorImageView;
+            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+            colorAttachment.resolveImageView = colorTargetView;
+            colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         }
 
+        VkRenderingAttachmentInfoKHR depthAttachment{};
+        depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        depthAttachment.imageView = vulkanProgramInfo.depthImageView;
+        depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthAttachment.loadOp = clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+        depthAttachment.storeOp = sceneDepthStoreOp(clear);
+        depthAttachment.clearValue = renderPassBeginInfo.pClearValues[1];
+
+        VkRenderingInfoKHR renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+        renderingInfo.renderArea = renderPassBeginInfo.renderArea;
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachments = &colorAttachment;
+        renderingInfo.pDepthAttachment = &depthAttachment;
+
+        vulkanProgramInfo.dynamicRendering.cmdBeginRendering(commandBuffer, &renderingInfo);
     }
 
-    void updateUniformBuffer()
+    void endScenePass(VkCommandBuffer commandBuffer) const
     {
-        // Copied from vulkan-tutorial.com
-        static auto startTime = std::chrono::high_resolution_clock::now();
+        if (vulkanProgramInfo.dynamicRenderingEnabled)
+        {
+            vulkanProgramInfo.dynamicRendering.cmdEndRendering(commandBuffer);
+        } else
+        {
+            vkCmdEndRenderPass(commandBuffer);
+        }
+    }
 
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+    // The transient images have to exist before the descriptor sets using them are written, so
+    // a frame graph is built for them once here. Graphs built for recording later on have the
+    // same transient images and are bound to these.
+    void createFrameTransients()
+    {
+        if (vulkanProgramInfo.postProcessingEnabled && (options.postEffects & POST_EFFECT_BLOOM) != 0)
+        {
+            sizeBloomPyramid();
+        }
+        if (vulkanProgramInfo.occlusionCullingEnabled)
+        {
+            sizeDepthPyramid();
+        }
 
-        UniformBufferObject ubo{};
-        // center model
-        ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(.0f, 0.0f, -0.5f));
-
-        // Allow model to be place upright
-        ubo.model = ubo.model * glm::rotate(glm::mat4(1.0f), 3.14f / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-
-        // Allow model to face to the front
-        ubo.model = ubo.model * glm::rotate(glm::mat4(1.0f), 2.0f, glm::vec3(.0f, 1.0f, 0.0f));
-        
-        // Rotate model
-        ubo.model = ubo.model * glm::rotate(glm::mat4(1.0f), 1.0f * glm::sin(time), glm::vec3(0.0f, 1.0f, 0.0f));
-
-        ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        ubo.proj = glm::perspective(glm::radians(45.0f),
-                                    vulkanProgramInfo.swapchainExtent.width /
-                                    (float) vulkanProgramInfo.swapchainExtent.height,
-                                    0.1f,
-                                    10.0f);
-        ubo.proj[1][1] *= -1;
+        VkRenderPassBeginInfo renderPassBeginInfo{};
+        renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassBeginInfo.renderPass = vulkanProgramInfo.renderPass;
 
-        // End of copy
-        // I copied cuz I have no idea how to use glm or chrono lol
+        RenderGraph frameGraph;
+        buildFrameGraph(frameGraph, renderPassBeginInfo);
+        frameGraph.compile();
+        frameGraph.realize(vulkanProgramInfo.renderDevice,
+                           vulkanProgramInfo.GPU,
+                           vulkanProgramInfo.frameTransients,
+                           transientQueueFamilies());
 
-        void *uniformMappedMemory;
-        vkMapMemory(vulkanProgramInfo.renderDevice,
-                    vulkanProgramInfo.uniformBufferMemories[vulkanProgramInfo.curr_frame],
-                    0,
-                    sizeof(ubo),
-                    0,
-                    &uniformMappedMemory);
+        const RenderGraphTransients &transients = vulkanProgramInfo.frameTransients;
+        if (transients.memorySize(false) > 0)
+        {
+            auto mebibytes = [](VkDeviceSize bytes)
+            {
+                return static_cast<double>(bytes) / (1024.0 * 1024.0);
+            };
 
-        memcpy(uniformMappedMemory, &ubo, sizeof(ubo));
-        vkUnmapMemory(vulkanProgramInfo.renderDevice,
-                      vulkanProgramInfo.uniformBufferMemories[vulkanProgramInfo.curr_frame]);
+            std::cout << "Frame graph transient images: " << std::fixed << std::setprecision(2)
+                      << mebibytes(transients.memorySize(true)) << " MiB aliased, "
+                      << mebibytes(transients.memorySize(false)) << " MiB without aliasing\n";
+        }
     }
 
-    void createDescriptorPool()
+    // The transient images are used by both queues with async compute, like shareWithComputeQueue
+    std::vector<uint32_t> transientQueueFamilies() const
     {
-        VkDescriptorPoolSize uniformPoolSize{};
-        uniformPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        uniformPoolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-        VkDescriptorPoolSize samplerPoolSize{};
-        samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        samplerPoolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-        std::array<VkDescriptorPoolSize, 2> poolSizes =
-                {
-                        uniformPoolSize, samplerPoolSize
-                };
+        if (!vulkanProgramInfo.asyncComputeEnabled)
+        {
+            return {};
+        }
+        return {vulkanProgramInfo.graphicsAndComputeFamilies[0], vulkanProgramInfo.graphicsAndComputeFamilies[1]};
+    }
 
-        VkDescriptorPoolCreateInfo poolInfo{};
-        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-        poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    void dumpFrameGraph(bool dot)
+    {
+        VkRenderPassBeginInfo renderPassBeginInfo{};
+        renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassBeginInfo.renderPass = vulkanProgramInfo.renderPass;
 
-        vkResult = vkCreateDescriptorPool(vulkanProgramInfo.renderDevice,
-                                          &poolInfo,
-                                          nullptr,
-                                          &vulkanProgramInfo.descriptorPool);
+        RenderGraph frameGraph;
+        buildFrameGraph(frameGraph, renderPassBeginInfo);
+        frameGraph.compile();
 
-        checkVkResult(vkResult, "Failed to create Vulkan Descriptor Pool");
+        std::cout << (dot ? frameGraph.toDot() : frameGraph.toText()) << std::flush;
+    }
 
-        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, vulkanProgramInfo.descriptorSetLayout);
-        VkDescriptorSetAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = vulkanProgramInfo.descriptorPool;
-        allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-        allocInfo.pSetLayouts = layouts.data();
+    // Picks the pipeline every group is drawn with in the frame about to be recorded. Once per
+    // frame, so all scene passes of it agree: a pipeline becoming ready between the depth
+    // pre-pass and the scene pass would change the vertex format and miss the EQUAL test.
+    void resolveGroupPipelines()
+    {
+        ShaderPermutation defaultPermutation{options.shaderFeatures};
 
-        vulkanProgramInfo.descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-        if (vkAllocateDescriptorSets(vulkanProgramInfo.renderDevice, &allocInfo,
-                                     vulkanProgramInfo.descriptorSets.data()) != VK_SUCCESS)
+        for (auto &group: vulkanProgramInfo.drawGroups)
         {
-            throw std::runtime_error("failed to allocate descriptor sets!");
-        }
-
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            group.framePipeline = vulkanProgramInfo.graphicsPipeline;
+            group.frameQuantized = group.permutation.has(SHADER_FEATURE_QUANTIZED_VERTICES);
+            if (group.permutation == defaultPermutation)
+            {
+                continue;
+            }
+
+            // Never waits: a pipeline still being created on a worker thread comes back as
+            // VK_NULL_HANDLE and the group is drawn with the fallback meanwhile
+            group.framePipeline = pipelineManager->get(group.pipelineDesc, group.pipelineKey);
+            if (group.framePipeline == VK_NULL_HANDLE)
+            {
+                group.framePipeline = vulkanProgramInfo.fallbackPipeline;
+                group.frameQuantized = false;
+                vulkanProgramInfo.fallbackDraws++;
+            }
+        }
+    }
+
+    // Binds everything the scene needs and draws it. Objects are drawn with a single instanced
+    // draw, or with one GPU written indirect draw per object when indirectDrawBuffer is given.
+    // depthOnly draws the position streams with the depth pre-pass pipelines.
+    void recordSceneDrawCommands(VkCommandBuffer commandBuffer, VkBuffer indirectDrawBuffer, bool depthOnly = false)
+    {
+        vkCmdBindIndexBuffer(commandBuffer,
+                             vulkanProgramInfo.indexBuffer,
+                             0,
+                             VK_INDEX_TYPE_UINT32);
+
+        // Every permutation shares the pipeline layout. With bindless descriptors this is the
+        // only descriptor bind of the pass, groups only push the indices they read.
+        VkDescriptorSet descriptorSet = vulkanProgramInfo.bindlessEnabled
+                                        ? vulkanProgramInfo.bindless.set()
+                                        : vulkanProgramInfo.sceneDescriptorSet;
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                vulkanProgramInfo.pipelineLayout,
+                                0,
+                                1,
+                                &descriptorSet,
+                                0,
+                                nullptr);
+
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            vkCmdBindDescriptorSets(commandBuffer,
+                                    VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    vulkanProgramInfo.pipelineLayout,
+                                    2,
+                                    1,
+                                    &vulkanProgramInfo.shadowSets[vulkanProgramInfo.curr_frame],
+                                    0,
+                                    nullptr);
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            vkCmdBindDescriptorSets(commandBuffer,
+                                    VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    vulkanProgramInfo.pipelineLayout,
+                                    3,
+                                    1,
+                                    &vulkanProgramInfo.clusterSets[vulkanProgramInfo.curr_frame],
+                                    0,
+                                    nullptr);
+        }
+
+        // Pipelines keep viewport and scissor dynamic. Dynamic resolution draws into the top left
+        // corner of the scene color image.
+        VkViewport viewport{};
+        viewport.width = (float) vulkanProgramInfo.renderExtent.width;
+        viewport.height = (float) vulkanProgramInfo.renderExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor{};
+        scissor.extent = vulkanProgramInfo.renderExtent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        auto recordingStart = std::chrono::steady_clock::now();
+        uint32_t indexCount = static_cast<uint32_t>(vertex_indices.size());
+
+        for (const auto &group: vulkanProgramInfo.drawGroups)
+        {
+            VkPipeline pipeline = group.framePipeline;
+            const VkBuffer *vertexBuffer = group.frameQuantized ? &vulkanProgramInfo.quantizedVertexBuffer
+                                                                : &vulkanProgramInfo.vertexBuffer;
+            if (depthOnly)
+            {
+                pipeline = group.frameQuantized ? vulkanProgramInfo.quantizedDepthPrepassPipeline
+                                                : vulkanProgramInfo.depthPrepassPipeline;
+                vertexBuffer = group.frameQuantized ? &vulkanProgramInfo.quantizedPositionBuffer
+                                                    : &vulkanProgramInfo.positionBuffer;
+            }
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+            VkDeviceSize offsets[] = {0};
+            vkCmdBindVertexBuffers(commandBuffer, 1, 1, vertexBuffer, offsets);
+
+            DrawPushConstants drawConstants{};
+            drawConstants.instanceBufferIndex = vulkanProgramInfo.bindlessEnabled
+                                                ? vulkanProgramInfo.instanceBufferIndices[vulkanProgramInfo.curr_frame]
+                                                : 0;
+            drawConstants.objectIndex = 0;
+            drawConstants.materialId = group.materialId;
+            drawConstants.lodBias = options.lodBias;
+
+            // The model matrix is instances[objectIndex + gl_InstanceIndex], and gl_InstanceIndex
+            // includes firstInstance. Indirect and instanced draws pass the object in firstInstance.
+            if (indirectDrawBuffer != VK_NULL_HANDLE)
+            {
+                submitDrawConstants(commandBuffer, drawConstants);
+                vkCmdDrawIndexedIndirect(commandBuffer,
+                                         indirectDrawBuffer,
+                                         group.firstObject * sizeof(VkDrawIndexedIndirectCommand),
+                                         group.objectCount,
+                                         sizeof(VkDrawIndexedIndirectCommand));
+                vulkanProgramInfo.drawsRecorded++;
+            } else if (options.drawSubmission == "instanced")
+            {
+                submitDrawConstants(commandBuffer, drawConstants);
+                vkCmdDrawIndexed(commandBuffer,
+                                 indexCount,
+                                 group.objectCount,
+                                 0,
+                                 0,
+                                 group.firstObject);
+                vulkanProgramInfo.drawsRecorded++;
+            } else
+            {
+                // One draw per object, the object only travels with the per draw data
+                for (uint32_t object = group.firstObject; object < group.firstObject + group.objectCount; object++)
+                {
+                    drawConstants.objectIndex = object;
+                    submitDrawConstants(commandBuffer, drawConstants);
+                    vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+                }
+                vulkanProgramInfo.drawsRecorded += group.objectCount;
+            }
+        }
+
+        vulkanProgramInfo.drawRecordingNanoseconds += std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - recordingStart).count();
+    }
+
+    // Hands per draw data to the next draw, as push constants or through the next slot of
+    // this frame's draw data buffer
+    void submitDrawConstants(VkCommandBuffer commandBuffer, const DrawPushConstants &drawConstants)
+    {
+        if (options.drawSubmission != "ubo")
+        {
+            vkCmdPushConstants(commandBuffer,
+                               vulkanProgramInfo.pipelineLayout,
+                               VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                               0,
+                               sizeof(drawConstants),
+                               &drawConstants);
+            return;
+        }
+
+        if (vulkanProgramInfo.drawDataCursor == vulkanProgramInfo.drawDataCapacity)
+        {
+            throw std::runtime_error("draw data buffer is full!");
+        }
+
+        uint32_t dynamicOffset = static_cast<uint32_t>(vulkanProgramInfo.drawDataCursor++ *
+                                                       vulkanProgramInfo.drawDataStride);
+        memcpy(vulkanProgramInfo.drawDataMappings[vulkanProgramInfo.curr_frame] + dynamicOffset,
+               &drawConstants,
+               sizeof(drawConstants));
+
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                vulkanProgramInfo.pipelineLayout,
+                                1,
+                                1,
+                                &vulkanProgramInfo.drawDataSets[vulkanProgramInfo.curr_frame],
+                                1,
+                                &dynamicOffset);
+    }
+
+    void createSynchronizationObjects()
+    {
+        // Acquire and present only take binary semaphores, frame completion is tracked on the timeline
+        VkSemaphoreCreateInfo nextImageReadySemaphoreCreateInfo{};
+        nextImageReadySemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VkSemaphoreCreateInfo renderFinishedSemaphoreCreateInfo{};
+        renderFinishedSemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        for (std::size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkResult = vkCreateSemaphore(vulkanProgramInfo.renderDevice,
+                                         &nextImageReadySemaphoreCreateInfo,
+                                         nullptr,
+                                         &vulkanProgramInfo.nextImageReadySemaphores[i]);
+            checkVkResult(vkResult, "Failed to create next image ready semaphore");
+
+            vkResult = vkCreateSemaphore(vulkanProgramInfo.renderDevice,
+                                         &renderFinishedSemaphoreCreateInfo,
+                                         nullptr,
+                                         &vulkanProgramInfo.renderFinishedSemaphores[i]);
+
+            checkVkResult(vkResult, "Failed to create render finished semaphore");
+        }
+    }
+
+    void createDescriptorSetLayout()
+    {
+        VkDescriptorSetLayoutBinding descriptorSetLayoutBinding{};
+        descriptorSetLayoutBinding.binding = 0;
+        descriptorSetLayoutBinding.descriptorCount = 1;
+        descriptorSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorSetLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+        VkDescriptorSetLayoutBinding textureImageSamplerDescriptorBinding{};
+        textureImageSamplerDescriptorBinding.binding = 1;
+        textureImageSamplerDescriptorBinding.descriptorCount = 1;
+        textureImageSamplerDescriptorBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        textureImageSamplerDescriptorBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorSetLayoutBinding instanceBufferDescriptorBinding{};
+        instanceBufferDescriptorBinding.binding = 2;
+        instanceBufferDescriptorBinding.descriptorCount = 1;
+        instanceBufferDescriptorBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        instanceBufferDescriptorBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+        std::array<VkDescriptorSetLayoutBinding, 3> descriptorSetLayoutBindings =
+                {
+                        descriptorSetLayoutBinding, textureImageSamplerDescriptorBinding,
+                        instanceBufferDescriptorBinding
+                };
+
+        vulkanProgramInfo.descriptorLayoutCache.init(vulkanProgramInfo.renderDevice);
+        vulkanProgramInfo.descriptorSetLayout = vulkanProgramInfo.descriptorLayoutCache.get(
+                {descriptorSetLayoutBindings.begin(), descriptorSetLayoutBindings.end()});
+    }
+
+    void createUniformBuffer()
+    {
+        vulkanProgramInfo.uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.uniformBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+
+        VkBufferCreateInfo uniformBufferCreateInfo{};
+        uniformBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        uniformBufferCreateInfo.size = sizeof(UniformBufferObject);
+        uniformBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        uniformBufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            createBuffer(uniformBufferCreateInfo,
+                         vulkanProgramInfo.renderDevice,
+                         vulkanProgramInfo.uniformBuffers[i],
+                         vulkanProgramInfo.GPU,
+                         vulkanProgramInfo.uniformBufferMemories[i],
+                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+        }
+
+    }
+
+    void createSceneObjects()
+    {
+        // Lay the copies of the mesh out on a square grid centered where the single model used to be
+        uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(options.objectCount))));
+        float spacing = 4.0f / static_cast<float>(gridSize);
+        float objectScale = std::min(1.0f, 1.5f / static_cast<float>(gridSize));
+
+        for (uint32_t i = 0; i < options.objectCount; i++)
+        {
+            float x = (static_cast<float>(i % gridSize) - static_cast<float>(gridSize - 1) / 2.0f) * spacing;
+            float y = (static_cast<float>(i / gridSize) - static_cast<float>(gridSize - 1) / 2.0f) * spacing;
+
+            vulkanProgramInfo.sceneTransforms.add(glm::vec3(x, y, -0.5f),
+                                                  glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+                                                  glm::vec3(objectScale));
+        }
+
+        if (!options.shaderPermutations)
+        {
+            vulkanProgramInfo.drawGroups.push_back({ShaderPermutation{options.shaderFeatures}, 0, options.objectCount});
+            return;
+        }
+
+        // Consecutive blocks of objects get consecutive permutations, one draw per block
+        uint32_t permutationCount = std::min<uint32_t>(SHADER_FEATURE_ALL + 1, options.objectCount);
+        for (uint32_t i = 0; i < permutationCount; i++)
+        {
+            uint32_t first = i * options.objectCount / permutationCount;
+            uint32_t last = (i + 1) * options.objectCount / permutationCount;
+            vulkanProgramInfo.drawGroups.push_back({ShaderPermutation{i}, first, last - first});
+        }
+    }
+
+    void createInstanceBuffer()
+    {
+        vulkanProgramInfo.instanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.instanceBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.instanceBufferMappings.resize(MAX_FRAMES_IN_FLIGHT);
+
+        VkBufferCreateInfo instanceBufferCreateInfo{};
+        instanceBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        instanceBufferCreateInfo.size = sizeof(InstanceData) * vulkanProgramInfo.sceneTransforms.size();
+        instanceBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        instanceBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        shareWithComputeQueue(instanceBufferCreateInfo);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            createBuffer(instanceBufferCreateInfo,
+                         vulkanProgramInfo.renderDevice,
+                         vulkanProgramInfo.instanceBuffers[i],
+                         vulkanProgramInfo.GPU,
+                         vulkanProgramInfo.instanceBufferMemories[i],
+                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+            // Keep it mapped, the transform kernels write into it every frame
+            void *mappedMemory;
+            vkResult = vkMapMemory(vulkanProgramInfo.renderDevice,
+                                   vulkanProgramInfo.instanceBufferMemories[i],
+                                   0,
+                                   instanceBufferCreateInfo.size,
+                                   0,
+                                   &mappedMemory);
+            checkVkResult(vkResult, "Failed to map instance buffer");
+
+            vulkanProgramInfo.instanceBufferMappings[i] = static_cast<InstanceData *>(mappedMemory);
+        }
+    }
+
+    void updateUniformBuffer()
+    {
+        // Copied from vulkan-tutorial.com
+        static auto startTime = std::chrono::high_resolution_clock::now();
+
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+        // Objects stand still with --static-scene, otherwise they move every frame
+        if (options.staticScene)
+        {
+            time = 0.0f;
+        } else
+        {
+            vulkanProgramInfo.sceneVersion++;
+        }
+
+        UniformBufferObject ubo{};
+
+        // Allow model to be place upright, face to the front and rotate it
+        glm::quat objectRotation = glm::angleAxis(3.14f / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f)) *
+                                   glm::angleAxis(2.0f + 1.0f * glm::sin(time), glm::vec3(0.0f, 1.0f, 0.0f));
+
+        TransformStore &transforms = vulkanProgramInfo.sceneTransforms;
+        for (std::size_t i = 0; i < transforms.size(); i++)
+        {
+            transforms.setRotation(i, objectRotation);
+        }
+
+        ShadowCamera camera{};
+        camera.position = glm::vec3(2.0f, 2.0f, 1.0f);
+        camera.forward = glm::normalize(-camera.position);
+        camera.fovY = glm::radians(45.0f);
+        camera.aspect = vulkanProgramInfo.swapchainExtent.width / (float) vulkanProgramInfo.swapchainExtent.height;
+        camera.nearPlane = 0.1f;
+        camera.farPlane = 10.0f;
+
+        ubo.view = glm::lookAt(camera.position, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        ubo.proj = glm::perspective(camera.fovY, camera.aspect, camera.nearPlane, camera.farPlane);
+        ubo.proj[1][1] *= -1;
+
+        // End of copy
+        // I copied cuz I have no idea how to use glm or chrono lol
+
+        // Model and MVP of every object go straight into this frame's mapped instance buffer
+        composeInstanceMatrices(transforms,
+                                ubo.proj * ubo.view,
+                                vulkanProgramInfo.instanceBufferMappings[vulkanProgramInfo.curr_frame]);
+        ubo.model = vulkanProgramInfo.instanceBufferMappings[vulkanProgramInfo.curr_frame][0].model;
+
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            updateShadowCascades(camera);
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            updateClusterLights(camera, ubo.view, ubo.proj, time);
+        }
+        if (vulkanProgramInfo.deferredShadingEnabled)
+        {
+            updateDeferredUniforms(ubo.view, ubo.proj);
+        }
+        if (vulkanProgramInfo.particlesEnabled)
+        {
+            updateParticles(camera, ubo.view, ubo.proj);
+        }
+
+        void *uniformMappedMemory;
+        vkMapMemory(vulkanProgramInfo.renderDevice,
+                    vulkanProgramInfo.uniformBufferMemories[vulkanProgramInfo.curr_frame],
+                    0,
+                    sizeof(ubo),
+                    0,
+                    &uniformMappedMemory);
+
+        memcpy(uniformMappedMemory, &ubo, sizeof(ubo));
+        vkUnmapMemory(vulkanProgramInfo.renderDevice,
+                      vulkanProgramInfo.uniformBufferMemories[vulkanProgramInfo.curr_frame]);
+    }
+
+    // Written into the scene set with one template update, see sceneDescriptorTemplate
+    struct SceneDescriptorData
+    {
+        VkDescriptorBufferInfo uniformBuffer;
+        VkDescriptorImageInfo texture;
+        VkDescriptorBufferInfo instanceBuffer;
+    };
+
+    void createDescriptorAllocators()
+    {
+        // Pools hold about one of each descriptor type per set, that is what the sets here use
+        std::vector<DescriptorPoolSizeRatio> poolSizeRatios =
+                {
+                        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         1.0f},
+                        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0.5f},
+                        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f},
+                        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         1.0f},
+                        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          1.0f},
+                        {VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,       1.0f}
+                };
+
+        // Sets with more of a type than that get pools sized from their cached layouts
+        vulkanProgramInfo.persistentDescriptors.init(vulkanProgramInfo.renderDevice, 8, poolSizeRatios,
+                                                     &vulkanProgramInfo.descriptorLayoutCache);
+
+        vulkanProgramInfo.frameDescriptors.resize(MAX_FRAMES_IN_FLIGHT);
+        for (auto &frameAllocator: vulkanProgramInfo.frameDescriptors)
+        {
+            frameAllocator.init(vulkanProgramInfo.renderDevice, 16, poolSizeRatios,
+                                &vulkanProgramInfo.descriptorLayoutCache);
+        }
+
+        vulkanProgramInfo.sceneDescriptorTemplate.create(
+                vulkanProgramInfo.renderDevice,
+                vulkanProgramInfo.descriptorSetLayout,
+                {
+                        {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         1, offsetof(SceneDescriptorData, uniformBuffer),  0},
+                        {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, offsetof(SceneDescriptorData, texture),        0},
+                        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         1, offsetof(SceneDescriptorData, instanceBuffer), 0}
+                },
+                vulkanProgramInfo.descriptorUpdateTemplateAvailable);
+    }
+
+    // Frame boundary: the sets of the last use of this frame slot are no longer read by the
+    // GPU, so its allocator is reset and the scene set allocated and written anew
+    void allocateFrameDescriptors()
+    {
+        DescriptorAllocator &frameAllocator = vulkanProgramInfo.frameDescriptors[vulkanProgramInfo.curr_frame];
+        frameAllocator.reset();
+
+        if (vulkanProgramInfo.bindlessEnabled)
+        {
+            return;
+        }
+
+        // Pre-recorded command buffers bind the set they were recorded with, so with them every
+        // frame slot writes its set once and keeps it
+        VkDescriptorSet *staticSet = vulkanProgramInfo.staticCommandBuffers
+                                     ? &vulkanProgramInfo.staticSceneDescriptorSets[vulkanProgramInfo.curr_frame]
+                                     : nullptr;
+        if (staticSet != nullptr && *staticSet != VK_NULL_HANDLE)
+        {
+            vulkanProgramInfo.sceneDescriptorSet = *staticSet;
+            return;
+        }
+
+        SceneDescriptorData sceneDescriptorData{};
+        sceneDescriptorData.uniformBuffer.buffer = vulkanProgramInfo.uniformBuffers[vulkanProgramInfo.curr_frame];
+        sceneDescriptorData.uniformBuffer.offset = 0;
+        sceneDescriptorData.uniformBuffer.range = sizeof(UniformBufferObject);
+        sceneDescriptorData.texture.imageView = vulkanProgramInfo.textureImageView;
+        sceneDescriptorData.texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        sceneDescriptorData.texture.sampler = vulkanProgramInfo.textureImageSampler;
+        sceneDescriptorData.instanceBuffer.buffer = vulkanProgramInfo.instanceBuffers[vulkanProgramInfo.curr_frame];
+        sceneDescriptorData.instanceBuffer.offset = 0;
+        sceneDescriptorData.instanceBuffer.range = VK_WHOLE_SIZE;
+
+        DescriptorAllocator &allocator = staticSet != nullptr ? vulkanProgramInfo.persistentDescriptors : frameAllocator;
+        vulkanProgramInfo.sceneDescriptorSet = allocator.allocate(vulkanProgramInfo.descriptorSetLayout);
+        vulkanProgramInfo.sceneDescriptorTemplate.update(vulkanProgramInfo.sceneDescriptorSet, &sceneDescriptorData);
+        if (staticSet != nullptr)
+        {
+            *staticSet = vulkanProgramInfo.sceneDescriptorSet;
+        }
+    }
+
+    void createDrawDataBuffers()
+    {
+        VkPhysicalDeviceProperties physicalDeviceProperties{};
+        vkGetPhysicalDeviceProperties(vulkanProgramInfo.GPU, &physicalDeviceProperties);
+
+        // Every draw gets its own slot at a dynamic offset. One draw per object, plus one per group
+        // for instanced and indirect draws, in both occlusion culling passes.
+        VkDeviceSize alignment = physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
+        vulkanProgramInfo.drawDataStride = (sizeof(DrawPushConstants) + alignment - 1) / alignment * alignment;
+        vulkanProgramInfo.drawDataCapacity = 2 * (options.objectCount +
+                                                  static_cast<uint32_t>(vulkanProgramInfo.drawGroups.size()));
+
+        VkDescriptorSetLayoutBinding drawDataBinding{};
+        drawDataBinding.binding = 0;
+        drawDataBinding.descriptorCount = 1;
+        drawDataBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        drawDataBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        vulkanProgramInfo.drawDataSetLayout = vulkanProgramInfo.descriptorLayoutCache.get({drawDataBinding});
+
+        // The sets point at whole buffers that live until exit, so they come from the persistent allocator
+        vulkanProgramInfo.drawDataSets.resize(MAX_FRAMES_IN_FLIGHT);
+        for (auto &drawDataSet: vulkanProgramInfo.drawDataSets)
+        {
+            drawDataSet = vulkanProgramInfo.persistentDescriptors.allocate(vulkanProgramInfo.drawDataSetLayout);
+        }
+
+        VkBufferCreateInfo drawDataBufferCreateInfo{};
+        drawDataBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        drawDataBufferCreateInfo.size = vulkanProgramInfo.drawDataStride * vulkanProgramInfo.drawDataCapacity;
+        drawDataBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        drawDataBufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+
+        vulkanProgramInfo.drawDataBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.drawDataBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.drawDataMappings.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            createBuffer(drawDataBufferCreateInfo,
+                         vulkanProgramInfo.renderDevice,
+                         vulkanProgramInfo.drawDataBuffers[i],
+                         vulkanProgramInfo.GPU,
+                         vulkanProgramInfo.drawDataBufferMemories[i],
+                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+            void *mappedMemory;
+            vkResult = vkMapMemory(vulkanProgramInfo.renderDevice,
+                                   vulkanProgramInfo.drawDataBufferMemories[i],
+                                   0,
+                                   drawDataBufferCreateInfo.size,
+                                   0,
+                                   &mappedMemory);
+            checkVkResult(vkResult, "Failed to map draw data buffer");
+            vulkanProgramInfo.drawDataMappings[i] = static_cast<char *>(mappedMemory);
+
+            VkDescriptorBufferInfo bufferInfo{};
+            bufferInfo.buffer = vulkanProgramInfo.drawDataBuffers[i];
+            bufferInfo.offset = 0;
+            bufferInfo.range = sizeof(DrawPushConstants);
+
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = vulkanProgramInfo.drawDataSets[i];
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+
+            vkUpdateDescriptorSets(vulkanProgramInfo.renderDevice, 1, &descriptorWrite, 0, nullptr);
+        }
+    }
+
+    void createBindlessDescriptors()
+    {
+        vulkanProgramInfo.bindless.create(vulkanProgramInfo.renderDevice,
+                                          vulkanProgramInfo.textureImageSampler,
+                                          vulkanProgramInfo.maxBindlessTextures,
+                                          vulkanProgramInfo.maxBindlessBuffers);
+
+        // The instance buffer of every frame in flight gets a slot, shaders pick theirs by index
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vulkanProgramInfo.instanceBufferIndices.push_back(
+                    vulkanProgramInfo.bindless.addBuffer(vulkanProgramInfo.instanceBuffers[i]));
+        }
+
+        uint32_t sceneTextureIndex = vulkanProgramInfo.bindless.addTexture(vulkanProgramInfo.textureImageView);
+        for (auto &group: vulkanProgramInfo.drawGroups)
+        {
+            group.materialId = sceneTextureIndex;
+        }
+
+        std::cout << "Bindless descriptors: " << vulkanProgramInfo.maxBindlessTextures << " texture and "
+                  << vulkanProgramInfo.maxBindlessBuffers << " buffer slots" << std::endl;
+    }
+
+    void drawFrame()
+    {
+        // The last submission of this frame slot has to be done before its command buffer, uniform
+        // buffer and descriptor sets are reused. Nothing needs resetting, so an acquire that fails
+        // below leaves the slot as it was.
+        vulkanProgramInfo.timeline.wait(vulkanProgramInfo.frameTimelineValues[vulkanProgramInfo.curr_frame]);
+        if (vulkanProgramInfo.asyncComputeEnabled)
+        {
+            vulkanProgramInfo.computeTimeline.wait(
+                    vulkanProgramInfo.frameComputeTimelineValues[vulkanProgramInfo.curr_frame]);
+        }
+        vulkanProgramInfo.deletionQueue.collect(vulkanProgramInfo.timeline.completed());
+        vulkanProgramInfo.gpuProfiler.collect(static_cast<uint32_t>(vulkanProgramInfo.curr_frame));
+        updateRenderScale();
+        recordShadowFrameTime();
+        collectLightStatistics();
+
+        vkResult = vkAcquireNextImageKHR(vulkanProgramInfo.renderDevice,
+                                         vulkanProgramInfo.swapchain,
+                                         UINT64_MAX,
+                                         vulkanProgramInfo.nextImageReadySemaphores[vulkanProgramInfo.curr_frame],
+                                         VK_NULL_HANDLE,
+                                         &vulkanProgramInfo.activeSwapchainImage);
+        if (vkResult == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            return;
+        }
+        if (vkResult != VK_SUBOPTIMAL_KHR)
+        {
+            checkFrameVkResult(vkResult, "Failed to acquire swapchain image");
+        }
+        auto frameCpuStart = std::chrono::steady_clock::now();
+
+        swapReloadedPipelines();
+        allocateFrameDescriptors();
+
+        updateUniformBuffer();
+
+        std::vector<FrameSubmission> submissions = vulkanProgramInfo.staticCommandBuffers ? staticFrameSubmissions()
+                                                                                           : recordCommandBuffer();
+
+        // Graphics batches signal the main timeline and compute batches the compute one. A batch
+        // after a queue switch waits for the batch before it. The first compute batch needs no
+        // wait on last frame's graphics work: the last compute batch of last frame already
+        // waited for everything it could conflict with, and the graph's barriers chain on that.
+        bool imageWaited = false;
+        uint64_t graphicsValue = 0;
+        uint64_t computeValue = 0;
+        for (std::size_t i = 0; i < submissions.size(); i++)
+        {
+            bool compute = submissions[i].queue == RenderGraphQueue::Compute;
+            bool last = i + 1 == submissions.size();
+
+            // Presentation waits on the binary semaphore, the CPU and other queues on the
+            // timelines. Values given for binary semaphores are ignored.
+            std::vector<VkSemaphore> waitSemaphores;
+            std::vector<uint64_t> waitValues;
+            std::vector<VkPipelineStageFlags> waitStages;
+            if (!imageWaited && (!compute || last))
+            {
+                waitSemaphores.push_back(vulkanProgramInfo.nextImageReadySemaphores[vulkanProgramInfo.curr_frame]);
+                waitValues.push_back(0);
+                waitStages.push_back(compute ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+                                             : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+                imageWaited = true;
+            }
+            if (i > 0 && submissions[i - 1].queue != submissions[i].queue)
+            {
+                waitSemaphores.push_back(compute ? vulkanProgramInfo.timeline.semaphore()
+                                                 : vulkanProgramInfo.computeTimeline.semaphore());
+                waitValues.push_back(compute ? graphicsValue : computeValue);
+                waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+            }
+
+            GpuTimeline &signalTimeline = compute ? vulkanProgramInfo.computeTimeline : vulkanProgramInfo.timeline;
+            uint64_t &signalValue = compute ? computeValue : graphicsValue;
+            signalValue = signalTimeline.next();
+
+            std::vector<VkSemaphore> signalSemaphores = {signalTimeline.semaphore()};
+            std::vector<uint64_t> signalValues = {signalValue};
+            if (last)
+            {
+                signalSemaphores.push_back(vulkanProgramInfo.renderFinishedSemaphores[vulkanProgramInfo.curr_frame]);
+                signalValues.push_back(0);
+            }
+
+            VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+            timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            timelineSubmitInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+            timelineSubmitInfo.pWaitSemaphoreValues = waitValues.data();
+            timelineSubmitInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+            timelineSubmitInfo.pSignalSemaphoreValues = signalValues.data();
+
+            VkSubmitInfo submitCmdBuffer{};
+            submitCmdBuffer.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitCmdBuffer.pNext = &timelineSubmitInfo;
+            submitCmdBuffer.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+            submitCmdBuffer.pWaitSemaphores = waitSemaphores.data();
+            submitCmdBuffer.pWaitDstStageMask = waitStages.data();
+            submitCmdBuffer.commandBufferCount = 1;
+            submitCmdBuffer.pCommandBuffers = &submissions[i].commandBuffer;
+            submitCmdBuffer.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+            submitCmdBuffer.pSignalSemaphores = signalSemaphores.data();
+
+            vkResult = vkQueueSubmit(compute ? vulkanProgramInfo.computeQueue : vulkanProgramInfo.graphicsQueue,
+                                     1,
+                                     &submitCmdBuffer,
+                                     VK_NULL_HANDLE);
+
+            checkFrameVkResult(vkResult, "Failed to submit command buffer");
+        }
+        vulkanProgramInfo.frameTimelineValues[vulkanProgramInfo.curr_frame] = vulkanProgramInfo.timeline.submitted();
+        vulkanProgramInfo.frameComputeTimelineValues[vulkanProgramInfo.curr_frame] =
+                vulkanProgramInfo.asyncComputeEnabled ? vulkanProgramInfo.computeTimeline.submitted() : 0;
+
+        uint32_t renderedImageIndices[] = {vulkanProgramInfo.activeSwapchainImage};
+
+        VkPresentInfoKHR presentInfo{};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = &vulkanProgramInfo.renderFinishedSemaphores[vulkanProgramInfo.curr_frame];
+        presentInfo.pImageIndices = renderedImageIndices;
+        presentInfo.swapchainCount = 1;
+        presentInfo.pSwapchains = &vulkanProgramInfo.swapchain;
+        presentInfo.pResults = nullptr;
+
+        vkQueuePresentKHR(vulkanProgramInfo.presentQueue,
+                          &presentInfo);
+
+        if (options.benchFrames > 0)
+        {
+            vulkanProgramInfo.frameCpuMilliseconds.push_back(std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - frameCpuStart).count());
+        }
+    }
+
+    // The command buffers of the acquired image in this frame slot, recorded again only when
+    // they are older than commandGeneration
+    std::vector<FrameSubmission> staticFrameSubmissions()
+    {
+        uint32_t pipelineGeneration = pipelineManager->generation();
+        if (pipelineGeneration != vulkanProgramInfo.observedPipelineGeneration)
+        {
+            vulkanProgramInfo.observedPipelineGeneration = pipelineGeneration;
+            vulkanProgramInfo.commandGeneration++;
+        }
+
+        auto frame = static_cast<uint32_t>(vulkanProgramInfo.curr_frame);
+        StaticFrameCommands &commands = vulkanProgramInfo.staticFrameCommands[
+                vulkanProgramInfo.activeSwapchainImage * MAX_FRAMES_IN_FLIGHT + frame];
+        if (commands.generation != vulkanProgramInfo.commandGeneration)
+        {
+            commands.submissions = recordCommandBuffer(&commands);
+            commands.generation = vulkanProgramInfo.commandGeneration;
+            vulkanProgramInfo.staticRecordings++;
+        } else
+        {
+            vulkanProgramInfo.gpuProfiler.resubmitFrame(frame);
+        }
+        return commands.submissions;
+    }
+
+    // Frame boundary: pipelines rebuilt by the shader watcher replace the current ones. The old
+    // ones may still be used by the frames submitted so far, so they are retired with the last
+    // submitted timeline value.
+    void swapReloadedPipelines()
+    {
+        vulkanProgramInfo.frameNumber++;
+
+        if (shaderHotReloader)
+        {
+            for (VkPipeline replaced: shaderHotReloader->applyPendingSwaps())
+            {
+                vulkanProgramInfo.deletionQueue.retire(replaced, vulkanProgramInfo.timeline.submitted());
+                vulkanProgramInfo.commandGeneration++;
+            }
+        }
+    }
+
+    void programLoop()
+    {
+        while (!glfwWindowShouldClose(vulkanProgramInfo.window))
+        {
+            if (options.benchFrames > 0 && vulkanProgramInfo.frameCpuMilliseconds.size() >= options.benchFrames)
+            {
+                break;
+            }
+            if (lightBenchmarkFinished() || particleVerificationFinished())
+            {
+                break;
+            }
+            glfwPollEvents();
+            drawFrame();
+            vulkanProgramInfo.curr_frame = (vulkanProgramInfo.curr_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+        }
+        vkDeviceWaitIdle(vulkanProgramInfo.renderDevice);
+
+        if (shaderHotReloader)
+        {
+            shaderHotReloader->stop();
+            for (VkPipeline replaced: shaderHotReloader->applyPendingSwaps())
+            {
+                vulkanProgramInfo.deletionQueue.retire(replaced, vulkanProgramInfo.timeline.submitted());
+            }
+        }
+        vulkanProgramInfo.deletionQueue.collect(vulkanProgramInfo.timeline.completed());
+    }
+
+    void cleanup() const
+    {
+        pipelineJobs->waitIdle();
+        if (pipelineManager->pipelinesCreated() + pipelineManager->descsDeduplicated() > 0)
+        {
+            std::cout << "Pipeline manager: " << pipelineManager->pipelinesCreated() << " pipelines built in "
+                      << pipelineManager->creationMilliseconds() << " ms, "
+                      << pipelineManager->descsDeduplicated() << " shared with an identical one, "
+                      << vulkanProgramInfo.fallbackDraws << " draws with the fallback pipeline" << std::endl;
+        }
+        pipelineManager->destroy();
+
+        if (vulkanProgramInfo.frameNumber > 0)
+        {
+            double frames = static_cast<double>(vulkanProgramInfo.frameNumber);
+            std::cout << "Draw submission (" << options.drawSubmission << "): "
+                      << static_cast<double>(vulkanProgramInfo.drawsRecorded) / frames << " draws per frame, "
+                      << vulkanProgramInfo.drawRecordingNanoseconds / frames / 1000.0 << " us recording per frame, "
+                      << vulkanProgramInfo.drawRecordingNanoseconds /
+                         static_cast<double>(std::max<uint64_t>(vulkanProgramInfo.drawsRecorded, 1))
+                      << " ns per draw" << std::endl;
+            if (vulkanProgramInfo.staticCommandBuffers)
+            {
+                std::cout << "Static command buffers: recorded " << vulkanProgramInfo.staticRecordings
+                          << " times in " << vulkanProgramInfo.frameNumber << " frames" << std::endl;
+            }
+
+            uint64_t frameSets = 0;
+            std::size_t framePools = 0;
+            for (const auto &frameAllocator: vulkanProgramInfo.frameDescriptors)
+            {
+                frameSets += frameAllocator.setsAllocated();
+                framePools += frameAllocator.poolCount();
+            }
+            std::cout << "Descriptors: " << static_cast<double>(frameSets) / frames << " sets per frame from "
+                      << framePools << " frame pools, "
+                      << vulkanProgramInfo.persistentDescriptors.setsAllocated() << " persistent sets, "
+                      << vulkanProgramInfo.descriptorLayoutCache.layoutCount() << " layouts, "
+                      << vulkanProgramInfo.descriptorLayoutCache.hits() << " layout cache hits, "
+                      << (vulkanProgramInfo.sceneDescriptorTemplate.usesTemplate() ? "update templates"
+                                                                                   : "plain descriptor writes")
+                      << std::endl;
+        }
+        vulkanProgramInfo.gpuProfiler.print(std::cout);
+        if (vulkanProgramInfo.depthPrepassEnabled && vulkanProgramInfo.gpuProfiler.enabled())
+        {
+            // The pre-pass pays off when the scene pass of a run without it takes longer than both
+            double prepass = vulkanProgramInfo.gpuProfiler.averageMilliseconds("depth prepass");
+            double scene = vulkanProgramInfo.gpuProfiler.averageMilliseconds("scene");
+            std::cout << "Depth pre-pass: " << prepass << " ms + scene " << scene << " ms = " << prepass + scene
+                      << " ms, compare with the scene pass without --depth-prepass" << std::endl;
+        }
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            reportShadowCascades();
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            reportClusteredLights();
+        }
+        if (vulkanProgramInfo.dynamicResolutionEnabled)
+        {
+            const DynamicResolutionController &controller = vulkanProgramInfo.resolutionController;
+            std::cout << "Dynamic resolution: mean scale " << controller.averageScale() << ", "
+                      << controller.scaleChanges() << " changes, ended at " << vulkanProgramInfo.renderExtent.width
+                      << "x" << vulkanProgramInfo.renderExtent.height << std::endl;
+        }
+        if (vulkanProgramInfo.postProcessingEnabled)
+        {
+            reportPostProcessing();
+        }
+        if (vulkanProgramInfo.particlesEnabled)
+        {
+            reportParticles();
+        }
+
+        if (options.benchFrames > 0)
+        {
+            printFrameTimeBenchmark(vulkanProgramInfo.frameCpuMilliseconds,
+                                    std::string(buildProfileName()) + " build, validation " +
+                                    validationModeName(vulkanProgramInfo.validation) + ", " +
+                                    std::to_string(vulkanProgramInfo.msaaSamples) + "x MSAA" +
+                                    (vulkanProgramInfo.depthPrepassEnabled ? ", depth pre-pass" : "") +
+                                    (vulkanProgramInfo.deferredShadingEnabled ? ", deferred shading" : "") +
+                                    (vulkanProgramInfo.postProcessingEnabled ? ", post-processing" : "") +
+                                    (vulkanProgramInfo.particlesEnabled
+                                     ? ", " + std::to_string(vulkanProgramInfo.particleCapacity) + " particles"
+                                     : std::string()) +
+                                    (vulkanProgramInfo.shadowsEnabled
+                                     ? ", " + std::to_string(vulkanProgramInfo.shadowCascades.cascadeCount()) +
+                                       " shadow cascades"
+                                     : std::string()),
+                                    vulkanProgramInfo.gpuProfiler.averageFrameMilliseconds());
+            printMsaaMemoryTable();
+        }
+
+        if (vulkanProgramInfo.ownsFallbackPipeline)
+        {
+            vkDestroyPipeline(vulkanProgramInfo.renderDevice, vulkanProgramInfo.fallbackPipeline, nullptr);
+        }
+
+        if (vulkanProgramInfo.occlusionCullingEnabled)
+        {
+            destroyOcclusionCullingResources();
+        }
+
+        vkDestroyPipeline(vulkanProgramInfo.renderDevice, vulkanProgramInfo.depthPrepassPipeline, nullptr);
+        vkDestroyPipeline(vulkanProgramInfo.renderDevice, vulkanProgramInfo.quantizedDepthPrepassPipeline, nullptr);
+
+        if (vulkanProgramInfo.dynamicResolutionEnabled)
+        {
+            destroyDynamicResolutionResources();
+        }
+
+        if (vulkanProgramInfo.postProcessingEnabled)
+        {
+            destroyPostProcessingResources();
+        }
+        vulkanProgramInfo.frameTransients.destroy(vulkanProgramInfo.renderDevice);
+
+        if (vulkanProgramInfo.particlesEnabled)
+        {
+            destroyParticleSystem();
+        }
+
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            destroyShadowResources();
+        }
+
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            destroyClusteredLightResources();
+        }
+
+        if (vulkanProgramInfo.deferredShadingEnabled)
+        {
+            destroyDeferredShadingResources();
+        }
+
+        if (vulkanProgramInfo.msaaColorImage != VK_NULL_HANDLE)
+        {
+            vkDestroyImageView(vulkanProgramInfo.renderDevice, vulkanProgramInfo.msaaColorImageView, nullptr);
+            vkDestroyImage(vulkanProgramInfo.renderDevice, vulkanProgramInfo.msaaColorImage, nullptr);
+            vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.msaaColorImageMemory, nullptr);
+        }
+
+        vkDestroyImage(vulkanProgramInfo.renderDevice,
+                       vulkanProgramInfo.depthImage,
+                       nullptr);
+        vkDestroyImageView(vulkanProgramInfo.renderDevice,
+                           vulkanProgramInfo.depthImageView,
+                           nullptr);
+        vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.depthImageMemory, nullptr);
+
+        vkDestroySampler(vulkanProgramInfo.renderDevice, vulkanProgramInfo.textureImageSampler, nullptr);
+
+        // Destroy image and free image memory afterwards
+        vkDestroyImageView(vulkanProgramInfo.renderDevice, vulkanProgramInfo.textureImageView, nullptr);
+        vkDestroyImage(vulkanProgramInfo.renderDevice, vulkanProgramInfo.textureImage, nullptr);
+        vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.textureImageMemory, nullptr);
+
+        vulkanProgramInfo.sceneDescriptorTemplate.destroy();
+        vulkanProgramInfo.persistentDescriptors.destroy();
+        for (const auto &frameAllocator: vulkanProgramInfo.frameDescriptors)
+        {
+            frameAllocator.destroy();
+        }
+
+        // Uniform buffers
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkDestroyBuffer(vulkanProgramInfo.renderDevice,
+                            vulkanProgramInfo.uniformBuffers[i],
+                            nullptr);
+
+            vkFreeMemory(vulkanProgramInfo.renderDevice,
+                         vulkanProgramInfo.uniformBufferMemories[i],
+                         nullptr);
+        }
+        // Instance buffers stay mapped for their whole life time
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkUnmapMemory(vulkanProgramInfo.renderDevice,
+                          vulkanProgramInfo.instanceBufferMemories[i]);
+
+            vkDestroyBuffer(vulkanProgramInfo.renderDevice,
+                            vulkanProgramInfo.instanceBuffers[i],
+                            nullptr);
+
+            vkFreeMemory(vulkanProgramInfo.renderDevice,
+                         vulkanProgramInfo.instanceBufferMemories[i],
+                         nullptr);
+        }
+
+        vulkanProgramInfo.descriptorLayoutCache.destroy();
+
+        if (vulkanProgramInfo.bindlessEnabled)
+        {
+            vulkanProgramInfo.bindless.destroy();
+        }
+
+        for (std::size_t i = 0; i < vulkanProgramInfo.drawDataBuffers.size(); i++)
+        {
+            vkUnmapMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.drawDataBufferMemories[i]);
+            vkDestroyBuffer(vulkanProgramInfo.renderDevice, vulkanProgramInfo.drawDataBuffers[i], nullptr);
+            vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.drawDataBufferMemories[i], nullptr);
+        }
+
+        vkFreeMemory(vulkanProgramInfo.renderDevice,
+                     vulkanProgramInfo.indexBufferMemory,
+                     nullptr);
+        vkDestroyBuffer(vulkanProgramInfo.renderDevice,
+                        vulkanProgramInfo.indexBuffer,
+                        nullptr);
+
+        vkFreeMemory(vulkanProgramInfo.renderDevice,
+                     vulkanProgramInfo.vertexBufferMemory,
+                     nullptr);
+
+        vkDestroyBuffer(vulkanProgramInfo.renderDevice,
+                        vulkanProgramInfo.vertexBuffer,
+                        nullptr);
+
+        vkDestroyBuffer(vulkanProgramInfo.renderDevice, vulkanProgramInfo.quantizedVertexBuffer, nullptr);
+        vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.quantizedVertexBufferMemory, nullptr);
+        vkDestroyBuffer(vulkanProgramInfo.renderDevice, vulkanProgramInfo.positionBuffer, nullptr);
+        vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.positionBufferMemory, nullptr);
+        vkDestroyBuffer(vulkanProgramInfo.renderDevice, vulkanProgramInfo.quantizedPositionBuffer, nullptr);
+        vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.quantizedPositionBufferMemory, nullptr);
+
+        for (std::size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkDestroySemaphore(vulkanProgramInfo.renderDevice,
+                               vulkanProgramInfo.renderFinishedSemaphores[i],
+                               nullptr);
+
+            vkDestroySemaphore(vulkanProgramInfo.renderDevice,
+                               vulkanProgramInfo.nextImageReadySemaphores[i],
+                               nullptr);
+        }
+        vulkanProgramInfo.timeline.destroy();
+        if (vulkanProgramInfo.asyncComputeEnabled)
+        {
+            vulkanProgramInfo.computeTimeline.destroy();
+        }
+        vulkanProgramInfo.gpuProfiler.destroy();
+
+        if (vulkanProgramInfo.computeCommandPool != vulkanProgramInfo.commandPool)
+        {
+            vkDestroyCommandPool(vulkanProgramInfo.renderDevice, vulkanProgramInfo.computeCommandPool, nullptr);
+        }
+        if (vulkanProgramInfo.transferCommandPool != vulkanProgramInfo.commandPool)
+        {
+            vkDestroyCommandPool(vulkanProgramInfo.renderDevice, vulkanProgramInfo.transferCommandPool, nullptr);
+        }
+        vkDestroyCommandPool(vulkanProgramInfo.renderDevice,
+                             vulkanProgramInfo.commandPool,
+                             nullptr);
+
+        for (const VkFramebuffer &swapchainFramebuffer: vulkanProgramInfo.swapchainFramebuffers)
+        {
+            vkDestroyFramebuffer(vulkanProgramInfo.renderDevice,
+                                 swapchainFramebuffer,
+                                 nullptr);
+        }
+
+        vkDestroyPipeline(vulkanProgramInfo.renderDevice,
+                          vulkanProgramInfo.graphicsPipeline,
+                          nullptr);
+
+        vkDestroyPipelineLayout(vulkanProgramInfo.renderDevice,
+                                vulkanProgramInfo.pipelineLayout,
+                                nullptr);
+        vkDestroyRenderPass(vulkanProgramInfo.renderDevice,
+                            vulkanProgramInfo.renderPass,
+                            nullptr);
+        vkDestroyRenderPass(vulkanProgramInfo.renderDevice, vulkanProgramInfo.lateRenderPass, nullptr);
+        for (const auto &imageView: vulkanProgramInfo.swapchainImageViews)
+        {
+            vkDestroyImageView(vulkanProgramInfo.renderDevice,
+                               imageView,
+                               nullptr);
+        }
+        vkDestroySwapchainKHR(vulkanProgramInfo.renderDevice,
+                              vulkanProgramInfo.swapchain,
+                              nullptr);
+
+        vkDestroyDevice(vulkanProgramInfo.renderDevice,
+                        nullptr);
+
+        // Find function to destroy debug messenger
+        if (debugMessenger != VK_NULL_HANDLE)
+        {
+            auto destroyDebugMessenger = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(
+                    vulkanProgramInfo.vulkanInstance,
+                    "vkDestroyDebugUtilsMessengerEXT"
+            );
+            destroyDebugMessenger(vulkanProgramInfo.vulkanInstance,
+                                  debugMessenger,
+                                  nullptr);
+        }
+
+        vkDestroySurfaceKHR(vulkanProgramInfo.vulkanInstance,
+                            vulkanProgramInfo.windowSurface,
+                            nullptr);
+
+        vkDestroyInstance(vulkanProgramInfo.vulkanInstance, nullptr);
+
+        glfwDestroyWindow(vulkanProgramInfo.window);
+
+    }
+
+    // Adds the validation layer and what it needs when options.validation asks for it. Without
+    // an installed layer the program runs unvalidated rather than failing instance creation.
+    void enableValidation()
+    {
+        vulkanProgramInfo.validation = options.validation;
+        std::cout << "Build profile " << buildProfileName() << ", validation "
+                  << validationModeName(vulkanProgramInfo.validation) << std::endl;
+        if (vulkanProgramInfo.validation == ValidationMode::Off)
+        {
+            return;
+        }
+
+        const char *validationLayer = "VK_LAYER_KHRONOS_validation";
+
+        uint32_t layerCount;
+        vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+        std::vector<VkLayerProperties> layers(layerCount);
+        vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+
+        bool layerFound = std::any_of(layers.begin(), layers.end(), [&](const VkLayerProperties &layer)
+        {
+            return strcmp(layer.layerName, validationLayer) == 0;
+        });
+        if (!layerFound)
+        {
+            std::cout << validationLayer << " is not installed, running without validation" << std::endl;
+            vulkanProgramInfo.validation = ValidationMode::Off;
+            return;
+        }
+
+        vulkanProgramInfo.layerEnabled.push_back(validationLayer);
+        vulkanProgramInfo.instanceExtensionsEnabled.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+
+        // GPU-assisted validation is switched on through an extension of the layer itself
+        if (vulkanProgramInfo.validation == ValidationMode::GpuAssisted)
+        {
+            uint32_t extensionCount;
+            vkEnumerateInstanceExtensionProperties(validationLayer, &extensionCount, nullptr);
+            std::vector<VkExtensionProperties> extensions(extensionCount);
+            vkEnumerateInstanceExtensionProperties(validationLayer, &extensionCount, extensions.data());
+
+            bool featuresFound = std::any_of(extensions.begin(), extensions.end(),
+                                             [](const VkExtensionProperties &extension)
+                                             {
+                                                 return strcmp(extension.extensionName,
+                                                               VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME) == 0;
+                                             });
+            if (featuresFound)
+            {
+                vulkanProgramInfo.instanceExtensionsEnabled.push_back(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+            } else
+            {
+                std::cout << "The validation layer has no " << VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME
+                          << ", running without GPU-assisted validation" << std::endl;
+                vulkanProgramInfo.validation = ValidationMode::Layer;
+            }
+        }
+    }
+
+    void addAdditionalInstanceExtensions()
+    {
+        uint32_t extensionPptCount;
+        vkEnumerateInstanceExtensionProperties(nullptr,
+                                               &extensionPptCount,
+                                               nullptr);
+
+        std::vector<VkExtensionProperties> extensionPptList(extensionPptCount);
+
+        vkEnumerateInstanceExtensionProperties(nullptr,
+                                               &extensionPptCount,
+                                               extensionPptList.data());
+
+        // If VK_KHR_get_physical_device_properties2 is available add it in.
+        for (std::size_t i = 0; i < extensionPptCount; i++)
+        {
+            if (strcmp(extensionPptList[i].extensionName, "VK_KHR_get_physical_device_properties2") == 0)
+            {
+                vulkanProgramInfo.instanceExtensionsEnabled.push_back("VK_KHR_get_physical_device_properties2");
+            }
+        }
+
+        // Add extensions required by GLFW
+        uint32_t glfwRequiredExtensionCount;
+        const char **glfwInstanceExtensions;
+        glfwInstanceExtensions = glfwGetRequiredInstanceExtensions(&glfwRequiredExtensionCount);
+
+        if (glfwInstanceExtensions == nullptr)
+        {
+            std::cout << "Failed to get instance extensions required by glfw" << std::endl;
+            exit(-1);
+        }
+
+        for (std::size_t i = 0; i < glfwRequiredExtensionCount; i++)
+        {
+            vulkanProgramInfo.instanceExtensionsEnabled.push_back(glfwInstanceExtensions[i]);
+        }
+
+    }
+
+    void addAdditionalDeviceExtensions()
+    {
+        uint32_t extensionPptCount;
+        vkEnumerateDeviceExtensionProperties(vulkanProgramInfo.GPU,
+                                             nullptr,
+                                             &extensionPptCount,
+                                             nullptr);
+
+        std::vector<VkExtensionProperties> extensionPptList(extensionPptCount);
+
+        vkEnumerateDeviceExtensionProperties(vulkanProgramInfo.GPU,
+                                             nullptr,
+                                             &extensionPptCount,
+                                             extensionPptList.data());
+
+        bool descriptorIndexingAvailable = false;
+        bool maintenance3Available = false;
+        bool updateTemplateAvailable = false;
+        bool timelineSemaphoreAvailable = false;
+        bool dynamicRenderingAvailable = false;
+        bool synchronization2Available = false;
+        for (std::size_t i = 0; i < extensionPptCount; i++)
+        {
+            // If there is a portability subset device extension, add it in.
+            if (strcmp(extensionPptList[i].extensionName, "VK_KHR_portability_subset") == 0)
+            {
+                vulkanProgramInfo.deviceExtensionsEnabled.push_back("VK_KHR_portability_subset");
+            }
+            descriptorIndexingAvailable = descriptorIndexingAvailable ||
+                                          strcmp(extensionPptList[i].extensionName,
+                                                 VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0;
+            maintenance3Available = maintenance3Available ||
+                                    strcmp(extensionPptList[i].extensionName,
+                                           VK_KHR_MAINTENANCE3_EXTENSION_NAME) == 0;
+            updateTemplateAvailable = updateTemplateAvailable ||
+                                      strcmp(extensionPptList[i].extensionName,
+                                             VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME) == 0;
+            timelineSemaphoreAvailable = timelineSemaphoreAvailable ||
+                                         strcmp(extensionPptList[i].extensionName,
+                                                VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0;
+            dynamicRenderingAvailable = dynamicRenderingAvailable ||
+                                        strcmp(extensionPptList[i].extensionName,
+                                               VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) == 0;
+            synchronization2Available = synchronization2Available ||
+                                        strcmp(extensionPptList[i].extensionName,
+                                               VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0;
+        }
+
+        // Before Vulkan 1.2 timeline semaphores come from the extension
+        if (!timelineSemaphoresInCore() && timelineSemaphoreAvailable)
+        {
+            vulkanProgramInfo.deviceExtensionsEnabled.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+            vulkanProgramInfo.timelineSemaphoreExtensionAdded = true;
+        }
+
+        // Per frame descriptor sets are written with one template call when the driver has it
+        if (updateTemplateAvailable)
+        {
+            vulkanProgramInfo.deviceExtensionsEnabled.push_back(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+            vulkanProgramInfo.descriptorUpdateTemplateAvailable = true;
+        }
+
+        // Dynamic rendering depends on create_renderpass2 and depth_stencil_resolve, both core in
+        // Vulkan 1.2 which timeline semaphores are checked against already. Deferred shading needs
+        // the subpasses and input attachments of a render pass object.
+        if (!options.renderPasses && options.shading != "deferred" && dynamicRenderingAvailable &&
+            synchronization2Available && timelineSemaphoresInCore())
+        {
+            vulkanProgramInfo.deviceExtensionsEnabled.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+            vulkanProgramInfo.deviceExtensionsEnabled.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+            vulkanProgramInfo.dynamicRenderingExtensionsAdded = true;
+        }
+
+        // Descriptor indexing depends on maintenance3
+        if (options.bindless && descriptorIndexingAvailable && maintenance3Available)
+        {
+            vulkanProgramInfo.deviceExtensionsEnabled.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+            vulkanProgramInfo.deviceExtensionsEnabled.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+            vulkanProgramInfo.descriptorIndexingExtensionsAdded = true;
+        }
+    }
+
+    /*
+     * ============================================================
+     * START: Hierarchical-Z Occlusion Culling
+     * ============================================================
+     */
+    void sizeDepthPyramid()
+    {
+        // The pyramid starts at the power of two below the depth buffer size so that every
+        // following level is exactly half of the previous one
+        auto previousPowerOfTwo = [](uint32_t value)
+        {
+            uint32_t result = 1;
+            while (result * 2 <= value)
+            {
+                result *= 2;
+            }
+            return result;
+        };
+
+        vulkanProgramInfo.depthPyramidWidth = previousPowerOfTwo(vulkanProgramInfo.swapchainExtent.width);
+        vulkanProgramInfo.depthPyramidHeight = previousPowerOfTwo(vulkanProgramInfo.swapchainExtent.height);
+        vulkanProgramInfo.depthPyramidLevels = 1;
+        while ((std::max(vulkanProgramInfo.depthPyramidWidth, vulkanProgramInfo.depthPyramidHeight) >>
+                vulkanProgramInfo.depthPyramidLevels) > 0)
+        {
+            vulkanProgramInfo.depthPyramidLevels++;
+        }
+    }
+
+    // The image itself is a transient image of the frame graph, see createFrameTransients
+    void createDepthPyramid()
+    {
+        vulkanProgramInfo.depthPyramidImage = vulkanProgramInfo.frameTransients.image("depth pyramid");
+        vulkanProgramInfo.depthPyramidView = vulkanProgramInfo.frameTransients.imageView("depth pyramid");
+
+        // The culling shader uses the view over all levels, the reduction one per level
+        VkImageViewCreateInfo depthPyramidViewCreateInfo{};
+        depthPyramidViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        depthPyramidViewCreateInfo.image = vulkanProgramInfo.depthPyramidImage;
+        depthPyramidViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        depthPyramidViewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+        depthPyramidViewCreateInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT,
+                                                       0,
+                                                       vulkanProgramInfo.depthPyramidLevels,
+                                                       0,
+                                                       1};
+
+        vulkanProgramInfo.depthPyramidMipViews.resize(vulkanProgramInfo.depthPyramidLevels);
+        for (uint32_t i = 0; i < vulkanProgramInfo.depthPyramidLevels; i++)
+        {
+            depthPyramidViewCreateInfo.subresourceRange.baseMipLevel = i;
+            depthPyramidViewCreateInfo.subresourceRange.levelCount = 1;
+
+            vkResult = vkCreateImageView(vulkanProgramInfo.renderDevice,
+                                         &depthPyramidViewCreateInfo,
+                                         nullptr,
+                                         &vulkanProgramInfo.depthPyramidMipViews[i]);
+            checkVkResult(vkResult, "Failed to create depth pyramid level view");
+        }
+
+        // Texels are only ever fetched, never filtered
+        VkSamplerCreateInfo depthPyramidSamplerCreateInfo{};
+        depthPyramidSamplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        depthPyramidSamplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+        depthPyramidSamplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+        depthPyramidSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        depthPyramidSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        depthPyramidSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        depthPyramidSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        depthPyramidSamplerCreateInfo.minLod = 0.0f;
+        depthPyramidSamplerCreateInfo.maxLod = static_cast<float>(vulkanProgramInfo.depthPyramidLevels);
+
+        vkResult = vkCreateSampler(vulkanProgramInfo.renderDevice,
+                                   &depthPyramidSamplerCreateInfo,
+                                   nullptr,
+                                   &vulkanProgramInfo.depthPyramidSampler);
+        checkVkResult(vkResult, "Failed to create depth pyramid sampler");
+    }
+
+    void createOcclusionCullingResources()
+    {
+        VkDeviceSize objectCount = vulkanProgramInfo.sceneTransforms.size();
+
+        // GPU only buffers: visibility from last frame and the draws of both phases
+        VkBufferCreateInfo visibilityBufferCreateInfo{};
+        visibilityBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        visibilityBufferCreateInfo.size = sizeof(uint32_t) * objectCount;
+        visibilityBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        visibilityBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        shareWithComputeQueue(visibilityBufferCreateInfo);
+
+        createBuffer(visibilityBufferCreateInfo,
+                     vulkanProgramInfo.renderDevice,
+                     vulkanProgramInfo.visibilityBuffer,
+                     vulkanProgramInfo.GPU,
+                     vulkanProgramInfo.visibilityBufferMemory,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VkBufferCreateInfo drawBufferCreateInfo{};
+        drawBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        drawBufferCreateInfo.size = sizeof(VkDrawIndexedIndirectCommand) * objectCount;
+        drawBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        drawBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        shareWithComputeQueue(drawBufferCreateInfo);
+
+        createBuffer(drawBufferCreateInfo,
+                     vulkanProgramInfo.renderDevice,
+                     vulkanProgramInfo.earlyDrawBuffer,
+                     vulkanProgramInfo.GPU,
+                     vulkanProgramInfo.earlyDrawBufferMemory,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        createBuffer(drawBufferCreateInfo,
+                     vulkanProgramInfo.renderDevice,
+                     vulkanProgramInfo.lateDrawBuffer,
+                     vulkanProgramInfo.GPU,
+                     vulkanProgramInfo.lateDrawBufferMemory,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        // Nothing was visible before the first frame
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+        vkCmdFillBuffer(commandBuffer, vulkanProgramInfo.visibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+
+        VkMemoryBarrier fillBarrier{};
+        fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &fillBarrier,
+                             0, nullptr,
+                             0, nullptr);
+
+        endSingleTimeCommands(commandBuffer);
+
+        // Descriptor set layouts
+        // Depth reduction: previous level (or the depth buffer) in, next level out
+        std::array<VkDescriptorSetLayoutBinding, 2> depthReduceBindings{};
+        depthReduceBindings[0].binding = 0;
+        depthReduceBindings[0].descriptorCount = 1;
+        depthReduceBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        depthReduceBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        depthReduceBindings[1].binding = 1;
+        depthReduceBindings[1].descriptorCount = 1;
+        depthReduceBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        depthReduceBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo depthReduceSetLayoutCreateInfo{};
+        depthReduceSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        depthReduceSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(depthReduceBindings.size());
+        depthReduceSetLayoutCreateInfo.pBindings = depthReduceBindings.data();
+
+        vkResult = vkCreateDescriptorSetLayout(vulkanProgramInfo.renderDevice,
+                                               &depthReduceSetLayoutCreateInfo,
+                                               nullptr,
+                                               &vulkanProgramInfo.depthReduceSetLayout);
+        checkVkResult(vkResult, "Failed to create depth reduce descriptor set layout");
+
+        // Culling: instances, visibility, early draws, late draws and the depth pyramid
+        std::array<VkDescriptorSetLayoutBinding, 5> cullBindings{};
+        for (uint32_t i = 0; i < cullBindings.size(); i++)
+        {
+            cullBindings[i].binding = i;
+            cullBindings[i].descriptorCount = 1;
+            cullBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        cullBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+        VkDescriptorSetLayoutCreateInfo cullSetLayoutCreateInfo{};
+        cullSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        cullSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(cullBindings.size());
+        cullSetLayoutCreateInfo.pBindings = cullBindings.data();
+
+        vkResult = vkCreateDescriptorSetLayout(vulkanProgramInfo.renderDevice,
+                                               &cullSetLayoutCreateInfo,
+                                               nullptr,
+                                               &vulkanProgramInfo.cullSetLayout);
+        checkVkResult(vkResult, "Failed to create cull descriptor set layout");
+
+        // Descriptor pool and sets
+        uint32_t levels = vulkanProgramInfo.depthPyramidLevels;
+
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+        poolSizes[0] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, levels + MAX_FRAMES_IN_FLIGHT};
+        poolSizes[1] = {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levels};
+        poolSizes[2] = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * MAX_FRAMES_IN_FLIGHT};
+
+        VkDescriptorPoolCreateInfo poolCreateInfo{};
+        poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolCreateInfo.pPoolSizes = poolSizes.data();
+        poolCreateInfo.maxSets = levels + MAX_FRAMES_IN_FLIGHT;
+
+        vkResult = vkCreateDescriptorPool(vulkanProgramInfo.renderDevice,
+                                          &poolCreateInfo,
+                                          nullptr,
+                                          &vulkanProgramInfo.occlusionDescriptorPool);
+        checkVkResult(vkResult, "Failed to create occlusion culling descriptor pool");
+
+        std::vector<VkDescriptorSetLayout> depthReduceLayouts(levels, vulkanProgramInfo.depthReduceSetLayout);
+        VkDescriptorSetAllocateInfo depthReduceAllocateInfo{};
+        depthReduceAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        depthReduceAllocateInfo.descriptorPool = vulkanProgramInfo.occlusionDescriptorPool;
+        depthReduceAllocateInfo.descriptorSetCount = levels;
+        depthReduceAllocateInfo.pSetLayouts = depthReduceLayouts.data();
+
+        vulkanProgramInfo.depthReduceSets.resize(levels);
+        vkResult = vkAllocateDescriptorSets(vulkanProgramInfo.renderDevice,
+                                            &depthReduceAllocateInfo,
+                                            vulkanProgramInfo.depthReduceSets.data());
+        checkVkResult(vkResult, "Failed to allocate depth reduce descriptor sets");
+
+        for (uint32_t i = 0; i < levels; i++)
+        {
+            // Level 0 reads the depth buffer, every other level reads the one before it
+            VkDescriptorImageInfo inputInfo{};
+            inputInfo.sampler = vulkanProgramInfo.depthPyramidSampler;
+            inputInfo.imageView = i == 0 ? vulkanProgramInfo.depthImageView : vulkanProgramInfo.depthPyramidMipViews[i - 1];
+            inputInfo.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+            VkDescriptorImageInfo outputInfo{};
+            outputInfo.imageView = vulkanProgramInfo.depthPyramidMipViews[i];
+            outputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            std::array<VkWriteDescriptorSet, 2> writes{};
+            writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[0].dstSet = vulkanProgramInfo.depthReduceSets[i];
+            writes[0].dstBinding = 0;
+            writes[0].descriptorCount = 1;
+            writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writes[0].pImageInfo = &inputInfo;
+            writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[1].dstSet = vulkanProgramInfo.depthReduceSets[i];
+            writes[1].dstBinding = 1;
+            writes[1].descriptorCount = 1;
+            writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[1].pImageInfo = &outputInfo;
+
+            vkUpdateDescriptorSets(vulkanProgramInfo.renderDevice,
+                                   static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+
+        std::vector<VkDescriptorSetLayout> cullLayouts(MAX_FRAMES_IN_FLIGHT, vulkanProgramInfo.cullSetLayout);
+        VkDescriptorSetAllocateInfo cullAllocateInfo{};
+        cullAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        cullAllocateInfo.descriptorPool = vulkanProgramInfo.occlusionDescriptorPool;
+        cullAllocateInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+        cullAllocateInfo.pSetLayouts = cullLayouts.data();
+
+        vulkanProgramInfo.cullSets.resize(MAX_FRAMES_IN_FLIGHT);
+        vkResult = vkAllocateDescriptorSets(vulkanProgramInfo.renderDevice,
+                                            &cullAllocateInfo,
+                                            vulkanProgramInfo.cullSets.data());
+        checkVkResult(vkResult, "Failed to allocate cull descriptor sets");
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            std::array<VkDescriptorBufferInfo, 4> bufferInfos =
+                    {
+                            VkDescriptorBufferInfo{vulkanProgramInfo.instanceBuffers[i], 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.visibilityBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.earlyDrawBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.lateDrawBuffer, 0, VK_WHOLE_SIZE}
+                    };
+
+            VkDescriptorImageInfo depthPyramidInfo{};
+            depthPyramidInfo.sampler = vulkanProgramInfo.depthPyramidSampler;
+            depthPyramidInfo.imageView = vulkanProgramInfo.depthPyramidView;
+            depthPyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            std::array<VkWriteDescriptorSet, 5> writes{};
+            for (uint32_t binding = 0; binding < writes.size(); binding++)
+            {
+                writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[binding].dstSet = vulkanProgramInfo.cullSets[i];
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[binding].pBufferInfo = binding < bufferInfos.size() ? &bufferInfos[binding] : nullptr;
+            }
+            writes[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writes[4].pImageInfo = &depthPyramidInfo;
+
+            vkUpdateDescriptorSets(vulkanProgramInfo.renderDevice,
+                                   static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+
+        // Compute pipelines
+        createComputePipeline("depth_reduce.comp",
+                              vulkanProgramInfo.depthReduceSetLayout,
+                              sizeof(DepthReducePushConstants),
+                              vulkanProgramInfo.depthReducePipelineLayout,
+                              vulkanProgramInfo.depthReducePipeline);
+
+        createComputePipeline("occlusion_cull.comp",
+                              vulkanProgramInfo.cullSetLayout,
+                              sizeof(CullPushConstants),
+                              vulkanProgramInfo.cullPipelineLayout,
+                              vulkanProgramInfo.cullPipeline);
+    }
+
+    void createComputePipeline(const std::string &shaderName,
+                               VkDescriptorSetLayout setLayout,
+                               uint32_t pushConstantSize,
+                               VkPipelineLayout &pipelineLayout,
+                               VkPipeline &pipeline)
+    {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = pushConstantSize;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.setLayoutCount = 1;
+        pipelineLayoutCreateInfo.pSetLayouts = &setLayout;
+        pipelineLayoutCreateInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        vkResult = vkCreatePipelineLayout(vulkanProgramInfo.renderDevice,
+                                          &pipelineLayoutCreateInfo,
+                                          nullptr,
+                                          &pipelineLayout);
+        checkVkResult(vkResult, "Failed to create compute pipeline layout");
+
+        std::vector<char> shaderCode;
+        if (!shaderCompiler.compile(shaderName, {}, shaderCode))
+        {
+            throw std::runtime_error("failed to load compute shader!");
+        }
+
+        pipeline = buildComputePipeline(shaderCode, pipelineLayout);
+        if (pipeline == VK_NULL_HANDLE)
+        {
+            std::cerr << "Failed to create compute pipeline " << shaderName << std::endl;
+            exit(-1);
+        }
+
+        if (shaderHotReloader)
+        {
+            shaderHotReloader->watch(shaderName, &pipeline, {{shaderName, {}}},
+                                     [this, pipelineLayout](const std::vector<std::vector<char>> &spirv)
+                                     {
+                                         return buildComputePipeline(spirv[0], pipelineLayout);
+                                     });
+        }
+    }
+
+    VkPipeline buildComputePipeline(const std::vector<char> &shaderCode, VkPipelineLayout pipelineLayout)
+    {
+        VkShaderModule shaderModule = createShaderModule(shaderCode);
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo{};
+        computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        computePipelineCreateInfo.layout = pipelineLayout;
+        computePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        computePipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        computePipelineCreateInfo.stage.module = shaderModule;
+        computePipelineCreateInfo.stage.pName = "main";
+
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkResult result = vkCreateComputePipelines(vulkanProgramInfo.renderDevice,
+                                                   VK_NULL_HANDLE,
+                                                   1,
+                                                   &computePipelineCreateInfo,
+                                                   nullptr,
+                                                   &pipeline);
+
+        vkDestroyShaderModule(vulkanProgramInfo.renderDevice, shaderModule, nullptr);
+
+        return result == VK_SUCCESS ? pipeline : VK_NULL_HANDLE;
+    }
+
+    void recordCullDispatch(VkCommandBuffer commandBuffer, uint32_t phase)
+    {
+        CullPushConstants pushConstants{};
+        pushConstants.meshBoundsMin = glm::vec4(vulkanProgramInfo.meshBoundsMin, 0.0f);
+        pushConstants.meshBoundsMax = glm::vec4(vulkanProgramInfo.meshBoundsMax, 0.0f);
+        pushConstants.pyramidSize = glm::vec2(static_cast<float>(vulkanProgramInfo.depthPyramidWidth),
+                                              static_cast<float>(vulkanProgramInfo.depthPyramidHeight));
+        pushConstants.objectCount = static_cast<uint32_t>(vulkanProgramInfo.sceneTransforms.size());
+        pushConstants.indexCount = static_cast<uint32_t>(vertex_indices.size());
+        pushConstants.phase = phase;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.cullPipeline);
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                vulkanProgramInfo.cullPipelineLayout,
+                                0,
+                                1,
+                                &vulkanProgramInfo.cullSets[vulkanProgramInfo.curr_frame],
+                                0,
+                                nullptr);
+        vkCmdPushConstants(commandBuffer,
+                           vulkanProgramInfo.cullPipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(pushConstants),
+                           &pushConstants);
+        vkCmdDispatch(commandBuffer, (pushConstants.objectCount + 63) / 64, 1, 1);
+    }
+
+    void recordDepthPyramid(VkCommandBuffer commandBuffer)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.depthReducePipeline);
+
+        for (uint32_t i = 0; i < vulkanProgramInfo.depthPyramidLevels; i++)
+        {
+            DepthReducePushConstants pushConstants{};
+            pushConstants.outputWidth = std::max(1u, vulkanProgramInfo.depthPyramidWidth >> i);
+            pushConstants.outputHeight = std::max(1u, vulkanProgramInfo.depthPyramidHeight >> i);
+
+            vkCmdBindDescriptorSets(commandBuffer,
+                                    VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    vulkanProgramInfo.depthReducePipelineLayout,
+                                    0,
+                                    1,
+                                    &vulkanProgramInfo.depthReduceSets[i],
+                                    0,
+                                    nullptr);
+            vkCmdPushConstants(commandBuffer,
+                               vulkanProgramInfo.depthReducePipelineLayout,
+                               VK_SHADER_STAGE_COMPUTE_BIT,
+                               0,
+                               sizeof(pushConstants),
+                               &pushConstants);
+            vkCmdDispatch(commandBuffer,
+                          (pushConstants.outputWidth + 15) / 16,
+                          (pushConstants.outputHeight + 15) / 16,
+                          1);
+
+            // The next level reads what was just written. After the last level the render graph
+            // takes care of synchronizing with the late culling pass.
+            if (i + 1 == vulkanProgramInfo.depthPyramidLevels)
+            {
+                break;
+            }
+
+            VkMemoryBarrier levelBarrier{};
+            levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0,
+                                 1, &levelBarrier,
+                                 0, nullptr,
+                                 0, nullptr);
+        }
+    }
+
+    // Two phase culling expressed as render graph passes. The graph works out the barriers between
+    // the culling dispatches, the two scene passes and the depth pyramid.
+    void addOcclusionCulledScenePasses(RenderGraph &graph, const VkRenderPassBeginInfo &renderPassBeginInfo,
+                                       RenderGraphHandle colorTarget, RenderGraphHandle depthTarget,
+                                       const SceneInputs &sceneInputs)
+    {
+        // Last frame's indirect draws and visibility writes are what these buffers saw last
+        RenderGraphHandle visibility = graph.importBuffer("visibility",
+                                                          vulkanProgramInfo.visibilityBuffer,
+                                                          describeUsage(ResourceUsage::StorageReadWriteCompute));
+        RenderGraphHandle earlyDraws = graph.importBuffer("early draws",
+                                                          vulkanProgramInfo.earlyDrawBuffer,
+                                                          describeUsage(ResourceUsage::IndirectRead));
+        RenderGraphHandle lateDraws = graph.importBuffer("late draws",
+                                                         vulkanProgramInfo.lateDrawBuffer,
+                                                         describeUsage(ResourceUsage::IndirectRead));
+        // Built from this frame's depth and only read by the late cull, so it shares its memory
+        // with the transient images used later in the frame
+        RenderGraphImageDesc depthPyramidDesc{};
+        depthPyramidDesc.format = VK_FORMAT_R32_SFLOAT;
+        depthPyramidDesc.extent = {vulkanProgramInfo.depthPyramidWidth, vulkanProgramInfo.depthPyramidHeight};
+        depthPyramidDesc.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        depthPyramidDesc.mipLevels = vulkanProgramInfo.depthPyramidLevels;
+        RenderGraphHandle depthPyramid = graph.createTransientImage("depth pyramid", depthPyramidDesc);
+
+        // Visibility is carried over to the next frame
+        graph.markOutput(visibility);
+
+        // The early cull only needs last frame's results, so on the async compute queue it
+        // overlaps the late scene of the previous frame
+        RenderGraphQueue cullQueue = vulkanProgramInfo.asyncComputeEnabled ? RenderGraphQueue::Compute
+                                                                           : RenderGraphQueue::Graphics;
+
+        // Phase 1: draw what was visible last frame
+        graph.addPass("early cull", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordCullDispatch(commandBuffer, 0);
+                })
+                .read(visibility, ResourceUsage::StorageReadCompute)
+                .write(earlyDraws, ResourceUsage::StorageWriteCompute)
+                .queue(cullQueue);
+
+        auto earlyScenePass = graph.addPass("early scene", [this, renderPassBeginInfo](VkCommandBuffer commandBuffer)
+                {
+                    beginScenePass(commandBuffer, renderPassBeginInfo, true);
+                    recordSceneDrawCommands(commandBuffer, vulkanProgramInfo.earlyDrawBuffer);
+                    endScenePass(commandBuffer);
+                });
+        earlyScenePass.read(earlyDraws, ResourceUsage::IndirectRead)
+                .write(colorTarget, ResourceUsage::ColorAttachment)
+                .write(depthTarget, ResourceUsage::DepthAttachment);
+
+        graph.addPass("depth pyramid", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordDepthPyramid(commandBuffer);
+                })
+                .read(depthTarget, ResourceUsage::SampledCompute)
+                .write(depthPyramid, ResourceUsage::StorageReadWriteCompute);
+
+        // Phase 2: test everything against the pyramid and draw what just became visible
+        graph.addPass("late cull", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordCullDispatch(commandBuffer, 1);
+                })
+                .read(depthPyramid, ResourceUsage::StorageReadCompute)
+                .write(visibility, ResourceUsage::StorageReadWriteCompute)
+                .write(lateDraws, ResourceUsage::StorageWriteCompute)
+                .queue(cullQueue);
+
+        VkRenderPassBeginInfo lateRenderPassBeginInfo = renderPassBeginInfo;
+        lateRenderPassBeginInfo.renderPass = vulkanProgramInfo.lateRenderPass;
+
+        auto lateScenePass = graph.addPass("late scene", [this, lateRenderPassBeginInfo](VkCommandBuffer commandBuffer)
+                {
+                    beginScenePass(commandBuffer, lateRenderPassBeginInfo, false);
+                    recordSceneDrawCommands(commandBuffer, vulkanProgramInfo.lateDrawBuffer);
+                    if (vulkanProgramInfo.particlesEnabled)
+                    {
+                        recordParticleDraw(commandBuffer);
+                    }
+                    endScenePass(commandBuffer);
+                });
+        lateScenePass.read(lateDraws, ResourceUsage::IndirectRead)
+                .write(colorTarget, ResourceUsage::ColorAttachment, scenePassPresentLayout())
+                .write(depthTarget, ResourceUsage::DepthAttachment);
+
+        readSceneInputs(earlyScenePass, sceneInputs);
+        readSceneInputs(lateScenePass, sceneInputs);
+        if (vulkanProgramInfo.particlesEnabled)
+        {
+            readParticleInputs(lateScenePass, sceneInputs);
+        }
+    }
+
+    void destroyOcclusionCullingResources() const
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+
+        vkDestroyPipeline(device, vulkanProgramInfo.cullPipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.cullPipelineLayout, nullptr);
+        vkDestroyPipeline(device, vulkanProgramInfo.depthReducePipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.depthReducePipelineLayout, nullptr);
+
+        vkDestroyDescriptorPool(device, vulkanProgramInfo.occlusionDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, vulkanProgramInfo.cullSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, vulkanProgramInfo.depthReduceSetLayout, nullptr);
+
+        vkDestroyBuffer(device, vulkanProgramInfo.lateDrawBuffer, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.lateDrawBufferMemory, nullptr);
+        vkDestroyBuffer(device, vulkanProgramInfo.earlyDrawBuffer, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.earlyDrawBufferMemory, nullptr);
+        vkDestroyBuffer(device, vulkanProgramInfo.visibilityBuffer, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.visibilityBufferMemory, nullptr);
+
+        vkDestroySampler(device, vulkanProgramInfo.depthPyramidSampler, nullptr);
+        for (const auto &mipView: vulkanProgramInfo.depthPyramidMipViews)
+        {
+            vkDestroyImageView(device, mipView, nullptr);
+        }
+    }
+
+    /*
+     * ============================================================
+     * END: Hierarchical-Z Occlusion Culling
+     * ============================================================
+     */
+
+    /*
+     * ============================================================
+     * START: Dynamic Resolution
+     * ============================================================
+     */
+    // Swapchain usage for dynamic resolution. The compute upscale writes the swapchain image as a
+    // storage image, which sRGB formats cannot be: a UNORM format is picked for it instead and the
+    // shader encodes sRGB itself. Without one the scene color image is blitted to the swapchain.
+    VkImageUsageFlags chooseUpscaleTarget(const VkSurfaceCapabilitiesKHR &capabilities,
+                                          VkSurfaceFormatKHR &surfaceFormat)
+    {
+        if (chooseStorageSurfaceFormat(capabilities, surfaceFormat))
+        {
+            vulkanProgramInfo.upscaleByCompute = true;
+            return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+        }
+
+        VkFormatProperties formatProperties{};
+        vkGetPhysicalDeviceFormatProperties(vulkanProgramInfo.GPU, surfaceFormat.format, &formatProperties);
+        VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                            VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if ((capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) &&
+            (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures)
+        {
+            return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+
+        std::cout << "Dynamic resolution needs a swapchain that is a storage image or blit destination, "
+                     "it is disabled" << std::endl;
+        vulkanProgramInfo.dynamicResolutionEnabled = false;
+        return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    }
+
+    // Picks a UNORM surface format the swapchain image can be a storage image in, written by
+    // shaders that do not name its format and encode sRGB themselves
+    bool chooseStorageSurfaceFormat(const VkSurfaceCapabilitiesKHR &capabilities, VkSurfaceFormatKHR &surfaceFormat)
+    {
+        if (!vulkanProgramInfo.storageWriteWithoutFormat ||
+            !(capabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT))
+        {
+            return false;
+        }
+
+        uint32_t surfaceFormatCount = 0;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(vulkanProgramInfo.GPU, vulkanProgramInfo.windowSurface,
+                                             &surfaceFormatCount, nullptr);
+        std::vector<VkSurfaceFormatKHR> surfaceFormats(surfaceFormatCount);
+        vkGetPhysicalDeviceSurfaceFormatsKHR(vulkanProgramInfo.GPU, vulkanProgramInfo.windowSurface,
+                                             &surfaceFormatCount, surfaceFormats.data());
+
+        for (VkFormat candidate: {VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM})
+        {
+            VkFormatProperties formatProperties{};
+            vkGetPhysicalDeviceFormatProperties(vulkanProgramInfo.GPU, candidate, &formatProperties);
+            if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+            {
+                continue;
+            }
+            for (const auto &available: surfaceFormats)
+            {
+                if (available.format == candidate && available.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+                {
+                    surfaceFormat = available;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Swapchain sized, so any render scale fits without reallocating. sRGB for the compute upscale
+    // so its bilinear filter works on linear values, the swapchain format for the blit.
+    void createSceneColorTarget()
+    {
+        if (!vulkanProgramInfo.dynamicResolutionEnabled)
+        {
+            return;
+        }
+
+        vulkanProgramInfo.sceneColorFormat = vulkanProgramInfo.upscaleByCompute ? VK_FORMAT_R8G8B8A8_SRGB
+                                                                                : vulkanProgramInfo.swapchainImageFormat;
+        createSceneColorImage(vulkanProgramInfo.upscaleByCompute ? VK_IMAGE_USAGE_SAMPLED_BIT
+                                                                 : VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+
+        vulkanProgramInfo.resolutionController = DynamicResolutionController(options.targetFrameMilliseconds,
+                                                                             options.minRenderScale);
+        vulkanProgramInfo.renderExtent =
+                vulkanProgramInfo.resolutionController.renderExtent(vulkanProgramInfo.swapchainExtent);
+
+        std::cout << "Dynamic resolution: " << options.targetFrameMilliseconds << " ms GPU frame time target, scale "
+                  << options.minRenderScale << " to 1, "
+                  << (vulkanProgramInfo.upscaleByCompute ? options.upscaleFilter + " compute upscale"
+                                                         : std::string("blit upscale")) << std::endl;
+        if (!vulkanProgramInfo.upscaleByCompute && options.upscaleFilter == "sharpen")
+        {
+            std::cout << "Sharpening needs the compute upscale, the blit filters bilinear only" << std::endl;
+        }
+    }
+
+    // Swapchain sized scene color image in sceneColorFormat, drawn into and read as usage says
+    void createSceneColorImage(VkImageUsageFlags usage)
+    {
+        bool lazilyAllocated = false;
+        createAttachmentImage(vulkanProgramInfo.sceneColorFormat,
+                              VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | usage,
+                              VK_SAMPLE_COUNT_1_BIT,
+                              vulkanProgramInfo.sceneColorImage,
+                              &vulkanProgramInfo.sceneColorImageMemory,
+                              lazilyAllocated);
+
+        VkImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = vulkanProgramInfo.sceneColorFormat;
+        imageViewCreateInfo.image = vulkanProgramInfo.sceneColorImage;
+        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+
+        vkResult = vkCreateImageView(vulkanProgramInfo.renderDevice, &imageViewCreateInfo, nullptr,
+                                     &vulkanProgramInfo.sceneColorImageView);
+        checkVkResult(vkResult, "Failed to create scene color image view");
+    }
+
+    void createUpscaleResources()
+    {
+        VkSamplerCreateInfo samplerCreateInfo{};
+        samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+        samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+        samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        vkResult = vkCreateSampler(vulkanProgramInfo.renderDevice, &samplerCreateInfo, nullptr,
+                                   &vulkanProgramInfo.upscaleSampler);
+        checkVkResult(vkResult, "Failed to create upscale sampler");
+
+        // Scene color in, swapchain image out
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+        bindings[0].binding = 0;
+        bindings[0].descriptorCount = 1;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[1].binding = 1;
+        bindings[1].descriptorCount = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{};
+        setLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        setLayoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        setLayoutCreateInfo.pBindings = bindings.data();
+
+        vkResult = vkCreateDescriptorSetLayout(vulkanProgramInfo.renderDevice, &setLayoutCreateInfo, nullptr,
+                                               &vulkanProgramInfo.upscaleSetLayout);
+        checkVkResult(vkResult, "Failed to create upscale descriptor set layout");
+
+        auto imageCount = static_cast<uint32_t>(vulkanProgramInfo.swapchainImages.size());
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageCount};
+        poolSizes[1] = {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageCount};
+
+        VkDescriptorPoolCreateInfo poolCreateInfo{};
+        poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolCreateInfo.pPoolSizes = poolSizes.data();
+        poolCreateInfo.maxSets = imageCount;
+
+        vkResult = vkCreateDescriptorPool(vulkanProgramInfo.renderDevice, &poolCreateInfo, nullptr,
+                                          &vulkanProgramInfo.upscaleDescriptorPool);
+        checkVkResult(vkResult, "Failed to create upscale descriptor pool");
+
+        std::vector<VkDescriptorSetLayout> setLayouts(imageCount, vulkanProgramInfo.upscaleSetLayout);
+        VkDescriptorSetAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocateInfo.descriptorPool = vulkanProgramInfo.upscaleDescriptorPool;
+        allocateInfo.descriptorSetCount = imageCount;
+        allocateInfo.pSetLayouts = setLayouts.data();
+
+        vulkanProgramInfo.upscaleSets.resize(imageCount);
+        vkResult = vkAllocateDescriptorSets(vulkanProgramInfo.renderDevice, &allocateInfo,
+                                            vulkanProgramInfo.upscaleSets.data());
+        checkVkResult(vkResult, "Failed to allocate upscale descriptor sets");
+
+        for (uint32_t i = 0; i < imageCount; i++)
+        {
+            VkDescriptorImageInfo inputInfo{};
+            inputInfo.sampler = vulkanProgramInfo.upscaleSampler;
+            inputInfo.imageView = vulkanProgramInfo.sceneColorImageView;
+            inputInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+            VkDescriptorImageInfo outputInfo{};
+            outputInfo.imageView = vulkanProgramInfo.swapchainImageViews[i];
+            outputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            std::array<VkWriteDescriptorSet, 2> writes{};
+            writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[0].dstSet = vulkanProgramInfo.upscaleSets[i];
+            writes[0].dstBinding = 0;
+            writes[0].descriptorCount = 1;
+            writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writes[0].pImageInfo = &inputInfo;
+            writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[1].dstSet = vulkanProgramInfo.upscaleSets[i];
+            writes[1].dstBinding = 1;
+            writes[1].descriptorCount = 1;
+            writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[1].pImageInfo = &outputInfo;
+
+            vkUpdateDescriptorSets(vulkanProgramInfo.renderDevice,
+                                   static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+
+        createComputePipeline("upscale.comp",
+                              vulkanProgramInfo.upscaleSetLayout,
+                              sizeof(UpscalePushConstants),
+                              vulkanProgramInfo.upscalePipelineLayout,
+                              vulkanProgramInfo.upscalePipeline);
+    }
+
+    void addUpscalePass(RenderGraph &graph, RenderGraphHandle sceneColor, RenderGraphHandle swapchainTarget)
+    {
+        if (vulkanProgramInfo.upscaleByCompute)
+        {
+            graph.addPass("upscale", [this](VkCommandBuffer commandBuffer)
+                    {
+                        recordUpscaleDispatch(commandBuffer);
+                    })
+                    .read(sceneColor, ResourceUsage::SampledCompute)
+                    .write(swapchainTarget, ResourceUsage::StorageWriteCompute);
+            return;
+        }
+
+        graph.addPass("upscale blit", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordUpscaleBlit(commandBuffer);
+                })
+                .read(sceneColor, ResourceUsage::TransferSrc)
+                .write(swapchainTarget, ResourceUsage::TransferDst);
+    }
+
+    void recordUpscaleDispatch(VkCommandBuffer commandBuffer)
+    {
+        VkExtent2D renderExtent = vulkanProgramInfo.renderExtent;
+        VkExtent2D outputExtent = vulkanProgramInfo.swapchainExtent;
+
+        UpscalePushConstants pushConstants{};
+        pushConstants.renderSize = glm::vec2(static_cast<float>(renderExtent.width),
+                                             static_cast<float>(renderExtent.height));
+        pushConstants.inverseImageSize = glm::vec2(1.0f / static_cast<float>(outputExtent.width),
+                                                   1.0f / static_cast<float>(outputExtent.height));
+        pushConstants.outputSize = glm::uvec2(outputExtent.width, outputExtent.height);
+        pushConstants.sharpness = options.upscaleFilter == "sharpen" ? 0.5f : 0.0f;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.upscalePipeline);
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                vulkanProgramInfo.upscalePipelineLayout,
+                                0,
+                                1,
+                                &vulkanProgramInfo.upscaleSets[vulkanProgramInfo.activeSwapchainImage],
+                                0,
+                                nullptr);
+        vkCmdPushConstants(commandBuffer,
+                           vulkanProgramInfo.upscalePipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(pushConstants),
+                           &pushConstants);
+        vkCmdDispatch(commandBuffer, (outputExtent.width + 7) / 8, (outputExtent.height + 7) / 8, 1);
+    }
+
+    void recordUpscaleBlit(VkCommandBuffer commandBuffer) const
+    {
+        VkImageBlit region{};
+        region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.srcOffsets[1] = {static_cast<int32_t>(vulkanProgramInfo.renderExtent.width),
+                                static_cast<int32_t>(vulkanProgramInfo.renderExtent.height),
+                                1};
+        region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.dstOffsets[1] = {static_cast<int32_t>(vulkanProgramInfo.swapchainExtent.width),
+                                static_cast<int32_t>(vulkanProgramInfo.swapchainExtent.height),
+                                1};
+
+        vkCmdBlitImage(commandBuffer,
+                       vulkanProgramInfo.sceneColorImage,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       vulkanProgramInfo.swapchainImages[vulkanProgramInfo.activeSwapchainImage],
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       1,
+                       &region,
+                       VK_FILTER_LINEAR);
+    }
+
+    // Gives the GPU time of each newly collected frame to the controller. A new scale only changes
+    // render area, viewport and scissor, so pre-recorded command buffers are recorded again.
+    void updateRenderScale()
+    {
+        if (!vulkanProgramInfo.dynamicResolutionEnabled)
+        {
+            return;
+        }
+
+        const GpuProfiler &profiler = vulkanProgramInfo.gpuProfiler;
+        if (profiler.collectedFrames() == vulkanProgramInfo.resolutionMeasurements)
+        {
+            return;
+        }
+        vulkanProgramInfo.resolutionMeasurements = profiler.collectedFrames();
+
+        if (vulkanProgramInfo.resolutionController.update(profiler.lastFrameMilliseconds()))
+        {
+            vulkanProgramInfo.renderExtent =
+                    vulkanProgramInfo.resolutionController.renderExtent(vulkanProgramInfo.swapchainExtent);
+            vulkanProgramInfo.commandGeneration++;
+        }
+    }
+
+    void destroyDynamicResolutionResources() const
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+
+        if (vulkanProgramInfo.upscaleByCompute)
+        {
+            vkDestroyPipeline(device, vulkanProgramInfo.upscalePipeline, nullptr);
+            vkDestroyPipelineLayout(device, vulkanProgramInfo.upscalePipelineLayout, nullptr);
+            vkDestroyDescriptorPool(device, vulkanProgramInfo.upscaleDescriptorPool, nullptr);
+            vkDestroyDescriptorSetLayout(device, vulkanProgramInfo.upscaleSetLayout, nullptr);
+            vkDestroySampler(device, vulkanProgramInfo.upscaleSampler, nullptr);
+        }
+
+        destroySceneColorImage();
+    }
+
+    void destroySceneColorImage() const
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+
+        vkDestroyImageView(device, vulkanProgramInfo.sceneColorImageView, nullptr);
+        vkDestroyImage(device, vulkanProgramInfo.sceneColorImage, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.sceneColorImageMemory, nullptr);
+    }
+
+    /*
+     * ============================================================
+     * END: Dynamic Resolution
+     * ============================================================
+     */
+
+    /*
+     * ============================================================
+     * START: Cascaded Shadow Maps
+     * ============================================================
+     */
+    // The shadow map and what does not depend on the pipeline layout: views, compare sampler,
+    // per frame uniforms, the shadow sets and, without dynamic rendering, the depth only render
+    // pass with a framebuffer per layer
+    void createShadowMap()
+    {
+        vulkanProgramInfo.shadowCascades = ShadowCascades(options.shadowCascades, options.shadowMapSize);
+        uint32_t cascadeCount = vulkanProgramInfo.shadowCascades.cascadeCount();
+        VkDevice device = vulkanProgramInfo.renderDevice;
+
+        // A cascade covers a short depth range, 16 bits are plenty. Filtered for hardware PCF.
+        DepthFormatInfo shadowFormat = selectDepthFormat(vulkanProgramInfo.GPU, 16,
+                                                         VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                                         VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+                                                         VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+        vulkanProgramInfo.shadowMapFormat = shadowFormat.format;
+
+        VkImageCreateInfo shadowMapCreateInfo{};
+        shadowMapCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        shadowMapCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        shadowMapCreateInfo.format = shadowFormat.format;
+        shadowMapCreateInfo.extent = {options.shadowMapSize, options.shadowMapSize, 1};
+        shadowMapCreateInfo.mipLevels = 1;
+        shadowMapCreateInfo.arrayLayers = cascadeCount;
+        shadowMapCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        shadowMapCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        shadowMapCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        shadowMapCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        shadowMapCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        createImage(shadowMapCreateInfo,
+                    vulkanProgramInfo.renderDevice,
+                    vulkanProgramInfo.shadowMapImage,
+                    vulkanProgramInfo.GPU,
+                    vulkanProgramInfo.shadowMapMemory,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        // The scene samples all layers through one array view, every cascade renders into its own
+        VkImageViewCreateInfo shadowMapViewCreateInfo{};
+        shadowMapViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        shadowMapViewCreateInfo.image = vulkanProgramInfo.shadowMapImage;
+        shadowMapViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+        shadowMapViewCreateInfo.format = shadowFormat.format;
+        shadowMapViewCreateInfo.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, cascadeCount};
+
+        vkResult = vkCreateImageView(device, &shadowMapViewCreateInfo, nullptr, &vulkanProgramInfo.shadowMapView);
+        checkVkResult(vkResult, "Failed to create shadow map view");
+
+        vulkanProgramInfo.shadowLayerViews.resize(cascadeCount);
+        for (uint32_t i = 0; i < cascadeCount; i++)
+        {
+            shadowMapViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            shadowMapViewCreateInfo.subresourceRange.baseArrayLayer = i;
+            shadowMapViewCreateInfo.subresourceRange.layerCount = 1;
+
+            vkResult = vkCreateImageView(device, &shadowMapViewCreateInfo, nullptr,
+                                         &vulkanProgramInfo.shadowLayerViews[i]);
+            checkVkResult(vkResult, "Failed to create shadow map layer view");
+        }
+
+        // Depth compare with bilinear filtering is 2x2 PCF per sample. Outside of the map
+        // everything is lit.
+        VkSamplerCreateInfo shadowSamplerCreateInfo{};
+        shadowSamplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        shadowSamplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+        shadowSamplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+        shadowSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        shadowSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+        shadowSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+        shadowSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+        shadowSamplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+        shadowSamplerCreateInfo.compareEnable = VK_TRUE;
+        shadowSamplerCreateInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+        shadowSamplerCreateInfo.minLod = 0.0f;
+        shadowSamplerCreateInfo.maxLod = 0.0f;
+
+        vkResult = vkCreateSampler(device, &shadowSamplerCreateInfo, nullptr, &vulkanProgramInfo.shadowSampler);
+        checkVkResult(vkResult, "Failed to create shadow sampler");
+
+        // Every cascade is pulled back far enough along the light to catch all objects in front of it
+        glm::vec3 meshCenter = quantizationCenter();
+        float meshRadius = glm::length(meshCenter) + glm::length(quantizationHalfExtent());
+        float sceneRadius = 0.0f;
+        const TransformStore &transforms = vulkanProgramInfo.sceneTransforms;
+        for (std::size_t i = 0; i < transforms.size(); i++)
+        {
+            glm::vec3 scale = transforms.scale(i);
+            float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
+            sceneRadius = std::max(sceneRadius, glm::length(transforms.position(i)) + meshRadius * maxScale);
+        }
+        vulkanProgramInfo.shadowCasterExtent = 2.0f * sceneRadius;
+
+        // Binding 0 is only sampled by the scene, binding 1 also places the cascades in shadow.vert
+        VkDescriptorSetLayoutBinding shadowMapBinding{};
+        shadowMapBinding.binding = 0;
+        shadowMapBinding.descriptorCount = 1;
+        shadowMapBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        shadowMapBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorSetLayoutBinding shadowUniformBinding{};
+        shadowUniformBinding.binding = 1;
+        shadowUniformBinding.descriptorCount = 1;
+        shadowUniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        shadowUniformBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        vulkanProgramInfo.shadowSetLayout = vulkanProgramInfo.descriptorLayoutCache.get({shadowMapBinding,
+                                                                                          shadowUniformBinding});
+
+        VkBufferCreateInfo shadowUniformBufferCreateInfo{};
+        shadowUniformBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        shadowUniformBufferCreateInfo.size = sizeof(ShadowUniforms);
+        shadowUniformBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        shadowUniformBufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+
+        vulkanProgramInfo.shadowUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.shadowUniformBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.shadowUniformMappings.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.shadowSets.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            createBuffer(shadowUniformBufferCreateInfo,
+                         vulkanProgramInfo.renderDevice,
+                         vulkanProgramInfo.shadowUniformBuffers[i],
+                         vulkanProgramInfo.GPU,
+                         vulkanProgramInfo.shadowUniformBufferMemories[i],
+                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+            void *mappedMemory;
+            vkResult = vkMapMemory(device,
+                                   vulkanProgramInfo.shadowUniformBufferMemories[i],
+                                   0,
+                                   sizeof(ShadowUniforms),
+                                   0,
+                                   &mappedMemory);
+            checkVkResult(vkResult, "Failed to map shadow uniform buffer");
+            vulkanProgramInfo.shadowUniformMappings[i] = static_cast<ShadowUniforms *>(mappedMemory);
+
+            // Point at resources that live until exit, so they come from the persistent allocator
+            vulkanProgramInfo.shadowSets[i] = vulkanProgramInfo.persistentDescriptors.allocate(
+                    vulkanProgramInfo.shadowSetLayout);
+
+            VkDescriptorImageInfo imageInfo{};
+            imageInfo.sampler = vulkanProgramInfo.shadowSampler;
+            imageInfo.imageView = vulkanProgramInfo.shadowMapView;
+            imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+            VkDescriptorBufferInfo bufferInfo{};
+            bufferInfo.buffer = vulkanProgramInfo.shadowUniformBuffers[i];
+            bufferInfo.offset = 0;
+            bufferInfo.range = sizeof(ShadowUniforms);
+
+            std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+            descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[0].dstSet = vulkanProgramInfo.shadowSets[i];
+            descriptorWrites[0].dstBinding = 0;
+            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrites[0].descriptorCount = 1;
+            descriptorWrites[0].pImageInfo = &imageInfo;
+            descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[1].dstSet = vulkanProgramInfo.shadowSets[i];
+            descriptorWrites[1].dstBinding = 1;
+            descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrites[1].descriptorCount = 1;
+            descriptorWrites[1].pBufferInfo = &bufferInfo;
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(),
+                                   0, nullptr);
+        }
+
+        if (!vulkanProgramInfo.dynamicRenderingEnabled)
+        {
+            createShadowRenderPass();
+        }
+
+        // The frame graph expects the map where the scene left it, no cascade has been rendered yet
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+        VkImageMemoryBarrier shadowMapBarrier{};
+        shadowMapBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        shadowMapBarrier.image = vulkanProgramInfo.shadowMapImage;
+        shadowMapBarrier.srcAccessMask = 0;
+        shadowMapBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        shadowMapBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        shadowMapBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        shadowMapBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        shadowMapBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        shadowMapBarrier.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, cascadeCount};
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0,
+                             0, nullptr,
+                             0, nullptr,
+                             1, &shadowMapBarrier);
+
+        endSingleTimeCommands(commandBuffer);
+
+        VkDeviceSize layerBytes = static_cast<VkDeviceSize>(options.shadowMapSize) * options.shadowMapSize *
+                                  shadowFormat.bytesPerPixel;
+        std::cout << "Shadows: " << cascadeCount << " cascades of " << options.shadowMapSize << "x"
+                  << options.shadowMapSize << " " << shadowFormat.name << ", "
+                  << static_cast<double>(layerBytes * cascadeCount) / (1024.0 * 1024.0) << " MiB"
+                  << (options.staticScene ? "" : ", objects move so every cascade is rendered every frame")
+                  << std::endl;
+    }
+
+    // Depth only, cleared and kept. The frame graph has the layer in attachment layout already
+    // and takes it to shader read for the scene.
+    void createShadowRenderPass()
+    {
+        VkAttachmentDescription depthAttachment{};
+        depthAttachment.format = vulkanProgramInfo.shadowMapFormat;
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depthAttachmentReference{};
+        depthAttachmentReference.attachment = 0;
+        depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpassDescription{};
+        subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpassDescription.colorAttachmentCount = 0;
+        subpassDescription.pDepthStencilAttachment = &depthAttachmentReference;
+
+        VkRenderPassCreateInfo renderPassCreateInfo{};
+        renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassCreateInfo.attachmentCount = 1;
+        renderPassCreateInfo.pAttachments = &depthAttachment;
+        renderPassCreateInfo.subpassCount = 1;
+        renderPassCreateInfo.pSubpasses = &subpassDescription;
+
+        vkResult = vkCreateRenderPass(vulkanProgramInfo.renderDevice, &renderPassCreateInfo, nullptr,
+                                      &vulkanProgramInfo.shadowRenderPass);
+        checkVkResult(vkResult, "Failed to create shadow render pass");
+
+        vulkanProgramInfo.shadowFramebuffers.resize(vulkanProgramInfo.shadowLayerViews.size());
+        for (std::size_t i = 0; i < vulkanProgramInfo.shadowLayerViews.size(); i++)
+        {
+            VkFramebufferCreateInfo framebufferCreateInfo{};
+            framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferCreateInfo.renderPass = vulkanProgramInfo.shadowRenderPass;
+            framebufferCreateInfo.attachmentCount = 1;
+            framebufferCreateInfo.pAttachments = &vulkanProgramInfo.shadowLayerViews[i];
+            framebufferCreateInfo.width = options.shadowMapSize;
+            framebufferCreateInfo.height = options.shadowMapSize;
+            framebufferCreateInfo.layers = 1;
+
+            vkResult = vkCreateFramebuffer(vulkanProgramInfo.renderDevice, &framebufferCreateInfo, nullptr,
+                                           &vulkanProgramInfo.shadowFramebuffers[i]);
+            checkVkResult(vkResult, "Failed to create shadow framebuffer");
+        }
+    }
+
+    // Positions only, no fragment shader. Both faces cast, and a slope scaled bias keeps lit
+    // surfaces at grazing angles to the light from shadowing themselves.
+    GraphicsPipelineDesc describeShadowPipeline() const
+    {
+        GraphicsPipelineDesc desc{};
+        desc.layout = vulkanProgramInfo.shadowPipelineLayout;
+        desc.renderPass = vulkanProgramInfo.shadowRenderPass;
+        desc.colorAttachmentCount = 0;
+        if (vulkanProgramInfo.dynamicRenderingEnabled)
+        {
+            desc.depthFormat = vulkanProgramInfo.shadowMapFormat;
+        }
+        desc.raster.cullMode = VK_CULL_MODE_NONE;
+        desc.raster.depthBiasConstant = 1.25f;
+        desc.raster.depthBiasSlope = 1.75f;
+
+        desc.vertexLayout.binding = 1;
+        desc.vertexLayout.stride = sizeof(glm::vec3);
+        desc.vertexLayout.attributes = {{0, VK_FORMAT_R32G32B32_SFLOAT, 0}};
+
+        ShaderStageDesc vertexStage{};
+        vertexStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertexStage.name = "shadow.vert";
+        if (vulkanProgramInfo.bindlessEnabled)
+        {
+            vertexStage.defines.emplace_back("BINDLESS", "1");
+        }
+
+        desc.stages = {vertexStage};
+        return desc;
+    }
+
+    void createShadowPipeline()
+    {
+        // Set 0 for the instance matrices, the shadow set is set 1 here
+        std::array<VkDescriptorSetLayout, 2> setLayouts = {vulkanProgramInfo.bindlessEnabled
+                                                           ? vulkanProgramInfo.bindless.layout()
+                                                           : vulkanProgramInfo.descriptorSetLayout,
+                                                           vulkanProgramInfo.shadowSetLayout};
+
+        VkPushConstantRange shadowPushConstantRange{};
+        shadowPushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        shadowPushConstantRange.offset = 0;
+        shadowPushConstantRange.size = sizeof(ShadowPushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &shadowPushConstantRange;
+
+        vkResult = vkCreatePipelineLayout(vulkanProgramInfo.renderDevice, &pipelineLayoutCreateInfo, nullptr,
+                                          &vulkanProgramInfo.shadowPipelineLayout);
+        checkVkResult(vkResult, "Failed to create shadow pipeline layout");
+
+        GraphicsPipelineDesc desc = describeShadowPipeline();
+        vulkanProgramInfo.shadowPipeline = pipelineManager->create(desc);
+        if (vulkanProgramInfo.shadowPipeline == VK_NULL_HANDLE)
+        {
+            throw std::runtime_error("failed to create shadow pipeline!");
+        }
+
+        if (shaderHotReloader)
+        {
+            shaderHotReloader->watch("shadow", &vulkanProgramInfo.shadowPipeline,
+                                     {{"shadow.vert", desc.stages[0].defines}},
+                                     [this, desc](const std::vector<std::vector<char>> &spirv)
+                                     {
+                                         return pipelineManager->create(desc, &spirv);
+                                     });
+        }
+    }
+
+    // Imports the shadow map and, when a cascade has to be rendered this frame, adds the pass that
+    // does. Last frame's scene sampled it, cached layers are carried over as they are.
+    RenderGraphHandle addShadowPass(RenderGraph &graph)
+    {
+        RenderGraphHandle shadowMap = graph.importImage("shadow map",
+                                                        vulkanProgramInfo.shadowMapImage,
+                                                        vulkanProgramInfo.shadowMapView,
+                                                        VK_IMAGE_ASPECT_DEPTH_BIT,
+                                                        1,
+                                                        describeUsage(ResourceUsage::SampledFragment),
+                                                        vulkanProgramInfo.shadowCascades.cascadeCount());
+
+        uint32_t renderMask = vulkanProgramInfo.shadowRenderMask;
+        if (renderMask != 0)
+        {
+            graph.addPass("shadow cascades", [this, renderMask](VkCommandBuffer commandBuffer)
+                    {
+                        recordShadowCascades(commandBuffer, renderMask);
+                    })
+                    .write(shadowMap, ResourceUsage::DepthAttachment);
+        }
+        return shadowMap;
+    }
+
+    // Every cascade in renderMask gets all objects in one instanced draw
+    void recordShadowCascades(VkCommandBuffer commandBuffer, uint32_t renderMask)
+    {
+        VkDescriptorSet descriptorSets[2] = {vulkanProgramInfo.bindlessEnabled ? vulkanProgramInfo.bindless.set()
+                                                                               : vulkanProgramInfo.sceneDescriptorSet,
+                                             vulkanProgramInfo.shadowSets[vulkanProgramInfo.curr_frame]};
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                vulkanProgramInfo.shadowPipelineLayout,
+                                0,
+                                2,
+                                descriptorSets,
+                                0,
+                                nullptr);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanProgramInfo.shadowPipeline);
+        vkCmdBindIndexBuffer(commandBuffer, vulkanProgramInfo.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        VkDeviceSize offsets[] = {0};
+        vkCmdBindVertexBuffers(commandBuffer, 1, 1, &vulkanProgramInfo.positionBuffer, offsets);
+
+        VkViewport viewport{};
+        viewport.width = static_cast<float>(options.shadowMapSize);
+        viewport.height = static_cast<float>(options.shadowMapSize);
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D renderArea{};
+        renderArea.extent = {options.shadowMapSize, options.shadowMapSize};
+        vkCmdSetScissor(commandBuffer, 0, 1, &renderArea);
+
+        VkClearValue depthClearValue{};
+        depthClearValue.depthStencil = {1.0f, 0};
+
+        for (uint32_t cascade = 0; cascade < vulkanProgramInfo.shadowCascades.cascadeCount(); cascade++)
+        {
+            if (!(renderMask & (1u << cascade)))
+            {
+                continue;
+            }
+
+            if (vulkanProgramInfo.dynamicRenderingEnabled)
+            {
+                VkRenderingAttachmentInfoKHR depthAttachment{};
+                depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+                depthAttachment.imageView = vulkanProgramInfo.shadowLayerViews[cascade];
+                depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+                depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                depthAttachment.clearValue = depthClearValue;
+
+                VkRenderingInfoKHR renderingInfo{};
+                renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+                renderingInfo.renderArea = renderArea;
+                renderingInfo.layerCount = 1;
+                renderingInfo.colorAttachmentCount = 0;
+                renderingInfo.pDepthAttachment = &depthAttachment;
+
+                vulkanProgramInfo.dynamicRendering.cmdBeginRendering(commandBuffer, &renderingInfo);
+            } else
+            {
+                VkRenderPassBeginInfo renderPassBeginInfo{};
+                renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                renderPassBeginInfo.renderPass = vulkanProgramInfo.shadowRenderPass;
+                renderPassBeginInfo.framebuffer = vulkanProgramInfo.shadowFramebuffers[cascade];
+                renderPassBeginInfo.renderArea = renderArea;
+                renderPassBeginInfo.clearValueCount = 1;
+                renderPassBeginInfo.pClearValues = &depthClearValue;
+
+                vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            }
+
+            ShadowPushConstants pushConstants{};
+            pushConstants.instanceBufferIndex = vulkanProgramInfo.bindlessEnabled
+                                                ? vulkanProgramInfo.instanceBufferIndices[vulkanProgramInfo.curr_frame]
+                                                : 0;
+            pushConstants.cascade = cascade;
+            vkCmdPushConstants(commandBuffer, vulkanProgramInfo.shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                               0, sizeof(pushConstants), &pushConstants);
+
+            vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(vertex_indices.size()),
+                             static_cast<uint32_t>(vulkanProgramInfo.sceneTransforms.size()), 0, 0, 0);
+
+            endScenePass(commandBuffer);
+        }
+    }
+
+    // Fits the cascades to this frame's camera and light and writes the frame's shadow uniforms.
+    // The E and Y keys turn the light around the vertical axis. Baseline frames of the benchmark
+    // leave the cascades as they are, render none and set a cascade count of 0, which the scene
+    // shaders take as lit everywhere without looking at the shadow map.
+    void updateShadowCascades(const ShadowCamera &camera)
+    {
+        bool skipped = options.benchFrames > 0 &&
+                       (vulkanProgramInfo.frameNumber / SHADOW_BASELINE_BLOCK) % SHADOW_BASELINE_PERIOD ==
+                       SHADOW_BASELINE_PERIOD - 1;
+
+        float lightAngle = 0.6f + 5.0f * direction;
+        glm::vec3 lightDirection = glm::normalize(glm::vec3(0.5f * std::cos(lightAngle),
+                                                            0.5f * std::sin(lightAngle),
+                                                            -1.0f));
+
+        ShadowCascades &cascades = vulkanProgramInfo.shadowCascades;
+        uint32_t renderMask = skipped ? 0 : cascades.update(camera, lightDirection,
+                                                            vulkanProgramInfo.shadowCasterExtent,
+                                                            vulkanProgramInfo.sceneVersion);
+        vulkanProgramInfo.shadowFrameRendered[vulkanProgramInfo.curr_frame] = renderMask != 0;
+        vulkanProgramInfo.shadowFrameSkipped[vulkanProgramInfo.curr_frame] = skipped;
+
+        // Pre-recorded frames render the cascades of the mask they were recorded with
+        if (renderMask != vulkanProgramInfo.shadowRenderMask)
+        {
+            vulkanProgramInfo.shadowRenderMask = renderMask;
+            vulkanProgramInfo.commandGeneration++;
+        }
+
+        ShadowUniforms &uniforms = *vulkanProgramInfo.shadowUniformMappings[vulkanProgramInfo.curr_frame];
+        for (uint32_t i = 0; i < cascades.cascadeCount(); i++)
+        {
+            uniforms.cascadeViewProjection[i] = cascades.viewProjection(i);
+            uniforms.cascadeSplits[i] = cascades.splitDistance(i);
+            uniforms.cascadeTexelSizes[i] = cascades.texelSize(i);
+        }
+        uniforms.lightDirection = glm::vec4(lightDirection, 0.0f);
+        uniforms.cameraPosition = glm::vec4(camera.position, 1.0f);
+        uniforms.cameraForward = glm::vec4(camera.forward, 0.0f);
+        uniforms.cascadeCount = skipped ? 0 : cascades.cascadeCount();
+    }
+
+    // Adds the GPU time of the frame just collected to the frames with or without cascades rendered,
+    // or to the ones without shadows
+    void recordShadowFrameTime()
+    {
+        const GpuProfiler &profiler = vulkanProgramInfo.gpuProfiler;
+        if (!vulkanProgramInfo.shadowsEnabled || profiler.collectedFrames() == vulkanProgramInfo.shadowMeasurements)
+        {
+            return;
+        }
+        vulkanProgramInfo.shadowMeasurements = profiler.collectedFrames();
+
+        if (vulkanProgramInfo.shadowFrameSkipped[vulkanProgramInfo.curr_frame])
+        {
+            vulkanProgramInfo.unshadowedFrameMilliseconds += profiler.lastFrameMilliseconds();
+            vulkanProgramInfo.unshadowedFrames++;
+        } else if (vulkanProgramInfo.shadowFrameRendered[vulkanProgramInfo.curr_frame])
+        {
+            vulkanProgramInfo.renderedShadowFrameMilliseconds += profiler.lastFrameMilliseconds();
+            vulkanProgramInfo.renderedShadowFrames++;
+        } else
+        {
+            vulkanProgramInfo.cachedShadowFrameMilliseconds += profiler.lastFrameMilliseconds();
+            vulkanProgramInfo.cachedShadowFrames++;
+        }
+    }
+
+    void reportShadowCascades() const
+    {
+        const ShadowCascades &cascades = vulkanProgramInfo.shadowCascades;
+        uint64_t updates = cascades.cascadesRendered() + cascades.cascadesCached();
+        std::cout << "Shadows: " << cascades.cascadesRendered() << " cascades rendered, "
+                  << cascades.cascadesCached() << " cached ("
+                  << (updates > 0 ? 100.0 * static_cast<double>(cascades.cascadesCached()) /
+                                    static_cast<double>(updates) : 0.0) << "%)" << std::endl;
+
+        auto average = [](double milliseconds, uint64_t frames)
+        {
+            return frames > 0 ? milliseconds / static_cast<double>(frames) : 0.0;
+        };
+        if (vulkanProgramInfo.renderedShadowFrames + vulkanProgramInfo.cachedShadowFrames > 0)
+        {
+            std::cout << "  GPU frame time " << average(vulkanProgramInfo.renderedShadowFrameMilliseconds,
+                                                         vulkanProgramInfo.renderedShadowFrames)
+                      << " ms over " << vulkanProgramInfo.renderedShadowFrames << " frames rendering cascades ("
+                      << vulkanProgramInfo.gpuProfiler.averageMilliseconds("shadow cascades") << " ms of it), "
+                      << average(vulkanProgramInfo.cachedShadowFrameMilliseconds, vulkanProgramInfo.cachedShadowFrames)
+                      << " ms over " << vulkanProgramInfo.cachedShadowFrames << " frames with all cached"
+                      << std::endl;
+        }
+        if (vulkanProgramInfo.unshadowedFrames > 0 &&
+            vulkanProgramInfo.renderedShadowFrames + vulkanProgramInfo.cachedShadowFrames > 0)
+        {
+            double unshadowed = average(vulkanProgramInfo.unshadowedFrameMilliseconds,
+                                        vulkanProgramInfo.unshadowedFrames);
+            double rendered = average(vulkanProgramInfo.renderedShadowFrameMilliseconds,
+                                      vulkanProgramInfo.renderedShadowFrames);
+            double cached = average(vulkanProgramInfo.cachedShadowFrameMilliseconds,
+                                    vulkanProgramInfo.cachedShadowFrames);
+            std::cout << "  " << unshadowed << " ms over " << vulkanProgramInfo.unshadowedFrames
+                      << " frames without shadows, so shadows cost ";
+            if (vulkanProgramInfo.renderedShadowFrames > 0)
+            {
+                std::cout << rendered - unshadowed << " ms when rendering cascades";
+            }
+            if (vulkanProgramInfo.renderedShadowFrames > 0 && vulkanProgramInfo.cachedShadowFrames > 0)
+            {
+                std::cout << " and ";
+            }
+            if (vulkanProgramInfo.cachedShadowFrames > 0)
+            {
+                std::cout << cached - unshadowed << " ms with all cached";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    void destroyShadowResources() const
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+
+        vkDestroyPipeline(device, vulkanProgramInfo.shadowPipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.shadowPipelineLayout, nullptr);
+
+        for (const auto &framebuffer: vulkanProgramInfo.shadowFramebuffers)
+        {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        vkDestroyRenderPass(device, vulkanProgramInfo.shadowRenderPass, nullptr);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkUnmapMemory(device, vulkanProgramInfo.shadowUniformBufferMemories[i]);
+            vkDestroyBuffer(device, vulkanProgramInfo.shadowUniformBuffers[i], nullptr);
+            vkFreeMemory(device, vulkanProgramInfo.shadowUniformBufferMemories[i], nullptr);
+        }
+
+        vkDestroySampler(device, vulkanProgramInfo.shadowSampler, nullptr);
+        for (const auto &layerView: vulkanProgramInfo.shadowLayerViews)
+        {
+            vkDestroyImageView(device, layerView, nullptr);
+        }
+        vkDestroyImageView(device, vulkanProgramInfo.shadowMapView, nullptr);
+        vkDestroyImage(device, vulkanProgramInfo.shadowMapImage, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.shadowMapMemory, nullptr);
+    }
+
+    /*
+     * ============================================================
+     * END: Cascaded Shadow Maps
+     * ============================================================
+     */
+
+    /*
+     * ============================================================
+     * START: Clustered Lighting
+     * ============================================================
+     */
+    // Froxel grid: screen tiles of CLUSTER_TILE_SIZE pixels, each split into CLUSTER_DEPTH_SLICES
+    // slices spaced exponentially between the near and far plane
+    static constexpr uint32_t CLUSTER_TILE_SIZE = 64;
+    static constexpr uint32_t CLUSTER_DEPTH_SLICES = 24;
+    // Average lights per cluster the light index list has room for
+    static constexpr uint32_t CLUSTER_AVERAGE_LIGHTS = 64;
+    // About this many lights reach any point of the scene, whatever the light count
+    static constexpr float LIGHT_OVERLAP = 6.0f;
+    static constexpr float LIGHT_AREA_HALF_EXTENT = 2.2f;
+
+    // Host visible buffer of one frame slot, mapped until exit
+    void *createMappedBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer &buffer, VkDeviceMemory &memory)
+    {
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = size;
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        bufferCreateInfo.usage = usage;
+
+        createBuffer(bufferCreateInfo,
+                     vulkanProgramInfo.renderDevice,
+                     buffer,
+                     vulkanProgramInfo.GPU,
+                     memory,
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+        void *mappedMemory;
+        vkResult = vkMapMemory(vulkanProgramInfo.renderDevice, memory, 0, size, 0, &mappedMemory);
+        checkVkResult(vkResult, "Failed to map buffer");
+        return mappedMemory;
+    }
+
+    // Lights, grid buffers, the cluster sets and the binning pipeline. The grid covers the
+    // swapchain, a smaller dynamic resolution viewport uses its top left tiles.
+    void createClusteredLights()
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+        vulkanProgramInfo.maxLights = options.benchLightFrames > 0
+                                      ? std::max(options.lights, LIGHT_BENCHMARK_COUNTS[std::size(LIGHT_BENCHMARK_COUNTS) - 1])
+                                      : options.lights;
+
+        // Scattered over and between the objects, every fourth one a spot light pointing down.
+        // Positions are where they start, they circle around the vertical axis.
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> horizontal(-LIGHT_AREA_HALF_EXTENT, LIGHT_AREA_HALF_EXTENT);
+        std::uniform_real_distribution<float> vertical(-0.6f, 0.4f);
+        std::uniform_real_distribution<float> channel(0.2f, 1.0f);
+        std::uniform_real_distribution<float> tilt(-0.4f, 0.4f);
+
+        vulkanProgramInfo.lights.resize(vulkanProgramInfo.maxLights);
+        for (uint32_t i = 0; i < vulkanProgramInfo.maxLights; i++)
+        {
+            ClusterLight &light = vulkanProgramInfo.lights[i];
+            light.positionRange = glm::vec4(horizontal(rng), horizontal(rng), vertical(rng), 0.0f);
+            light.color = glm::vec4(channel(rng), channel(rng), channel(rng), 0.0f);
+            light.directionCone = glm::vec4(0.0f, 0.0f, -1.0f, -1.0f);
+            if (i % 4 == 3)
+            {
+                light.directionCone = glm::vec4(glm::normalize(glm::vec3(tilt(rng), tilt(rng), -1.0f)),
+                                                std::cos(glm::radians(35.0f)));
+            }
+        }
+
+        VkExtent2D extent = vulkanProgramInfo.swapchainExtent;
+        vulkanProgramInfo.clusterGridSize = glm::uvec4((extent.width + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE,
+                                                       (extent.height + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE,
+                                                       CLUSTER_DEPTH_SLICES,
+                                                       CLUSTER_TILE_SIZE);
+        uint32_t clusterCount = clusterCountOf(vulkanProgramInfo.clusterGridSize);
+        vulkanProgramInfo.maxLightReferences = clusterCount * CLUSTER_AVERAGE_LIGHTS;
+
+        // Written by the binning and read by the scene in the same frame, never by the host
+        VkBufferCreateInfo gridBufferCreateInfo{};
+        gridBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        gridBufferCreateInfo.size = sizeof(glm::uvec2) * clusterCount;
+        gridBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        gridBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+        createBuffer(gridBufferCreateInfo,
+                     vulkanProgramInfo.renderDevice,
+                     vulkanProgramInfo.clusterBuffer,
+                     vulkanProgramInfo.GPU,
+                     vulkanProgramInfo.clusterBufferMemory,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        gridBufferCreateInfo.size = sizeof(uint32_t) * vulkanProgramInfo.maxLightReferences;
+        createBuffer(gridBufferCreateInfo,
+                     vulkanProgramInfo.renderDevice,
+                     vulkanProgramInfo.lightIndexBuffer,
+                     vulkanProgramInfo.GPU,
+                     vulkanProgramInfo.lightIndexBufferMemory,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        // Everything but the counter is read by both the binning and the fragment shader
+        std::array<VkDescriptorSetLayoutBinding, 5> bindings{};
+        for (uint32_t binding = 0; binding < bindings.size(); binding++)
+        {
+            bindings[binding].binding = binding;
+            bindings[binding].descriptorCount = 1;
+            bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        }
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[4].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        vulkanProgramInfo.clusterSetLayout = vulkanProgramInfo.descriptorLayoutCache.get(
+                {bindings[0], bindings[1], bindings[2], bindings[3], bindings[4]});
+
+        VkDeviceSize lightBufferSize = sizeof(ClusterLight) * std::max(vulkanProgramInfo.maxLights, 1u);
+        vulkanProgramInfo.lightBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.lightBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.lightBufferMappings.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.clusterUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.clusterUniformBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.clusterUniformMappings.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.lightCounterBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.lightCounterBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.lightCounterMappings.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.clusterSets.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vulkanProgramInfo.lightBufferMappings[i] = static_cast<ClusterLight *>(
+                    createMappedBuffer(lightBufferSize,
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                       vulkanProgramInfo.lightBuffers[i],
+                                       vulkanProgramInfo.lightBufferMemories[i]));
+            vulkanProgramInfo.clusterUniformMappings[i] = static_cast<ClusterUniforms *>(
+                    createMappedBuffer(sizeof(ClusterUniforms),
+                                       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                       vulkanProgramInfo.clusterUniformBuffers[i],
+                                       vulkanProgramInfo.clusterUniformBufferMemories[i]));
+            // Zeroed by the binning pass, so it is a transfer destination too
+            vulkanProgramInfo.lightCounterMappings[i] = static_cast<uint32_t *>(
+                    createMappedBuffer(sizeof(uint32_t),
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       vulkanProgramInfo.lightCounterBuffers[i],
+                                       vulkanProgramInfo.lightCounterBufferMemories[i]));
+            *vulkanProgramInfo.lightCounterMappings[i] = 0;
+
+            vulkanProgramInfo.clusterSets[i] = vulkanProgramInfo.persistentDescriptors.allocate(
+                    vulkanProgramInfo.clusterSetLayout);
+
+            std::array<VkDescriptorBufferInfo, 5> bufferInfos =
+                    {
+                            VkDescriptorBufferInfo{vulkanProgramInfo.clusterUniformBuffers[i], 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.lightBuffers[i], 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.clusterBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.lightIndexBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.lightCounterBuffers[i], 0, VK_WHOLE_SIZE}
+                    };
+
+            std::array<VkWriteDescriptorSet, 5> writes{};
+            for (uint32_t binding = 0; binding < writes.size(); binding++)
+            {
+                writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[binding].dstSet = vulkanProgramInfo.clusterSets[i];
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = bindings[binding].descriptorType;
+                writes[binding].pBufferInfo = &bufferInfos[binding];
+            }
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+
+        createComputePipeline("cluster_lights.comp",
+                              vulkanProgramInfo.clusterSetLayout,
+                              0,
+                              vulkanProgramInfo.clusterPipelineLayout,
+                              vulkanProgramInfo.clusterPipeline);
+
+        if (options.benchLightFrames > 0)
+        {
+            for (uint32_t lights: LIGHT_BENCHMARK_COUNTS)
+            {
+                vulkanProgramInfo.lightBenchmark.push_back({lights});
+            }
+        }
+
+        std::cout << "Clustered lights: " << vulkanProgramInfo.maxLights << " lights, "
+                  << vulkanProgramInfo.clusterGridSize.x << "x" << vulkanProgramInfo.clusterGridSize.y << "x"
+                  << vulkanProgramInfo.clusterGridSize.z << " clusters of " << CLUSTER_TILE_SIZE << " pixels, room for "
+                  << vulkanProgramInfo.maxLightReferences << " light references" << std::endl;
+    }
+
+    static uint32_t clusterCountOf(const glm::uvec4 &gridSize)
+    {
+        return gridSize.x * gridSize.y * gridSize.z;
+    }
+
+    // Lights of this frame. --bench-lights moves through LIGHT_BENCHMARK_COUNTS.
+    uint32_t activeLightCount() const
+    {
+        if (options.benchLightFrames == 0)
+        {
+            return options.lights;
+        }
+        uint64_t step = (std::max<uint64_t>(vulkanProgramInfo.frameNumber, 1) - 1) / options.benchLightFrames;
+        return LIGHT_BENCHMARK_COUNTS[std::min<uint64_t>(step, std::size(LIGHT_BENCHMARK_COUNTS) - 1)];
+    }
+
+    bool lightBenchmarkFinished() const
+    {
+        return options.benchLightFrames > 0 &&
+               vulkanProgramInfo.frameNumber >= options.benchLightFrames * std::size(LIGHT_BENCHMARK_COUNTS);
+    }
+
+    // Moves the lights and writes them with this frame's camera into the frame's buffers. The
+    // count is in the uniforms, pre-recorded frames pick it up without being recorded again.
+    void updateClusterLights(const ShadowCamera &camera, const glm::mat4 &view, const glm::mat4 &projection,
+                             float time)
+    {
+        uint32_t lightCount = activeLightCount();
+        uint32_t frame = vulkanProgramInfo.curr_frame;
+        vulkanProgramInfo.frameLightCounts[frame] = lightCount;
+
+        // Ranges shrink as lights are added, so the lights reaching a point stay about the same
+        float area = 4.0f * LIGHT_AREA_HALF_EXTENT * LIGHT_AREA_HALF_EXTENT;
+        float range = std::min(2.0f, std::sqrt(LIGHT_OVERLAP * area /
+                                               (3.14159265f * static_cast<float>(std::max(lightCount, 1u)))));
+
+        ClusterLight *mappedLights = vulkanProgramInfo.lightBufferMappings[frame];
+        for (uint32_t i = 0; i < lightCount; i++)
+        {
+            const ClusterLight &light = vulkanProgramInfo.lights[i];
+            float speed = 0.1f * static_cast<float>(1 + i % 5) * (i % 2 == 0 ? 1.0f : -1.0f);
+            float c = std::cos(speed * time);
+            float s = std::sin(speed * time);
+
+            ClusterLight &moved = mappedLights[i];
+            moved.positionRange = glm::vec4(c * light.positionRange.x - s * light.positionRange.y,
+                                            s * light.positionRange.x + c * light.positionRange.y,
+                                            light.positionRange.z,
+                                            range);
+            moved.color = light.color;
+            moved.directionCone = glm::vec4(c * light.directionCone.x - s * light.directionCone.y,
+                                            s * light.directionCone.x + c * light.directionCone.y,
+                                            light.directionCone.z,
+                                            light.directionCone.w);
+        }
+
+        float depthRange = std::log(camera.farPlane / camera.nearPlane);
+        ClusterUniforms &uniforms = *vulkanProgramInfo.clusterUniformMappings[frame];
+        uniforms.view = view;
+        uniforms.inverseProjection = glm::inverse(projection);
+        uniforms.screenSize = glm::vec2(static_cast<float>(vulkanProgramInfo.renderExtent.width),
+                                        static_cast<float>(vulkanProgramInfo.renderExtent.height));
+        uniforms.nearPlane = camera.nearPlane;
+        uniforms.farPlane = camera.farPlane;
+        uniforms.gridSize = vulkanProgramInfo.clusterGridSize;
+        uniforms.lightCount = lightCount;
+        uniforms.sliceScale = static_cast<float>(CLUSTER_DEPTH_SLICES) / depthRange;
+        uniforms.sliceBias = -static_cast<float>(CLUSTER_DEPTH_SLICES) * std::log(camera.nearPlane) / depthRange;
+        uniforms.maxLightReferences = vulkanProgramInfo.maxLightReferences;
+    }
+
+    // The shading scene passes read what the binning wrote
+    void addLightBinningPass(RenderGraph &graph, SceneInputs &sceneInputs)
+    {
+        // Last read by the fragment shader of the previous frame
+        sceneInputs.lightClusters = graph.importBuffer("light clusters",
+                                                       vulkanProgramInfo.clusterBuffer,
+                                                       describeUsage(ResourceUsage::StorageReadFragment));
+        sceneInputs.lightIndices = graph.importBuffer("light indices",
+                                                      vulkanProgramInfo.lightIndexBuffer,
+                                                      describeUsage(ResourceUsage::StorageReadFragment));
+
+        graph.addPass("light binning", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordLightBinning(commandBuffer);
+                })
+                .write(sceneInputs.lightClusters, ResourceUsage::StorageWriteCompute)
+                .write(sceneInputs.lightIndices, ResourceUsage::StorageWriteCompute);
+    }
+
+    // One invocation per cluster. The frame's counter is zeroed first and read by the host
+    // once the frame is done.
+    void recordLightBinning(VkCommandBuffer commandBuffer)
+    {
+        VkBuffer counter = vulkanProgramInfo.lightCounterBuffers[vulkanProgramInfo.curr_frame];
+        vkCmdFillBuffer(commandBuffer, counter, 0, sizeof(uint32_t), 0);
+
+        VkBufferMemoryBarrier counterBarrier{};
+        counterBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        counterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        counterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        counterBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        counterBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        counterBarrier.buffer = counter;
+        counterBarrier.offset = 0;
+        counterBarrier.size = VK_WHOLE_SIZE;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             0, nullptr,
+                             1, &counterBarrier,
+                             0, nullptr);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.clusterPipeline);
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                vulkanProgramInfo.clusterPipelineLayout,
+                                0,
+                                1,
+                                &vulkanProgramInfo.clusterSets[vulkanProgramInfo.curr_frame],
+                                0,
+                                nullptr);
+        vkCmdDispatch(commandBuffer, (clusterCountOf(vulkanProgramInfo.clusterGridSize) + 127) / 128, 1, 1);
+
+        counterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        counterBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0,
+                             0, nullptr,
+                             1, &counterBarrier,
+                             0, nullptr);
+    }
+
+    // The frame slot's last frame is done: its light references and, with --bench-lights, its
+    // GPU times go to the light count it was rendered with
+    void collectLightStatistics()
+    {
+        uint32_t frame = vulkanProgramInfo.curr_frame;
+        uint32_t lightCount = vulkanProgramInfo.frameLightCounts[frame];
+        if (!vulkanProgramInfo.clusteredLightsEnabled || lightCount == 0)
+        {
+            return;
+        }
+
+        uint32_t lightReferences = *vulkanProgramInfo.lightCounterMappings[frame];
+        vulkanProgramInfo.lightReferenceSum += lightReferences;
+        vulkanProgramInfo.lightReferenceFrames++;
+        vulkanProgramInfo.lightIndexListOverflows += lightReferences > vulkanProgramInfo.maxLightReferences;
+
+        const GpuProfiler &profiler = vulkanProgramInfo.gpuProfiler;
+        if (profiler.collectedFrames() == vulkanProgramInfo.lightMeasurements)
+        {
+            return;
+        }
+        vulkanProgramInfo.lightMeasurements = profiler.collectedFrames();
+
+        for (auto &step: vulkanProgramInfo.lightBenchmark)
+        {
+            if (step.lights == lightCount)
+            {
+                step.frames++;
+                step.binningMilliseconds += profiler.lastMilliseconds("light binning");
+                step.frameMilliseconds += profiler.lastFrameMilliseconds();
+                step.lightReferences += lightReferences;
+            }
+        }
+    }
+
+    void reportClusteredLights() const
+    {
+        uint32_t clusterCount = clusterCountOf(vulkanProgramInfo.clusterGridSize);
+        if (vulkanProgramInfo.lightReferenceFrames > 0)
+        {
+            std::cout << "Clustered lights: " << static_cast<double>(vulkanProgramInfo.lightReferenceSum) /
+                                                 static_cast<double>(vulkanProgramInfo.lightReferenceFrames) /
+                                                 static_cast<double>(clusterCount)
+                      << " lights per cluster on average, light binning "
+                      << vulkanProgramInfo.gpuProfiler.averageMilliseconds("light binning") << " ms" << std::endl;
+        }
+        if (vulkanProgramInfo.lightIndexListOverflows > 0)
+        {
+            std::cout << "  the light index list was full in " << vulkanProgramInfo.lightIndexListOverflows
+                      << " frames, clusters past its end were drawn without lights" << std::endl;
+        }
+        if (!vulkanProgramInfo.lightBenchmark.empty())
+        {
+            printLightScalingBenchmark(vulkanProgramInfo.lightBenchmark, clusterCount);
+        }
+    }
+
+    void destroyClusteredLightResources() const
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+
+        vkDestroyPipeline(device, vulkanProgramInfo.clusterPipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.clusterPipelineLayout, nullptr);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            for (VkDeviceMemory memory: {vulkanProgramInfo.lightBufferMemories[i],
+                                         vulkanProgramInfo.clusterUniformBufferMemories[i],
+                                         vulkanProgramInfo.lightCounterBufferMemories[i]})
+            {
+                vkUnmapMemory(device, memory);
+                vkFreeMemory(device, memory, nullptr);
+            }
+            vkDestroyBuffer(device, vulkanProgramInfo.lightBuffers[i], nullptr);
+            vkDestroyBuffer(device, vulkanProgramInfo.clusterUniformBuffers[i], nullptr);
+            vkDestroyBuffer(device, vulkanProgramInfo.lightCounterBuffers[i], nullptr);
+        }
+
+        vkDestroyBuffer(device, vulkanProgramInfo.clusterBuffer, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.clusterBufferMemory, nullptr);
+        vkDestroyBuffer(device, vulkanProgramInfo.lightIndexBuffer, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.lightIndexBufferMemory, nullptr);
+    }
+
+    /*
+     * ============================================================
+     * END: Clustered Lighting
+     * ============================================================
+     */
+
+    /*
+     * ============================================================
+     * START: Deferred Shading
+     * ============================================================
+     */
+    // Albedo is stored encoded and read back linear, normals are mapped to 0 to 1. Both formats
+    // are color attachments on every device.
+    static constexpr VkFormat GBUFFER_ALBEDO_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
+    static constexpr VkFormat GBUFFER_NORMAL_FORMAT = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+
+    // G-buffer attachments, the per frame uniforms and the G-buffer sets of the lighting subpass.
+    // Runs after the depth buffer is created, the sets read it as well.
+    void createGBuffer()
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT |
+                                  VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+        bool albedoLazy = false;
+        bool normalLazy = false;
+        VkDeviceSize size = createAttachmentImage(GBUFFER_ALBEDO_FORMAT, usage, VK_SAMPLE_COUNT_1_BIT,
+                                                  vulkanProgramInfo.gbufferAlbedoImage,
+                                                  &vulkanProgramInfo.gbufferAlbedoMemory, albedoLazy);
+        size += createAttachmentImage(GBUFFER_NORMAL_FORMAT, usage, VK_SAMPLE_COUNT_1_BIT,
+                                      vulkanProgramInfo.gbufferNormalImage,
+                                      &vulkanProgramInfo.gbufferNormalMemory, normalLazy);
+
+        VkImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+
+        imageViewCreateInfo.format = GBUFFER_ALBEDO_FORMAT;
+        imageViewCreateInfo.image = vulkanProgramInfo.gbufferAlbedoImage;
+        vkResult = vkCreateImageView(device, &imageViewCreateInfo, nullptr, &vulkanProgramInfo.gbufferAlbedoView);
+        checkVkResult(vkResult, "Failed to create G-buffer albedo view");
+
+        imageViewCreateInfo.format = GBUFFER_NORMAL_FORMAT;
+        imageViewCreateInfo.image = vulkanProgramInfo.gbufferNormalImage;
+        vkResult = vkCreateImageView(device, &imageViewCreateInfo, nullptr, &vulkanProgramInfo.gbufferNormalView);
+        checkVkResult(vkResult, "Failed to create G-buffer normal view");
+
+        // Albedo, normal and depth in input attachment order, then the uniforms
+        std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+        for (uint32_t binding = 0; binding < bindings.size(); binding++)
         {
-            VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = vulkanProgramInfo.uniformBuffers[i];
-            bufferInfo.offset = 0;
-            bufferInfo.range = sizeof(UniformBufferObject);
-
-            VkDescriptorImageInfo textureImageInfo{};
-            textureImageInfo.imageView = vulkanProgramInfo.textureImageView;
-            textureImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            textureImageInfo.sampler = vulkanProgramInfo.textureImageSampler;
-
-            VkWriteDescriptorSet descriptorWriteUniformBuffer{};
-            descriptorWriteUniformBuffer.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWriteUniformBuffer.dstSet = vulkanProgramInfo.descriptorSets[i];
-            descriptorWriteUniformBuffer.dstBinding = 0;
-            descriptorWriteUniformBuffer.dstArrayElement = 0;
-            descriptorWriteUniformBuffer.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptorWriteUniformBuffer.descriptorCount = 1;
-            descriptorWriteUniformBuffer.pBufferInfo = &bufferInfo;
-
-            VkWriteDescriptorSet descriptorWriteImage{};
-            descriptorWriteImage.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWriteImage.dstSet = vulkanProgramInfo.descriptorSets[i];
-            descriptorWriteImage.dstBinding = 1;
-            descriptorWriteImage.dstArrayElement = 0;
-            descriptorWriteImage.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptorWriteImage.descriptorCount = 1;
-            descriptorWriteImage.pImageInfo = &textureImageInfo;
-
-            std::array<VkWriteDescriptorSet, 2> descriptorWrites =
-                    {
-                            descriptorWriteUniformBuffer,
-                            descriptorWriteImage
-                    };
+            bindings[binding].binding = binding;
+            bindings[binding].descriptorCount = 1;
+            bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            bindings[binding].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        }
+        bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
-            vkUpdateDescriptorSets(vulkanProgramInfo.renderDevice,
-                                   descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        vulkanProgramInfo.deferredSetLayout = vulkanProgramInfo.descriptorLayoutCache.get(
+                {bindings[0], bindings[1], bindings[2], bindings[3]});
+
+        vulkanProgramInfo.deferredUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.deferredUniformBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.deferredUniformMappings.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.deferredSets.resize(MAX_FRAMES_IN_FLIGHT);
+
+        std::array<VkDescriptorImageInfo, 3> imageInfos =
+                {
+                        VkDescriptorImageInfo{VK_NULL_HANDLE, vulkanProgramInfo.gbufferAlbedoView,
+                                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                        VkDescriptorImageInfo{VK_NULL_HANDLE, vulkanProgramInfo.gbufferNormalView,
+                                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                        VkDescriptorImageInfo{VK_NULL_HANDLE, vulkanProgramInfo.depthImageView,
+                                              VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}
+                };
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vulkanProgramInfo.deferredUniformMappings[i] = static_cast<DeferredUniforms *>(
+                    createMappedBuffer(sizeof(DeferredUniforms),
+                                       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                       vulkanProgramInfo.deferredUniformBuffers[i],
+                                       vulkanProgramInfo.deferredUniformBufferMemories[i]));
+
+            vulkanProgramInfo.deferredSets[i] = vulkanProgramInfo.persistentDescriptors.allocate(
+                    vulkanProgramInfo.deferredSetLayout);
+
+            VkDescriptorBufferInfo uniformBufferInfo{vulkanProgramInfo.deferredUniformBuffers[i], 0, VK_WHOLE_SIZE};
+
+            std::array<VkWriteDescriptorSet, 4> writes{};
+            for (uint32_t binding = 0; binding < writes.size(); binding++)
+            {
+                writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[binding].dstSet = vulkanProgramInfo.deferredSets[i];
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = bindings[binding].descriptorType;
+                if (binding < imageInfos.size())
+                {
+                    writes[binding].pImageInfo = &imageInfos[binding];
+                } else
+                {
+                    writes[binding].pBufferInfo = &uniformBufferInfo;
+                }
+            }
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
         }
+
+        std::cout << std::fixed << std::setprecision(2) << "Deferred shading: G-buffer of albedo, normal and depth, "
+                  << "transient, " << (albedoLazy && normalLazy ? "lazily allocated" : "device local") << ", "
+                  << static_cast<double>(size) / (1024.0 * 1024.0) << " MiB besides depth" << std::defaultfloat
+                  << std::endl;
     }
 
-    void drawFrame()
+    // Attachments: scene color (swapchain or scene color image), depth, albedo, normal. The
+    // geometry subpass writes the last three, the lighting subpass reads them as input attachments
+    // and writes scene color. Only scene color is stored.
+    void createDeferredRenderPass(VkImageLayout colorFinalLayout)
     {
-        vkWaitForFences(vulkanProgramInfo.renderDevice,
-                        1,
-                        &vulkanProgramInfo.frameReadyFences[vulkanProgramInfo.curr_frame],
-                        VK_TRUE,
-                        UINT64_MAX);
-        // Reset fence immediately for next use
-        vkResetFences(vulkanProgramInfo.renderDevice,
-                      1,
-                      &vulkanProgramInfo.frameReadyFences[vulkanProgramInfo.curr_frame]);
+        std::array<VkAttachmentDescription, 4> attachments{};
 
+        // Cleared, the lighting subpass skips the pixels nothing was drawn to
+        VkAttachmentDescription &colorAttachment = attachments[0];
+        colorAttachment.format = vulkanProgramInfo.sceneColorFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = colorFinalLayout;
 
-        vkAcquireNextImageKHR(vulkanProgramInfo.renderDevice,
-                              vulkanProgramInfo.swapchain,
-                              UINT64_MAX,
-                              vulkanProgramInfo.nextImageReadySemaphores[vulkanProgramInfo.curr_frame],
-                              VK_NULL_HANDLE,
-                              &vulkanProgramInfo.activeSwapchainImage);
+        VkAttachmentDescription &depthAttachment = attachments[1];
+        depthAttachment.format = vulkanProgramInfo.depthFormat;
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-        updateUniformBuffer();
+        // Every pixel the lighting subpass reads was written by the geometry subpass
+        for (uint32_t i: {2u, 3u})
+        {
+            attachments[i].format = i == 2 ? GBUFFER_ALBEDO_FORMAT : GBUFFER_NORMAL_FORMAT;
+            attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+            attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            attachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
 
-        vkResetCommandBuffer(vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame],
-                             0);
+        std::array<VkAttachmentReference, 2> gbufferWriteReferences =
+                {
+                        VkAttachmentReference{2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+                        VkAttachmentReference{3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}
+                };
+        VkAttachmentReference depthWriteReference{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
 
-        recordCommandBuffer();
+        // Depth is an input attachment and, read only, the depth attachment the lighting subpass
+        // tests against, in the same layout
+        std::array<VkAttachmentReference, 3> gbufferReadReferences =
+                {
+                        VkAttachmentReference{2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                        VkAttachmentReference{3, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+                        VkAttachmentReference{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}
+                };
+        VkAttachmentReference depthReadReference{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+        VkAttachmentReference colorReference{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+
+        std::array<VkSubpassDescription, 2> subpasses{};
+        subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpasses[0].colorAttachmentCount = static_cast<uint32_t>(gbufferWriteReferences.size());
+        subpasses[0].pColorAttachments = gbufferWriteReferences.data();
+        subpasses[0].pDepthStencilAttachment = &depthWriteReference;
+
+        subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpasses[1].inputAttachmentCount = static_cast<uint32_t>(gbufferReadReferences.size());
+        subpasses[1].pInputAttachments = gbufferReadReferences.data();
+        subpasses[1].colorAttachmentCount = 1;
+        subpasses[1].pColorAttachments = &colorReference;
+        subpasses[1].pDepthStencilAttachment = &depthReadReference;
+
+        // Each pixel only reads what the geometry subpass wrote at the same pixel
+        VkSubpassDependency dependency{};
+        dependency.srcSubpass = 0;
+        dependency.dstSubpass = 1;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                  VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependency.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+        dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
-        const VkPipelineStageFlags waitStageFlags[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+        VkRenderPassCreateInfo renderPassCreateInfo{};
+        renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassCreateInfo.pAttachments = attachments.data();
+        renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+        renderPassCreateInfo.pSubpasses = subpasses.data();
+        renderPassCreateInfo.dependencyCount = 1;
+        renderPassCreateInfo.pDependencies = &dependency;
+
+        vkResult = vkCreateRenderPass(vulkanProgramInfo.renderDevice, &renderPassCreateInfo, nullptr,
+                                      &vulkanProgramInfo.renderPass);
+        checkVkResult(vkResult, "Failed to create deferred render pass");
+    }
 
-        VkSubmitInfo submitCmdBuffer{};
-        submitCmdBuffer.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitCmdBuffer.waitSemaphoreCount = 1;
-        submitCmdBuffer.pWaitSemaphores = &vulkanProgramInfo.nextImageReadySemaphores[vulkanProgramInfo.curr_frame];
-        submitCmdBuffer.pWaitDstStageMask = waitStageFlags;
-        submitCmdBuffer.commandBufferCount = 1;
-        submitCmdBuffer.pCommandBuffers = &vulkanProgramInfo.commandBuffers[vulkanProgramInfo.curr_frame];
-        submitCmdBuffer.signalSemaphoreCount = 1;
-        submitCmdBuffer.pSignalSemaphores = &vulkanProgramInfo.renderFinishedSemaphores[vulkanProgramInfo.curr_frame];
+    // A full screen triangle on the far plane, tested GREATER against the read only depth so only
+    // pixels with geometry are lit
+    GraphicsPipelineDesc describeDeferredLightingPipeline() const
+    {
+        GraphicsPipelineDesc desc{};
+        desc.layout = vulkanProgramInfo.deferredPipelineLayout;
+        desc.renderPass = vulkanProgramInfo.renderPass;
+        desc.subpass = 1;
+        desc.raster.cullMode = VK_CULL_MODE_NONE;
+        desc.depth.writeEnable = VK_FALSE;
+        desc.depth.compareOp = VK_COMPARE_OP_GREATER;
+
+        ShaderStageDesc vertexStage{};
+        vertexStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertexStage.name = "fullscreen.vert";
+
+        ShaderStageDesc fragmentStage{};
+        fragmentStage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragmentStage.name = "deferred_lighting.frag";
+        appendLightingDefines(fragmentStage);
+
+        desc.stages = {vertexStage, fragmentStage};
+        return desc;
+    }
 
-        vkResult = vkQueueSubmit(vulkanProgramInfo.graphicsQueue,
-                                 1,
-                                 &submitCmdBuffer,
-                                 vulkanProgramInfo.frameReadyFences[vulkanProgramInfo.curr_frame]);
+    void createDeferredLightingPipeline()
+    {
+        // The G-buffer set is set 0, the shadow and cluster sets keep their scene set numbers
+        std::vector<VkDescriptorSetLayout> setLayouts = {vulkanProgramInfo.deferredSetLayout};
+        auto setLayoutAt = [&](uint32_t set, VkDescriptorSetLayout layout)
+        {
+            if (setLayouts.size() < set)
+            {
+                setLayouts.resize(set, vulkanProgramInfo.descriptorLayoutCache.get({}));
+            }
+            setLayouts.push_back(layout);
+        };
+        if (vulkanProgramInfo.shadowsEnabled)
+        {
+            setLayoutAt(2, vulkanProgramInfo.shadowSetLayout);
+        }
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            setLayoutAt(3, vulkanProgramInfo.clusterSetLayout);
+        }
 
-        checkVkResult(vkResult, "Failed to submit command buffer");
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
 
-        uint32_t renderedImageIndices[] = {vulkanProgramInfo.activeSwapchainImage};
+        vkResult = vkCreatePipelineLayout(vulkanProgramInfo.renderDevice, &pipelineLayoutCreateInfo, nullptr,
+                                          &vulkanProgramInfo.deferredPipelineLayout);
+        checkVkResult(vkResult, "Failed to create deferred lighting pipeline layout");
 
-        VkPresentInfoKHR presentInfo{};
-        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = &vulkanProgramInfo.renderFinishedSemaphores[vulkanProgramInfo.curr_frame];
-        presentInfo.pImageIndices = renderedImageIndices;
-        presentInfo.swapchainCount = 1;
-        presentInfo.pSwapchains = &vulkanProgramInfo.swapchain;
-        presentInfo.pResults = nullptr;
+        GraphicsPipelineDesc desc = describeDeferredLightingPipeline();
+        vulkanProgramInfo.deferredLightingPipeline = pipelineManager->create(desc);
+        if (vulkanProgramInfo.deferredLightingPipeline == VK_NULL_HANDLE)
+        {
+            throw std::runtime_error("failed to create deferred lighting pipeline!");
+        }
 
-        vkQueuePresentKHR(vulkanProgramInfo.presentQueue,
-                          &presentInfo);
+        if (shaderHotReloader)
+        {
+            shaderHotReloader->watch("deferred lighting", &vulkanProgramInfo.deferredLightingPipeline,
+                                     {{"fullscreen.vert", desc.stages[0].defines},
+                                      {"deferred_lighting.frag", desc.stages[1].defines}},
+                                     [this, desc](const std::vector<std::vector<char>> &spirv)
+                                     {
+                                         return pipelineManager->create(desc, &spirv);
+                                     });
+        }
     }
 
-    void programLoop()
+    // Second subpass of the scene pass, after the scene was drawn into the G-buffer. Viewport
+    // and scissor are still the ones the scene was drawn with.
+    void recordDeferredLighting(VkCommandBuffer commandBuffer)
     {
-        while (!glfwWindowShouldClose(vulkanProgramInfo.window))
+        vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanProgramInfo.deferredLightingPipeline);
+
+        uint32_t frame = vulkanProgramInfo.curr_frame;
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanProgramInfo.deferredPipelineLayout,
+                                0, 1, &vulkanProgramInfo.deferredSets[frame], 0, nullptr);
+        if (vulkanProgramInfo.shadowsEnabled)
         {
-            glfwPollEvents();
-            drawFrame();
-            vulkanProgramInfo.curr_frame = (vulkanProgramInfo.curr_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    vulkanProgramInfo.deferredPipelineLayout,
+                                    2, 1, &vulkanProgramInfo.shadowSets[frame], 0, nullptr);
         }
-        vkDeviceWaitIdle(vulkanProgramInfo.renderDevice);
+        if (vulkanProgramInfo.clusteredLightsEnabled)
+        {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    vulkanProgramInfo.deferredPipelineLayout,
+                                    3, 1, &vulkanProgramInfo.clusterSets[frame], 0, nullptr);
+        }
+
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
     }
 
-    void cleanup() const
+    void updateDeferredUniforms(const glm::mat4 &view, const glm::mat4 &projection)
     {
-        vkDestroyImage(vulkanProgramInfo.renderDevice,
-                       vulkanProgramInfo.depthImage,
-                       nullptr);
-        vkDestroyImageView(vulkanProgramInfo.renderDevice,
-                           vulkanProgramInfo.depthImageView,
-                           nullptr);
-        vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.depthImageMemory, nullptr);
+        DeferredUniforms &uniforms = *vulkanProgramInfo.deferredUniformMappings[vulkanProgramInfo.curr_frame];
+        uniforms.inverseViewProjection = glm::inverse(projection * view);
+        uniforms.inverseRenderSize = glm::vec2(1.0f / static_cast<float>(vulkanProgramInfo.renderExtent.width),
+                                               1.0f / static_cast<float>(vulkanProgramInfo.renderExtent.height));
+    }
 
-        vkDestroySampler(vulkanProgramInfo.renderDevice, vulkanProgramInfo.textureImageSampler, nullptr);
+    void destroyDeferredShadingResources() const
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
 
-        // Destroy image and free image memory afterwards
-        vkDestroyImageView(vulkanProgramInfo.renderDevice, vulkanProgramInfo.textureImageView, nullptr);
-        vkDestroyImage(vulkanProgramInfo.renderDevice, vulkanProgramInfo.textureImage, nullptr);
-        vkFreeMemory(vulkanProgramInfo.renderDevice, vulkanProgramInfo.textureImageMemory, nullptr);
+        vkDestroyPipeline(device, vulkanProgramInfo.deferredLightingPipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.deferredPipelineLayout, nullptr);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkUnmapMemory(device, vulkanProgramInfo.deferredUniformBufferMemories[i]);
+            vkDestroyBuffer(device, vulkanProgramInfo.deferredUniformBuffers[i], nullptr);
+            vkFreeMemory(device, vulkanProgramInfo.deferredUniformBufferMemories[i], nullptr);
+        }
+
+        vkDestroyImageView(device, vulkanProgramInfo.gbufferAlbedoView, nullptr);
+        vkDestroyImage(device, vulkanProgramInfo.gbufferAlbedoImage, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.gbufferAlbedoMemory, nullptr);
+        vkDestroyImageView(device, vulkanProgramInfo.gbufferNormalView, nullptr);
+        vkDestroyImage(device, vulkanProgramInfo.gbufferNormalImage, nullptr);
+        vkFreeMemory(device, vulkanProgramInfo.gbufferNormalMemory, nullptr);
+    }
+
+    /*
+     * ============================================================
+     * END: Deferred Shading
+     * ============================================================
+     */
+
+    /*
+     * ============================================================
+     * START: Post-Processing
+     * ============================================================
+     */
+    // Levels of the bloom pyramid, the first one is half the swapchain size
+    static constexpr uint32_t BLOOM_MAX_LEVELS = 6;
+
+    // The composite writes the swapchain image as a storage image, the same way the compute
+    // upscale does
+    VkImageUsageFlags choosePostProcessingTarget(const VkSurfaceCapabilitiesKHR &capabilities,
+                                                 VkSurfaceFormatKHR &surfaceFormat)
+    {
+        if (chooseStorageSurfaceFormat(capabilities, surfaceFormat))
+        {
+            return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+        }
+
+        std::cout << "Post-processing needs a swapchain that is a storage image, it is disabled" << std::endl;
+        vulkanProgramInfo.postProcessingEnabled = false;
+        return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    }
+
+    // Half floats keep the range above 1 that bloom and tonemapping work with
+    void createHdrSceneColorTarget()
+    {
+        vulkanProgramInfo.sceneColorFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+        createSceneColorImage(VK_IMAGE_USAGE_SAMPLED_BIT);
+
+        std::cout << "Post-processing:" << (options.postEffects & POST_EFFECT_BLOOM ? " bloom" : "")
+                  << (options.postEffects & POST_EFFECT_TONEMAP ? " tonemap" : " clip") << ", exposure "
+                  << options.exposure << (options.postEffects & POST_EFFECT_FXAA ? ", FXAA" : "") << std::endl;
+    }
+
+    void createPostProcessingResources()
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+        bool bloom = (options.postEffects & POST_EFFECT_BLOOM) != 0;
+
+        VkSamplerCreateInfo samplerCreateInfo{};
+        samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+        samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+        samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        vkResult = vkCreateSampler(device, &samplerCreateInfo, nullptr, &vulkanProgramInfo.postSampler);
+        checkVkResult(vkResult, "Failed to create post-processing sampler");
+
+        // Binding i gets images[i], sampled but for the last binding, which is stored to
+        auto writeImageSet = [device](VkDescriptorSet set, std::initializer_list<VkDescriptorImageInfo> images)
+        {
+            std::vector<VkDescriptorImageInfo> imageInfos(images);
+            std::vector<VkWriteDescriptorSet> writes(imageInfos.size());
+            for (uint32_t binding = 0; binding < writes.size(); binding++)
+            {
+                writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[binding].dstSet = set;
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = binding + 1 == writes.size() ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                                                              : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                writes[binding].pImageInfo = &imageInfos[binding];
+            }
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        };
+
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+        for (uint32_t binding = 0; binding < bindings.size(); binding++)
+        {
+            bindings[binding].binding = binding;
+            bindings[binding].descriptorCount = 1;
+            bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorImageInfo sceneColorInfo{vulkanProgramInfo.postSampler,
+                                             vulkanProgramInfo.sceneColorImageView,
+                                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        // Without bloom the scene color takes its binding, the shader never reads it then
+        VkDescriptorImageInfo bloomInfo = sceneColorInfo;
+        if (bloom)
+        {
+            createBloomPyramid();
+
+            // The level read and the level written, both in GENERAL layout while the pyramid is built
+            bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            vulkanProgramInfo.bloomSetLayout = vulkanProgramInfo.descriptorLayoutCache.get({bindings[0], bindings[1]});
+            bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+            auto levelInfo = [this](uint32_t level, VkImageLayout layout)
+            {
+                return VkDescriptorImageInfo{vulkanProgramInfo.postSampler,
+                                             vulkanProgramInfo.bloomLevelViews[level],
+                                             layout};
+            };
+
+            for (uint32_t level = 0; level < vulkanProgramInfo.bloomLevels; level++)
+            {
+                VkDescriptorSet downsampleSet = vulkanProgramInfo.persistentDescriptors.allocate(
+                        vulkanProgramInfo.bloomSetLayout);
+                writeImageSet(downsampleSet, {level == 0 ? sceneColorInfo : levelInfo(level - 1, VK_IMAGE_LAYOUT_GENERAL),
+                                              levelInfo(level, VK_IMAGE_LAYOUT_GENERAL)});
+                vulkanProgramInfo.bloomDownsampleSets.push_back(downsampleSet);
+
+                if (level + 1 < vulkanProgramInfo.bloomLevels)
+                {
+                    VkDescriptorSet upsampleSet = vulkanProgramInfo.persistentDescriptors.allocate(
+                            vulkanProgramInfo.bloomSetLayout);
+                    writeImageSet(upsampleSet, {levelInfo(level + 1, VK_IMAGE_LAYOUT_GENERAL),
+                                                levelInfo(level, VK_IMAGE_LAYOUT_GENERAL)});
+                    vulkanProgramInfo.bloomUpsampleSets.push_back(upsampleSet);
+                }
+            }
+            bloomInfo = levelInfo(0, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+            createComputePipeline("bloom_downsample.comp",
+                                  vulkanProgramInfo.bloomSetLayout,
+                                  sizeof(BloomPushConstants),
+                                  vulkanProgramInfo.bloomDownsamplePipelineLayout,
+                                  vulkanProgramInfo.bloomDownsamplePipeline);
+            createComputePipeline("bloom_upsample.comp",
+                                  vulkanProgramInfo.bloomSetLayout,
+                                  sizeof(BloomPushConstants),
+                                  vulkanProgramInfo.bloomUpsamplePipelineLayout,
+                                  vulkanProgramInfo.bloomUpsamplePipeline);
+        }
+
+        // Scene color and bloom in, swapchain image out
+        bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        vulkanProgramInfo.postCompositeSetLayout = vulkanProgramInfo.descriptorLayoutCache.get(
+                {bindings[0], bindings[1], bindings[2]});
+
+        for (VkImageView swapchainImageView: vulkanProgramInfo.swapchainImageViews)
+        {
+            VkDescriptorSet compositeSet = vulkanProgramInfo.persistentDescriptors.allocate(
+                    vulkanProgramInfo.postCompositeSetLayout);
+            writeImageSet(compositeSet, {sceneColorInfo,
+                                         bloomInfo,
+                                         VkDescriptorImageInfo{VK_NULL_HANDLE, swapchainImageView,
+                                                               VK_IMAGE_LAYOUT_GENERAL}});
+            vulkanProgramInfo.postCompositeSets.push_back(compositeSet);
+        }
+
+        createComputePipeline("post_composite.comp",
+                              vulkanProgramInfo.postCompositeSetLayout,
+                              sizeof(PostCompositePushConstants),
+                              vulkanProgramInfo.postCompositePipelineLayout,
+                              vulkanProgramInfo.postCompositePipeline);
+    }
+
+    // Half the swapchain size and down from there, levels stop before either side would be 0
+    void sizeBloomPyramid()
+    {
+        VkExtent2D extent = vulkanProgramInfo.swapchainExtent;
+        vulkanProgramInfo.bloomExtent = {std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u)};
+        vulkanProgramInfo.bloomLevels = 1;
+        while (vulkanProgramInfo.bloomLevels < BLOOM_MAX_LEVELS &&
+               (std::min(vulkanProgramInfo.bloomExtent.width, vulkanProgramInfo.bloomExtent.height) >>
+                vulkanProgramInfo.bloomLevels) > 0)
+        {
+            vulkanProgramInfo.bloomLevels++;
+        }
+    }
+
+    // The image itself is a transient image of the frame graph, see createFrameTransients
+    void createBloomPyramid()
+    {
+        vulkanProgramInfo.bloomImage = vulkanProgramInfo.frameTransients.image("bloom");
+        vulkanProgramInfo.bloomImageView = vulkanProgramInfo.frameTransients.imageView("bloom");
+
+        VkImageViewCreateInfo bloomViewCreateInfo{};
+        bloomViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        bloomViewCreateInfo.image = vulkanProgramInfo.bloomImage;
+        bloomViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        bloomViewCreateInfo.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        bloomViewCreateInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, vulkanProgramInfo.bloomLevels, 0, 1};
+
+        vulkanProgramInfo.bloomLevelViews.resize(vulkanProgramInfo.bloomLevels);
+        for (uint32_t i = 0; i < vulkanProgramInfo.bloomLevels; i++)
+        {
+            bloomViewCreateInfo.subresourceRange.baseMipLevel = i;
+            bloomViewCreateInfo.subresourceRange.levelCount = 1;
+
+            vkResult = vkCreateImageView(vulkanProgramInfo.renderDevice, &bloomViewCreateInfo, nullptr,
+                                         &vulkanProgramInfo.bloomLevelViews[i]);
+            checkVkResult(vkResult, "Failed to create bloom level view");
+        }
+    }
+
+    // Bloom as two passes over its pyramid, then everything else fused into the composite. Each
+    // pass is timed on its own by the GPU profiler.
+    void addPostProcessingPasses(RenderGraph &graph, RenderGraphHandle sceneColor, RenderGraphHandle swapchainTarget)
+    {
+        RenderGraphHandle bloom{};
+        bool bloomEnabled = (options.postEffects & POST_EFFECT_BLOOM) != 0;
+        if (bloomEnabled)
+        {
+            // Built again every frame after the scene, so it can take the memory of the images
+            // the scene passes are done with
+            RenderGraphImageDesc bloomDesc{};
+            bloomDesc.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+            bloomDesc.extent = vulkanProgramInfo.bloomExtent;
+            bloomDesc.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+            bloomDesc.mipLevels = vulkanProgramInfo.bloomLevels;
+            bloom = graph.createTransientImage("bloom", bloomDesc);
+
+            graph.addPass("bloom downsample", [this](VkCommandBuffer commandBuffer)
+                    {
+                        recordBloomDownsample(commandBuffer);
+                    })
+                    .read(sceneColor, ResourceUsage::SampledCompute)
+                    .write(bloom, ResourceUsage::StorageReadWriteCompute);
+
+            graph.addPass("bloom upsample", [this](VkCommandBuffer commandBuffer)
+                    {
+                        recordBloomUpsample(commandBuffer);
+                    })
+                    .write(bloom, ResourceUsage::StorageReadWriteCompute);
+        }
+
+        auto compositePass = graph.addPass("post composite", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordPostComposite(commandBuffer);
+                });
+        compositePass.read(sceneColor, ResourceUsage::SampledCompute)
+                .write(swapchainTarget, ResourceUsage::StorageWriteCompute);
+        if (bloomEnabled)
+        {
+            compositePass.read(bloom, ResourceUsage::SampledCompute);
+        }
+    }
+
+    VkExtent2D bloomLevelExtent(uint32_t level) const
+    {
+        return {std::max(vulkanProgramInfo.bloomExtent.width >> level, 1u),
+                std::max(vulkanProgramInfo.bloomExtent.height >> level, 1u)};
+    }
+
+    // Every level reads the one written before it
+    void bloomLevelBarrier(VkCommandBuffer commandBuffer) const
+    {
+        VkMemoryBarrier levelBarrier{};
+        levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &levelBarrier,
+                             0, nullptr,
+                             0, nullptr);
+    }
+
+    void recordBloomLevel(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkDescriptorSet set,
+                          uint32_t level, uint32_t groupSize) const
+    {
+        VkExtent2D extent = bloomLevelExtent(level);
+
+        BloomPushConstants pushConstants{};
+        pushConstants.outputSize = glm::uvec2(extent.width, extent.height);
+        pushConstants.threshold = options.bloomThreshold;
+        pushConstants.firstLevel = level == 0 ? 1 : 0;
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(commandBuffer,
+                           pipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(pushConstants),
+                           &pushConstants);
+        vkCmdDispatch(commandBuffer, (extent.width + groupSize - 1) / groupSize,
+                      (extent.height + groupSize - 1) / groupSize, 1);
+    }
+
+    // From the scene down to the smallest level. After the last one the render graph takes care
+    // of synchronizing with the upsample.
+    void recordBloomDownsample(VkCommandBuffer commandBuffer) const
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.bloomDownsamplePipeline);
+        for (uint32_t level = 0; level < vulkanProgramInfo.bloomLevels; level++)
+        {
+            if (level > 0)
+            {
+                bloomLevelBarrier(commandBuffer);
+            }
+            recordBloomLevel(commandBuffer, vulkanProgramInfo.bloomDownsamplePipelineLayout,
+                             vulkanProgramInfo.bloomDownsampleSets[level], level, 8);
+        }
+    }
+
+    // From the second smallest level up to the first, which the composite reads
+    void recordBloomUpsample(VkCommandBuffer commandBuffer) const
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.bloomUpsamplePipeline);
+        for (uint32_t level = vulkanProgramInfo.bloomLevels - 1; level-- > 0;)
+        {
+            if (level + 2 < vulkanProgramInfo.bloomLevels)
+            {
+                bloomLevelBarrier(commandBuffer);
+            }
+            recordBloomLevel(commandBuffer, vulkanProgramInfo.bloomUpsamplePipelineLayout,
+                             vulkanProgramInfo.bloomUpsampleSets[level], level, 16);
+        }
+    }
+
+    void recordPostComposite(VkCommandBuffer commandBuffer) const
+    {
+        VkExtent2D extent = vulkanProgramInfo.swapchainExtent;
+
+        PostCompositePushConstants pushConstants{};
+        pushConstants.outputSize = glm::uvec2(extent.width, extent.height);
+        pushConstants.exposure = options.exposure;
+        pushConstants.bloomStrength = options.bloomStrength;
+        pushConstants.effects = options.postEffects;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.postCompositePipeline);
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                vulkanProgramInfo.postCompositePipelineLayout,
+                                0,
+                                1,
+                                &vulkanProgramInfo.postCompositeSets[vulkanProgramInfo.activeSwapchainImage],
+                                0,
+                                nullptr);
+        vkCmdPushConstants(commandBuffer,
+                           vulkanProgramInfo.postCompositePipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(pushConstants),
+                           &pushConstants);
+        vkCmdDispatch(commandBuffer, (extent.width + 15) / 16, (extent.height + 15) / 16, 1);
+    }
+
+    void reportPostProcessing() const
+    {
+        const GpuProfiler &profiler = vulkanProgramInfo.gpuProfiler;
+        double total = 0.0;
+        std::cout << "Post-processing:";
+        for (const char *pass: {"bloom downsample", "bloom upsample", "post composite"})
+        {
+            double milliseconds = profiler.averageMilliseconds(pass);
+            if (milliseconds > 0.0)
+            {
+                std::cout << " " << pass << " " << milliseconds << " ms,";
+            }
+            total += milliseconds;
+        }
+        std::cout << " " << total << " ms in total" << std::endl;
+    }
+
+    void destroyPostProcessingResources() const
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+
+        vkDestroyPipeline(device, vulkanProgramInfo.postCompositePipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.postCompositePipelineLayout, nullptr);
+        vkDestroyPipeline(device, vulkanProgramInfo.bloomUpsamplePipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.bloomUpsamplePipelineLayout, nullptr);
+        vkDestroyPipeline(device, vulkanProgramInfo.bloomDownsamplePipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.bloomDownsamplePipelineLayout, nullptr);
+        vkDestroySampler(device, vulkanProgramInfo.postSampler, nullptr);
+
+        for (const auto &levelView: vulkanProgramInfo.bloomLevelViews)
+        {
+            vkDestroyImageView(device, levelView, nullptr);
+        }
+
+        destroySceneColorImage();
+    }
+
+    /*
+     * ============================================================
+     * END: Post-Processing
+     * ============================================================
+     */
+
+    /*
+     * ============================================================
+     * START: GPU Particles
+     * ============================================================
+     */
+    // Longest step the particles take, slower frames slow the simulation down instead
+    static constexpr float MAX_PARTICLE_STEP = 1.0f / 30.0f;
+    // Half the width of a particle's quad in world units
+    static constexpr float PARTICLE_SIZE = 0.012f;
+    // Modes of particle_sort.comp
+    static constexpr uint32_t PARTICLE_SORT_LOCAL = 0;
+    static constexpr uint32_t PARTICLE_SORT_GLOBAL = 1;
+    static constexpr uint32_t PARTICLE_SORT_MERGE = 2;
+
+    // Device local particle buffers, the particle sets with their per frame uniforms and the
+    // pipelines. The counters start with an empty system that draws quads of 6 vertices.
+    void createParticleSystem()
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+        uint32_t capacity = options.particles;
+        vulkanProgramInfo.particleCapacity = capacity;
+        vulkanProgramInfo.particleSortSize = PARTICLE_SORT_BLOCK;
+        while (vulkanProgramInfo.particleSortSize < capacity)
+        {
+            vulkanProgramInfo.particleSortSize <<= 1;
+        }
+
+        // A particle lives at most PARTICLE_MAX_LIFETIME, and a step may emit a particle more
+        // than its share. Emitting this many per second keeps the pool from running full.
+        vulkanProgramInfo.particleEmitRate = static_cast<float>(capacity) /
+                                             (PARTICLE_MAX_LIFETIME + 2.0f * MAX_PARTICLE_STEP);
+        vulkanProgramInfo.maxParticleEmitCount = static_cast<uint32_t>(
+                std::ceil(vulkanProgramInfo.particleEmitRate * MAX_PARTICLE_STEP)) + 1;
+
+        auto createParticleBuffer = [&](VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer &buffer,
+                                        VkDeviceMemory &memory)
+        {
+            VkBufferCreateInfo bufferCreateInfo{};
+            bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferCreateInfo.size = size;
+            bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | usage;
+
+            createBuffer(bufferCreateInfo,
+                         device,
+                         buffer,
+                         vulkanProgramInfo.GPU,
+                         memory,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        };
+
+        // Particles, alive list and counters are read back by --verify-particles
+        createParticleBuffer(sizeof(Particle) * capacity,
+                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                             vulkanProgramInfo.particleBuffer,
+                             vulkanProgramInfo.particleBufferMemory);
+        createParticleBuffer(sizeof(uint32_t) * capacity,
+                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                             vulkanProgramInfo.particleAliveBuffer,
+                             vulkanProgramInfo.particleAliveBufferMemory);
+        createParticleBuffer(sizeof(uint32_t) * capacity,
+                             0,
+                             vulkanProgramInfo.particleCompactedBuffer,
+                             vulkanProgramInfo.particleCompactedBufferMemory);
+        createParticleBuffer(sizeof(uint32_t) * capacity,
+                             0,
+                             vulkanProgramInfo.particleDeadBuffer,
+                             vulkanProgramInfo.particleDeadBufferMemory);
+        createParticleBuffer(sizeof(glm::uvec2) * vulkanProgramInfo.particleSortSize,
+                             0,
+                             vulkanProgramInfo.particleSortBuffer,
+                             vulkanProgramInfo.particleSortBufferMemory);
+        createParticleBuffer(sizeof(ParticleCounters),
+                             VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                             VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             vulkanProgramInfo.particleCounterBuffer,
+                             vulkanProgramInfo.particleCounterBufferMemory);
+
+        // No slot was handed out yet, so neither the dead list nor the particles need clearing
+        ParticleCounters counters{};
+        counters.drawVertexCount = 6;
+        counters.simulateGroupsY = 1;
+        counters.simulateGroupsZ = 1;
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+        vkCmdUpdateBuffer(commandBuffer, vulkanProgramInfo.particleCounterBuffer, 0, sizeof(counters), &counters);
+
+        VkMemoryBarrier updateBarrier{};
+        updateBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        updateBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        updateBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT |
+                                      VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &updateBarrier,
+                             0, nullptr,
+                             0, nullptr);
+
+        endSingleTimeCommands(commandBuffer);
+
+        // Uniforms, particles and alive list are read by the vertex shader as well
+        std::array<VkDescriptorSetLayoutBinding, 7> bindings{};
+        for (uint32_t binding = 0; binding < bindings.size(); binding++)
+        {
+            bindings[binding].binding = binding;
+            bindings[binding].descriptorCount = 1;
+            bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[binding].stageFlags = binding <= 2 ? VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT
+                                                        : VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
-        vkDestroyDescriptorPool(vulkanProgramInfo.renderDevice,
-                                vulkanProgramInfo.descriptorPool,
-                                nullptr);
+        vulkanProgramInfo.particleSetLayout = vulkanProgramInfo.descriptorLayoutCache.get(
+                std::vector<VkDescriptorSetLayoutBinding>(bindings.begin(), bindings.end()));
+
+        vulkanProgramInfo.particleUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.particleUniformBufferMemories.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.particleUniformMappings.resize(MAX_FRAMES_IN_FLIGHT);
+        vulkanProgramInfo.particleSets.resize(MAX_FRAMES_IN_FLIGHT);
 
-        // Uniform buffers
         for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
         {
-            vkDestroyBuffer(vulkanProgramInfo.renderDevice,
-                            vulkanProgramInfo.uniformBuffers[i],
-                            nullptr);
+            vulkanProgramInfo.particleUniformMappings[i] = static_cast<ParticleUniforms *>(
+                    createMappedBuffer(sizeof(ParticleUniforms),
+                                       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                       vulkanProgramInfo.particleUniformBuffers[i],
+                                       vulkanProgramInfo.particleUniformBufferMemories[i]));
 
-            vkFreeMemory(vulkanProgramInfo.renderDevice,
-                         vulkanProgramInfo.uniformBufferMemories[i],
-                         nullptr);
-        }
-        vkDestroyDescriptorSetLayout(vulkanProgramInfo.renderDevice,
-                                     vulkanProgramInfo.descriptorSetLayout,
-                                     nullptr);
+            vulkanProgramInfo.particleSets[i] = vulkanProgramInfo.persistentDescriptors.allocate(
+                    vulkanProgramInfo.particleSetLayout);
 
-        vkFreeMemory(vulkanProgramInfo.renderDevice,
-                     vulkanProgramInfo.indexBufferMemory,
-                     nullptr);
-        vkDestroyBuffer(vulkanProgramInfo.renderDevice,
-                        vulkanProgramInfo.indexBuffer,
-                        nullptr);
+            std::array<VkDescriptorBufferInfo, 7> bufferInfos =
+                    {
+                            VkDescriptorBufferInfo{vulkanProgramInfo.particleUniformBuffers[i], 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.particleBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.particleAliveBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.particleCompactedBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.particleDeadBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.particleSortBuffer, 0, VK_WHOLE_SIZE},
+                            VkDescriptorBufferInfo{vulkanProgramInfo.particleCounterBuffer, 0, VK_WHOLE_SIZE}
+                    };
 
-        vkFreeMemory(vulkanProgramInfo.renderDevice,
-                     vulkanProgramInfo.vertexBufferMemory,
-                     nullptr);
+            std::array<VkWriteDescriptorSet, 7> writes{};
+            for (uint32_t binding = 0; binding < writes.size(); binding++)
+            {
+                writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[binding].dstSet = vulkanProgramInfo.particleSets[i];
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = bindings[binding].descriptorType;
+                writes[binding].pBufferInfo = &bufferInfos[binding];
+            }
 
-        vkDestroyBuffer(vulkanProgramInfo.renderDevice,
-                        vulkanProgramInfo.vertexBuffer,
-                        nullptr);
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
 
-        for (std::size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        createComputePipeline("particle_simulate.comp",
+                              vulkanProgramInfo.particleSetLayout,
+                              0,
+                              vulkanProgramInfo.particleSimulatePipelineLayout,
+                              vulkanProgramInfo.particleSimulatePipeline);
+        createComputePipeline("particle_emit.comp",
+                              vulkanProgramInfo.particleSetLayout,
+                              0,
+                              vulkanProgramInfo.particleEmitPipelineLayout,
+                              vulkanProgramInfo.particleEmitPipeline);
+        createComputePipeline("particle_finalize.comp",
+                              vulkanProgramInfo.particleSetLayout,
+                              0,
+                              vulkanProgramInfo.particleFinalizePipelineLayout,
+                              vulkanProgramInfo.particleFinalizePipeline);
+        createComputePipeline("particle_sort.comp",
+                              vulkanProgramInfo.particleSetLayout,
+                              sizeof(ParticleSortPushConstants),
+                              vulkanProgramInfo.particleSortPipelineLayout,
+                              vulkanProgramInfo.particleSortPipeline);
+        createParticleDrawPipeline();
+
+        vulkanProgramInfo.particleClock = std::chrono::steady_clock::now();
+        if (options.verifyParticleFrames > 0)
         {
-            vkDestroySemaphore(vulkanProgramInfo.renderDevice,
-                               vulkanProgramInfo.renderFinishedSemaphores[i],
-                               nullptr);
+            vulkanProgramInfo.particleReference = std::make_unique<ParticleReference>(capacity);
+        }
 
-            vkDestroySemaphore(vulkanProgramInfo.renderDevice,
-                               vulkanProgramInfo.nextImageReadySemaphores[i],
-                               nullptr);
+        std::cout << "Particles: " << capacity << " at most, emitting " << vulkanProgramInfo.particleEmitRate
+                  << " per second, sorted in " << vulkanProgramInfo.particleSortSize << " elements" << std::endl;
+    }
 
-            vkDestroyFence(vulkanProgramInfo.renderDevice,
-                           vulkanProgramInfo.frameReadyFences[i],
-                           nullptr);
+    // Drawn into the last scene pass like the scene, with deferred shading into its lighting
+    // subpass, which has the depth read only
+    GraphicsPipelineDesc describeParticlePipeline() const
+    {
+        GraphicsPipelineDesc desc{};
+        describeSceneTarget(desc);
+        desc.layout = vulkanProgramInfo.particleDrawPipelineLayout;
+        if (vulkanProgramInfo.deferredShadingEnabled)
+        {
+            desc.subpass = 1;
+            desc.colorAttachmentCount = 1;
         }
+        desc.raster.cullMode = VK_CULL_MODE_NONE;
 
-        vkDestroyCommandPool(vulkanProgramInfo.renderDevice,
-                             vulkanProgramInfo.commandPool,
-                             nullptr);
+        // Sorted back to front, so they are tested against the scene's depth but never write it
+        desc.depth.writeEnable = VK_FALSE;
+        desc.depth.compareOp = VK_COMPARE_OP_LESS;
 
-        for (const VkFramebuffer &swapchainFramebuffer: vulkanProgramInfo.swapchainFramebuffers)
+        // Premultiplied alpha
+        desc.blend.enable = VK_TRUE;
+        desc.blend.srcColorFactor = VK_BLEND_FACTOR_ONE;
+        desc.blend.dstColorFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        desc.blend.srcAlphaFactor = VK_BLEND_FACTOR_ONE;
+        desc.blend.dstAlphaFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+
+        ShaderStageDesc vertexStage{};
+        vertexStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertexStage.name = "particles.vert";
+
+        ShaderStageDesc fragmentStage{};
+        fragmentStage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragmentStage.name = "particles.frag";
+
+        desc.stages = {vertexStage, fragmentStage};
+        return desc;
+    }
+
+    void createParticleDrawPipeline()
+    {
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.setLayoutCount = 1;
+        pipelineLayoutCreateInfo.pSetLayouts = &vulkanProgramInfo.particleSetLayout;
+
+        vkResult = vkCreatePipelineLayout(vulkanProgramInfo.renderDevice, &pipelineLayoutCreateInfo, nullptr,
+                                          &vulkanProgramInfo.particleDrawPipelineLayout);
+        checkVkResult(vkResult, "Failed to create particle pipeline layout");
+
+        GraphicsPipelineDesc desc = describeParticlePipeline();
+        vulkanProgramInfo.particleDrawPipeline = pipelineManager->create(desc);
+        if (vulkanProgramInfo.particleDrawPipeline == VK_NULL_HANDLE)
         {
-            vkDestroyFramebuffer(vulkanProgramInfo.renderDevice,
-                                 swapchainFramebuffer,
-                                 nullptr);
+            throw std::runtime_error("failed to create particle pipeline!");
         }
 
-        vkDestroyPipeline(vulkanProgramInfo.renderDevice,
-                          vulkanProgramInfo.graphicsPipeline,
-                          nullptr);
-
-        vkDestroyPipelineLayout(vulkanProgramInfo.renderDevice,
-                                vulkanProgramInfo.pipelineLayout,
-                                nullptr);
-        vkDestroyRenderPass(vulkanProgramInfo.renderDevice,
-                            vulkanProgramInfo.renderPass,
-                            nullptr);
-        for (const auto &imageView: vulkanProgramInfo.swapchainImageViews)
+        if (shaderHotReloader)
         {
-            vkDestroyImageView(vulkanProgramInfo.renderDevice,
-                               imageView,
-                               nullptr);
+            shaderHotReloader->watch("particles", &vulkanProgramInfo.particleDrawPipeline,
+                                     {{"particles.vert", desc.stages[0].defines},
+                                      {"particles.frag", desc.stages[1].defines}},
+                                     [this, desc](const std::vector<std::vector<char>> &spirv)
+                                     {
+                                         return pipelineManager->create(desc, &spirv);
+                                     });
         }
-        vkDestroySwapchainKHR(vulkanProgramInfo.renderDevice,
-                              vulkanProgramInfo.swapchain,
-                              nullptr);
+    }
 
-        vkDestroyDevice(vulkanProgramInfo.renderDevice,
-                        nullptr);
+    // The step of this frame: how long it is, where the emitter is and which particles it
+    // emits. With --verify-particles the CPU reference takes the same step.
+    void updateParticles(const ShadowCamera &camera, const glm::mat4 &view, const glm::mat4 &projection)
+    {
+        auto now = std::chrono::steady_clock::now();
+        float deltaTime = std::min(std::chrono::duration<float>(now - vulkanProgramInfo.particleClock).count(),
+                                   MAX_PARTICLE_STEP);
+        vulkanProgramInfo.particleClock = now;
+        vulkanProgramInfo.particleTime += deltaTime;
+
+        // Fractions of a particle are emitted with a later step
+        vulkanProgramInfo.particleEmitCarry += vulkanProgramInfo.particleEmitRate * deltaTime;
+        auto emitCount = std::min(static_cast<uint32_t>(vulkanProgramInfo.particleEmitCarry),
+                                  vulkanProgramInfo.maxParticleEmitCount);
+        vulkanProgramInfo.particleEmitCarry -= static_cast<float>(emitCount);
+
+        // The emitter circles over the objects
+        float angle = 0.7f * vulkanProgramInfo.particleTime;
+        ParticleStep step{};
+        step.emitterPosition = glm::vec3(0.8f * std::cos(angle), 0.8f * std::sin(angle), 0.2f);
+        step.deltaTime = deltaTime;
+        step.gravity = glm::vec3(0.0f, 0.0f, -2.5f);
+        step.floorHeight = -0.5f;
+        step.firstEmitted = vulkanProgramInfo.particlesEmitted;
+        step.emitCount = emitCount;
+        step.capacity = vulkanProgramInfo.particleCapacity;
+        step.bounce = 0.4f;
+        vulkanProgramInfo.particlesEmitted += emitCount;
+
+        // Right and up of the camera are the first two rows of the view matrix
+        ParticleUniforms &uniforms = *vulkanProgramInfo.particleUniformMappings[vulkanProgramInfo.curr_frame];
+        uniforms.step = step;
+        uniforms.viewProjection = projection * view;
+        uniforms.cameraRight = glm::vec4(view[0][0], view[1][0], view[2][0], PARTICLE_SIZE);
+        uniforms.cameraUp = glm::vec4(view[0][1], view[1][1], view[2][1], 0.0f);
+        uniforms.cameraPosition = glm::vec4(camera.position, 1.0f);
+
+        vulkanProgramInfo.lastParticleStep = step;
+        vulkanProgramInfo.particleCameraPosition = camera.position;
+        if (vulkanProgramInfo.particleReference)
+        {
+            vulkanProgramInfo.particleReference->step(step);
+        }
+    }
 
-        // Find function to destroy debug messenger
-        auto destroyDebugMessenger = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(
-                vulkanProgramInfo.vulkanInstance,
-                "vkDestroyDebugUtilsMessengerEXT"
-        );
-        destroyDebugMessenger(vulkanProgramInfo.vulkanInstance,
-                              debugMessenger,
-                              nullptr);
+    // Simulation, emission and sorting of this frame's step. The last scene pass draws the
+    // sorted alive list, as many instances as the counters say.
+    void addParticlePasses(RenderGraph &graph, SceneInputs &sceneInputs)
+    {
+        // Last frame's compute passes wrote all of them and its last scene pass drew from the
+        // particles, the alive list and the counters
+        ResourceState computeState = describeUsage(ResourceUsage::StorageReadWriteCompute);
+        ResourceState drawnState = computeState;
+        drawnState.stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+        ResourceState countersState = computeState;
+        countersState.stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+
+        sceneInputs.particles = graph.importBuffer("particles", vulkanProgramInfo.particleBuffer, drawnState);
+        sceneInputs.particleAliveList = graph.importBuffer("particle alive list",
+                                                           vulkanProgramInfo.particleAliveBuffer,
+                                                           drawnState);
+        sceneInputs.particleCounters = graph.importBuffer("particle counters",
+                                                          vulkanProgramInfo.particleCounterBuffer,
+                                                          countersState);
+        RenderGraphHandle compactedList = graph.importBuffer("particle compacted list",
+                                                             vulkanProgramInfo.particleCompactedBuffer,
+                                                             computeState);
+        RenderGraphHandle deadList = graph.importBuffer("particle dead list",
+                                                        vulkanProgramInfo.particleDeadBuffer,
+                                                        computeState);
+        RenderGraphHandle sortPairs = graph.importBuffer("particle sort pairs",
+                                                         vulkanProgramInfo.particleSortBuffer,
+                                                         computeState);
+
+        // The next step continues with them
+        graph.markOutput(sceneInputs.particles);
+        graph.markOutput(sceneInputs.particleAliveList);
+        graph.markOutput(sceneInputs.particleCounters);
+        graph.markOutput(deadList);
+
+        graph.addPass("particle simulate", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordParticleSimulation(commandBuffer);
+                })
+                .read(sceneInputs.particleCounters, ResourceUsage::IndirectRead)
+                .write(sceneInputs.particleCounters, ResourceUsage::StorageReadWriteCompute)
+                .read(sceneInputs.particleAliveList, ResourceUsage::StorageReadCompute)
+                .write(sceneInputs.particles, ResourceUsage::StorageReadWriteCompute)
+                .write(compactedList, ResourceUsage::StorageWriteCompute)
+                .write(deadList, ResourceUsage::StorageWriteCompute);
+
+        graph.addPass("particle emit", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordParticleEmission(commandBuffer);
+                })
+                .write(sceneInputs.particleCounters, ResourceUsage::StorageReadWriteCompute)
+                .read(deadList, ResourceUsage::StorageReadCompute)
+                .write(sceneInputs.particles, ResourceUsage::StorageWriteCompute)
+                .write(compactedList, ResourceUsage::StorageWriteCompute);
+
+        graph.addPass("particle sort", [this](VkCommandBuffer commandBuffer)
+                {
+                    recordParticleSort(commandBuffer);
+                })
+                .read(sceneInputs.particleCounters, ResourceUsage::StorageReadCompute)
+                .read(sceneInputs.particles, ResourceUsage::StorageReadCompute)
+                .read(compactedList, ResourceUsage::StorageReadCompute)
+                .write(sortPairs, ResourceUsage::StorageReadWriteCompute)
+                .write(sceneInputs.particleAliveList, ResourceUsage::StorageWriteCompute);
+    }
 
-        vkDestroySurfaceKHR(vulkanProgramInfo.vulkanInstance,
-                            vulkanProgramInfo.windowSurface,
-                            nullptr);
+    // What the particle draw of the last scene pass reads
+    void readParticleInputs(RenderGraph::PassBuilder &pass, const SceneInputs &sceneInputs) const
+    {
+        pass.read(sceneInputs.particleCounters, ResourceUsage::IndirectRead)
+                .read(sceneInputs.particles, ResourceUsage::StorageReadVertex)
+                .read(sceneInputs.particleAliveList, ResourceUsage::StorageReadVertex);
+    }
 
-        vkDestroyInstance(vulkanProgramInfo.vulkanInstance, nullptr);
+    void bindParticleSet(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout) const
+    {
+        vkCmdBindDescriptorSets(commandBuffer,
+                                bindPoint,
+                                layout,
+                                0,
+                                1,
+                                &vulkanProgramInfo.particleSets[vulkanProgramInfo.curr_frame],
+                                0,
+                                nullptr);
+    }
 
-        glfwDestroyWindow(vulkanProgramInfo.window);
+    // Dispatches of one pass that read what the one before wrote
+    static void recordParticleComputeBarrier(VkCommandBuffer commandBuffer)
+    {
+        VkMemoryBarrier computeBarrier{};
+        computeBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        computeBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        computeBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &computeBarrier,
+                             0, nullptr,
+                             0, nullptr);
+    }
 
+    // One invocation per live particle, the group count was written by the last step
+    void recordParticleSimulation(VkCommandBuffer commandBuffer)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.particleSimulatePipeline);
+        bindParticleSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.particleSimulatePipelineLayout);
+        vkCmdDispatchIndirect(commandBuffer, vulkanProgramInfo.particleCounterBuffer,
+                              offsetof(ParticleCounters, simulateGroupsX));
     }
 
-    void addAdditionalInstanceExtensions()
+    // Sized for the most particles a step emits, the step's emitCount is in the uniforms. The
+    // finalize dispatch then turns the compacted count into the counts the others read.
+    void recordParticleEmission(VkCommandBuffer commandBuffer)
     {
-        uint32_t extensionPptCount;
-        vkEnumerateInstanceExtensionProperties(nullptr,
-                                               &extensionPptCount,
-                                               nullptr);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.particleEmitPipeline);
+        bindParticleSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.particleEmitPipelineLayout);
+        vkCmdDispatch(commandBuffer,
+                      (vulkanProgramInfo.maxParticleEmitCount + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE, 1, 1);
 
-        std::vector<VkExtensionProperties> extensionPptList(extensionPptCount);
+        recordParticleComputeBarrier(commandBuffer);
 
-        vkEnumerateInstanceExtensionProperties(nullptr,
-                                               &extensionPptCount,
-                                               extensionPptList.data());
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.particleFinalizePipeline);
+        bindParticleSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                        vulkanProgramInfo.particleFinalizePipelineLayout);
+        vkCmdDispatch(commandBuffer, 1, 1, 1);
+    }
 
-        // If VK_KHR_get_physical_device_properties2 is available add it in.
-        for (std::size_t i = 0; i < extensionPptCount; i++)
+    // Bitonic sort over particleSortSize elements. Blocks are sorted in shared memory first,
+    // then every merge takes a global dispatch per distance down to a block and finishes
+    // in shared memory. The sort size is fixed, so recorded frames stay valid, and padding
+    // past the live particles costs little next to the rest.
+    void recordParticleSort(VkCommandBuffer commandBuffer)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.particleSortPipeline);
+        bindParticleSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkanProgramInfo.particleSortPipelineLayout);
+
+        uint32_t sortSize = vulkanProgramInfo.particleSortSize;
+        auto sortStep = [&](uint32_t mode, uint32_t k, uint32_t j)
         {
-            if (strcmp(extensionPptList[i].extensionName, "VK_KHR_get_physical_device_properties2") == 0)
+            ParticleSortPushConstants pushConstants{};
+            pushConstants.k = k;
+            pushConstants.j = j;
+            pushConstants.mode = mode;
+            pushConstants.writeAliveList = mode != PARTICLE_SORT_GLOBAL && k == sortSize ? 1 : 0;
+
+            vkCmdPushConstants(commandBuffer,
+                               vulkanProgramInfo.particleSortPipelineLayout,
+                               VK_SHADER_STAGE_COMPUTE_BIT,
+                               0,
+                               sizeof(pushConstants),
+                               &pushConstants);
+            vkCmdDispatch(commandBuffer, sortSize / PARTICLE_SORT_BLOCK, 1, 1);
+        };
+
+        sortStep(PARTICLE_SORT_LOCAL, PARTICLE_SORT_BLOCK, 0);
+        for (uint32_t k = 2 * PARTICLE_SORT_BLOCK; k <= sortSize; k <<= 1)
+        {
+            for (uint32_t j = k / 2; j >= PARTICLE_SORT_BLOCK; j >>= 1)
             {
-                vulkanProgramInfo.instanceExtensionsEnabled.push_back("VK_KHR_get_physical_device_properties2");
+                recordParticleComputeBarrier(commandBuffer);
+                sortStep(PARTICLE_SORT_GLOBAL, k, j);
             }
+            recordParticleComputeBarrier(commandBuffer);
+            sortStep(PARTICLE_SORT_MERGE, k, 0);
         }
+    }
 
-        // Add extensions required by GLFW
-        uint32_t glfwRequiredExtensionCount;
-        const char **glfwInstanceExtensions;
-        glfwInstanceExtensions = glfwGetRequiredInstanceExtensions(&glfwRequiredExtensionCount);
+    // At the end of the last scene pass, after the scene or the deferred lighting. Viewport and
+    // scissor are still the scene's.
+    void recordParticleDraw(VkCommandBuffer commandBuffer)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanProgramInfo.particleDrawPipeline);
+        bindParticleSet(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanProgramInfo.particleDrawPipelineLayout);
+        vkCmdDrawIndirect(commandBuffer, vulkanProgramInfo.particleCounterBuffer, 0, 1,
+                          sizeof(VkDrawIndirectCommand));
+    }
 
-        if (glfwInstanceExtensions == nullptr)
-        {
-            std::cout << "Failed to get instance extensions required by glfw" << std::endl;
-            exit(-1);
-        }
+    bool particleVerificationFinished() const
+    {
+        return vulkanProgramInfo.particleReference &&
+               vulkanProgramInfo.particleReference->stepCount() >= options.verifyParticleFrames;
+    }
 
-        for (std::size_t i = 0; i < glfwRequiredExtensionCount; i++)
+    // Reads back what the GPU simulated in the last frame, which is done once the program loop
+    // waited for the device, and compares it with the CPU reference. Returns whether they agree.
+    bool verifyParticles()
+    {
+        uint32_t capacity = vulkanProgramInfo.particleCapacity;
+        VkDeviceSize particleBytes = sizeof(Particle) * capacity;
+        VkDeviceSize aliveBytes = sizeof(uint32_t) * capacity;
+
+        VkBuffer readbackBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory readbackMemory = VK_NULL_HANDLE;
+        auto *readback = static_cast<char *>(createMappedBuffer(sizeof(ParticleCounters) + particleBytes + aliveBytes,
+                                                                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                                readbackBuffer,
+                                                                readbackMemory));
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+        VkMemoryBarrier readBarrier{};
+        readBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        readBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        readBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             1, &readBarrier,
+                             0, nullptr,
+                             0, nullptr);
+
+        VkBufferCopy counterCopy{0, 0, sizeof(ParticleCounters)};
+        VkBufferCopy particleCopy{0, sizeof(ParticleCounters), particleBytes};
+        VkBufferCopy aliveCopy{0, sizeof(ParticleCounters) + particleBytes, aliveBytes};
+        vkCmdCopyBuffer(commandBuffer, vulkanProgramInfo.particleCounterBuffer, readbackBuffer, 1, &counterCopy);
+        vkCmdCopyBuffer(commandBuffer, vulkanProgramInfo.particleBuffer, readbackBuffer, 1, &particleCopy);
+        vkCmdCopyBuffer(commandBuffer, vulkanProgramInfo.particleAliveBuffer, readbackBuffer, 1, &aliveCopy);
+
+        readBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        readBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0,
+                             1, &readBarrier,
+                             0, nullptr,
+                             0, nullptr);
+
+        endSingleTimeCommands(commandBuffer);
+
+        ParticleCounters counters{};
+        std::vector<Particle> slots(capacity);
+        std::vector<uint32_t> aliveList(capacity);
+        memcpy(&counters, readback, sizeof(counters));
+        memcpy(slots.data(), readback + sizeof(ParticleCounters), particleBytes);
+        memcpy(aliveList.data(), readback + sizeof(ParticleCounters) + particleBytes, aliveBytes);
+
+        vkUnmapMemory(vulkanProgramInfo.renderDevice, readbackMemory);
+        vkDestroyBuffer(vulkanProgramInfo.renderDevice, readbackBuffer, nullptr);
+        vkFreeMemory(vulkanProgramInfo.renderDevice, readbackMemory, nullptr);
+
+        // In draw order
+        std::vector<Particle> drawn;
+        uint32_t aliveCount = std::min(counters.aliveCount, capacity);
+        drawn.reserve(aliveCount);
+        for (uint32_t i = 0; i < aliveCount; i++)
         {
-            vulkanProgramInfo.instanceExtensionsEnabled.push_back(glfwInstanceExtensions[i]);
+            drawn.push_back(slots[aliveList[i] < capacity ? aliveList[i] : 0]);
         }
 
+        const ParticleReference &reference = *vulkanProgramInfo.particleReference;
+        ParticleComparison comparison = compareParticles(drawn,
+                                                         reference,
+                                                         vulkanProgramInfo.particleCameraPosition,
+                                                         vulkanProgramInfo.lastParticleStep.deltaTime);
+
+        // Every slot handed out is either alive or on the dead list
+        bool slotsAccounted = counters.deadCount >= 0 &&
+                              counters.aliveCount + static_cast<uint32_t>(counters.deadCount) ==
+                              counters.allocatedCount;
+        bool passed = comparison.passed() && slotsAccounted && counters.droppedCount == reference.droppedParticles();
+
+        std::cout << "Particle verification after " << reference.stepCount() << " steps: "
+                  << counters.aliveCount << " alive on the GPU, " << reference.particles().size()
+                  << " in the CPU reference, " << comparison.matched << " matched (" << comparison.mismatched
+                  << " too far apart, largest difference " << comparison.maxPositionError << "), "
+                  << comparison.missing << " missing, " << comparison.unexpected << " unexpected, "
+                  << comparison.atEndOfLife << " at the end of their lifetime, "
+                  << comparison.orderErrors << " out of order, " << counters.droppedCount << " dropped"
+                  << (slotsAccounted ? "" : ", slots lost") << ": " << (passed ? "passed" : "FAILED") << std::endl;
+        return passed;
     }
 
-    void addAdditionalDeviceExtensions()
+    void reportParticles() const
     {
-        uint32_t extensionPptCount;
-        vkEnumerateDeviceExtensionProperties(vulkanProgramInfo.GPU,
-                                             nullptr,
-                                             &extensionPptCount,
-                                             nullptr);
+        const GpuProfiler &profiler = vulkanProgramInfo.gpuProfiler;
+        double total = 0.0;
+        std::cout << "Particles:";
+        for (const char *pass: {"particle simulate", "particle emit", "particle sort"})
+        {
+            double milliseconds = profiler.averageMilliseconds(pass);
+            std::cout << " " << pass << " " << milliseconds << " ms,";
+            total += milliseconds;
+        }
+        std::cout << " " << total << " ms in total for " << vulkanProgramInfo.particleCapacity
+                  << " particles at most, the draw is part of the scene pass" << std::endl;
+    }
 
-        std::vector<VkExtensionProperties> extensionPptList(extensionPptCount);
+    void destroyParticleSystem() const
+    {
+        VkDevice device = vulkanProgramInfo.renderDevice;
+
+        vkDestroyPipeline(device, vulkanProgramInfo.particleDrawPipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.particleDrawPipelineLayout, nullptr);
+        vkDestroyPipeline(device, vulkanProgramInfo.particleSortPipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.particleSortPipelineLayout, nullptr);
+        vkDestroyPipeline(device, vulkanProgramInfo.particleFinalizePipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.particleFinalizePipelineLayout, nullptr);
+        vkDestroyPipeline(device, vulkanProgramInfo.particleEmitPipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.particleEmitPipelineLayout, nullptr);
+        vkDestroyPipeline(device, vulkanProgramInfo.particleSimulatePipeline, nullptr);
+        vkDestroyPipelineLayout(device, vulkanProgramInfo.particleSimulatePipelineLayout, nullptr);
 
-        vkEnumerateDeviceExtensionProperties(vulkanProgramInfo.GPU,
-                                             nullptr,
-                                             &extensionPptCount,
-                                             extensionPptList.data());
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkUnmapMemory(device, vulkanProgramInfo.particleUniformBufferMemories[i]);
+            vkDestroyBuffer(device, vulkanProgramInfo.particleUniformBuffers[i], nullptr);
+            vkFreeMemory(device, vulkanProgramInfo.particleUniformBufferMemories[i], nullptr);
+        }
 
-        // If there is a portability subset device extension, add it in.
-        for (std::size_t i = 0; i < extensionPptCount; i++)
+        for (auto buffer: {std::make_pair(vulkanProgramInfo.particleBuffer, vulkanProgramInfo.particleBufferMemory),
+                           std::make_pair(vulkanProgramInfo.particleAliveBuffer,
+                                          vulkanProgramInfo.particleAliveBufferMemory),
+                           std::make_pair(vulkanProgramInfo.particleCompactedBuffer,
+                                          vulkanProgramInfo.particleCompactedBufferMemory),
+                           std::make_pair(vulkanProgramInfo.particleDeadBuffer,
+                                          vulkanProgramInfo.particleDeadBufferMemory),
+                           std::make_pair(vulkanProgramInfo.particleSortBuffer,
+                                          vulkanProgramInfo.particleSortBufferMemory),
+                           std::make_pair(vulkanProgramInfo.particleCounterBuffer,
+                                          vulkanProgramInfo.particleCounterBufferMemory)})
         {
-            if (strcmp(extensionPptList[i].extensionName, "VK_KHR_portability_subset") == 0)
-            {
-                vulkanProgramInfo.deviceExtensionsEnabled.push_back("VK_KHR_portability_subset");
-                break;
-            }
+            vkDestroyBuffer(device, buffer.first, nullptr);
+            vkFreeMemory(device, buffer.second, nullptr);
         }
     }
 
+    /*
+     * ============================================================
+     * END: GPU Particles
+     * ============================================================
+     */
+
     /*
      * ============================================================
      * START: Swapchain Helper Functions
@@ -2028,8 +7856,10 @@ private:
 
     VkSharingMode chooseImageSharingMode()
     {
-        // Because currently we only deal with present queue and graphics queue that are the same
-        return VK_SHARING_MODE_EXCLUSIVE;
+        // With a separate present queue the images are shared rather than handed over with an
+        // ownership transfer every frame. Few devices lack a family that does both.
+        return vulkanProgramInfo.queueFamilies.separatePresent() ? VK_SHARING_MODE_CONCURRENT
+                                                                 : VK_SHARING_MODE_EXCLUSIVE;
     }
 
     /*
@@ -2083,6 +7913,16 @@ private:
         exit(-1);
     }
 
+    // For the calls made every frame. Release builds do not look at the result, the validation
+    // layer (when enabled) still reports what went wrong.
+    static void checkFrameVkResult([[maybe_unused]] const VkResult &result,
+                                   [[maybe_unused]] const char *failMessage)
+    {
+#if VULKANPROGRAM_FRAME_RESULT_CHECKS
+        checkVkResult(result, failMessage);
+#endif
+    }
+
     static void fillInDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo)
     {
         createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
@@ -2198,22 +8038,182 @@ private:
                         &vulkanProgramInfo.textureImageSampler);
     }
 
+    void createMsaaColorTarget()
+    {
+        vulkanProgramInfo.msaaSamples = clampSampleCount(vulkanProgramInfo.GPU, options.msaaSamples);
+
+        // The depth pyramid is built from single sampled depth, and a second scene pass (late pass
+        // or the one after the depth pre-pass) would have to load the samples the first one
+        // stored, which is what MSAA here avoids
+        if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT && twoScenePasses())
+        {
+            std::cout << "MSAA does not work with occlusion culling or the depth pre-pass, it is disabled"
+                      << std::endl;
+            vulkanProgramInfo.msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+        }
+        // The lighting subpass would have to light every sample of the G-buffer
+        if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT && vulkanProgramInfo.deferredShadingEnabled)
+        {
+            std::cout << "MSAA does not work with deferred shading, it is disabled" << std::endl;
+            vulkanProgramInfo.msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+        }
+        if (options.msaaSamples != 1)
+        {
+            std::cout << "MSAA: " << vulkanProgramInfo.msaaSamples << "x (asked for " << options.msaaSamples << "x)"
+                      << std::endl;
+        }
+        if (vulkanProgramInfo.msaaSamples == VK_SAMPLE_COUNT_1_BIT)
+        {
+            return;
+        }
+
+        bool lazilyAllocated = false;
+        VkDeviceSize size = createAttachmentImage(vulkanProgramInfo.sceneColorFormat,
+                                                  VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                                  VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+                                                  vulkanProgramInfo.msaaSamples,
+                                                  vulkanProgramInfo.msaaColorImage,
+                                                  &vulkanProgramInfo.msaaColorImageMemory,
+                                                  lazilyAllocated);
+
+        VkImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = vulkanProgramInfo.sceneColorFormat;
+        imageViewCreateInfo.image = vulkanProgramInfo.msaaColorImage;
+        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+
+        vkResult = vkCreateImageView(vulkanProgramInfo.renderDevice, &imageViewCreateInfo, nullptr,
+                                     &vulkanProgramInfo.msaaColorImageView);
+        checkVkResult(vkResult, "Failed to create MSAA color image view");
+
+        std::cout << std::fixed << std::setprecision(2) << "MSAA color: transient, "
+                  << (lazilyAllocated ? "lazily allocated" : "device local") << ", "
+                  << static_cast<double>(size) / (1024.0 * 1024.0) << " MiB" << std::defaultfloat << std::endl;
+    }
+
+    // Swapchain sized 2D attachment with one mip and layer. Transient attachments get lazily
+    // allocated memory where there is some. Without memory only the requirements are looked
+    // at and the image is left to the caller to destroy. Returns the size of the allocation.
+    VkDeviceSize createAttachmentImage(VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits samples,
+                                       VkImage &image, VkDeviceMemory *memory, bool &lazilyAllocated) const
+    {
+        VkImageCreateInfo imageCreateInfo{};
+        imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = format;
+        imageCreateInfo.extent = {vulkanProgramInfo.swapchainExtent.width, vulkanProgramInfo.swapchainExtent.height, 1};
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = samples;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = usage;
+        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkResult result = vkCreateImage(vulkanProgramInfo.renderDevice, &imageCreateInfo, nullptr, &image);
+        checkVkResult(result, "Failed to create attachment image");
+
+        VkMemoryRequirements memoryRequirements;
+        vkGetImageMemoryRequirements(vulkanProgramInfo.renderDevice, image, &memoryRequirements);
+
+        VkMemoryAllocateInfo memoryAllocateInfo{};
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.allocationSize = memoryRequirements.size;
+        memoryAllocateInfo.memoryTypeIndex = findAttachmentMemoryType(vulkanProgramInfo.GPU,
+                                                                      memoryRequirements.memoryTypeBits,
+                                                                      (usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0,
+                                                                      lazilyAllocated);
+        if (memory != nullptr)
+        {
+            result = vkAllocateMemory(vulkanProgramInfo.renderDevice, &memoryAllocateInfo, nullptr, memory);
+            checkVkResult(result, "Failed to allocate attachment memory");
+            vkBindImageMemory(vulkanProgramInfo.renderDevice, image, *memory, 0);
+        }
+        return memoryRequirements.size;
+    }
+
+    // Memory the multisampled color and depth attachments take at every sample count the device
+    // supports, for comparing the frame times of --msaa runs. Lazily allocated memory is only
+    // what the driver may need, tile based GPUs resolve on chip and commit none of it.
+    void printMsaaMemoryTable() const
+    {
+        auto mebibytes = [](VkDeviceSize bytes)
+        {
+            return static_cast<double>(bytes) / (1024.0 * 1024.0);
+        };
+
+        std::cout << "MSAA attachment memory at " << vulkanProgramInfo.swapchainExtent.width << "x"
+                  << vulkanProgramInfo.swapchainExtent.height << ":\n" << std::fixed << std::setprecision(2);
+        for (uint32_t requested: {1u, 2u, 4u, 8u})
+        {
+            VkSampleCountFlagBits samples = clampSampleCount(vulkanProgramInfo.GPU, requested);
+            if (static_cast<uint32_t>(samples) != requested)
+            {
+                continue;
+            }
+
+            // Single sampled color is the swapchain image itself
+            VkDeviceSize colorBytes = 0;
+            bool colorLazy = false;
+            if (samples != VK_SAMPLE_COUNT_1_BIT)
+            {
+                VkImage colorProbe = VK_NULL_HANDLE;
+                colorBytes = createAttachmentImage(vulkanProgramInfo.sceneColorFormat,
+                                                   VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                                   VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+                                                   samples, colorProbe, nullptr, colorLazy);
+                vkDestroyImage(vulkanProgramInfo.renderDevice, colorProbe, nullptr);
+            }
+
+            VkImage depthProbe = VK_NULL_HANDLE;
+            bool depthLazy = false;
+            VkDeviceSize depthBytes = createAttachmentImage(vulkanProgramInfo.depthFormat,
+                                                            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                                            VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+                                                            samples, depthProbe, nullptr, depthLazy);
+            vkDestroyImage(vulkanProgramInfo.renderDevice, depthProbe, nullptr);
+
+            std::cout << "  " << requested << "x: color " << mebibytes(colorBytes) << " MiB, depth "
+                      << mebibytes(depthBytes) << " MiB, "
+                      << (depthLazy && (colorLazy || colorBytes == 0) ? "lazily allocated" : "device local")
+                      << (samples == vulkanProgramInfo.msaaSamples ? " (this run)" : "") << "\n";
+        }
+        std::cout << std::defaultfloat << std::flush;
+    }
+
     void createDepthBuffer()
     {
+        // Occlusion culling samples depth for the pyramid and the depth pre-pass hands it to the scene
+        // pass, otherwise it never leaves the scene pass
+        vulkanProgramInfo.depthTransient = !twoScenePasses();
 
-        // For Depth Buffer format, we simply choose VK_FORMAT_D32_SFLOAT
-        VkFormat depthBufferFormat = VK_FORMAT_D32_SFLOAT;
+        VkFormatFeatureFlags depthFeatures = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        if (!vulkanProgramInfo.depthTransient)
+        {
+            depthFeatures |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        }
+        DepthFormatInfo depthFormat = selectDepthFormat(vulkanProgramInfo.GPU, options.depthBits, depthFeatures);
+        vulkanProgramInfo.depthFormat = depthFormat.format;
 
         // Create depth image
         VkImageCreateInfo depthImageCreateInfo{};
         depthImageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        depthImageCreateInfo.format = depthBufferFormat;
+        depthImageCreateInfo.format = depthFormat.format;
         depthImageCreateInfo.pNext = nullptr;
         depthImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
         depthImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-        depthImageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        // Sampled so the depth pyramid for occlusion culling can be built from it. The deferred
+        // lighting subpass reads it as an input attachment, which keeps it transient.
+        depthImageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                     (vulkanProgramInfo.depthTransient ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT
+                                                                       : VK_IMAGE_USAGE_SAMPLED_BIT) |
+                                     (vulkanProgramInfo.deferredShadingEnabled ? VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT
+                                                                               : 0);
         depthImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        depthImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthImageCreateInfo.samples = vulkanProgramInfo.msaaSamples;
         depthImageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
         depthImageCreateInfo.queueFamilyIndexCount = 0;
         depthImageCreateInfo.extent = {vulkanProgramInfo.swapchainExtent.width,
@@ -2228,31 +8228,15 @@ private:
         vkGetImageMemoryRequirements(vulkanProgramInfo.renderDevice, vulkanProgramInfo.depthImage,
                                      &depthImageMemoryRequirements);
 
-        // Allocate Image memory
+        // Allocate Image memory, lazily allocated for a transient depth buffer when there is such memory
+        bool lazilyAllocated = false;
         VkMemoryAllocateInfo depthImageAllocateInfo{};
         depthImageAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
         depthImageAllocateInfo.allocationSize = depthImageMemoryRequirements.size;
-
-        VkPhysicalDeviceMemoryProperties memoryProperties;
-        vkGetPhysicalDeviceMemoryProperties(vulkanProgramInfo.GPU,
-                                            &memoryProperties);
-
-        bool foundCorrectMemoryType = false;
-        VkMemoryPropertyFlags depthImageMemoryProperty = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-        for (int i = 0; i < memoryProperties.memoryTypeCount; i++)
-        {
-            if (depthImageMemoryRequirements.memoryTypeBits & (1 << i) &&
-                depthImageMemoryProperty & memoryProperties.memoryTypes[i].propertyFlags)
-            {
-                depthImageAllocateInfo.memoryTypeIndex = i;
-                foundCorrectMemoryType = true;
-            }
-        }
-
-        if (!foundCorrectMemoryType)
-        {
-            throw std::runtime_error("Failed to find suitable memory type for depth buffer");
-        }
+        depthImageAllocateInfo.memoryTypeIndex = findAttachmentMemoryType(vulkanProgramInfo.GPU,
+                                                                          depthImageMemoryRequirements.memoryTypeBits,
+                                                                          vulkanProgramInfo.depthTransient,
+                                                                          lazilyAllocated);
 
         vkAllocateMemory(vulkanProgramInfo.renderDevice, &depthImageAllocateInfo,
                          nullptr, &vulkanProgramInfo.depthImageMemory);
@@ -2267,7 +8251,7 @@ private:
         VkImageViewCreateInfo depthImageViewCreateInfo{};
         depthImageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
         depthImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        depthImageViewCreateInfo.format = VK_FORMAT_D32_SFLOAT;
+        depthImageViewCreateInfo.format = depthFormat.format;
         depthImageViewCreateInfo.image = vulkanProgramInfo.depthImage;
         depthImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
         depthImageViewCreateInfo.subresourceRange.layerCount = 1;
@@ -2281,6 +8265,46 @@ private:
                           &vulkanProgramInfo.depthImageView);
 
         // Image created, Image View created and Image Memory allocated and binded
+
+        reportDepthBuffer(depthFormat, depthImageMemoryRequirements.size, lazilyAllocated);
+    }
+
+    // What the depth buffer costs compared to a D32 depth buffer in device local memory that is
+    // stored after every scene pass, the way it was allocated before
+    void reportDepthBuffer(const DepthFormatInfo &depthFormat, VkDeviceSize allocationSize, bool lazilyAllocated) const
+    {
+        VkDeviceSize pixels = static_cast<VkDeviceSize>(vulkanProgramInfo.swapchainExtent.width) *
+                              vulkanProgramInfo.swapchainExtent.height;
+        VkDeviceSize baselineBytes = pixels * 4;
+
+        // Lazily allocated memory is only backed once the driver needs to, which tile based GPUs
+        // never do for an attachment that is not stored
+        VkDeviceSize committedBytes = allocationSize;
+        if (lazilyAllocated)
+        {
+            vkGetDeviceMemoryCommitment(vulkanProgramInfo.renderDevice, vulkanProgramInfo.depthImageMemory,
+                                        &committedBytes);
+        }
+
+        // Bytes of depth written back to memory per frame: by each scene pass that stores it
+        uint32_t storingPasses = sceneDepthStoreOp(true) == VK_ATTACHMENT_STORE_OP_STORE ? 1 : 0;
+        uint32_t scenePasses = twoScenePasses() ? 2 : 1;
+        VkDeviceSize storedBytes = storingPasses * pixels * depthFormat.bytesPerPixel;
+        VkDeviceSize baselineStoredBytes = scenePasses * baselineBytes;
+
+        auto mebibytes = [](VkDeviceSize bytes)
+        {
+            return static_cast<double>(bytes) / (1024.0 * 1024.0);
+        };
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << "Depth buffer: " << depthFormat.name << ", "
+                  << (vulkanProgramInfo.depthTransient ? "transient" : "stored") << ", "
+                  << (lazilyAllocated ? "lazily allocated" : "device local") << ", "
+                  << mebibytes(committedBytes) << " MiB committed (D32 device local: "
+                  << mebibytes(baselineBytes) << " MiB, saved " << mebibytes(baselineBytes - std::min(committedBytes, baselineBytes))
+                  << " MiB); stores " << mebibytes(storedBytes) << " MiB per frame instead of "
+                  << mebibytes(baselineStoredBytes) << " MiB" << std::defaultfloat << std::endl;
     }
 
     void loadModel()
@@ -2321,12 +8345,29 @@ private:
                 vertex_indices.push_back(vertex_indices.size());
             }
         }
+
+        // Bounding box used by the culling shader
+        vulkanProgramInfo.meshBoundsMin = vertices[0].pos;
+        vulkanProgramInfo.meshBoundsMax = vertices[0].pos;
+        for (const auto &vertex: vertices)
+        {
+            vulkanProgramInfo.meshBoundsMin = glm::min(vulkanProgramInfo.meshBoundsMin, vertex.pos);
+            vulkanProgramInfo.meshBoundsMax = glm::max(vulkanProgramInfo.meshBoundsMax, vertex.pos);
+        }
     }
 };
 
 
-int main()
+int main(int argc, char **argv)
 {
-    VulkanProgram program{};
-    program.run();
+    ProgramOptions options = parseProgramOptions(argc, argv);
+
+    if (options.benchTransforms)
+    {
+        runTransformBenchmark(options.benchObjectCount);
+        return 0;
+    }
+
+    VulkanProgram program{options};
+    return program.run();
 }
@@ -0,0 +1,167 @@
+#ifndef VULKANPROGRAM_PARTICLE_SIMULATION_HPP
+#define VULKANPROGRAM_PARTICLE_SIMULATION_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "glslShaders/particles.h"
+
+// The particle system stepped on the CPU, one particle after the other, to check what the
+// compute passes did. Steps are the ParticleStep the GPU was given, and particles move with the
+// same stepParticle() and are emitted with the same emitParticle(). Only the slots differ: the
+// GPU hands them out with atomics in whatever order its invocations run, here particles are
+// simply kept in a list.
+class ParticleReference
+{
+public:
+    ParticleReference() = default;
+
+    explicit ParticleReference(uint32_t capacity) : capacity(capacity)
+    {
+        alive.reserve(capacity);
+    }
+
+    // Survivors are simulated first and then the particles of the step are emitted, as long as
+    // there is room, like the "particle simulate" and "particle emit" passes do
+    void step(const ParticleStep &step)
+    {
+        auto dead = std::remove_if(alive.begin(), alive.end(), [&step](Particle &particle)
+        {
+            return !stepParticle(particle, step.gravity, step.floorHeight, step.bounce, step.deltaTime);
+        });
+        alive.erase(dead, alive.end());
+
+        for (uint32_t i = 0; i < step.emitCount; i++)
+        {
+            if (alive.size() == capacity)
+            {
+                dropped += step.emitCount - i;
+                break;
+            }
+            alive.push_back(emitParticle(step.firstEmitted + i, step.emitterPosition));
+        }
+        steps++;
+    }
+
+    const std::vector<Particle> &particles() const
+    {
+        return alive;
+    }
+
+    uint64_t droppedParticles() const
+    {
+        return dropped;
+    }
+
+    uint64_t stepCount() const
+    {
+        return steps;
+    }
+
+private:
+    uint32_t capacity = 0;
+    std::vector<Particle> alive;
+    uint64_t dropped = 0;
+    uint64_t steps = 0;
+};
+
+struct ParticleComparison
+{
+    // Alive on both sides, and of those the ones further apart than the tolerance
+    uint32_t matched = 0;
+    uint32_t mismatched = 0;
+    // Alive on one side only. Particles at the very end of their lifetime may be, since
+    // float rounding can differ, everything else is an error.
+    uint32_t missing = 0;
+    uint32_t unexpected = 0;
+    uint32_t atEndOfLife = 0;
+    // Neighbours in draw order where the nearer one comes first
+    uint32_t orderErrors = 0;
+    float maxPositionError = 0.0f;
+
+    bool passed() const
+    {
+        return mismatched == 0 && missing == 0 && unexpected == 0 && orderErrors == 0;
+    }
+};
+
+// Matches the particles the GPU drew, in draw order, with the reference by id. Positions are
+// compared relative to how far the particle can have travelled, as the GPU may fuse multiplies
+// and adds and round differently. Draw order has to be back to front seen from cameraPosition.
+inline ParticleComparison compareParticles(const std::vector<Particle> &drawn, const ParticleReference &reference,
+                                           const glm::vec3 &cameraPosition, float deltaTime)
+{
+    const float tolerance = 1e-3f;
+    ParticleComparison result{};
+
+    auto byId = [](const Particle &a, const Particle &b)
+    {
+        return a.id < b.id;
+    };
+    std::vector<Particle> gpu = drawn;
+    std::vector<Particle> cpu = reference.particles();
+    std::sort(gpu.begin(), gpu.end(), byId);
+    std::sort(cpu.begin(), cpu.end(), byId);
+
+    // Within a step of the end of its lifetime a particle may be dead on one side only
+    auto endOfLife = [deltaTime](const Particle &particle)
+    {
+        return particleLifetime(particle.id) - particle.age <= deltaTime;
+    };
+
+    std::size_t i = 0;
+    std::size_t j = 0;
+    while (i < gpu.size() || j < cpu.size())
+    {
+        if (j == cpu.size() || (i < gpu.size() && gpu[i].id < cpu[j].id))
+        {
+            if (endOfLife(gpu[i]))
+            {
+                result.atEndOfLife++;
+            } else
+            {
+                result.unexpected++;
+            }
+            i++;
+        } else if (i == gpu.size() || cpu[j].id < gpu[i].id)
+        {
+            if (endOfLife(cpu[j]))
+            {
+                result.atEndOfLife++;
+            } else
+            {
+                result.missing++;
+            }
+            j++;
+        } else
+        {
+            float travelled = PARTICLE_MAX_SPEED * cpu[j].age;
+            float error = glm::length(gpu[i].position - cpu[j].position);
+            result.maxPositionError = std::max(result.maxPositionError, error);
+            if (error > tolerance * std::max(1.0f, travelled) || std::abs(gpu[i].age - cpu[j].age) > tolerance)
+            {
+                result.mismatched++;
+            }
+            result.matched++;
+            i++;
+            j++;
+        }
+    }
+
+    // The GPU computed the distances it sorted by with its own rounding as well
+    for (std::size_t k = 1; k < drawn.size(); k++)
+    {
+        glm::vec3 previous = drawn[k - 1].position - cameraPosition;
+        glm::vec3 current = drawn[k].position - cameraPosition;
+        if (glm::dot(previous, previous) < glm::dot(current, current) * (1.0f - 1e-5f))
+        {
+            result.orderErrors++;
+        }
+    }
+
+    return result;
+}
+
+#endif //VULKANPROGRAM_PARTICLE_SIMULATION_HPP
@@ -0,0 +1,620 @@
+#ifndef VULKANPROGRAM_PIPELINE_CACHE_HPP
+#define VULKANPROGRAM_PIPELINE_CACHE_HPP
+
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "dynamic_rendering.hpp"
+#include "hash.hpp"
+#include "job_system.hpp"
+#include "shader_compiler.hpp"
+
+// Everything a graphics pipeline is created from, as plain values. Shaders are referenced
+// by name and defines, render pass compatibility by the render pass and subpass the
+// pipeline is used in. Viewport and scissor are dynamic and not part of the description.
+
+struct ShaderStageDesc
+{
+    VkShaderStageFlagBits stage = VK_SHADER_STAGE_VERTEX_BIT;
+    std::string name;
+    ShaderDefines defines;
+    std::vector<VkSpecializationMapEntry> specializationEntries;
+    std::vector<char> specializationData;
+};
+
+struct VertexAttributeDesc
+{
+    uint32_t location = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t offset = 0;
+};
+
+struct VertexLayoutDesc
+{
+    uint32_t binding = 0;
+    uint32_t stride = 0;
+    std::vector<VertexAttributeDesc> attributes;
+};
+
+struct RasterStateDesc
+{
+    VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    // Depth bias is enabled when either is not 0
+    float depthBiasConstant = 0.0f;
+    float depthBiasSlope = 0.0f;
+};
+
+struct DepthStateDesc
+{
+    VkBool32 testEnable = VK_TRUE;
+    VkBool32 writeEnable = VK_TRUE;
+    VkCompareOp compareOp = VK_COMPARE_OP_LESS;
+};
+
+struct BlendStateDesc
+{
+    VkBool32 enable = VK_FALSE;
+    VkBlendFactor srcColorFactor = VK_BLEND_FACTOR_ONE;
+    VkBlendFactor dstColorFactor = VK_BLEND_FACTOR_ZERO;
+    VkBlendOp colorOp = VK_BLEND_OP_ADD;
+    VkBlendFactor srcAlphaFactor = VK_BLEND_FACTOR_ONE;
+    VkBlendFactor dstAlphaFactor = VK_BLEND_FACTOR_ZERO;
+    VkBlendOp alphaOp = VK_BLEND_OP_ADD;
+    VkColorComponentFlags writeMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+};
+
+struct GraphicsPipelineDesc
+{
+    std::vector<ShaderStageDesc> stages;
+    VertexLayoutDesc vertexLayout;
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    RasterStateDesc raster;
+    DepthStateDesc depth;
+    BlendStateDesc blend;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    // 0 for depth only passes, all color attachments share the blend state
+    uint32_t colorAttachmentCount = 1;
+    // Attachment formats for dynamic rendering, only used when there is no renderPass
+    VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+
+    uint64_t hash() const
+    {
+        uint64_t result = hashFixedFunction();
+        for (const auto &stage: stages)
+        {
+            result = hashString(stage.name, result);
+            for (const auto &define: stage.defines)
+            {
+                result = hashString(define.second, hashString(define.first, result));
+            }
+        }
+        return result;
+    }
+
+    // Same as hash() but over the compiled code instead of the shader names, so that
+    // descriptions ending up with identical SPIR-V can share a pipeline
+    uint64_t hash(const std::vector<std::vector<char>> &spirv) const
+    {
+        uint64_t result = hashFixedFunction();
+        for (const auto &code: spirv)
+        {
+            result = hashBytes(code.data(), code.size(), hashValue(code.size(), result));
+        }
+        return result;
+    }
+
+private:
+    // Field by field, padding bytes must not end up in the hash
+    uint64_t hashFixedFunction() const
+    {
+        uint64_t result = hashValue(vertexLayout.binding);
+        result = hashValue(vertexLayout.stride, result);
+        for (const auto &attribute: vertexLayout.attributes)
+        {
+            result = hashValue(attribute.location, result);
+            result = hashValue(attribute.format, result);
+            result = hashValue(attribute.offset, result);
+        }
+
+        for (const auto &stage: stages)
+        {
+            result = hashValue(stage.stage, result);
+            for (const auto &entry: stage.specializationEntries)
+            {
+                result = hashValue(entry.constantID, result);
+                result = hashValue(entry.offset, result);
+                result = hashValue(static_cast<uint64_t>(entry.size), result);
+            }
+            result = hashBytes(stage.specializationData.data(), stage.specializationData.size(),
+                               hashValue(stage.specializationData.size(), result));
+        }
+
+        result = hashValue(topology, result);
+        result = hashValue(raster.polygonMode, result);
+        result = hashValue(raster.cullMode, result);
+        result = hashValue(raster.frontFace, result);
+        result = hashValue(raster.depthBiasConstant, result);
+        result = hashValue(raster.depthBiasSlope, result);
+        result = hashValue(depth.testEnable, result);
+        result = hashValue(depth.writeEnable, result);
+        result = hashValue(depth.compareOp, result);
+        result = hashValue(blend.enable, result);
+        result = hashValue(blend.srcColorFactor, result);
+        result = hashValue(blend.dstColorFactor, result);
+        result = hashValue(blend.colorOp, result);
+        result = hashValue(blend.srcAlphaFactor, result);
+        result = hashValue(blend.dstAlphaFactor, result);
+        result = hashValue(blend.alphaOp, result);
+        result = hashValue(blend.writeMask, result);
+        result = hashValue(samples, result);
+        result = hashValue(layout, result);
+        result = hashValue(renderPass, result);
+        result = hashValue(colorAttachmentCount, result);
+        result = hashValue(subpass, result);
+        result = hashValue(colorFormat, result);
+        result = hashValue(depthFormat, result);
+        return result;
+    }
+};
+
+// Creates graphics pipelines from descriptions and caches them by description hash.
+//
+// get() never blocks the render thread: the first lookup of a description queues the
+// shader compile and pipeline creation on the job system and returns VK_NULL_HANDLE,
+// the caller draws with a fallback pipeline until a later lookup returns the real one.
+// Descriptions whose compiled state turns out identical share one pipeline. All creation
+// goes through one VkPipelineCache that is stored on disk, so later runs skip most of
+// the driver side compilation as well.
+class PipelineManager
+{
+public:
+    PipelineManager(VkDevice device, VkPhysicalDevice gpu, const ShaderCompiler &compiler, JobSystem &jobs,
+                    std::string cachePath = "shaderCache/pipelines.bin")
+            : device(device), compiler(compiler), jobs(jobs), cachePath(std::move(cachePath))
+    {
+        std::vector<char> initialData = loadCacheData(gpu);
+
+        VkPipelineCacheCreateInfo pipelineCacheCreateInfo{};
+        pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        pipelineCacheCreateInfo.initialDataSize = initialData.size();
+        pipelineCacheCreateInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+        if (vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+        {
+            pipelineCache = VK_NULL_HANDLE;
+        }
+    }
+
+    PipelineManager(const PipelineManager &) = delete;
+    PipelineManager &operator=(const PipelineManager &) = delete;
+
+    // Compiles the shaders and creates the pipeline on the calling thread. The pipeline is
+    // not cached, the caller owns it. spirv replaces the compile when given, one entry per stage.
+    VkPipeline create(const GraphicsPipelineDesc &desc, const std::vector<std::vector<char>> *spirv = nullptr) const
+    {
+        std::vector<std::vector<char>> compiled;
+        if (!spirv)
+        {
+            if (!compileStages(desc, compiled))
+            {
+                return VK_NULL_HANDLE;
+            }
+            spirv = &compiled;
+        }
+        return createPipeline(desc, *spirv);
+    }
+
+    VkPipeline get(const GraphicsPipelineDesc &desc)
+    {
+        return get(desc, desc.hash());
+    }
+
+    // key is desc.hash(), callers that look the same description up every frame keep it around
+    VkPipeline get(const GraphicsPipelineDesc &desc, uint64_t key)
+    {
+        std::shared_ptr<Slot> slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = descSlots.find(key);
+            if (found != descSlots.end())
+            {
+                return found->second->pipeline.load(std::memory_order_acquire);
+            }
+
+            slot = std::make_shared<Slot>();
+            descSlots[key] = slot;
+        }
+
+        jobs.submit([this, desc, key, slot]()
+                    {
+                        buildSlot(desc, key, slot);
+                    });
+        return VK_NULL_HANDLE;
+    }
+
+    // Queue builds ahead of time, e.g. for every material a scene is known to use
+    void prewarm(const std::vector<GraphicsPipelineDesc> &descs)
+    {
+        for (const auto &desc: descs)
+        {
+            get(desc);
+        }
+    }
+
+    // Changes whenever get() may return a different pipeline than before for some description,
+    // so whatever was recorded with the fallback can be recorded again
+    uint32_t generation() const
+    {
+        return createdCount.load() + deduplicatedCount.load();
+    }
+
+    uint32_t pipelinesCreated() const
+    {
+        return createdCount.load();
+    }
+
+    uint32_t descsDeduplicated() const
+    {
+        return deduplicatedCount.load();
+    }
+
+    double creationMilliseconds() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totalCreationMilliseconds;
+    }
+
+    // Worker jobs have to be done (JobSystem::waitIdle) before this is called. Writes the
+    // pipeline cache back to disk.
+    void destroy()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &state: stateSlots)
+        {
+            vkDestroyPipeline(device, state.second->pipeline.load(), nullptr);
+        }
+        stateSlots.clear();
+        descSlots.clear();
+
+        if (pipelineCache != VK_NULL_HANDLE)
+        {
+            saveCacheData();
+            vkDestroyPipelineCache(device, pipelineCache, nullptr);
+            pipelineCache = VK_NULL_HANDLE;
+        }
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+    };
+
+    VkDevice device;
+    const ShaderCompiler &compiler;
+    JobSystem &jobs;
+    std::string cachePath;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, std::shared_ptr<Slot>> descSlots;
+    std::unordered_map<uint64_t, std::shared_ptr<Slot>> stateSlots;
+    double totalCreationMilliseconds = 0.0;
+
+    std::atomic<uint32_t> createdCount{0};
+    std::atomic<uint32_t> deduplicatedCount{0};
+
+    bool compileStages(const GraphicsPipelineDesc &desc, std::vector<std::vector<char>> &spirv) const
+    {
+        spirv.resize(desc.stages.size());
+        for (std::size_t i = 0; i < desc.stages.size(); i++)
+        {
+            if (!compiler.compile(desc.stages[i].name, desc.stages[i].defines, spirv[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void buildSlot(const GraphicsPipelineDesc &desc, uint64_t key, const std::shared_ptr<Slot> &slot)
+    {
+        std::vector<std::vector<char>> spirv;
+        if (!compileStages(desc, spirv))
+        {
+            // The slot stays empty and the fallback keeps being used
+            return;
+        }
+
+        uint64_t stateHash = desc.hash(spirv);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = stateSlots.find(stateHash);
+            if (found != stateSlots.end())
+            {
+                descSlots[key] = found->second;
+                deduplicatedCount++;
+                return;
+            }
+            stateSlots[stateHash] = slot;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        VkPipeline pipeline = createPipeline(desc, spirv);
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            totalCreationMilliseconds += milliseconds;
+        }
+
+        if (pipeline != VK_NULL_HANDLE)
+        {
+            slot->pipeline.store(pipeline, std::memory_order_release);
+            createdCount++;
+        }
+    }
+
+    VkShaderModule createShaderModule(const std::vector<char> &code) const
+    {
+        VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+        shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderModuleCreateInfo.codeSize = code.size();
+        shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+
+        VkShaderModule shaderModule = VK_NULL_HANDLE;
+        if (vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
+        {
+            return VK_NULL_HANDLE;
+        }
+        return shaderModule;
+    }
+
+    // Safe to call from several threads, VkPipelineCache is internally synchronized
+    VkPipeline createPipeline(const GraphicsPipelineDesc &desc, const std::vector<std::vector<char>> &spirv) const
+    {
+        std::vector<VkShaderModule> shaderModules(desc.stages.size(), VK_NULL_HANDLE);
+        std::vector<VkSpecializationInfo> specializationInfos(desc.stages.size());
+        std::vector<VkPipelineShaderStageCreateInfo> shaderStages(desc.stages.size());
+
+        bool modulesCreated = spirv.size() == desc.stages.size();
+        for (std::size_t i = 0; modulesCreated && i < desc.stages.size(); i++)
+        {
+            const ShaderStageDesc &stage = desc.stages[i];
+            shaderModules[i] = createShaderModule(spirv[i]);
+            modulesCreated = shaderModules[i] != VK_NULL_HANDLE;
+
+            specializationInfos[i].mapEntryCount = static_cast<uint32_t>(stage.specializationEntries.size());
+            specializationInfos[i].pMapEntries = stage.specializationEntries.data();
+            specializationInfos[i].dataSize = stage.specializationData.size();
+            specializationInfos[i].pData = stage.specializationData.data();
+
+            shaderStages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            shaderStages[i].stage = stage.stage;
+            shaderStages[i].module = shaderModules[i];
+            shaderStages[i].pName = "main";
+            shaderStages[i].pSpecializationInfo = stage.specializationEntries.empty() ? nullptr
+                                                                                       : &specializationInfos[i];
+        }
+
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        if (modulesCreated)
+        {
+            pipeline = createPipeline(desc, shaderStages);
+        }
+
+        for (VkShaderModule shaderModule: shaderModules)
+        {
+            vkDestroyShaderModule(device, shaderModule, nullptr);
+        }
+        return pipeline;
+    }
+
+    VkPipeline createPipeline(const GraphicsPipelineDesc &desc,
+                              const std::vector<VkPipelineShaderStageCreateInfo> &shaderStages) const
+    {
+        // Vertex Input
+        VkVertexInputBindingDescription vertexInputBindingDescription{};
+        vertexInputBindingDescription.binding = desc.vertexLayout.binding;
+        vertexInputBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        vertexInputBindingDescription.stride = desc.vertexLayout.stride;
+
+        std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
+        for (const auto &attribute: desc.vertexLayout.attributes)
+        {
+            VkVertexInputAttributeDescription vertexInputAttribute{};
+            vertexInputAttribute.binding = desc.vertexLayout.binding;
+            vertexInputAttribute.location = attribute.location;
+            vertexInputAttribute.format = attribute.format;
+            vertexInputAttribute.offset = attribute.offset;
+            vertexInputAttributeDescriptions.push_back(vertexInputAttribute);
+        }
+
+        VkPipelineVertexInputStateCreateInfo vertexInputStateCreateInfo{};
+        vertexInputStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputStateCreateInfo.vertexBindingDescriptionCount = desc.vertexLayout.stride != 0 ? 1 : 0;
+        vertexInputStateCreateInfo.pVertexBindingDescriptions = &vertexInputBindingDescription;
+        vertexInputStateCreateInfo.vertexAttributeDescriptionCount =
+                static_cast<uint32_t>(vertexInputAttributeDescriptions.size());
+        vertexInputStateCreateInfo.pVertexAttributeDescriptions = vertexInputAttributeDescriptions.data();
+
+        // Input Assembly
+        VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCreateInfo{};
+        inputAssemblyStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssemblyStateCreateInfo.primitiveRestartEnable = VK_FALSE;
+        inputAssemblyStateCreateInfo.topology = desc.topology;
+
+        // Viewport: dynamic, so one pipeline works for any extent
+        VkPipelineViewportStateCreateInfo viewportStateCreateInfo{};
+        viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportStateCreateInfo.viewportCount = 1;
+        viewportStateCreateInfo.scissorCount = 1;
+
+        std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+        VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
+        dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
+
+        // Rasterizer
+        VkPipelineRasterizationStateCreateInfo rasterizationStateCreateInfo{};
+        rasterizationStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizationStateCreateInfo.depthBiasEnable =
+                desc.raster.depthBiasConstant != 0.0f || desc.raster.depthBiasSlope != 0.0f;
+        rasterizationStateCreateInfo.depthBiasConstantFactor = desc.raster.depthBiasConstant;
+        rasterizationStateCreateInfo.depthBiasSlopeFactor = desc.raster.depthBiasSlope;
+        rasterizationStateCreateInfo.depthClampEnable = VK_FALSE;
+        rasterizationStateCreateInfo.lineWidth = 1.0f;
+        rasterizationStateCreateInfo.polygonMode = desc.raster.polygonMode;
+        rasterizationStateCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+        rasterizationStateCreateInfo.cullMode = desc.raster.cullMode;
+        rasterizationStateCreateInfo.frontFace = desc.raster.frontFace;
+
+        // Depth and Stencil
+        VkPipelineDepthStencilStateCreateInfo depthStencilStateCreateInfo{};
+        depthStencilStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencilStateCreateInfo.depthTestEnable = desc.depth.testEnable;
+        depthStencilStateCreateInfo.depthWriteEnable = desc.depth.writeEnable;
+        depthStencilStateCreateInfo.depthCompareOp = desc.depth.compareOp;
+        depthStencilStateCreateInfo.depthBoundsTestEnable = VK_FALSE;
+        depthStencilStateCreateInfo.stencilTestEnable = VK_FALSE;
+
+        // Multisampling
+        VkPipelineMultisampleStateCreateInfo multisampleStateCreateInfo{};
+        multisampleStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampleStateCreateInfo.rasterizationSamples = desc.samples;
+        multisampleStateCreateInfo.sampleShadingEnable = VK_FALSE;
+
+        // Color blending
+        VkPipelineColorBlendAttachmentState colorBlendAttachmentState{};
+        colorBlendAttachmentState.blendEnable = desc.blend.enable;
+        colorBlendAttachmentState.srcColorBlendFactor = desc.blend.srcColorFactor;
+        colorBlendAttachmentState.dstColorBlendFactor = desc.blend.dstColorFactor;
+        colorBlendAttachmentState.colorBlendOp = desc.blend.colorOp;
+        colorBlendAttachmentState.srcAlphaBlendFactor = desc.blend.srcAlphaFactor;
+        colorBlendAttachmentState.dstAlphaBlendFactor = desc.blend.dstAlphaFactor;
+        colorBlendAttachmentState.alphaBlendOp = desc.blend.alphaOp;
+        colorBlendAttachmentState.colorWriteMask = desc.blend.writeMask;
+
+        std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachmentStates(desc.colorAttachmentCount,
+                                                                                    colorBlendAttachmentState);
+
+        VkPipelineColorBlendStateCreateInfo colorBlendStateCreateInfo{};
+        colorBlendStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlendStateCreateInfo.attachmentCount = desc.colorAttachmentCount;
+        colorBlendStateCreateInfo.pAttachments = colorBlendAttachmentStates.data();
+        colorBlendStateCreateInfo.logicOpEnable = VK_FALSE;
+
+        // Without a render pass the attachment formats come from VK_KHR_dynamic_rendering
+        VkPipelineRenderingCreateInfoKHR renderingCreateInfo{};
+        renderingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+        renderingCreateInfo.colorAttachmentCount =
+                desc.colorFormat != VK_FORMAT_UNDEFINED ? std::min(desc.colorAttachmentCount, 1u) : 0;
+        renderingCreateInfo.pColorAttachmentFormats = &desc.colorFormat;
+        renderingCreateInfo.depthAttachmentFormat = desc.depthFormat;
+        renderingCreateInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+
+        VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo{};
+        graphicsPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        graphicsPipelineCreateInfo.pNext = desc.renderPass == VK_NULL_HANDLE ? &renderingCreateInfo : nullptr;
+        graphicsPipelineCreateInfo.renderPass = desc.renderPass;
+        graphicsPipelineCreateInfo.subpass = desc.subpass;
+        graphicsPipelineCreateInfo.layout = desc.layout;
+        graphicsPipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+        graphicsPipelineCreateInfo.pStages = shaderStages.data();
+        graphicsPipelineCreateInfo.pVertexInputState = &vertexInputStateCreateInfo;
+        graphicsPipelineCreateInfo.pInputAssemblyState = &inputAssemblyStateCreateInfo;
+        graphicsPipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+        graphicsPipelineCreateInfo.pRasterizationState = &rasterizationStateCreateInfo;
+        graphicsPipelineCreateInfo.pMultisampleState = &multisampleStateCreateInfo;
+        graphicsPipelineCreateInfo.pDepthStencilState = &depthStencilStateCreateInfo;
+        graphicsPipelineCreateInfo.pColorBlendState = &colorBlendStateCreateInfo;
+        graphicsPipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &graphicsPipelineCreateInfo,
+                                                    nullptr, &pipeline);
+        return result == VK_SUCCESS ? pipeline : VK_NULL_HANDLE;
+    }
+
+    // Cache data written by another driver or GPU is ignored rather than handed to the driver
+    std::vector<char> loadCacheData(VkPhysicalDevice gpu) const
+    {
+        std::vector<char> data;
+        std::ifstream file(cachePath, std::ios::ate | std::ios::binary);
+        if (!file.is_open())
+        {
+            return data;
+        }
+
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), static_cast<std::streamsize>(data.size()));
+
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(gpu, &properties);
+
+        VkPipelineCacheHeaderVersionOne header{};
+        if (data.size() < sizeof(header))
+        {
+            data.clear();
+            return data;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+
+        if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            header.vendorID != properties.vendorID ||
+            header.deviceID != properties.deviceID ||
+            memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        {
+            std::cout << "Ignoring pipeline cache " << cachePath << " from another device or driver" << std::endl;
+            data.clear();
+        }
+        return data;
+    }
+
+    void saveCacheData() const
+    {
+        size_t size = 0;
+        if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0)
+        {
+            return;
+        }
+
+        std::vector<char> data(size);
+        if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS)
+        {
+            return;
+        }
+
+        std::string temporaryPath = cachePath + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), static_cast<std::streamsize>(size));
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, cachePath, error);
+    }
+};
+
+#endif //VULKANPROGRAM_PIPELINE_CACHE_HPP
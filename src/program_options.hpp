@@ -0,0 +1,431 @@
+#ifndef VULKANPROGRAM_PROGRAM_OPTIONS_HPP
+#define VULKANPROGRAM_PROGRAM_OPTIONS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "build_profile.hpp"
+#include "shader_permutations.hpp"
+
+// Compute passes after the scene, drawn into a 16 bit float target when any of them is on
+enum PostEffect : uint32_t
+{
+    POST_EFFECT_TONEMAP = 1u << 0,
+    POST_EFFECT_BLOOM = 1u << 1,
+    POST_EFFECT_FXAA = 1u << 2
+};
+
+// Everything that can be changed from the command line
+struct ProgramOptions
+{
+    // Number of copies of the mesh laid out on a grid
+    uint32_t objectCount = 1;
+
+    // Two phase hierarchical-Z occlusion culling with GPU generated draws
+    bool occlusionCulling = false;
+
+    // Run the transform micro benchmark instead of opening a window
+    bool benchTransforms = false;
+    uint32_t benchObjectCount = 100000;
+
+    // Features of the scene shader, ShaderFeature bits
+    uint32_t shaderFeatures = SHADER_FEATURE_TEXTURED;
+
+    // Spread every shader permutation over the objects, built lazily on worker threads
+    bool shaderPermutations = false;
+
+    // One descriptor set for all textures and buffers, indexed through push constants
+    bool bindless = false;
+
+    // How per draw data reaches the scene shaders: "instanced" draws every group with one
+    // instanced draw, "push" and "ubo" draw every object on its own with the per draw data in
+    // push constants or in a dynamic uniform buffer
+    std::string drawSubmission = "instanced";
+
+    // Mip level bias of every draw, passed as per draw data
+    float lodBias = 0.0f;
+
+    // Recompile shaders and rebuild pipelines when their sources change
+    bool hotReload = false;
+
+    // Print the compiled frame graph as "text" or "dot" once everything is set up
+    std::string dumpRenderGraph;
+
+    // Physical device to use by index, part of its name or UUID prefix instead of the highest
+    // scoring one. Taken from VULKANPROGRAM_GPU when not given on the command line.
+    std::string gpu;
+
+    // Submit everything to the graphics queue even when the device has dedicated compute and
+    // transfer queue families, to compare against async compute
+    bool singleQueue = false;
+
+    // Least bits of depth precision, the cheapest depth format with as many is used
+    uint32_t depthBits = 24;
+
+    // Record the frame once per (swapchain image, frame slot) pair and submit it again until
+    // a pipeline changes, instead of recording every frame
+    bool staticCommandBuffers = false;
+
+    // Draw the scene with render pass and framebuffer objects even when the device has
+    // VK_KHR_dynamic_rendering
+    bool renderPasses = false;
+
+    // Samples per pixel of the scene, clamped to what the device supports for color and depth
+    uint32_t msaaSamples = 1;
+
+    // Draw the scene at a fraction of the swapchain size, chosen every frame so the GPU time per
+    // frame approaches this target. 0 draws at full size.
+    float targetFrameMilliseconds = 0.0f;
+
+    // Least fraction of the swapchain width and height dynamic resolution goes down to
+    float minRenderScale = 0.5f;
+
+    // "bilinear" or "sharpen" upscaling of the dynamic resolution scene
+    std::string upscaleFilter = "bilinear";
+
+    // Lay down depth with a position only pass first, the scene pass then only shades the
+    // fragments that survive it
+    bool depthPrepass = false;
+
+    // Cascaded shadow maps of a directional light, 0 draws without shadows. Each cascade is a
+    // layer of shadowMapSize squared texels, rendered again only when what it covers changed.
+    uint32_t shadowCascades = 0;
+    uint32_t shadowMapSize = 2048;
+
+    // Objects keep their starting pose instead of turning, so cached shadow cascades stay valid
+    bool staticScene = false;
+
+    // Point and spot lights binned into a froxel grid by a compute pass, 0 is none. With
+    // benchLightFrames the count steps from 10 to 10000 lights, that many frames each.
+    uint32_t lights = 0;
+    uint32_t benchLightFrames = 0;
+
+    // "forward" shades every fragment as it is drawn, "deferred" draws a G-buffer in a first
+    // subpass and shades it once per pixel from input attachments in a second one
+    std::string shading = "forward";
+
+    // PostEffect bits, 0 draws straight into the swapchain image. Without tonemapping the HDR
+    // scene is clipped to 1 after exposure.
+    uint32_t postEffects = 0;
+    float exposure = 1.0f;
+    // Weight of the bloom added to the scene and the brightness it starts at
+    float bloomStrength = 0.04f;
+    float bloomThreshold = 1.0f;
+
+    // Particles simulated, sorted and compacted by compute passes and drawn with an indirect
+    // draw, this many at most, 0 is none. With verifyParticleFrames a CPU reference steps along
+    // for that many frames and what the GPU simulated is read back and compared with it.
+    uint32_t particles = 0;
+    uint32_t verifyParticleFrames = 0;
+
+    // Validation layer, defaults to on in debug builds and off in release builds
+    ValidationMode validation = defaultValidationMode();
+
+    // Render this many frames, print the CPU time per frame and exit. 0 runs until the window
+    // is closed.
+    uint32_t benchFrames = 0;
+};
+
+inline void printUsage(const char *programName)
+{
+    std::cout << "Usage: " << programName << " [options]\n"
+              << "  --objects <n>               Draw n copies of the mesh\n"
+              << "  --occlusion-culling         Cull hidden objects against a depth pyramid\n"
+              << "  --bench-transforms [n]      Benchmark scalar vs batched transform update\n"
+              << "  --shader-features <list>    Comma separated: textured, color, quantized or none\n"
+              << "  --permutations              Draw the objects with all shader permutations\n"
+              << "  --bindless                  Use descriptor indexing instead of per frame sets\n"
+              << "  --draw-submission <mode>    instanced (default), push or ubo per draw data\n"
+              << "  --lod-bias <bias>           Texture mip bias passed with every draw\n"
+              << "  --hot-reload                Rebuild pipelines when shader sources change\n"
+              << "  --dump-render-graph [fmt]   Print the frame graph as text (default) or dot\n"
+              << "  --gpu <index|name|uuid>     Use this GPU, also read from VULKANPROGRAM_GPU\n"
+              << "  --single-queue              No async compute or transfer queue\n"
+              << "  --depth-bits <16|24|32>     Least depth precision, picks the cheapest format\n"
+              << "  --static-command-buffers    Reuse recorded frames until a pipeline changes\n"
+              << "  --render-passes             No dynamic rendering, use render pass objects\n"
+              << "  --msaa <1|2|4|8>            Samples per pixel, resolved inside the scene pass\n"
+              << "  --target-frame-ms <ms>      Scale the render resolution to this GPU frame time\n"
+              << "  --min-render-scale <s>      Lowest dynamic resolution scale (default 0.5)\n"
+              << "  --upscale <filter>          bilinear (default) or sharpen dynamic resolution\n"
+              << "  --depth-prepass             Draw depth first, shade with an EQUAL depth test\n"
+              << "  --shadow-cascades <0-4>     Directional light shadow cascades, 0 is no shadows\n"
+              << "  --shadow-map-size <n>       Texels per side of a shadow cascade (default 2048)\n"
+              << "  --static-scene              Objects do not move, shadow cascades stay cached\n"
+              << "  --lights <n>                Clustered point and spot lights, 0 is none\n"
+              << "  --bench-lights <frames>     GPU time with 10 to 10000 lights, frames per step\n"
+              << "  --shading <mode>            forward (default) or deferred with G-buffer subpasses\n"
+              << "  --post <list>               Comma separated: tonemap, bloom, fxaa or none\n"
+              << "  --exposure <e>              Scene exposure before tonemapping (default 1)\n"
+              << "  --bloom-strength <s>        Weight of the bloom (default 0.04)\n"
+              << "  --bloom-threshold <t>       Brightness the bloom starts at (default 1)\n"
+              << "  --particles <n>             GPU simulated particles at most, 0 is none\n"
+              << "  --verify-particles <frames> Compare the particles with a CPU reference and exit\n"
+              << "  --validation <off|on|gpu>   Validation layer, gpu adds GPU-assisted validation\n"
+              << "  --bench-frames <n>          Render n frames and print the CPU time per frame\n"
+              << "  --help                      Show this message\n";
+}
+
+inline ProgramOptions parseProgramOptions(int argc, char **argv)
+{
+    ProgramOptions options{};
+
+    // Returns the value following argv[i] and skips over it
+    auto nextValue = [&](int &i) -> const char *
+    {
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << argv[i] << std::endl;
+            exit(-1);
+        }
+        return argv[++i];
+    };
+
+    auto hasValue = [&](int i)
+    {
+        return i + 1 < argc && argv[i + 1][0] != '-';
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--objects") == 0)
+        {
+            options.objectCount = static_cast<uint32_t>(std::max(1L, strtol(nextValue(i), nullptr, 10)));
+        } else if (strcmp(argv[i], "--occlusion-culling") == 0)
+        {
+            options.occlusionCulling = true;
+        } else if (strcmp(argv[i], "--bench-transforms") == 0)
+        {
+            options.benchTransforms = true;
+            if (hasValue(i))
+            {
+                options.benchObjectCount = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+                if (options.benchObjectCount == 0)
+                {
+                    std::cerr << "Transform benchmark needs at least one object" << std::endl;
+                    exit(-1);
+                }
+            }
+        } else if (strcmp(argv[i], "--shader-features") == 0)
+        {
+            options.shaderFeatures = 0;
+            std::string list = nextValue(i);
+            std::size_t start = 0;
+            while (start <= list.size())
+            {
+                std::size_t end = std::min(list.find(',', start), list.size());
+                std::string feature = list.substr(start, end - start);
+                if (feature == "textured")
+                {
+                    options.shaderFeatures |= SHADER_FEATURE_TEXTURED;
+                } else if (feature == "color")
+                {
+                    options.shaderFeatures |= SHADER_FEATURE_VERTEX_COLOR;
+                } else if (feature == "quantized")
+                {
+                    options.shaderFeatures |= SHADER_FEATURE_QUANTIZED_VERTICES;
+                } else if (feature != "none")
+                {
+                    std::cerr << "Unknown shader feature " << feature << std::endl;
+                    exit(-1);
+                }
+                start = end + 1;
+            }
+        } else if (strcmp(argv[i], "--permutations") == 0)
+        {
+            options.shaderPermutations = true;
+        } else if (strcmp(argv[i], "--bindless") == 0)
+        {
+            options.bindless = true;
+        } else if (strcmp(argv[i], "--draw-submission") == 0)
+        {
+            options.drawSubmission = nextValue(i);
+            if (options.drawSubmission != "instanced" && options.drawSubmission != "push" &&
+                options.drawSubmission != "ubo")
+            {
+                std::cerr << "Unknown draw submission mode " << options.drawSubmission << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--lod-bias") == 0)
+        {
+            options.lodBias = strtof(nextValue(i), nullptr);
+        } else if (strcmp(argv[i], "--hot-reload") == 0)
+        {
+            options.hotReload = true;
+        } else if (strcmp(argv[i], "--dump-render-graph") == 0)
+        {
+            options.dumpRenderGraph = hasValue(i) ? nextValue(i) : "text";
+            if (options.dumpRenderGraph != "text" && options.dumpRenderGraph != "dot")
+            {
+                std::cerr << "Unknown render graph format " << options.dumpRenderGraph << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--gpu") == 0)
+        {
+            options.gpu = nextValue(i);
+        } else if (strcmp(argv[i], "--single-queue") == 0)
+        {
+            options.singleQueue = true;
+        } else if (strcmp(argv[i], "--depth-bits") == 0)
+        {
+            options.depthBits = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+            if (options.depthBits != 16 && options.depthBits != 24 && options.depthBits != 32)
+            {
+                std::cerr << "Depth bits must be 16, 24 or 32" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--static-command-buffers") == 0)
+        {
+            options.staticCommandBuffers = true;
+        } else if (strcmp(argv[i], "--render-passes") == 0)
+        {
+            options.renderPasses = true;
+        } else if (strcmp(argv[i], "--msaa") == 0)
+        {
+            options.msaaSamples = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+            if (options.msaaSamples != 1 && options.msaaSamples != 2 && options.msaaSamples != 4 &&
+                options.msaaSamples != 8)
+            {
+                std::cerr << "MSAA samples must be 1, 2, 4 or 8" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--target-frame-ms") == 0)
+        {
+            options.targetFrameMilliseconds = std::max(0.0f, strtof(nextValue(i), nullptr));
+        } else if (strcmp(argv[i], "--min-render-scale") == 0)
+        {
+            options.minRenderScale = strtof(nextValue(i), nullptr);
+            if (!(options.minRenderScale > 0.0f && options.minRenderScale <= 1.0f))
+            {
+                std::cerr << "Render scale must be above 0 and at most 1" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--upscale") == 0)
+        {
+            options.upscaleFilter = nextValue(i);
+            if (options.upscaleFilter != "bilinear" && options.upscaleFilter != "sharpen")
+            {
+                std::cerr << "Unknown upscale filter " << options.upscaleFilter << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--depth-prepass") == 0)
+        {
+            options.depthPrepass = true;
+        } else if (strcmp(argv[i], "--shadow-cascades") == 0)
+        {
+            options.shadowCascades = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+            if (options.shadowCascades > 4)
+            {
+                std::cerr << "Shadow cascades must be 0 to 4" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--shadow-map-size") == 0)
+        {
+            options.shadowMapSize = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+            if (options.shadowMapSize < 256 || options.shadowMapSize > 8192)
+            {
+                std::cerr << "Shadow map size must be 256 to 8192" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--static-scene") == 0)
+        {
+            options.staticScene = true;
+        } else if (strcmp(argv[i], "--lights") == 0)
+        {
+            options.lights = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+            if (options.lights > 65536)
+            {
+                std::cerr << "Lights must be 0 to 65536" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--bench-lights") == 0)
+        {
+            options.benchLightFrames = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+        } else if (strcmp(argv[i], "--shading") == 0)
+        {
+            options.shading = nextValue(i);
+            if (options.shading != "forward" && options.shading != "deferred")
+            {
+                std::cerr << "Unknown shading mode " << options.shading << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--post") == 0)
+        {
+            options.postEffects = 0;
+            std::string list = nextValue(i);
+            std::size_t start = 0;
+            while (start <= list.size())
+            {
+                std::size_t end = std::min(list.find(',', start), list.size());
+                std::string effect = list.substr(start, end - start);
+                if (effect == "tonemap")
+                {
+                    options.postEffects |= POST_EFFECT_TONEMAP;
+                } else if (effect == "bloom")
+                {
+                    options.postEffects |= POST_EFFECT_BLOOM;
+                } else if (effect == "fxaa")
+                {
+                    options.postEffects |= POST_EFFECT_FXAA;
+                } else if (effect != "none")
+                {
+                    std::cerr << "Unknown post effect " << effect << std::endl;
+                    exit(-1);
+                }
+                start = end + 1;
+            }
+        } else if (strcmp(argv[i], "--exposure") == 0)
+        {
+            options.exposure = std::max(0.0f, strtof(nextValue(i), nullptr));
+        } else if (strcmp(argv[i], "--bloom-strength") == 0)
+        {
+            options.bloomStrength = std::max(0.0f, strtof(nextValue(i), nullptr));
+        } else if (strcmp(argv[i], "--bloom-threshold") == 0)
+        {
+            options.bloomThreshold = std::max(0.0f, strtof(nextValue(i), nullptr));
+        } else if (strcmp(argv[i], "--particles") == 0)
+        {
+            options.particles = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+            if (options.particles > (1u << 24))
+            {
+                std::cerr << "Particles must be 0 to 16777216" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--verify-particles") == 0)
+        {
+            options.verifyParticleFrames = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+        } else if (strcmp(argv[i], "--validation") == 0)
+        {
+            const char *mode = nextValue(i);
+            if (!parseValidationMode(mode, options.validation))
+            {
+                std::cerr << "Unknown validation mode " << mode << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--bench-frames") == 0)
+        {
+            options.benchFrames = static_cast<uint32_t>(strtoul(nextValue(i), nullptr, 10));
+        } else if (strcmp(argv[i], "--help") == 0)
+        {
+            printUsage(argv[0]);
+            exit(0);
+        } else
+        {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            printUsage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (options.gpu.empty() && getenv("VULKANPROGRAM_GPU") != nullptr)
+    {
+        options.gpu = getenv("VULKANPROGRAM_GPU");
+    }
+
+    return options;
+}
+
+#endif //VULKANPROGRAM_PROGRAM_OPTIONS_HPP
@@ -0,0 +1,116 @@
+#ifndef VULKANPROGRAM_QUEUE_FAMILIES_HPP
+#define VULKANPROGRAM_QUEUE_FAMILIES_HPP
+
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Queue families the program submits to. Compute and transfer fall back to the graphics
+// family when the device has no dedicated one (or they are not wanted), so code can always
+// submit to all four and only has to care about ownership when the families differ.
+struct QueueFamilySelection
+{
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    uint32_t graphics = NONE;
+    uint32_t present = NONE;
+    uint32_t compute = NONE;
+    uint32_t transfer = NONE;
+
+    bool valid() const
+    {
+        return graphics != NONE && present != NONE;
+    }
+
+    bool asyncCompute() const
+    {
+        return compute != graphics;
+    }
+
+    bool separateTransfer() const
+    {
+        return transfer != graphics;
+    }
+
+    bool separatePresent() const
+    {
+        return present != graphics;
+    }
+
+    // One entry per family a queue has to be created for
+    std::vector<uint32_t> uniqueFamilies() const
+    {
+        std::vector<uint32_t> families = {graphics, present, compute, transfer};
+        std::sort(families.begin(), families.end());
+        families.erase(std::unique(families.begin(), families.end()), families.end());
+        return families;
+    }
+};
+
+// Graphics goes to the first family that can also present, so most devices need no second
+// queue for presentation. Compute goes to a family without graphics (async compute) and
+// transfer to one with neither graphics nor compute (the copy engine), when they exist.
+// A compute family has to write timestamps, or the overlap could not be measured.
+inline QueueFamilySelection selectQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface,
+                                                bool dedicatedQueues)
+{
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    QueueFamilySelection selection{};
+    uint32_t firstGraphics = QueueFamilySelection::NONE;
+
+    for (uint32_t i = 0; i < queueFamilyCount; i++)
+    {
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        VkBool32 presentSupport = VK_FALSE;
+        vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &presentSupport);
+
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && firstGraphics == QueueFamilySelection::NONE)
+        {
+            firstGraphics = i;
+        }
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && presentSupport && selection.graphics == QueueFamilySelection::NONE)
+        {
+            selection.graphics = i;
+            selection.present = i;
+        }
+        if (presentSupport && selection.present == QueueFamilySelection::NONE)
+        {
+            selection.present = i;
+        }
+
+        bool computeOnly = (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT);
+        if (computeOnly && queueFamilies[i].timestampValidBits > 0 && selection.compute == QueueFamilySelection::NONE)
+        {
+            selection.compute = i;
+        }
+
+        bool transferOnly = (flags & VK_QUEUE_TRANSFER_BIT) &&
+                            !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+        if (transferOnly && selection.transfer == QueueFamilySelection::NONE)
+        {
+            selection.transfer = i;
+        }
+    }
+
+    if (selection.graphics == QueueFamilySelection::NONE)
+    {
+        selection.graphics = firstGraphics;
+    }
+    if (!dedicatedQueues || selection.compute == QueueFamilySelection::NONE)
+    {
+        selection.compute = selection.graphics;
+    }
+    if (!dedicatedQueues || selection.transfer == QueueFamilySelection::NONE)
+    {
+        selection.transfer = selection.graphics;
+    }
+
+    return selection;
+}
+
+#endif //VULKANPROGRAM_QUEUE_FAMILIES_HPP
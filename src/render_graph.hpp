@@ -0,0 +1,1398 @@
+#ifndef VULKANPROGRAM_RENDER_GRAPH_HPP
+#define VULKANPROGRAM_RENDER_GRAPH_HPP
+
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "attachments.hpp"
+#include "vulkan_helpers.h"
+
+// A small frame graph. Passes declare which virtual resources they read and
+// write and how. compile() then
+//   - culls passes whose results are never used,
+//   - works out the pipeline barriers and layout transitions between passes,
+//   - assigns transient images with non overlapping life times to the same memory.
+// realize() then gives the transient images their memory and execute() records the barriers and
+// calls every pass in order.
+//
+// Passes can be put on the async compute queue. batches() then splits the passes into runs on
+// the same queue, to be submitted in order with a semaphore wait whenever the queue changes.
+// That wait covers the dependencies on the other queue, so barriers of compute passes only keep
+// what the compute queue can do (plus layout transitions). Resources used by both queues have to
+// be created with VK_SHARING_MODE_CONCURRENT, the graph does no ownership transfers.
+
+using RenderGraphHandle = uint32_t;
+
+// How a pass touches a resource. Each usage maps to pipeline stages, access
+// flags and (for images) the layout the resource has to be in.
+enum class ResourceUsage
+{
+    ColorAttachment,
+    DepthAttachment,
+    DepthAttachmentRead,
+    SampledFragment,
+    SampledCompute,
+    StorageReadCompute,
+    StorageWriteCompute,
+    StorageReadWriteCompute,
+    StorageReadFragment,
+    StorageReadVertex,
+    IndirectRead,
+    VertexRead,
+    UniformRead,
+    TransferSrc,
+    TransferDst,
+    Present
+};
+
+struct ResourceState
+{
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkAccessFlags access = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+// Only the write bits need to be made available by a barrier
+inline VkAccessFlags writeAccessBits(VkAccessFlags access)
+{
+    return access & (VK_ACCESS_SHADER_WRITE_BIT |
+                     VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                     VK_ACCESS_TRANSFER_WRITE_BIT |
+                     VK_ACCESS_HOST_WRITE_BIT |
+                     VK_ACCESS_MEMORY_WRITE_BIT);
+}
+
+inline ResourceState describeUsage(ResourceUsage usage)
+{
+    switch (usage)
+    {
+        case ResourceUsage::ColorAttachment:
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        case ResourceUsage::DepthAttachment:
+            return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+        case ResourceUsage::DepthAttachmentRead:
+            return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+        case ResourceUsage::SampledFragment:
+            return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        case ResourceUsage::SampledCompute:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        case ResourceUsage::StorageReadCompute:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL};
+        case ResourceUsage::StorageWriteCompute:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL};
+        case ResourceUsage::StorageReadWriteCompute:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL};
+        case ResourceUsage::StorageReadFragment:
+            return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL};
+        case ResourceUsage::StorageReadVertex:
+            return {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL};
+        case ResourceUsage::IndirectRead:
+            return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                    VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED};
+        case ResourceUsage::VertexRead:
+            return {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                    VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED};
+        case ResourceUsage::UniformRead:
+            return {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_UNIFORM_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED};
+        case ResourceUsage::TransferSrc:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_READ_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+        case ResourceUsage::TransferDst:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+        case ResourceUsage::Present:
+            return {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                    0,
+                    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+    }
+    return {};
+}
+
+struct RenderGraphImageDesc
+{
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent{};
+    VkImageUsageFlags usage = 0;
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    uint32_t mipLevels = 1;
+    // Barriers cover every layer, views of layered images are 2D arrays
+    uint32_t arrayLayers = 1;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+};
+
+inline bool operator==(const RenderGraphImageDesc &a, const RenderGraphImageDesc &b)
+{
+    return a.format == b.format && a.extent.width == b.extent.width && a.extent.height == b.extent.height &&
+           a.usage == b.usage && a.aspect == b.aspect && a.mipLevels == b.mipLevels &&
+           a.arrayLayers == b.arrayLayers && a.samples == b.samples;
+}
+
+// The transient images of a graph and the memory they share. The first graph realized with it
+// creates them, every later graph with the same transient images in the same slots is bound to
+// them. A graph can so be built again without touching the descriptor sets that use the views.
+class RenderGraphTransients
+{
+public:
+    // VK_NULL_HANDLE when no alive transient image has that name
+    VkImage image(const std::string &name) const
+    {
+        const Image *found = find(name);
+        return found != nullptr ? found->image : VK_NULL_HANDLE;
+    }
+
+    VkImageView imageView(const std::string &name) const
+    {
+        const Image *found = find(name);
+        return found != nullptr ? found->view : VK_NULL_HANDLE;
+    }
+
+    // Memory of the transient images with and without aliasing
+    VkDeviceSize memorySize(bool aliased) const
+    {
+        VkDeviceSize total = 0;
+        if (aliased)
+        {
+            for (VkDeviceSize size: memorySizes)
+            {
+                total += size;
+            }
+            return total;
+        }
+
+        for (const auto &image: images)
+        {
+            total += image.size;
+        }
+        return total;
+    }
+
+    void destroy(VkDevice device) const
+    {
+        for (const auto &image: images)
+        {
+            vkDestroyImageView(device, image.view, nullptr);
+            vkDestroyImage(device, image.image, nullptr);
+        }
+        for (VkDeviceMemory memory: memories)
+        {
+            vkFreeMemory(device, memory, nullptr);
+        }
+    }
+
+private:
+    friend class RenderGraph;
+
+    struct Image
+    {
+        std::string name;
+        RenderGraphImageDesc desc;
+        // Slot the graph assigned and the allocation the image is bound to. Images of a slot
+        // that cannot share a memory type get allocations of their own.
+        uint32_t aliasSlot = 0;
+        uint32_t memory = 0;
+        VkDeviceSize size = 0;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+    };
+
+    const Image *find(const std::string &name) const
+    {
+        for (const auto &image: images)
+        {
+            if (image.name == name)
+            {
+                return &image;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<Image> images;
+    std::vector<VkDeviceMemory> memories;
+    std::vector<VkDeviceSize> memorySizes;
+};
+
+enum class RenderGraphQueue
+{
+    Graphics,
+    Compute
+};
+
+// Passes [firstPass, endPass) in declaration order, all alive ones on queue
+struct RenderGraphBatch
+{
+    RenderGraphQueue queue;
+    uint32_t firstPass;
+    uint32_t endPass;
+};
+
+class RenderGraph
+{
+public:
+    using ExecuteFunction = std::function<void(VkCommandBuffer)>;
+
+    // Called right before and after a pass records its commands (after its barriers)
+    using PassHook = std::function<void(VkCommandBuffer, const std::string &, RenderGraphQueue)>;
+
+    struct Access
+    {
+        RenderGraphHandle resource;
+        ResourceUsage usage;
+        bool write;
+        // Layout the pass itself leaves the image in (render pass finalLayout), UNDEFINED if unchanged
+        VkImageLayout layoutAfter;
+    };
+
+    class PassBuilder
+    {
+    public:
+        PassBuilder &read(RenderGraphHandle resource, ResourceUsage usage)
+        {
+            graph.passes[pass].accesses.push_back({resource, usage, false, VK_IMAGE_LAYOUT_UNDEFINED});
+            return *this;
+        }
+
+        PassBuilder &write(RenderGraphHandle resource, ResourceUsage usage,
+                           VkImageLayout layoutAfter = VK_IMAGE_LAYOUT_UNDEFINED)
+        {
+            graph.passes[pass].accesses.push_back({resource, usage, true, layoutAfter});
+            return *this;
+        }
+
+        // The pass does something outside of the graph (e.g. readback) and is never culled
+        PassBuilder &sideEffect()
+        {
+            graph.passes[pass].sideEffect = true;
+            return *this;
+        }
+
+        // Compute passes only, the pass is recorded into a command buffer of that queue
+        PassBuilder &queue(RenderGraphQueue queue)
+        {
+            graph.passes[pass].queue = queue;
+            return *this;
+        }
+
+    private:
+        friend class RenderGraph;
+
+        PassBuilder(RenderGraph &graph, uint32_t pass) : graph(graph), pass(pass)
+        {
+        }
+
+        RenderGraph &graph;
+        uint32_t pass;
+    };
+
+    RenderGraphHandle importImage(const std::string &name, VkImage image, VkImageView view,
+                                  VkImageAspectFlags aspect, uint32_t mipLevels, const ResourceState &initialState,
+                                  uint32_t arrayLayers = 1)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = true;
+        resource.image = image;
+        resource.view = view;
+        resource.aspect = aspect;
+        resource.mipLevels = mipLevels;
+        resource.arrayLayers = arrayLayers;
+        resource.initialState = initialState;
+        resources.push_back(resource);
+        return static_cast<RenderGraphHandle>(resources.size() - 1);
+    }
+
+    RenderGraphHandle importBuffer(const std::string &name, VkBuffer buffer, const ResourceState &initialState)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.buffer = buffer;
+        resource.initialState = initialState;
+        resources.push_back(resource);
+        return static_cast<RenderGraphHandle>(resources.size() - 1);
+    }
+
+    // Image that only lives within the frame. It starts every frame undefined and shares its memory
+    // with the transient images that are not alive at the same time.
+    RenderGraphHandle createTransientImage(const std::string &name, const RenderGraphImageDesc &desc)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = true;
+        resource.transient = true;
+        resource.aspect = desc.aspect;
+        resource.mipLevels = desc.mipLevels;
+        resource.arrayLayers = desc.arrayLayers;
+        resource.imageDesc = desc;
+        resources.push_back(resource);
+        return static_cast<RenderGraphHandle>(resources.size() - 1);
+    }
+
+    // Results that are used outside of the graph, e.g. the swapchain image
+    void markOutput(RenderGraphHandle resource, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED)
+    {
+        resources[resource].output = true;
+        resources[resource].finalLayout = finalLayout;
+    }
+
+    PassBuilder addPass(const std::string &name, ExecuteFunction execute)
+    {
+        Pass pass{};
+        pass.name = name;
+        pass.execute = std::move(execute);
+        passes.push_back(std::move(pass));
+        return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+    }
+
+    VkImage image(RenderGraphHandle resource) const
+    {
+        return resources[resource].image;
+    }
+
+    VkImageView imageView(RenderGraphHandle resource) const
+    {
+        return resources[resource].view;
+    }
+
+    VkBuffer buffer(RenderGraphHandle resource) const
+    {
+        return resources[resource].buffer;
+    }
+
+    void compile()
+    {
+        cullPasses();
+        computeLifetimes();
+        assignAliasSlots();
+        computeBarriers();
+    }
+
+    // Binds the transient images to the ones of transients, which are created first when it is
+    // still empty. With two queue families given they are shared by both queues. Needs compile().
+    void realize(VkDevice device, VkPhysicalDevice physicalDevice, RenderGraphTransients &transients,
+                 const std::vector<uint32_t> &queueFamilies)
+    {
+        std::vector<RenderGraphHandle> used;
+        for (RenderGraphHandle i = 0; i < resources.size(); i++)
+        {
+            if (resources[i].transient && resources[i].firstPass >= 0)
+            {
+                used.push_back(i);
+            }
+        }
+
+        if (transients.images.empty())
+        {
+            createTransients(device, physicalDevice, transients, used, queueFamilies);
+        }
+
+        bool same = transients.images.size() == used.size();
+        for (std::size_t i = 0; same && i < used.size(); i++)
+        {
+            const Resource &resource = resources[used[i]];
+            same = transients.images[i].name == resource.name && transients.images[i].desc == resource.imageDesc &&
+                   transients.images[i].aliasSlot == resource.aliasSlot;
+        }
+        if (!same)
+        {
+            throw std::runtime_error("transient images of the render graph changed after they were created!");
+        }
+
+        for (std::size_t i = 0; i < used.size(); i++)
+        {
+            resources[used[i]].image = transients.images[i].image;
+            resources[used[i]].view = transients.images[i].view;
+        }
+
+        // Barriers refer to the images, so they are filled in now that they exist
+        for (auto &pass: passes)
+        {
+            for (auto &barrier: pass.imageBarriers)
+            {
+                barrier.image = resources[barrier.resource].image;
+            }
+        }
+        for (auto &barrier: epilogue.imageBarriers)
+        {
+            barrier.image = resources[barrier.resource].image;
+        }
+    }
+
+    void setPassHooks(PassHook before, PassHook after)
+    {
+        beforePass = std::move(before);
+        afterPass = std::move(after);
+    }
+
+    // Records the barriers with vkCmdPipelineBarrier2KHR (VK_KHR_synchronization2) instead of
+    // vkCmdPipelineBarrier, every image and buffer barrier carrying its own stages
+    void setPipelineBarrier2(PFN_vkCmdPipelineBarrier2KHR function)
+    {
+        pipelineBarrier2 = function;
+    }
+
+    // Everything on one command buffer, for graphs that do not use the compute queue
+    void execute(VkCommandBuffer commandBuffer) const
+    {
+        executePasses(commandBuffer, 0, static_cast<uint32_t>(passes.size()));
+        recordBarriers(commandBuffer, epilogue);
+    }
+
+    // Runs of alive passes on the same queue, in submission order. Every batch but the first
+    // waits for the one before with VK_PIPELINE_STAGE_ALL_COMMANDS_BIT. Needs compile() first.
+    std::vector<RenderGraphBatch> batches() const
+    {
+        std::vector<RenderGraphBatch> result;
+        for (uint32_t i = 0; i < passes.size(); i++)
+        {
+            if (passes[i].culled)
+            {
+                continue;
+            }
+
+            if (result.empty() || result.back().queue != passes[i].queue)
+            {
+                result.push_back({passes[i].queue, i, i + 1});
+            } else
+            {
+                result.back().endPass = i + 1;
+            }
+        }
+        return result;
+    }
+
+    // Records one batch. The last batch also brings the outputs into their final layout.
+    void executeBatch(VkCommandBuffer commandBuffer, const RenderGraphBatch &batch, bool last) const
+    {
+        executePasses(commandBuffer, batch.firstPass, batch.endPass);
+        if (last)
+        {
+            recordBarriers(commandBuffer, epilogue);
+        }
+    }
+
+    std::string toText() const
+    {
+        std::ostringstream out;
+
+        for (const auto &pass: passes)
+        {
+            out << "pass \"" << pass.name << "\""
+                << (pass.queue == RenderGraphQueue::Compute ? " [compute queue]" : "")
+                << (pass.culled ? " (culled)" : "") << "\n";
+
+            if (pass.culled)
+            {
+                continue;
+            }
+
+            writeBarrierText(out, pass);
+
+            for (const auto &access: pass.accesses)
+            {
+                out << "    " << (access.write ? "write " : "read  ") << resources[access.resource].name
+                    << " as " << usageName(access.usage) << "\n";
+            }
+        }
+
+        if (epilogue.dstStages != 0)
+        {
+            out << "end of graph\n";
+            writeBarrierText(out, epilogue);
+        }
+
+        for (std::size_t i = 0; i < aliasSlots.size(); i++)
+        {
+            out << "memory slot " << i << ":";
+            for (const auto &resource: resources)
+            {
+                if (resource.transient && resource.firstPass >= 0 && resource.aliasSlot == i)
+                {
+                    out << " " << resource.name << "[" << resource.firstPass << ", " << resource.lastPass << "]";
+                }
+            }
+            out << "\n";
+        }
+
+        return out.str();
+    }
+
+    std::string toDot() const
+    {
+        std::ostringstream out;
+        out << "digraph RenderGraph {\n";
+        out << "    rankdir=LR;\n";
+
+        for (std::size_t i = 0; i < resources.size(); i++)
+        {
+            out << "    r" << i << " [shape=ellipse, label=\"" << resources[i].name
+                << (resources[i].transient ? "\\n(transient)" : "") << "\"];\n";
+        }
+
+        for (std::size_t i = 0; i < passes.size(); i++)
+        {
+            const Pass &pass = passes[i];
+            std::size_t barrierCount = pass.imageBarriers.size() + pass.bufferBarriers.size();
+
+            out << "    p" << i << " [shape=box, label=\"" << pass.name;
+            if (pass.queue == RenderGraphQueue::Compute)
+            {
+                out << "\\n(compute queue)";
+            }
+            if (pass.dstStages != 0)
+            {
+                out << "\\n" << barrierCount << " barrier(s)";
+            }
+            out << "\"" << (pass.culled ? ", style=dashed, color=gray" : "") << "];\n";
+
+            for (const auto &access: pass.accesses)
+            {
+                if (access.write)
+                {
+                    out << "    p" << i << " -> r" << access.resource;
+                } else
+                {
+                    out << "    r" << access.resource << " -> p" << i;
+                }
+                out << " [label=\"" << usageName(access.usage) << "\"];\n";
+            }
+        }
+
+        out << "}\n";
+        return out.str();
+    }
+
+private:
+    struct ImageBarrier
+    {
+        RenderGraphHandle resource;
+        VkImage image;
+        VkImageAspectFlags aspect;
+        uint32_t mipLevels;
+        uint32_t arrayLayers;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+        VkImageLayout oldLayout;
+        VkImageLayout newLayout;
+    };
+
+    struct BufferBarrier
+    {
+        RenderGraphHandle resource;
+        VkBuffer buffer;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        ExecuteFunction execute;
+        std::vector<Access> accesses;
+        bool sideEffect = false;
+        bool culled = false;
+        RenderGraphQueue queue = RenderGraphQueue::Graphics;
+
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        std::vector<ImageBarrier> imageBarriers;
+        std::vector<BufferBarrier> bufferBarriers;
+    };
+
+    struct Resource
+    {
+        std::string name;
+        bool isImage = false;
+        bool transient = false;
+        bool output = false;
+        VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        ResourceState initialState{};
+
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        uint32_t mipLevels = 1;
+        // Barriers cover every layer
+        uint32_t arrayLayers = 1;
+        RenderGraphImageDesc imageDesc{};
+
+        int firstPass = -1;
+        int lastPass = -1;
+        uint32_t aliasSlot = 0;
+    };
+
+    struct AliasSlot
+    {
+        // Lazily allocated attachments only share with each other, so they keep that memory
+        bool transientAttachment = false;
+        // Last pass using the slot and the image using it then
+        int busyUntil = -1;
+        RenderGraphHandle lastUser = 0;
+    };
+
+    // Synchronization state of one resource while walking through the passes
+    struct TrackedState
+    {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags writeStages = 0;
+        VkAccessFlags writeAccess = 0;
+        // Readers since the last write and the stages already synchronized with it
+        VkPipelineStageFlags readStages = 0;
+        VkPipelineStageFlags syncedStages = 0;
+    };
+
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    std::vector<AliasSlot> aliasSlots;
+    Pass epilogue;
+
+    PassHook beforePass;
+    PassHook afterPass;
+
+    PFN_vkCmdPipelineBarrier2KHR pipelineBarrier2 = nullptr;
+
+    void executePasses(VkCommandBuffer commandBuffer, uint32_t firstPass, uint32_t endPass) const
+    {
+        for (uint32_t i = firstPass; i < endPass; i++)
+        {
+            const Pass &pass = passes[i];
+            if (pass.culled)
+            {
+                continue;
+            }
+
+            recordBarriers(commandBuffer, pass);
+
+            if (beforePass)
+            {
+                beforePass(commandBuffer, pass.name, pass.queue);
+            }
+            if (pass.execute)
+            {
+                pass.execute(commandBuffer);
+            }
+            if (afterPass)
+            {
+                afterPass(commandBuffer, pass.name, pass.queue);
+            }
+        }
+    }
+
+    void cullPasses()
+    {
+        std::vector<bool> needed(resources.size(), false);
+        for (std::size_t i = 0; i < resources.size(); i++)
+        {
+            needed[i] = resources[i].output;
+        }
+
+        // Walk backwards: a pass is alive if it writes something that is needed later on
+        for (auto pass = passes.rbegin(); pass != passes.rend(); ++pass)
+        {
+            bool alive = pass->sideEffect;
+            for (const auto &access: pass->accesses)
+            {
+                alive = alive || (access.write && needed[access.resource]);
+            }
+
+            pass->culled = !alive;
+            if (!alive)
+            {
+                continue;
+            }
+
+            for (const auto &access: pass->accesses)
+            {
+                if (!access.write)
+                {
+                    needed[access.resource] = true;
+                }
+            }
+        }
+    }
+
+    void computeLifetimes()
+    {
+        for (std::size_t i = 0; i < passes.size(); i++)
+        {
+            if (passes[i].culled)
+            {
+                continue;
+            }
+
+            for (const auto &access: passes[i].accesses)
+            {
+                Resource &resource = resources[access.resource];
+                if (resource.firstPass < 0)
+                {
+                    resource.firstPass = static_cast<int>(i);
+                }
+                resource.lastPass = static_cast<int>(i);
+            }
+        }
+    }
+
+    // Greedy interval colouring: a transient image reuses the first slot that is free by the
+    // time it is first used
+    void assignAliasSlots()
+    {
+        std::vector<RenderGraphHandle> transients;
+        for (RenderGraphHandle i = 0; i < resources.size(); i++)
+        {
+            if (resources[i].transient && resources[i].firstPass >= 0)
+            {
+                transients.push_back(i);
+            }
+        }
+
+        std::stable_sort(transients.begin(), transients.end(), [this](RenderGraphHandle a, RenderGraphHandle b)
+        {
+            return resources[a].firstPass < resources[b].firstPass;
+        });
+
+        aliasSlots.clear();
+        for (RenderGraphHandle handle: transients)
+        {
+            Resource &resource = resources[handle];
+            bool transientAttachment = (resource.imageDesc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+
+            bool assigned = false;
+            for (uint32_t slot = 0; slot < aliasSlots.size() && !assigned; slot++)
+            {
+                if (aliasSlots[slot].busyUntil < resource.firstPass &&
+                    aliasSlots[slot].transientAttachment == transientAttachment)
+                {
+                    resource.aliasSlot = slot;
+                    assigned = true;
+                }
+            }
+
+            if (!assigned)
+            {
+                AliasSlot slot{};
+                slot.transientAttachment = transientAttachment;
+                aliasSlots.push_back(slot);
+                resource.aliasSlot = static_cast<uint32_t>(aliasSlots.size() - 1);
+            }
+            aliasSlots[resource.aliasSlot].busyUntil = resource.lastPass;
+            aliasSlots[resource.aliasSlot].lastUser = handle;
+        }
+    }
+
+    void createTransients(VkDevice device, VkPhysicalDevice physicalDevice, RenderGraphTransients &transients,
+                          const std::vector<RenderGraphHandle> &used, const std::vector<uint32_t> &queueFamilies) const
+    {
+        struct Allocation
+        {
+            VkDeviceSize size = 0;
+            uint32_t memoryTypeBits = ~0u;
+            bool transientAttachment = true;
+        };
+        std::vector<Allocation> allocations;
+        std::vector<uint32_t> slotAllocations(aliasSlots.size(), UINT32_MAX);
+
+        for (RenderGraphHandle handle: used)
+        {
+            const Resource &resource = resources[handle];
+            const RenderGraphImageDesc &desc = resource.imageDesc;
+
+            VkImageCreateInfo imageCreateInfo{};
+            imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageCreateInfo.format = desc.format;
+            imageCreateInfo.extent = {desc.extent.width, desc.extent.height, 1};
+            imageCreateInfo.mipLevels = desc.mipLevels;
+            imageCreateInfo.arrayLayers = desc.arrayLayers;
+            imageCreateInfo.samples = desc.samples;
+            imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageCreateInfo.usage = desc.usage;
+            imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            if (queueFamilies.size() > 1)
+            {
+                imageCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+                imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+                imageCreateInfo.pQueueFamilyIndices = queueFamilies.data();
+            }
+
+            RenderGraphTransients::Image image{};
+            image.name = resource.name;
+            image.desc = desc;
+            image.aliasSlot = resource.aliasSlot;
+            if (vkCreateImage(device, &imageCreateInfo, nullptr, &image.image) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create transient image!");
+            }
+
+            VkMemoryRequirements memoryRequirements{};
+            vkGetImageMemoryRequirements(device, image.image, &memoryRequirements);
+            image.size = memoryRequirements.size;
+
+            // Every image is bound at offset 0, which suits any alignment
+            uint32_t &slotAllocation = slotAllocations[resource.aliasSlot];
+            if (slotAllocation != UINT32_MAX &&
+                (allocations[slotAllocation].memoryTypeBits & memoryRequirements.memoryTypeBits) != 0)
+            {
+                image.memory = slotAllocation;
+            } else
+            {
+                image.memory = static_cast<uint32_t>(allocations.size());
+                allocations.emplace_back();
+                if (slotAllocation == UINT32_MAX)
+                {
+                    slotAllocation = image.memory;
+                }
+            }
+
+            Allocation &allocation = allocations[image.memory];
+            allocation.size = std::max(allocation.size, memoryRequirements.size);
+            allocation.memoryTypeBits &= memoryRequirements.memoryTypeBits;
+            allocation.transientAttachment = allocation.transientAttachment &&
+                                             (desc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+
+            transients.images.push_back(image);
+        }
+
+        for (const auto &allocation: allocations)
+        {
+            bool lazilyAllocated = false;
+            VkMemoryAllocateInfo memoryAllocateInfo{};
+            memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            memoryAllocateInfo.allocationSize = allocation.size;
+            memoryAllocateInfo.memoryTypeIndex = findAttachmentMemoryType(physicalDevice,
+                                                                          allocation.memoryTypeBits,
+                                                                          allocation.transientAttachment,
+                                                                          lazilyAllocated);
+
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            if (vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &memory) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to allocate transient image memory!");
+            }
+            transients.memories.push_back(memory);
+            transients.memorySizes.push_back(allocation.size);
+        }
+
+        for (auto &image: transients.images)
+        {
+            if (vkBindImageMemory(device, image.image, transients.memories[image.memory], 0) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to bind transient image memory!");
+            }
+
+            VkImageViewCreateInfo viewCreateInfo{};
+            viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewCreateInfo.image = image.image;
+            viewCreateInfo.viewType = image.desc.arrayLayers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY
+                                                                 : VK_IMAGE_VIEW_TYPE_2D;
+            viewCreateInfo.format = image.desc.format;
+            viewCreateInfo.subresourceRange = {image.desc.aspect, 0, image.desc.mipLevels, 0,
+                                               image.desc.arrayLayers};
+
+            if (vkCreateImageView(device, &viewCreateInfo, nullptr, &image.view) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create transient image view!");
+            }
+        }
+    }
+
+    void computeBarriers()
+    {
+        std::vector<TrackedState> states(resources.size());
+        for (std::size_t i = 0; i < resources.size(); i++)
+        {
+            const ResourceState &initial = resources[i].initialState;
+            states[i].layout = initial.layout;
+            if (resources[i].transient)
+            {
+                continue;
+            }
+
+            // Whatever happened to an imported resource before the graph has to finish first
+            if (writeAccessBits(initial.access) != 0 || initial.access == 0)
+            {
+                states[i].writeStages = initial.stages;
+                states[i].writeAccess = writeAccessBits(initial.access);
+            } else
+            {
+                states[i].readStages = initial.stages;
+            }
+        }
+
+        // A transient image taking over a slot waits for the one before it. The first one of the
+        // frame waits for the last one, which used the memory in the frame before.
+        std::vector<VkPipelineStageFlags> slotReleaseStages(aliasSlots.size(), 0);
+        std::vector<VkAccessFlags> slotReleaseAccess(aliasSlots.size(), 0);
+        for (const auto &pass: passes)
+        {
+            for (const auto &access: pass.accesses)
+            {
+                const Resource &resource = resources[access.resource];
+                if (!pass.culled && resource.transient && aliasSlots[resource.aliasSlot].lastUser == access.resource)
+                {
+                    ResourceState usage = describeUsage(access.usage);
+                    slotReleaseStages[resource.aliasSlot] |= usage.stages;
+                    slotReleaseAccess[resource.aliasSlot] |= writeAccessBits(usage.access);
+                }
+            }
+        }
+        std::vector<bool> started(resources.size(), false);
+
+        for (std::size_t passIndex = 0; passIndex < passes.size(); passIndex++)
+        {
+            Pass &pass = passes[passIndex];
+            if (pass.culled)
+            {
+                continue;
+            }
+
+            for (const auto &access: pass.accesses)
+            {
+                Resource &resource = resources[access.resource];
+                TrackedState &state = states[access.resource];
+                ResourceState usage = describeUsage(access.usage);
+
+                if (resource.transient && !started[access.resource])
+                {
+                    started[access.resource] = true;
+                    state.writeStages = slotReleaseStages[resource.aliasSlot];
+                    state.writeAccess = slotReleaseAccess[resource.aliasSlot];
+                    state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                }
+
+                bool layoutChange = resource.isImage && usage.layout != state.layout;
+                VkPipelineStageFlags srcStages = 0;
+                VkAccessFlags srcAccess = 0;
+
+                if (access.write || layoutChange)
+                {
+                    // Wait for the last write (WAW) and every read since (WAR)
+                    srcStages = state.writeStages | state.readStages;
+                    srcAccess = state.writeAccess;
+                } else if ((usage.stages & ~state.syncedStages) != 0 && state.writeStages != 0)
+                {
+                    // Read after write from stages that have not waited for it yet
+                    srcStages = state.writeStages;
+                    srcAccess = state.writeAccess;
+                }
+
+                if (srcStages != 0 || layoutChange)
+                {
+                    pass.srcStages |= srcStages;
+                    pass.dstStages |= usage.stages;
+
+                    // Write after read without a layout change only needs the execution dependency
+                    if (resource.isImage && (layoutChange || srcAccess != 0))
+                    {
+                        pass.imageBarriers.push_back({access.resource, resource.image, resource.aspect,
+                                                      resource.mipLevels, resource.arrayLayers,
+                                                      srcAccess, usage.access,
+                                                      state.layout, usage.layout});
+                    } else if (!resource.isImage && srcAccess != 0)
+                    {
+                        pass.bufferBarriers.push_back({access.resource, resource.buffer, srcAccess, usage.access});
+                    }
+                }
+
+                if (access.write || layoutChange)
+                {
+                    state.writeStages = usage.stages;
+                    state.writeAccess = access.write ? writeAccessBits(usage.access) : 0;
+                    state.readStages = access.write ? 0 : usage.stages;
+                    state.syncedStages = access.write ? 0 : usage.stages;
+                    state.layout = usage.layout;
+                } else
+                {
+                    state.readStages |= usage.stages;
+                    state.syncedStages |= usage.stages;
+                }
+
+                if (access.layoutAfter != VK_IMAGE_LAYOUT_UNDEFINED)
+                {
+                    state.layout = access.layoutAfter;
+                }
+
+                if (resource.transient && resource.lastPass == static_cast<int>(passIndex))
+                {
+                    slotReleaseStages[resource.aliasSlot] = state.writeStages | state.readStages;
+                    slotReleaseAccess[resource.aliasSlot] = state.writeAccess;
+                }
+            }
+
+            if (pass.dstStages != 0 && pass.srcStages == 0)
+            {
+                pass.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            }
+            if (pass.queue == RenderGraphQueue::Compute)
+            {
+                restrictToComputeQueue(pass);
+            }
+        }
+
+        // Bring outputs into the layout the outside world expects
+        epilogue = Pass{};
+        for (std::size_t i = 0; i < resources.size(); i++)
+        {
+            const Resource &resource = resources[i];
+            const TrackedState &state = states[i];
+
+            if (!resource.isImage || !resource.output ||
+                resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || resource.finalLayout == state.layout)
+            {
+                continue;
+            }
+
+            epilogue.srcStages |= state.writeStages | state.readStages;
+            epilogue.dstStages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            epilogue.imageBarriers.push_back({static_cast<RenderGraphHandle>(i), resource.image,
+                                              resource.aspect, resource.mipLevels,
+                                              resource.arrayLayers, state.writeAccess, 0, state.layout, resource.finalLayout});
+        }
+
+        if (epilogue.srcStages == 0 && !epilogue.imageBarriers.empty())
+        {
+            epilogue.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        }
+
+        // A batch after a queue switch starts with the semaphore wait. Its first barrier waits for
+        // all commands before it, so its layout transitions are ordered after that wait.
+        std::vector<RenderGraphBatch> runs = batches();
+        for (std::size_t i = 1; i < runs.size(); i++)
+        {
+            Pass &first = passes[runs[i].firstPass];
+            if (first.dstStages != 0)
+            {
+                first.srcStages |= VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            }
+        }
+
+        if (!runs.empty() && runs.back().queue == RenderGraphQueue::Compute)
+        {
+            restrictToComputeQueue(epilogue);
+        }
+    }
+
+    // Work of the graphics queue a compute pass depends on was waited for with a semaphore,
+    // which makes all of its writes available. Only the stages and accesses of the compute
+    // queue stay, a barrier left without source stages still does its layout transitions.
+    static void restrictToComputeQueue(Pass &pass)
+    {
+        const VkPipelineStageFlags computeStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT |
+                                                   VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                                   VK_PIPELINE_STAGE_TRANSFER_BIT |
+                                                   VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT |
+                                                   VK_PIPELINE_STAGE_HOST_BIT |
+                                                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        const VkAccessFlags computeAccess = VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                                            VK_ACCESS_UNIFORM_READ_BIT |
+                                            VK_ACCESS_SHADER_READ_BIT |
+                                            VK_ACCESS_SHADER_WRITE_BIT |
+                                            VK_ACCESS_TRANSFER_READ_BIT |
+                                            VK_ACCESS_TRANSFER_WRITE_BIT |
+                                            VK_ACCESS_HOST_READ_BIT |
+                                            VK_ACCESS_HOST_WRITE_BIT |
+                                            VK_ACCESS_MEMORY_READ_BIT |
+                                            VK_ACCESS_MEMORY_WRITE_BIT;
+
+        if (pass.dstStages == 0)
+        {
+            return;
+        }
+
+        pass.srcStages &= computeStages;
+        pass.dstStages &= computeStages;
+        pass.srcStages = pass.srcStages != 0 ? pass.srcStages
+                                             : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        pass.dstStages = pass.dstStages != 0 ? pass.dstStages
+                                             : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+        for (auto &barrier: pass.imageBarriers)
+        {
+            barrier.srcAccess &= computeAccess;
+            barrier.dstAccess &= computeAccess;
+        }
+        for (auto &barrier: pass.bufferBarriers)
+        {
+            barrier.srcAccess &= computeAccess;
+            barrier.dstAccess &= computeAccess;
+        }
+    }
+
+    void recordBarriers(VkCommandBuffer commandBuffer, const Pass &pass) const
+    {
+        if (pass.dstStages == 0)
+        {
+            return;
+        }
+        if (pipelineBarrier2 != nullptr)
+        {
+            recordBarriers2(commandBuffer, pass);
+            return;
+        }
+
+        std::vector<VkImageMemoryBarrier> imageBarriers;
+        imageBarriers.reserve(pass.imageBarriers.size());
+        for (const auto &barrier: pass.imageBarriers)
+        {
+            VkImageMemoryBarrier imageBarrier{};
+            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarrier.image = barrier.image;
+            imageBarrier.srcAccessMask = barrier.srcAccess;
+            imageBarrier.dstAccessMask = barrier.dstAccess;
+            imageBarrier.oldLayout = barrier.oldLayout;
+            imageBarrier.newLayout = barrier.newLayout;
+            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.subresourceRange = {barrier.aspect, 0, barrier.mipLevels, 0, barrier.arrayLayers};
+            imageBarriers.push_back(imageBarrier);
+        }
+
+        std::vector<VkBufferMemoryBarrier> bufferBarriers;
+        bufferBarriers.reserve(pass.bufferBarriers.size());
+        for (const auto &barrier: pass.bufferBarriers)
+        {
+            VkBufferMemoryBarrier bufferBarrier{};
+            bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            bufferBarrier.buffer = barrier.buffer;
+            bufferBarrier.srcAccessMask = barrier.srcAccess;
+            bufferBarrier.dstAccessMask = barrier.dstAccess;
+            bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.offset = 0;
+            bufferBarrier.size = VK_WHOLE_SIZE;
+            bufferBarriers.push_back(bufferBarrier);
+        }
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             pass.srcStages,
+                             pass.dstStages,
+                             0,
+                             0, nullptr,
+                             static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                             static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+
+    // The stage and access bits of synchronization2 are a superset of the original ones with the
+    // same values, so the flags tracked for vkCmdPipelineBarrier carry over as they are
+    void recordBarriers2(VkCommandBuffer commandBuffer, const Pass &pass) const
+    {
+        auto srcStages = static_cast<VkPipelineStageFlags2KHR>(pass.srcStages);
+        auto dstStages = static_cast<VkPipelineStageFlags2KHR>(pass.dstStages);
+
+        std::vector<VkImageMemoryBarrier2KHR> imageBarriers;
+        imageBarriers.reserve(pass.imageBarriers.size());
+        for (const auto &barrier: pass.imageBarriers)
+        {
+            VkImageMemoryBarrier2KHR imageBarrier{};
+            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+            imageBarrier.image = barrier.image;
+            imageBarrier.srcStageMask = srcStages;
+            imageBarrier.dstStageMask = dstStages;
+            imageBarrier.srcAccessMask = barrier.srcAccess;
+            imageBarrier.dstAccessMask = barrier.dstAccess;
+            imageBarrier.oldLayout = barrier.oldLayout;
+            imageBarrier.newLayout = barrier.newLayout;
+            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.subresourceRange = {barrier.aspect, 0, barrier.mipLevels, 0, barrier.arrayLayers};
+            imageBarriers.push_back(imageBarrier);
+        }
+
+        std::vector<VkBufferMemoryBarrier2KHR> bufferBarriers;
+        bufferBarriers.reserve(pass.bufferBarriers.size());
+        for (const auto &barrier: pass.bufferBarriers)
+        {
+            VkBufferMemoryBarrier2KHR bufferBarrier{};
+            bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+            bufferBarrier.buffer = barrier.buffer;
+            bufferBarrier.srcStageMask = srcStages;
+            bufferBarrier.dstStageMask = dstStages;
+            bufferBarrier.srcAccessMask = barrier.srcAccess;
+            bufferBarrier.dstAccessMask = barrier.dstAccess;
+            bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.offset = 0;
+            bufferBarrier.size = VK_WHOLE_SIZE;
+            bufferBarriers.push_back(bufferBarrier);
+        }
+
+        // Stages are per barrier now, an execution dependency alone needs a barrier of its own
+        VkMemoryBarrier2KHR executionBarrier{};
+        executionBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+        executionBarrier.srcStageMask = srcStages;
+        executionBarrier.dstStageMask = dstStages;
+        bool executionOnly = imageBarriers.empty() && bufferBarriers.empty();
+
+        VkDependencyInfoKHR dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+        dependencyInfo.memoryBarrierCount = executionOnly ? 1 : 0;
+        dependencyInfo.pMemoryBarriers = &executionBarrier;
+        dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+        dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+        dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+
+        pipelineBarrier2(commandBuffer, &dependencyInfo);
+    }
+
+    void writeBarrierText(std::ostringstream &out, const Pass &pass) const
+    {
+        if (pass.dstStages == 0)
+        {
+            return;
+        }
+
+        out << "    barrier " << stageNames(pass.srcStages) << " -> " << stageNames(pass.dstStages) << "\n";
+        for (const auto &barrier: pass.imageBarriers)
+        {
+            out << "      image " << resources[barrier.resource].name << ": "
+                << layoutName(barrier.oldLayout) << " -> " << layoutName(barrier.newLayout)
+                << ", " << accessNames(barrier.srcAccess) << " -> " << accessNames(barrier.dstAccess) << "\n";
+        }
+        for (const auto &barrier: pass.bufferBarriers)
+        {
+            out << "      buffer " << resources[barrier.resource].name << ": "
+                << accessNames(barrier.srcAccess) << " -> " << accessNames(barrier.dstAccess) << "\n";
+        }
+    }
+
+    static const char *usageName(ResourceUsage usage)
+    {
+        switch (usage)
+        {
+            case ResourceUsage::ColorAttachment: return "color attachment";
+            case ResourceUsage::DepthAttachment: return "depth attachment";
+            case ResourceUsage::DepthAttachmentRead: return "read only depth attachment";
+            case ResourceUsage::SampledFragment: return "sampled (fragment)";
+            case ResourceUsage::SampledCompute: return "sampled (compute)";
+            case ResourceUsage::StorageReadCompute: return "storage read (compute)";
+            case ResourceUsage::StorageWriteCompute: return "storage write (compute)";
+            case ResourceUsage::StorageReadWriteCompute: return "storage read/write (compute)";
+            case ResourceUsage::StorageReadFragment: return "storage read (fragment)";
+            case ResourceUsage::StorageReadVertex: return "storage read (vertex)";
+            case ResourceUsage::IndirectRead: return "indirect";
+            case ResourceUsage::VertexRead: return "vertex input";
+            case ResourceUsage::UniformRead: return "uniform";
+            case ResourceUsage::TransferSrc: return "transfer src";
+            case ResourceUsage::TransferDst: return "transfer dst";
+            case ResourceUsage::Present: return "present";
+        }
+        return "unknown";
+    }
+
+    static const char *layoutName(VkImageLayout layout)
+    {
+        switch (layout)
+        {
+            case VK_IMAGE_LAYOUT_UNDEFINED: return "UNDEFINED";
+            case VK_IMAGE_LAYOUT_GENERAL: return "GENERAL";
+            case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: return "COLOR_ATTACHMENT";
+            case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL: return "DEPTH_ATTACHMENT";
+            case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL: return "DEPTH_READ_ONLY";
+            case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: return "SHADER_READ_ONLY";
+            case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return "TRANSFER_SRC";
+            case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: return "TRANSFER_DST";
+            case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: return "PRESENT_SRC";
+            default: return "OTHER";
+        }
+    }
+
+    static std::string stageNames(VkPipelineStageFlags stages)
+    {
+        static const std::pair<VkPipelineStageFlags, const char *> names[] =
+                {
+                        {VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,             "TOP"},
+                        {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,           "DRAW_INDIRECT"},
+                        {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,            "VERTEX_INPUT"},
+                        {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,           "VERTEX"},
+                        {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,         "FRAGMENT"},
+                        {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,    "EARLY_FRAGMENT_TESTS"},
+                        {VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,     "LATE_FRAGMENT_TESTS"},
+                        {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, "COLOR_OUTPUT"},
+                        {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,          "COMPUTE"},
+                        {VK_PIPELINE_STAGE_TRANSFER_BIT,                "TRANSFER"},
+                        {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,          "BOTTOM"},
+                        {VK_PIPELINE_STAGE_HOST_BIT,                    "HOST"},
+                        {VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,            "ALL_COMMANDS"},
+                };
+        return flagNames(stages, names, sizeof(names) / sizeof(names[0]));
+    }
+
+    static std::string accessNames(VkAccessFlags access)
+    {
+        static const std::pair<VkAccessFlags, const char *> names[] =
+                {
+                        {VK_ACCESS_INDIRECT_COMMAND_READ_BIT,          "INDIRECT_READ"},
+                        {VK_ACCESS_INDEX_READ_BIT,                     "INDEX_READ"},
+                        {VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,          "VERTEX_READ"},
+                        {VK_ACCESS_UNIFORM_READ_BIT,                   "UNIFORM_READ"},
+                        {VK_ACCESS_SHADER_READ_BIT,                    "SHADER_READ"},
+                        {VK_ACCESS_SHADER_WRITE_BIT,                   "SHADER_WRITE"},
+                        {VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,          "COLOR_READ"},
+                        {VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,         "COLOR_WRITE"},
+                        {VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,  "DEPTH_READ"},
+                        {VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, "DEPTH_WRITE"},
+                        {VK_ACCESS_TRANSFER_READ_BIT,                  "TRANSFER_READ"},
+                        {VK_ACCESS_TRANSFER_WRITE_BIT,                 "TRANSFER_WRITE"},
+                        {VK_ACCESS_HOST_WRITE_BIT,                     "HOST_WRITE"},
+                };
+        return flagNames(access, names, sizeof(names) / sizeof(names[0]));
+    }
+
+    template<typename Flags>
+    static std::string flagNames(Flags flags, const std::pair<Flags, const char *> *names, std::size_t count)
+    {
+        if (flags == 0)
+        {
+            return "NONE";
+        }
+
+        std::string result;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            if (flags & names[i].first)
+            {
+                result += result.empty() ? "" : "|";
+                result += names[i].second;
+            }
+        }
+        return result;
+    }
+};
+
+#endif //VULKANPROGRAM_RENDER_GRAPH_HPP
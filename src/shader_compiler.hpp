@@ -0,0 +1,332 @@
+#ifndef VULKANPROGRAM_SHADER_COMPILER_HPP
+#define VULKANPROGRAM_SHADER_COMPILER_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "hash.hpp"
+
+#ifdef VULKANPROGRAM_HAS_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+// Directory containing glslShaders/ and spvShaders/. CMake points it at the source
+// tree, the fallback matches running from a build directory next to src.
+#ifndef VULKANPROGRAM_SHADER_DIR
+#define VULKANPROGRAM_SHADER_DIR "../src"
+#endif
+
+// Precompiled SPIR-V for builds without shaderc. CMake compiles it into the build directory,
+// otherwise it is what compile_shader.sh wrote into spvShaders/ next to glslShaders/.
+#ifndef VULKANPROGRAM_SPIRV_DIR
+#define VULKANPROGRAM_SPIRV_DIR VULKANPROGRAM_SHADER_DIR "/spvShaders"
+#endif
+
+using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
+
+// Turns GLSL from src/glslShaders into SPIR-V at runtime.
+//
+// Results are cached in shaderCache/ keyed by a hash over the source, every file it
+// includes and the defines. Which files a shader includes is only known after compiling
+// it, so a small manifest per (shader, defines) remembers the include list of the last
+// compile. Without shaderc the precompiled spvShaders/<name>.spv (plus one suffix
+// per define for variants) is loaded instead.
+class ShaderCompiler
+{
+public:
+    explicit ShaderCompiler(std::string shaderDirectory = VULKANPROGRAM_SHADER_DIR,
+                            std::string cacheDirectory = "shaderCache")
+            : sourceDirectory(shaderDirectory + "/glslShaders"),
+              spirvDirectory(VULKANPROGRAM_SPIRV_DIR),
+              cacheDirectory(std::move(cacheDirectory))
+    {
+        std::error_code error;
+        std::filesystem::create_directories(this->cacheDirectory, error);
+    }
+
+    static bool runtimeCompilationAvailable()
+    {
+#ifdef VULKANPROGRAM_HAS_SHADERC
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    std::string sourcePath(const std::string &name) const
+    {
+        return sourceDirectory + "/" + name;
+    }
+
+    // Compiles (or loads from the cache) the shader called name, e.g. "shader.vert".
+    // dependencies receives the source and all included files. Returns false and
+    // prints the compiler output on failure.
+    bool compile(const std::string &name, const ShaderDefines &defines,
+                 std::vector<char> &spirv, std::vector<std::string> *dependencies = nullptr) const
+    {
+#ifdef VULKANPROGRAM_HAS_SHADERC
+        std::string path = sourcePath(name);
+        std::string source;
+        if (!readText(path, source))
+        {
+            std::cerr << "Failed to read shader " << path << std::endl;
+            return false;
+        }
+
+        uint64_t variantHash = hashString(name);
+        for (const auto &define: defines)
+        {
+            variantHash = hashString(define.first, variantHash);
+            variantHash = hashString(define.second, variantHash);
+        }
+        std::string manifestPath = cacheDirectory + "/" + hashToHex(variantHash) + ".deps";
+
+        // Key over everything that went into the last build of this variant
+        std::vector<std::string> includes = readLines(manifestPath);
+        uint64_t key = hashString(source, variantHash);
+        bool manifestValid = true;
+        for (const auto &include: includes)
+        {
+            std::string text;
+            manifestValid = manifestValid && readText(include, text);
+            key = hashString(text, hashString(include, key));
+        }
+
+        std::string cachePath = cacheDirectory + "/" + hashToHex(key) + ".spv";
+        if (manifestValid && readBinary(cachePath, spirv))
+        {
+            if (dependencies)
+            {
+                *dependencies = includes;
+                dependencies->insert(dependencies->begin(), path);
+            }
+            return true;
+        }
+
+        shaderc::CompileOptions options;
+        options.SetOptimizationLevel(shaderc_optimization_level_performance);
+        options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+        for (const auto &define: defines)
+        {
+            options.AddMacroDefinition(define.first, define.second);
+        }
+
+        auto includer = std::make_unique<Includer>(sourceDirectory);
+        Includer *includerPointer = includer.get();
+        options.SetIncluder(std::move(includer));
+
+        shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, shaderKind(name),
+                                                                         path.c_str(), options);
+        if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+        {
+            std::cerr << "Failed to compile " << name << ":\n" << result.GetErrorMessage() << std::endl;
+            return false;
+        }
+
+        spirv.resize((result.end() - result.begin()) * sizeof(uint32_t));
+        memcpy(spirv.data(), result.begin(), spirv.size());
+
+        // Re-key with the includes that were actually used and store both
+        includes = includerPointer->includedFiles;
+        key = hashString(source, variantHash);
+        for (const auto &include: includes)
+        {
+            std::string text;
+            readText(include, text);
+            key = hashString(text, hashString(include, key));
+        }
+
+        writeFileAtomically(cacheDirectory + "/" + hashToHex(key) + ".spv", spirv.data(), spirv.size());
+        std::string manifest;
+        for (const auto &include: includes)
+        {
+            manifest += include + "\n";
+        }
+        writeFileAtomically(manifestPath, manifest.data(), manifest.size());
+
+        if (dependencies)
+        {
+            *dependencies = includes;
+            dependencies->insert(dependencies->begin(), path);
+        }
+        return true;
+#else
+        if (dependencies)
+        {
+            dependencies->clear();
+        }
+
+        // Variants are precompiled by compile_shader.sh as <name>.<DEFINE>[=<value>].spv
+        std::string path = spirvDirectory + "/" + name;
+        for (const auto &define: defines)
+        {
+            path += "." + define.first + (define.second.empty() || define.second == "1" ? "" : "=" + define.second);
+        }
+        path += ".spv";
+        if (!readBinary(path, spirv))
+        {
+            std::cerr << "Failed to read precompiled shader " << path << ", run compile_shader.sh" << std::endl;
+            return false;
+        }
+        return true;
+#endif
+    }
+
+private:
+    std::string sourceDirectory;
+    std::string spirvDirectory;
+    std::string cacheDirectory;
+
+#ifdef VULKANPROGRAM_HAS_SHADERC
+    shaderc::Compiler compiler;
+
+    static shaderc_shader_kind shaderKind(const std::string &name)
+    {
+        std::string extension = std::filesystem::path(name).extension().string();
+        if (extension == ".vert") return shaderc_vertex_shader;
+        if (extension == ".frag") return shaderc_fragment_shader;
+        if (extension == ".comp") return shaderc_compute_shader;
+        if (extension == ".geom") return shaderc_geometry_shader;
+        if (extension == ".tesc") return shaderc_tess_control_shader;
+        if (extension == ".tese") return shaderc_tess_evaluation_shader;
+        return shaderc_glsl_infer_from_source;
+    }
+
+    // Resolves #include relative to the including file first, then to glslShaders/,
+    // and remembers every file it handed out.
+    class Includer : public shaderc::CompileOptions::IncluderInterface
+    {
+    public:
+        explicit Includer(std::string sourceDirectory) : sourceDirectory(std::move(sourceDirectory))
+        {
+        }
+
+        shaderc_include_result *GetInclude(const char *requestedSource, shaderc_include_type type,
+                                           const char *requestingSource, size_t) override
+        {
+            auto *include = new Include{};
+
+            std::vector<std::filesystem::path> candidates;
+            if (type == shaderc_include_type_relative)
+            {
+                candidates.push_back(std::filesystem::path(requestingSource).parent_path() / requestedSource);
+            }
+            candidates.push_back(std::filesystem::path(sourceDirectory) / requestedSource);
+
+            for (const auto &candidate: candidates)
+            {
+                if (readText(candidate.string(), include->content))
+                {
+                    include->name = candidate.lexically_normal().string();
+                    if (std::find(includedFiles.begin(), includedFiles.end(), include->name) == includedFiles.end())
+                    {
+                        includedFiles.push_back(include->name);
+                    }
+                    break;
+                }
+            }
+
+            if (include->name.empty())
+            {
+                // An empty name tells shaderc the include failed, content is the error message
+                include->content = std::string("Cannot find include file ") + requestedSource;
+            }
+
+            include->result.source_name = include->name.c_str();
+            include->result.source_name_length = include->name.size();
+            include->result.content = include->content.c_str();
+            include->result.content_length = include->content.size();
+            include->result.user_data = include;
+            return &include->result;
+        }
+
+        void ReleaseInclude(shaderc_include_result *data) override
+        {
+            delete static_cast<Include *>(data->user_data);
+        }
+
+        std::vector<std::string> includedFiles;
+
+    private:
+        struct Include
+        {
+            std::string name;
+            std::string content;
+            shaderc_include_result result;
+        };
+
+        std::string sourceDirectory;
+    };
+#endif
+
+    static bool readText(const std::string &path, std::string &text)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        std::ostringstream stream;
+        stream << file.rdbuf();
+        text = stream.str();
+        return true;
+    }
+
+    static bool readBinary(const std::string &path, std::vector<char> &data)
+    {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), static_cast<std::streamsize>(data.size()));
+        return !data.empty();
+    }
+
+    static std::vector<std::string> readLines(const std::string &path)
+    {
+        std::vector<std::string> lines;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (!line.empty())
+            {
+                lines.push_back(line);
+            }
+        }
+        return lines;
+    }
+
+    // Several threads may compile the same variant, so nobody should ever see half a file
+    static void writeFileAtomically(const std::string &path, const void *data, size_t size)
+    {
+        std::string temporaryPath = path + "." + hashToHex(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error)
+        {
+            std::filesystem::remove(temporaryPath, error);
+        }
+    }
+};
+
+#endif //VULKANPROGRAM_SHADER_COMPILER_HPP
@@ -0,0 +1,225 @@
+#ifndef VULKANPROGRAM_SHADER_HOT_RELOAD_HPP
+#define VULKANPROGRAM_SHADER_HOT_RELOAD_HPP
+
+#include <vulkan/vulkan.h>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "shader_compiler.hpp"
+
+// Watches the sources (and includes) of registered pipelines. When one of them changes
+// the shaders are recompiled and the pipeline is rebuilt on a background thread. The
+// render thread picks the new pipelines up with applyPendingSwaps() between frames, so
+// the frame loop never waits for the compiler.
+class ShaderHotReloader
+{
+public:
+    struct ShaderReference
+    {
+        std::string name;
+        ShaderDefines defines;
+    };
+
+    // Creates a pipeline from the SPIR-V of the shaders in the order they were registered.
+    // Called on the watcher thread, must not touch state the render thread writes to.
+    using BuildFunction = std::function<VkPipeline(const std::vector<std::vector<char>> &spirv)>;
+
+    explicit ShaderHotReloader(const ShaderCompiler &compiler) : compiler(compiler)
+    {
+    }
+
+    ~ShaderHotReloader()
+    {
+        stop();
+    }
+
+    // Register before start(). target is swapped by applyPendingSwaps().
+    void watch(const std::string &name, VkPipeline *target, std::vector<ShaderReference> shaders,
+               BuildFunction build)
+    {
+        Entry entry{};
+        entry.name = name;
+        entry.target = target;
+        entry.shaders = std::move(shaders);
+        entry.build = std::move(build);
+
+        // Dependencies come from the (cached) compile the pipeline was just created from
+        for (const auto &shader: entry.shaders)
+        {
+            std::vector<char> spirv;
+            std::vector<std::string> dependencies;
+            compiler.compile(shader.name, shader.defines, spirv, &dependencies);
+            if (dependencies.empty())
+            {
+                dependencies.push_back(compiler.sourcePath(shader.name));
+            }
+            entry.dependencies.insert(entry.dependencies.end(), dependencies.begin(), dependencies.end());
+        }
+        entry.lastWriteTime = latestWriteTime(entry.dependencies);
+
+        entries.push_back(std::move(entry));
+    }
+
+    void start()
+    {
+        running = true;
+        watcherThread = std::thread([this]()
+                                    {
+                                        watchLoop();
+                                    });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running)
+            {
+                return;
+            }
+            running = false;
+        }
+        wakeUp.notify_all();
+        watcherThread.join();
+
+        // Pipelines that were built but never swapped in are handed out as replaced ones
+        for (auto &swap: pendingSwaps)
+        {
+            abandoned.push_back(swap.second);
+        }
+        pendingSwaps.clear();
+    }
+
+    // Call on the render thread between frames. Returns the pipelines that were replaced;
+    // they may still be used by frames in flight and have to be destroyed later.
+    std::vector<VkPipeline> applyPendingSwaps()
+    {
+        std::vector<VkPipeline> replaced;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &swap: pendingSwaps)
+        {
+            replaced.push_back(*swap.first);
+            *swap.first = swap.second;
+        }
+        pendingSwaps.clear();
+
+        replaced.insert(replaced.end(), abandoned.begin(), abandoned.end());
+        abandoned.clear();
+        return replaced;
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        VkPipeline *target;
+        std::vector<ShaderReference> shaders;
+        BuildFunction build;
+        std::vector<std::string> dependencies;
+        std::filesystem::file_time_type lastWriteTime;
+    };
+
+    const ShaderCompiler &compiler;
+    std::vector<Entry> entries;
+
+    std::thread watcherThread;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool running = false;
+
+    std::vector<std::pair<VkPipeline *, VkPipeline>> pendingSwaps;
+    std::vector<VkPipeline> abandoned;
+
+    static std::filesystem::file_time_type latestWriteTime(const std::vector<std::string> &files)
+    {
+        std::filesystem::file_time_type latest{};
+        for (const auto &file: files)
+        {
+            std::error_code error;
+            auto writeTime = std::filesystem::last_write_time(file, error);
+            if (!error && writeTime > latest)
+            {
+                latest = writeTime;
+            }
+        }
+        return latest;
+    }
+
+    void watchLoop()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait_for(lock, std::chrono::milliseconds(250), [this]()
+                {
+                    return !running;
+                });
+                if (!running)
+                {
+                    return;
+                }
+            }
+
+            for (auto &entry: entries)
+            {
+                auto writeTime = latestWriteTime(entry.dependencies);
+                if (writeTime <= entry.lastWriteTime)
+                {
+                    continue;
+                }
+                // Remember the edit even if it does not compile, the next save tries again
+                entry.lastWriteTime = writeTime;
+
+                rebuild(entry);
+            }
+        }
+    }
+
+    void rebuild(Entry &entry)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::vector<char>> spirv(entry.shaders.size());
+        std::vector<std::string> dependencies;
+        for (std::size_t i = 0; i < entry.shaders.size(); i++)
+        {
+            std::vector<std::string> shaderDependencies;
+            if (!compiler.compile(entry.shaders[i].name, entry.shaders[i].defines, spirv[i], &shaderDependencies))
+            {
+                std::cerr << "Keeping the old " << entry.name << " pipeline" << std::endl;
+                return;
+            }
+            dependencies.insert(dependencies.end(), shaderDependencies.begin(), shaderDependencies.end());
+        }
+
+        // Includes may have been added or removed by the edit
+        if (!dependencies.empty())
+        {
+            entry.dependencies = dependencies;
+        }
+
+        VkPipeline pipeline = entry.build(spirv);
+        if (pipeline == VK_NULL_HANDLE)
+        {
+            std::cerr << "Failed to rebuild the " << entry.name << " pipeline" << std::endl;
+            return;
+        }
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Reloaded " << entry.name << " pipeline in " << milliseconds << " ms" << std::endl;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingSwaps.emplace_back(entry.target, pipeline);
+    }
+};
+
+#endif //VULKANPROGRAM_SHADER_HOT_RELOAD_HPP
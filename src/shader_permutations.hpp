@@ -0,0 +1,53 @@
+#ifndef VULKANPROGRAM_SHADER_PERMUTATIONS_HPP
+#define VULKANPROGRAM_SHADER_PERMUTATIONS_HPP
+
+#include <cstdint>
+#include <string>
+#include "shader_compiler.hpp"
+
+// Feature toggles of the scene shaders. Features that only change control flow are
+// specialization constants, so one SPIR-V module serves all of them. Features that
+// change the shader interface (vertex formats) are compile time defines.
+enum ShaderFeature : uint32_t
+{
+    SHADER_FEATURE_TEXTURED = 1u << 0,
+    SHADER_FEATURE_VERTEX_COLOR = 1u << 1,
+    SHADER_FEATURE_QUANTIZED_VERTICES = 1u << 2,
+
+    SHADER_FEATURE_ALL = (1u << 3) - 1
+};
+
+struct ShaderPermutation
+{
+    uint32_t features = SHADER_FEATURE_TEXTURED;
+
+    bool has(ShaderFeature feature) const
+    {
+        return (features & feature) != 0;
+    }
+
+    ShaderDefines defines() const
+    {
+        ShaderDefines result;
+        if (has(SHADER_FEATURE_QUANTIZED_VERTICES))
+        {
+            result.emplace_back("QUANTIZED_VERTICES", "1");
+        }
+        return result;
+    }
+
+    std::string name() const
+    {
+        std::string result = has(SHADER_FEATURE_TEXTURED) ? "textured" : "untextured";
+        result += has(SHADER_FEATURE_VERTEX_COLOR) ? "+color" : "";
+        result += has(SHADER_FEATURE_QUANTIZED_VERTICES) ? "+quantized" : "";
+        return result;
+    }
+
+    bool operator==(const ShaderPermutation &other) const
+    {
+        return features == other.features;
+    }
+};
+
+#endif //VULKANPROGRAM_SHADER_PERMUTATIONS_HPP
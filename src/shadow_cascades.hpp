@@ -0,0 +1,165 @@
+#ifndef VULKANPROGRAM_SHADOW_CASCADES_HPP
+#define VULKANPROGRAM_SHADOW_CASCADES_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// What the cascades are fitted to: a symmetric perspective camera
+struct ShadowCamera
+{
+    glm::vec3 position;
+    glm::vec3 forward;
+    float fovY;
+    float aspect;
+    float nearPlane;
+    float farPlane;
+};
+
+// Cascaded shadow maps of one directional light. The view range of the camera is split into
+// cascades, each covered by an orthographic light projection rendered into its own layer.
+//
+// Fitting is stable: every cascade is fitted to the bounding sphere of its slice of the view
+// frustum instead of to the slice itself, so its size does not change when the camera turns,
+// and the projection is moved by whole shadow map texels only. Shadow edges do not shimmer, and
+// as long as camera and light stay put the matrices come out bit for bit the same. Together
+// with a version number of everything that casts shadows, that tells which layers still hold
+// what would be rendered into them again.
+class ShadowCascades
+{
+public:
+    static constexpr uint32_t MAX_CASCADES = 4;
+
+    ShadowCascades() = default;
+
+    ShadowCascades(uint32_t cascadeCount, uint32_t mapSize)
+            : count(std::min(std::max(cascadeCount, 1u), MAX_CASCADES)), mapSize(mapSize)
+    {
+    }
+
+    uint32_t cascadeCount() const
+    {
+        return count;
+    }
+
+    // Fits the cascades for this frame. casterExtent is how far behind a cascade casters can be,
+    // sceneVersion changes whenever a caster moves. Returns a bit per cascade whose layer has to
+    // be rendered, the others are unchanged since they were last rendered.
+    uint32_t update(const ShadowCamera &camera, const glm::vec3 &lightDirection, float casterExtent,
+                    uint64_t sceneVersion)
+    {
+        float previousSplit = camera.nearPlane;
+        uint32_t renderMask = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            float split = splitDistance(camera, i + 1);
+            float radius = 0.0f;
+            glm::mat4 viewProjection = fitCascade(camera, lightDirection, casterExtent, previousSplit, split, radius);
+            splits[i] = split;
+            texelSizes[i] = 2.0f * radius / static_cast<float>(mapSize);
+            previousSplit = split;
+
+            Cascade &cascade = cascades[i];
+            if (cascade.valid && cascade.sceneVersion == sceneVersion && cascade.viewProjection == viewProjection)
+            {
+                cacheHits++;
+                continue;
+            }
+            cascade.viewProjection = viewProjection;
+            cascade.sceneVersion = sceneVersion;
+            cascade.valid = true;
+            renderMask |= 1u << i;
+            renders++;
+        }
+        return renderMask;
+    }
+
+    const glm::mat4 &viewProjection(uint32_t cascade) const
+    {
+        return cascades[cascade].viewProjection;
+    }
+
+    // View distance the cascade ends at
+    float splitDistance(uint32_t cascade) const
+    {
+        return splits[cascade];
+    }
+
+    // World space size of one shadow map texel of the cascade
+    float texelSize(uint32_t cascade) const
+    {
+        return texelSizes[cascade];
+    }
+
+    uint64_t cascadesRendered() const
+    {
+        return renders;
+    }
+
+    uint64_t cascadesCached() const
+    {
+        return cacheHits;
+    }
+
+private:
+    // Blend of logarithmic splits, which keep the texel to pixel ratio the same over the view
+    // range, and uniform ones, which would give the near range almost no room otherwise
+    static constexpr float LOGARITHMIC_WEIGHT = 0.5f;
+
+    struct Cascade
+    {
+        glm::mat4 viewProjection{1.0f};
+        uint64_t sceneVersion = 0;
+        bool valid = false;
+    };
+
+    float splitDistance(const ShadowCamera &camera, uint32_t index) const
+    {
+        float part = static_cast<float>(index) / static_cast<float>(count);
+        float logarithmic = camera.nearPlane * std::pow(camera.farPlane / camera.nearPlane, part);
+        float uniform = camera.nearPlane + (camera.farPlane - camera.nearPlane) * part;
+        return LOGARITHMIC_WEIGHT * logarithmic + (1.0f - LOGARITHMIC_WEIGHT) * uniform;
+    }
+
+    glm::mat4 fitCascade(const ShadowCamera &camera, const glm::vec3 &lightDirection, float casterExtent,
+                         float sliceNear, float sliceFar, float &radius) const
+    {
+        // Smallest sphere around the slice. Its corners are k = tan^2(x) + tan^2(y) times their
+        // squared distance off the view axis, the center lies on the axis where near and far
+        // corners are equally far, or at the far plane when that is further than the slice.
+        float tanY = std::tan(camera.fovY / 2.0f);
+        float tanX = tanY * camera.aspect;
+        float k = tanX * tanX + tanY * tanY;
+        float centerDistance = std::min(0.5f * (sliceNear + sliceFar) * (1.0f + k), sliceFar);
+        radius = std::sqrt((sliceFar - centerDistance) * (sliceFar - centerDistance) + sliceFar * sliceFar * k);
+        // Rounded up so float noise never changes the size
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+        glm::vec3 center = camera.position + camera.forward * centerDistance;
+
+        glm::vec3 up = std::abs(lightDirection.z) > 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+        glm::mat4 view = glm::lookAt(center - lightDirection * (radius + casterExtent), center, up);
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius + casterExtent);
+
+        // Move the projection so the world origin lands on a texel corner, every other point
+        // then keeps its place within its texel as the center moves. NDC spans 2 over the map.
+        glm::vec4 origin = projection * view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        float halfSize = static_cast<float>(mapSize) / 2.0f;
+        projection[3][0] += (std::round(origin.x * halfSize) - origin.x * halfSize) / halfSize;
+        projection[3][1] += (std::round(origin.y * halfSize) - origin.y * halfSize) / halfSize;
+
+        return projection * view;
+    }
+
+    uint32_t count = 1;
+    uint32_t mapSize = 2048;
+    Cascade cascades[MAX_CASCADES];
+    float splits[MAX_CASCADES] = {};
+    float texelSizes[MAX_CASCADES] = {};
+
+    uint64_t renders = 0;
+    uint64_t cacheHits = 0;
+};
+
+#endif //VULKANPROGRAM_SHADOW_CASCADES_HPP
@@ -0,0 +1,309 @@
+#ifndef VULKANPROGRAM_TRANSFORM_STORE_HPP
+#define VULKANPROGRAM_TRANSFORM_STORE_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cstddef>
+#include <vector>
+#include "vertex.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VULKANPROGRAM_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VULKANPROGRAM_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VULKANPROGRAM_SIMD_NEON
+#endif
+
+// Structure of arrays holding the local transform of every object in the scene.
+// Each component lives in its own array so the batch kernel below can load
+// 4 (SSE/NEON) or 8 (AVX2) objects at a time without any shuffling.
+struct TransformStore
+{
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+    std::vector<float> scaleX, scaleY, scaleZ;
+
+    std::size_t size() const
+    {
+        return positionX.size();
+    }
+
+    std::size_t add(const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale)
+    {
+        positionX.push_back(position.x);
+        positionY.push_back(position.y);
+        positionZ.push_back(position.z);
+        rotationX.push_back(rotation.x);
+        rotationY.push_back(rotation.y);
+        rotationZ.push_back(rotation.z);
+        rotationW.push_back(rotation.w);
+        scaleX.push_back(scale.x);
+        scaleY.push_back(scale.y);
+        scaleZ.push_back(scale.z);
+
+        return positionX.size() - 1;
+    }
+
+    void setRotation(std::size_t index, const glm::quat &rotation)
+    {
+        rotationX[index] = rotation.x;
+        rotationY[index] = rotation.y;
+        rotationZ[index] = rotation.z;
+        rotationW[index] = rotation.w;
+    }
+
+    glm::vec3 position(std::size_t index) const
+    {
+        return {positionX[index], positionY[index], positionZ[index]};
+    }
+
+    glm::quat rotation(std::size_t index) const
+    {
+        return {rotationW[index], rotationX[index], rotationY[index], rotationZ[index]};
+    }
+
+    glm::vec3 scale(std::size_t index) const
+    {
+        return {scaleX[index], scaleY[index], scaleZ[index]};
+    }
+};
+
+namespace transform_kernels
+{
+    // Every SIMD flavour below provides the same handful of operations so that
+    // composeBatch() only has to be written once.
+    struct ScalarLanes
+    {
+        using Reg = float;
+        static constexpr std::size_t width = 1;
+
+        static Reg load(const float *p) { return *p; }
+        static Reg set(float v) { return v; }
+        static Reg add(Reg a, Reg b) { return a + b; }
+        static Reg sub(Reg a, Reg b) { return a - b; }
+        static Reg mul(Reg a, Reg b) { return a * b; }
+        static Reg madd(Reg a, Reg b, Reg c) { return a * b + c; }
+
+        // Write one matrix column (rows r0..r3) of every lane to its instance
+        static void storeColumn(float *dst, std::size_t stride, Reg r0, Reg r1, Reg r2, Reg r3)
+        {
+            (void) stride;
+            dst[0] = r0;
+            dst[1] = r1;
+            dst[2] = r2;
+            dst[3] = r3;
+        }
+    };
+
+#if defined(VULKANPROGRAM_SIMD_SSE) || defined(VULKANPROGRAM_SIMD_AVX2)
+    struct SseLanes
+    {
+        using Reg = __m128;
+        static constexpr std::size_t width = 4;
+
+        static Reg load(const float *p) { return _mm_loadu_ps(p); }
+        static Reg set(float v) { return _mm_set1_ps(v); }
+        static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+        static Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+        static Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+        static Reg madd(Reg a, Reg b, Reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+        static void storeColumn(float *dst, std::size_t stride, Reg r0, Reg r1, Reg r2, Reg r3)
+        {
+            // After the transpose r0..r3 hold the column of lane 0..3
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(dst, r0);
+            _mm_storeu_ps(dst + stride, r1);
+            _mm_storeu_ps(dst + 2 * stride, r2);
+            _mm_storeu_ps(dst + 3 * stride, r3);
+        }
+    };
+#endif
+
+#if defined(VULKANPROGRAM_SIMD_AVX2)
+    struct Avx2Lanes
+    {
+        using Reg = __m256;
+        static constexpr std::size_t width = 8;
+
+        static Reg load(const float *p) { return _mm256_loadu_ps(p); }
+        static Reg set(float v) { return _mm256_set1_ps(v); }
+        static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+        static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+        static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+
+        static Reg madd(Reg a, Reg b, Reg c)
+        {
+#if defined(__FMA__)
+            return _mm256_fmadd_ps(a, b, c);
+#else
+            return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+        }
+
+        static void storeColumn(float *dst, std::size_t stride, Reg r0, Reg r1, Reg r2, Reg r3)
+        {
+            // Lanes 0-3 and 4-7 are transposed separately in the two 128 bit halves
+            SseLanes::storeColumn(dst, stride,
+                                  _mm256_castps256_ps128(r0), _mm256_castps256_ps128(r1),
+                                  _mm256_castps256_ps128(r2), _mm256_castps256_ps128(r3));
+            SseLanes::storeColumn(dst + 4 * stride, stride,
+                                  _mm256_extractf128_ps(r0, 1), _mm256_extractf128_ps(r1, 1),
+                                  _mm256_extractf128_ps(r2, 1), _mm256_extractf128_ps(r3, 1));
+        }
+    };
+#endif
+
+#if defined(VULKANPROGRAM_SIMD_NEON)
+    struct NeonLanes
+    {
+        using Reg = float32x4_t;
+        static constexpr std::size_t width = 4;
+
+        static Reg load(const float *p) { return vld1q_f32(p); }
+        static Reg set(float v) { return vdupq_n_f32(v); }
+        static Reg add(Reg a, Reg b) { return vaddq_f32(a, b); }
+        static Reg sub(Reg a, Reg b) { return vsubq_f32(a, b); }
+        static Reg mul(Reg a, Reg b) { return vmulq_f32(a, b); }
+        static Reg madd(Reg a, Reg b, Reg c) { return vmlaq_f32(c, a, b); }
+
+        static void storeColumn(float *dst, std::size_t stride, Reg r0, Reg r1, Reg r2, Reg r3)
+        {
+            float32x4x2_t t01 = vtrnq_f32(r0, r1);
+            float32x4x2_t t23 = vtrnq_f32(r2, r3);
+            vst1q_f32(dst, vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0])));
+            vst1q_f32(dst + stride, vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1])));
+            vst1q_f32(dst + 2 * stride, vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])));
+            vst1q_f32(dst + 3 * stride, vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1])));
+        }
+    };
+#endif
+
+#if defined(VULKANPROGRAM_SIMD_AVX2)
+    using NativeLanes = Avx2Lanes;
+#elif defined(VULKANPROGRAM_SIMD_SSE)
+    using NativeLanes = SseLanes;
+#elif defined(VULKANPROGRAM_SIMD_NEON)
+    using NativeLanes = NeonLanes;
+#else
+    using NativeLanes = ScalarLanes;
+#endif
+
+    // Compose model = T * R * S and mvp = viewProj * model for Lanes::width
+    // objects starting at "first" and write both matrices to out[first...].
+    template<typename Lanes>
+    inline void composeBatch(const TransformStore &store,
+                             std::size_t first,
+                             const glm::mat4 &viewProj,
+                             InstanceData *out)
+    {
+        using Reg = typename Lanes::Reg;
+        const Reg one = Lanes::set(1.0f);
+        const Reg two = Lanes::set(2.0f);
+        const Reg zero = Lanes::set(0.0f);
+
+        Reg qx = Lanes::load(&store.rotationX[first]);
+        Reg qy = Lanes::load(&store.rotationY[first]);
+        Reg qz = Lanes::load(&store.rotationZ[first]);
+        Reg qw = Lanes::load(&store.rotationW[first]);
+
+        Reg xx = Lanes::mul(qx, qx), yy = Lanes::mul(qy, qy), zz = Lanes::mul(qz, qz);
+        Reg xy = Lanes::mul(qx, qy), xz = Lanes::mul(qx, qz), yz = Lanes::mul(qy, qz);
+        Reg wx = Lanes::mul(qw, qx), wy = Lanes::mul(qw, qy), wz = Lanes::mul(qw, qz);
+
+        Reg sx = Lanes::load(&store.scaleX[first]);
+        Reg sy = Lanes::load(&store.scaleY[first]);
+        Reg sz = Lanes::load(&store.scaleZ[first]);
+
+        // model[column][row], same convention as glm
+        Reg m[4][4];
+        m[0][0] = Lanes::mul(Lanes::sub(one, Lanes::mul(two, Lanes::add(yy, zz))), sx);
+        m[0][1] = Lanes::mul(Lanes::mul(two, Lanes::add(xy, wz)), sx);
+        m[0][2] = Lanes::mul(Lanes::mul(two, Lanes::sub(xz, wy)), sx);
+        m[0][3] = zero;
+
+        m[1][0] = Lanes::mul(Lanes::mul(two, Lanes::sub(xy, wz)), sy);
+        m[1][1] = Lanes::mul(Lanes::sub(one, Lanes::mul(two, Lanes::add(xx, zz))), sy);
+        m[1][2] = Lanes::mul(Lanes::mul(two, Lanes::add(yz, wx)), sy);
+        m[1][3] = zero;
+
+        m[2][0] = Lanes::mul(Lanes::mul(two, Lanes::add(xz, wy)), sz);
+        m[2][1] = Lanes::mul(Lanes::mul(two, Lanes::sub(yz, wx)), sz);
+        m[2][2] = Lanes::mul(Lanes::sub(one, Lanes::mul(two, Lanes::add(xx, yy))), sz);
+        m[2][3] = zero;
+
+        m[3][0] = Lanes::load(&store.positionX[first]);
+        m[3][1] = Lanes::load(&store.positionY[first]);
+        m[3][2] = Lanes::load(&store.positionZ[first]);
+        m[3][3] = one;
+
+        constexpr std::size_t stride = sizeof(InstanceData) / sizeof(float);
+        float *base = reinterpret_cast<float *>(out + first);
+
+        for (int c = 0; c < 4; c++)
+        {
+            Lanes::storeColumn(base + offsetof(InstanceData, model) / sizeof(float) + 4 * c, stride,
+                               m[c][0], m[c][1], m[c][2], m[c][3]);
+        }
+
+        // mvp[c][r] = sum_k viewProj[k][r] * model[c][k]. The last row of the
+        // upper 3 columns is zero so it is skipped.
+        for (int c = 0; c < 4; c++)
+        {
+            Reg r[4];
+            for (int row = 0; row < 4; row++)
+            {
+                Reg acc = Lanes::mul(Lanes::set(viewProj[0][row]), m[c][0]);
+                acc = Lanes::madd(Lanes::set(viewProj[1][row]), m[c][1], acc);
+                acc = Lanes::madd(Lanes::set(viewProj[2][row]), m[c][2], acc);
+                if (c == 3)
+                {
+                    acc = Lanes::add(acc, Lanes::set(viewProj[3][row]));
+                }
+                r[row] = acc;
+            }
+            Lanes::storeColumn(base + offsetof(InstanceData, mvp) / sizeof(float) + 4 * c, stride,
+                               r[0], r[1], r[2], r[3]);
+        }
+    }
+
+    inline const char *nativeLanesName()
+    {
+#if defined(VULKANPROGRAM_SIMD_AVX2)
+        return "AVX2";
+#elif defined(VULKANPROGRAM_SIMD_SSE)
+        return "SSE";
+#elif defined(VULKANPROGRAM_SIMD_NEON)
+        return "NEON";
+#else
+        return "scalar";
+#endif
+    }
+}
+
+// Write model and MVP matrices of every object in the store to "out", which is
+// normally the persistently mapped instance buffer of the current frame.
+inline void composeInstanceMatrices(const TransformStore &store, const glm::mat4 &viewProj, InstanceData *out)
+{
+    using Lanes = transform_kernels::NativeLanes;
+
+    const std::size_t count = store.size();
+    std::size_t i = 0;
+
+    for (; i + Lanes::width <= count; i += Lanes::width)
+    {
+        transform_kernels::composeBatch<Lanes>(store, i, viewProj, out);
+    }
+
+    // Leftover objects that do not fill a whole register
+    for (; i < count; i++)
+    {
+        transform_kernels::composeBatch<transform_kernels::ScalarLanes>(store, i, viewProj, out);
+    }
+}
+
+#endif //VULKANPROGRAM_TRANSFORM_STORE_HPP
@@ -3,6 +3,8 @@
 //
 #include <glm/glm.hpp>
 #include <vector>
+#include "glslShaders/draw_constants.h"
+#include "glslShaders/particles.h"
 
 #ifndef VULKANPROGRAM_VERTEX_HPP
 #define VULKANPROGRAM_VERTEX_HPP
@@ -14,10 +16,170 @@ struct Vertex
     glm::vec2 texCoord;
 };
 
+// Compact vertex of the QUANTIZED_VERTICES shader permutation, 16 instead of 32 bytes
+struct QuantizedVertex
+{
+    int16_t pos[4];     // snorm16 relative to the mesh bounds, w unused
+    uint32_t color;     // unorm8 x 4
+    uint32_t texCoord;  // half x 2
+};
+
+// Position only stream of the depth pre-pass with QUANTIZED_VERTICES, the pos of QuantizedVertex
+struct QuantizedPosition
+{
+    int16_t pos[4];
+};
+
+// Specialization constants of shader.vert (QUANTIZED_VERTICES only), constant_id 0 - 5
+struct VertexSpecializationConstants {
+    float boundsCenter[3];
+    float boundsHalfExtent[3];
+};
+
+// Specialization constants of shader.frag, constant_id 0 - 1
+struct FragmentSpecializationConstants {
+    uint32_t textured;
+    uint32_t vertexColor;
+};
+
 struct UniformBufferObject {
     alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 proj;
 };
 
+// Per object data read by the vertex shader through gl_InstanceIndex
+struct InstanceData {
+    alignas(16) glm::mat4 model;
+    alignas(16) glm::mat4 mvp;
+};
+
+// Per draw data of the scene shaders, the members are declared in glslShaders/draw_constants.h.
+// Pushed as push constants, or written to a dynamic uniform buffer per draw for comparison.
+struct DrawPushConstants {
+    DRAW_CONSTANTS_MEMBERS
+};
+
+// 128 bytes is the push constant size every device supports
+static_assert(sizeof(DrawPushConstants) <= 128, "per draw data does not fit into push constants");
+static_assert(sizeof(DrawPushConstants) % 4 == 0, "per draw data must be 32 bit scalars only");
+
+// Push constants of occlusion_cull.comp
+struct CullPushConstants {
+    glm::vec4 meshBoundsMin;
+    glm::vec4 meshBoundsMax;
+    glm::vec2 pyramidSize;
+    uint32_t objectCount;
+    uint32_t indexCount;
+    uint32_t phase;
+};
+
+// Push constants of depth_reduce.comp
+struct DepthReducePushConstants {
+    uint32_t outputWidth;
+    uint32_t outputHeight;
+};
+
+// Push constants of upscale.comp
+struct UpscalePushConstants {
+    glm::vec2 renderSize;
+    glm::vec2 inverseImageSize;
+    glm::uvec2 outputSize;
+    float sharpness;
+};
+
+// Push constants of shadow.vert
+struct ShadowPushConstants {
+    uint32_t instanceBufferIndex;
+    uint32_t cascade;
+};
+
+// Uniform buffer of the shadow set, read by shadow.vert and the SHADOWS scene shaders (std140)
+struct ShadowUniforms {
+    glm::mat4 cascadeViewProjection[4];
+    // View distance every cascade ends at and the world size of one of its texels
+    glm::vec4 cascadeSplits;
+    glm::vec4 cascadeTexelSizes;
+    // Direction the light travels in, xyz
+    glm::vec4 lightDirection;
+    glm::vec4 cameraPosition;
+    glm::vec4 cameraForward;
+    uint32_t cascadeCount;
+};
+
+// A point or spot light of the cluster set (std430)
+struct ClusterLight {
+    // xyz position, w range, nothing is lit beyond it
+    glm::vec4 positionRange;
+    glm::vec4 color;
+    // xyz direction of a spot light, w cosine of its outer cone angle, -1 for point lights
+    glm::vec4 directionCone;
+};
+
+// Uniform buffer of the cluster set, read by cluster_lights.comp and the CLUSTERED_LIGHTS
+// scene fragment shader (std140)
+struct ClusterUniforms {
+    glm::mat4 view;
+    glm::mat4 inverseProjection;
+    // Pixels the scene is drawn into
+    glm::vec2 screenSize;
+    float nearPlane;
+    float farPlane;
+    // xyz clusters along each axis, w tile size in pixels
+    glm::uvec4 gridSize;
+    uint32_t lightCount;
+    // Depth slice of a view depth d is log(d) * sliceScale + sliceBias
+    float sliceScale;
+    float sliceBias;
+    // Capacity of the light index list
+    uint32_t maxLightReferences;
+};
+
+// Uniform buffer of the G-buffer set, read by the deferred lighting subpass (std140)
+struct DeferredUniforms {
+    // From NDC and depth back to the world position of a pixel
+    glm::mat4 inverseViewProjection;
+    // 1 over the pixels the scene is drawn into
+    glm::vec2 inverseRenderSize;
+};
+
+// Push constants of bloom_downsample.comp and bloom_upsample.comp
+struct BloomPushConstants {
+    glm::uvec2 outputSize;
+    // Only used by the first downsample, which reads the scene
+    float threshold;
+    uint32_t firstLevel;
+};
+
+// Push constants of post_composite.comp
+struct PostCompositePushConstants {
+    glm::uvec2 outputSize;
+    float exposure;
+    float bloomStrength;
+    // PostEffect bits
+    uint32_t effects;
+};
+
+// Uniform buffer of the particle set (std140). The shaders declare the members of the step
+// inline, it is 48 bytes, so everything after it has the same offsets.
+struct ParticleUniforms {
+    ParticleStep step;
+    glm::mat4 viewProjection;
+    // xyz camera right and up, w particle size
+    glm::vec4 cameraRight;
+    glm::vec4 cameraUp;
+    glm::vec4 cameraPosition;
+};
+
+static_assert(sizeof(ParticleStep) == 48, "the particle step must be std140 without padding");
+static_assert(sizeof(Particle) == 32, "particles must have their std430 size");
+
+// Push constants of particle_sort.comp
+struct ParticleSortPushConstants {
+    uint32_t k;
+    uint32_t j;
+    uint32_t mode;
+    uint32_t writeAliveList;
+};
+
 #endif //VULKANPROGRAM_VERTEX_HPP
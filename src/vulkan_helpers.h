@@ -69,4 +69,67 @@ void createBuffer(VkBufferCreateInfo &bufferCreateInfo,
                        0);
 }
 
+uint32_t findMemoryType(VkPhysicalDevice &physicalDevice,
+                        uint32_t memoryTypeBits,
+                        VkMemoryPropertyFlags memoryPropertyFlags)
+{
+    VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice,
+                                        &physicalDeviceMemoryProperties);
+
+    for (uint32_t i = 0; i < physicalDeviceMemoryProperties.memoryTypeCount; i++)
+    {
+        if (memoryTypeBits & (1 << i) &&
+            (physicalDeviceMemoryProperties.memoryTypes[i].propertyFlags & memoryPropertyFlags) == memoryPropertyFlags)
+        {
+            return i;
+        }
+    }
+
+    std::cerr << "Failed to find suitable memory type" << std::endl;
+    exit(1);
+}
+
+void createImage(VkImageCreateInfo &imageCreateInfo,
+                 VkDevice &targetDevice,
+                 VkImage &image,
+                 VkPhysicalDevice &physicalDevice,
+                 VkDeviceMemory &imageMemory,
+                 VkMemoryPropertyFlags memoryPropertyFlags)
+{
+    VkResult result = vkCreateImage(targetDevice,
+                                    &imageCreateInfo,
+                                    nullptr,
+                                    &image);
+
+    if (result != VK_SUCCESS)
+    {
+        std::cerr << "Failed to create image" << std::endl;
+        exit(1);
+    }
+
+    VkMemoryRequirements imageMemoryRequirements;
+    vkGetImageMemoryRequirements(targetDevice,
+                                 image,
+                                 &imageMemoryRequirements);
+
+    VkMemoryAllocateInfo memoryAllocateInfo{};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.pNext = nullptr;
+    memoryAllocateInfo.allocationSize = imageMemoryRequirements.size;
+    memoryAllocateInfo.memoryTypeIndex = findMemoryType(physicalDevice,
+                                                        imageMemoryRequirements.memoryTypeBits,
+                                                        memoryPropertyFlags);
+
+    vkAllocateMemory(targetDevice,
+                     &memoryAllocateInfo,
+                     nullptr,
+                     &imageMemory);
+
+    vkBindImageMemory(targetDevice,
+                      image,
+                      imageMemory,
+                      0);
+}
+
 #endif //VULKANPROGRAM_VULKAN_HELPERS_H